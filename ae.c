@@ -30,28 +30,110 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
+
 #include <stdio.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
 
+#include <string.h>
+#include <poll.h>
+
 #include "ae.h"
 #include "zmalloc.h"
+#include "config.h"
+
+/* Include the best multiplexing layer supported by this system.
+ * The following should be ordered by performances, descending. */
+#ifdef HAVE_IO_URING
+#include "ae_iouring.c"
+#elif defined(HAVE_EPOLL)
+#include "ae_epoll.c"
+#else
+#include "ae_select.c"
+#endif
+
+/* Make room in the file events table, in the fired events array and in
+ * the polling backend for file descriptors up to setsize-1. The set never
+ * shrinks. */
+static int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
+    aeFileEvent *events;
+    aeFiredEvent *fired;
+    int j;
+
+    if (setsize <= eventLoop->setsize) return AE_OK;
+    if (aeApiResize(eventLoop,setsize) == -1) return AE_ERR;
+    events = zrealloc(eventLoop->events,sizeof(aeFileEvent)*setsize);
+    if (!events) return AE_ERR;
+    eventLoop->events = events;
+    fired = zrealloc(eventLoop->fired,sizeof(aeFiredEvent)*setsize);
+    if (!fired) return AE_ERR;
+    eventLoop->fired = fired;
+    /* Events with mask == AE_NONE are not registered */
+    for (j = eventLoop->setsize; j < setsize; j++)
+        eventLoop->events[j].mask = AE_NONE;
+    eventLoop->setsize = setsize;
+    return AE_OK;
+}
+
+/* Grow the set, doubling its size, so that 'fd' can be registered */
+static int aeMakeRoomForFd(aeEventLoop *eventLoop, int fd) {
+    int setsize = eventLoop->setsize;
+
+    if (fd < setsize) return AE_OK;
+    while (setsize <= fd) setsize *= 2;
+    return aeResizeSetSize(eventLoop,setsize);
+}
 
 aeEventLoop *aeCreateEventLoop(void) {
     aeEventLoop *eventLoop;
 
     eventLoop = zmalloc(sizeof(*eventLoop));
     if (!eventLoop) return NULL;
-    eventLoop->fileEventHead = NULL;
-    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEvents = NULL;
+    eventLoop->timeEventsById = NULL;
+    eventLoop->timeEventsCount = 0;
+    eventLoop->timeEventsSize = 0;
+    eventLoop->timeEventFiring = NULL;
     eventLoop->timeEventNextId = 0;
+    eventLoop->ioops = 0;
     eventLoop->stop = 0;
+    eventLoop->maxfd = -1;
+    eventLoop->events = NULL;
+    eventLoop->fired = NULL;
+    eventLoop->setsize = 0;
+    eventLoop->apidata = NULL;
+    eventLoop->beforesleep = NULL;
+    if (aeApiCreate(eventLoop) == -1) {
+        zfree(eventLoop);
+        return NULL;
+    }
+    if (aeResizeSetSize(eventLoop,AE_SETSIZE_INITIAL) == AE_ERR) {
+        aeDeleteEventLoop(eventLoop);
+        return NULL;
+    }
     return eventLoop;
 }
 
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    int j;
+
+    /* Release the timers still registered, calling their finalizers */
+    for (j = 0; j < eventLoop->timeEventsCount; j++) {
+        aeTimeEvent *te = eventLoop->timeEvents[j];
+
+        if (te->finalizerProc)
+            te->finalizerProc(eventLoop, te->clientData);
+        zfree(te);
+    }
+    aeApiFree(eventLoop);
+    zfree(eventLoop->timeEvents);
+    zfree(eventLoop->timeEventsById);
+    zfree(eventLoop->events);
+    zfree(eventLoop->fired);
     zfree(eventLoop);
 }
 
@@ -59,75 +141,267 @@ void aeStop(aeEventLoop *eventLoop) {
     eventLoop->stop = 1;
 }
 
+/* Register 'proc' to be called when the events in 'mask' fire on 'fd'.
+ * File events live in a table indexed by fd, so registering, deleting and
+ * dispatching are all O(1). There is a single clientData and finalizer
+ * per file descriptor: the last registration wins, and the finalizer is
+ * called when no event is left registered for the fd. */
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
         aeFileProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
     aeFileEvent *fe;
 
-    fe = zmalloc(sizeof(*fe));
-    if (fe == NULL) return AE_ERR;
-    fe->fd = fd;
-    fe->mask = mask;
-    fe->fileProc = proc;
+    if (aeMakeRoomForFd(eventLoop,fd) == AE_ERR) return AE_ERR;
+    fe = &eventLoop->events[fd];
+    if (aeApiAddEvent(eventLoop,fd,mask) == -1) return AE_ERR;
+    fe->mask |= mask;
+    if (mask & AE_READABLE) fe->rfileProc = proc;
+    if (mask & AE_WRITABLE) fe->wfileProc = proc;
+    if (mask & AE_EXCEPTION) fe->efileProc = proc;
     fe->finalizerProc = finalizerProc;
     fe->clientData = clientData;
-    fe->next = eventLoop->fileEventHead;
-    eventLoop->fileEventHead = fe;
+    if (fd > eventLoop->maxfd) eventLoop->maxfd = fd;
     return AE_OK;
 }
-// 删除某个节点（fd和mask等于入参的节点）
+// 删除fd上mask对应的事件
 void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask)
 {
-    aeFileEvent *fe, *prev = NULL;
-
-    fe = eventLoop->fileEventHead;
-    while(fe) {
-        if (fe->fd == fd && fe->mask == mask) {
-            // 说明待删除的节点是第一个节点，直接修改头节点的指针
-            if (prev == NULL)
-                eventLoop->fileEventHead = fe->next;
-            else
-                // 修改prev节点的next指针指向当前删除节点的下一个节点
-                prev->next = fe->next;
-            // 钩子函数
-            if (fe->finalizerProc)
-                fe->finalizerProc(eventLoop, fe->clientData);
-            // 释放待删除节点的内存
-            zfree(fe);
-            return;
-        }
-        // 记录上一个节点，当找到待删除节点时，修改prev指针的next指针（如果prev非空）为待删除节点的下一个节点
-        prev = fe;
-        fe = fe->next;
+    aeFileEvent *fe;
+
+    if (fd >= eventLoop->setsize) return;
+    fe = &eventLoop->events[fd];
+    if ((fe->mask & mask) == AE_NONE) return;
+    aeApiDelEvent(eventLoop,fd,mask);
+    fe->mask = fe->mask & (~mask);
+    if (fe->mask != AE_NONE) return;
+    if (fd == eventLoop->maxfd) {
+        /* Update the max fd */
+        int j;
+
+        for (j = eventLoop->maxfd-1; j >= 0; j--)
+            if (eventLoop->events[j].mask != AE_NONE) break;
+        eventLoop->maxfd = j;
     }
+    // 钩子函数
+    if (fe->finalizerProc)
+        fe->finalizerProc(eventLoop, fe->clientData);
+}
+/* Completion based I/O. Instead of being notified when 'fd' is ready, the
+ * caller submits the operation itself, and 'proc' is called with its
+ * result once it was performed by the kernel:
+ *
+ * aeSubmitRecv() reads up to 'len' bytes. 'buf' holds the data and 'res'
+ * is the number of bytes read, 0 on EOF, or -errno. The buffer belongs to
+ * the event loop and is only valid while 'proc' runs.
+ *
+ * aeSubmitSend() copies the data in 'iov', so the caller can release it
+ * right away, and writes all of it. 'buf' is NULL and 'res' is the number
+ * of bytes written, or -errno.
+ *
+ * aeSubmitAccept() accepts connections on the listening socket 'fd' until
+ * aeCancelIo() is called: 'proc' is called for every connection with the
+ * new descriptor in 'res', or with -errno.
+ *
+ * aeCancelIo() cancels the requests pending on 'fd', their procs will not
+ * be called. It must be called before closing the descriptor.
+ *
+ * Only the io_uring backend implements this, with the others the submit
+ * functions return AE_ERR and the caller must use file events instead.
+ * Operations submitted while processing events are handed to the kernel
+ * in a single batch just before waiting for the next events. */
+#ifdef AE_API_IO
+int aeSubmitRecv(aeEventLoop *eventLoop, int fd, size_t len,
+        aeIoProc *proc, void *clientData)
+{
+    if (aeMakeRoomForFd(eventLoop,fd) == AE_ERR) return AE_ERR;
+    if (aeApiSubmitRecv(eventLoop,fd,len,proc,clientData) == -1)
+        return AE_ERR;
+    return AE_OK;
 }
-// 获取当前时间，秒和毫秒
-static void aeGetTime(long *seconds, long *milliseconds)
+
+int aeSubmitSend(aeEventLoop *eventLoop, int fd, struct iovec *iov, int iovcnt,
+        aeIoProc *proc, void *clientData)
+{
+    if (aeMakeRoomForFd(eventLoop,fd) == AE_ERR) return AE_ERR;
+    if (aeApiSubmitSend(eventLoop,fd,iov,iovcnt,proc,clientData) == -1)
+        return AE_ERR;
+    return AE_OK;
+}
+
+int aeSubmitAccept(aeEventLoop *eventLoop, int fd,
+        aeIoProc *proc, void *clientData)
+{
+    if (aeMakeRoomForFd(eventLoop,fd) == AE_ERR) return AE_ERR;
+    if (aeApiSubmitAccept(eventLoop,fd,proc,clientData) == -1)
+        return AE_ERR;
+    return AE_OK;
+}
+
+void aeCancelIo(aeEventLoop *eventLoop, int fd) {
+    if (fd >= eventLoop->setsize) return;
+    aeApiCancelIo(eventLoop,fd);
+}
+#else
+int aeSubmitRecv(aeEventLoop *eventLoop, int fd, size_t len,
+        aeIoProc *proc, void *clientData)
 {
-    struct timeval tv;
-
-    gettimeofday(&tv, NULL);
-    *seconds = tv.tv_sec;
-    *milliseconds = tv.tv_usec/1000;
-}
-
-static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms) {
-    long cur_sec, cur_ms, when_sec, when_ms;
-    // 获取
-    aeGetTime(&cur_sec, &cur_ms);
-    // 绝对时间，秒数
-    when_sec = cur_sec + milliseconds/1000;
-    // 绝对时间，毫秒数
-    when_ms = cur_ms + milliseconds%1000;
-    // 大于一秒则进位到秒中
-    if (when_ms >= 1000) {
-        when_sec ++;
-        when_ms -= 1000;
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(len);
+    AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    return AE_ERR;
+}
+
+int aeSubmitSend(aeEventLoop *eventLoop, int fd, struct iovec *iov, int iovcnt,
+        aeIoProc *proc, void *clientData)
+{
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(iov);
+    AE_NOTUSED(iovcnt); AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    return AE_ERR;
+}
+
+int aeSubmitAccept(aeEventLoop *eventLoop, int fd,
+        aeIoProc *proc, void *clientData)
+{
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd);
+    AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    return AE_ERR;
+}
+
+void aeCancelIo(aeEventLoop *eventLoop, int fd) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd);
+}
+#endif
+
+/* Return the current time in milliseconds. A monotonic clock is used when
+ * available so that timers are not affected by changes to the system time. */
+static long long aeGetMonotonicMs(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ((long long)ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return ((long long)tv.tv_sec)*1000 + tv.tv_usec/1000;
+    }
+}
+
+/* Time events are kept in a binary min-heap ordered by (when, id), so
+ * the nearest timer is always timeEvents[0]. Every timer remembers its
+ * position in the heap in order to be removed or rescheduled in O(log N).
+ * Timers are also hashed by id in timeEventsById, that has as many
+ * buckets as the heap has slots: ids are sequential so the buckets hold
+ * at most one timer most of the times, and aeDeleteTimeEvent() finds the
+ * timer to remove without scanning the heap. */
+static int aeTimeEventLess(aeTimeEvent *a, aeTimeEvent *b) {
+    if (a->when != b->when) return a->when < b->when;
+    return a->id < b->id;
+}
+
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timeEvents[idx] = te;
+    te->heapIndex = idx;
+}
+
+static void aeTimeHeapSiftUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timeEvents[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+
+        if (!aeTimeEventLess(te,eventLoop->timeEvents[parent])) break;
+        aeTimeHeapSet(eventLoop,idx,eventLoop->timeEvents[parent]);
+        idx = parent;
+    }
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+static void aeTimeHeapSiftDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timeEvents[idx];
+    int count = eventLoop->timeEventsCount;
+
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= count) break;
+        if (child+1 < count &&
+            aeTimeEventLess(eventLoop->timeEvents[child+1],
+                            eventLoop->timeEvents[child])) child++;
+        if (!aeTimeEventLess(eventLoop->timeEvents[child],te)) break;
+        aeTimeHeapSet(eventLoop,idx,eventLoop->timeEvents[child]);
+        idx = child;
     }
-    // 返回绝对时间的秒和毫秒
-    *sec = when_sec;
-    *ms = when_ms;
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+/* Restore the heap property after the 'when' of the timer at idx changed */
+static void aeTimeHeapFix(aeEventLoop *eventLoop, int idx) {
+    if (idx > 0 && aeTimeEventLess(eventLoop->timeEvents[idx],
+                                   eventLoop->timeEvents[(idx-1)/2]))
+        aeTimeHeapSiftUp(eventLoop,idx);
+    else
+        aeTimeHeapSiftDown(eventLoop,idx);
+}
+
+static aeTimeEvent **aeTimeIdBucket(aeEventLoop *eventLoop, long long id) {
+    return eventLoop->timeEventsById +
+           ((unsigned long long)id & (eventLoop->timeEventsSize-1));
+}
+
+static void aeTimeIdLink(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    aeTimeEvent **bucket = aeTimeIdBucket(eventLoop,te->id);
+
+    te->idNext = *bucket;
+    *bucket = te;
+}
+
+static void aeTimeIdUnlink(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    aeTimeEvent **bucket = aeTimeIdBucket(eventLoop,te->id);
+
+    while (*bucket != te) bucket = &(*bucket)->idNext;
+    *bucket = te->idNext;
+}
+
+static int aeTimeHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventsCount == eventLoop->timeEventsSize) {
+        int size = eventLoop->timeEventsSize ? eventLoop->timeEventsSize*2 : 16;
+        aeTimeEvent **timeEvents, **byId;
+        int j;
+
+        byId = zmalloc(sizeof(aeTimeEvent*)*size);
+        if (!byId) return AE_ERR;
+        timeEvents = zrealloc(eventLoop->timeEvents,sizeof(aeTimeEvent*)*size);
+        if (!timeEvents) {
+            zfree(byId);
+            return AE_ERR;
+        }
+        eventLoop->timeEvents = timeEvents;
+        eventLoop->timeEventsSize = size;
+        /* Rehash every timer in the bigger table */
+        memset(byId,0,sizeof(aeTimeEvent*)*size);
+        zfree(eventLoop->timeEventsById);
+        eventLoop->timeEventsById = byId;
+        for (j = 0; j < eventLoop->timeEventsCount; j++)
+            aeTimeIdLink(eventLoop,eventLoop->timeEvents[j]);
+    }
+    aeTimeIdLink(eventLoop,te);
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventsCount,te);
+    eventLoop->timeEventsCount++;
+    aeTimeHeapSiftUp(eventLoop,te->heapIndex);
+    return AE_OK;
+}
+
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, int idx) {
+    int last = --eventLoop->timeEventsCount;
+
+    aeTimeIdUnlink(eventLoop,eventLoop->timeEvents[idx]);
+    if (idx == last) return;
+    aeTimeHeapSet(eventLoop,idx,eventLoop->timeEvents[last]);
+    aeTimeHeapFix(eventLoop,idx);
 }
 
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
@@ -140,64 +414,58 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te = zmalloc(sizeof(*te));
     if (te == NULL) return AE_ERR;
     te->id = id;
-    aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
+    te->when = aeGetMonotonicMs()+milliseconds;
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    // 头插法插入eventLoop的timeEventHead队列
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
+    if (aeTimeHeapInsert(eventLoop,te) == AE_ERR) {
+        zfree(te);
+        return AE_ERR;
+    }
     return id;
 }
-// 删除一个timeEvent节点
+
+/* Unlink the timer from the heap and call its finalizer. The structure is
+ * released unless its handler is running right now: in that case
+ * aeProcessEvents() will free it as soon as the handler returns. */
+static void aeRemoveTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    aeTimeHeapRemove(eventLoop,te->heapIndex);
+    if (te->finalizerProc)
+        te->finalizerProc(eventLoop, te->clientData);
+    if (te == eventLoop->timeEventFiring)
+        te->id = AE_DELETED_EVENT_ID;
+    else
+        zfree(te);
+}
+
+/* Delete a time event. The id is looked up in the hash table and the
+ * timer is removed from the heap at its heapIndex, that is O(log N). */
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
+    aeTimeEvent *te;
 
-    te = eventLoop->timeEventHead;
-    while(te) {
+    if (eventLoop->timeEventsSize == 0) return AE_ERR;
+    te = *aeTimeIdBucket(eventLoop,id);
+    while (te) {
         if (te->id == id) {
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
+            aeRemoveTimeEvent(eventLoop,te);
             return AE_OK;
         }
-        prev = te;
-        te = te->next;
+        te = te->idNext;
     }
     return AE_ERR; /* NO event with the specified ID found */
 }
 
 /* Search the first timer to fire.
- * This operation is useful to know how many time the select can be
+ * This operation is useful to know how many time the poll can be
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted. */
-// 找出最快到期的节点
+ * This is O(1) as the nearest timer is always on top of the heap. */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        /*
-            nearest记录当前最快到期的节点，初始化为NULL
-            1 nearest为空，把当前节点作为最小值
-            2 when_sec小的作为最小值
-            3 when_sec一样的情况下，when_ms小者为最小值
-        */
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    if (eventLoop->timeEventsCount == 0) return NULL;
+    return eventLoop->timeEvents[0];
 }
 
 /* Process every pending time event, then every pending file event
@@ -215,9 +483,7 @@ static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
  * The function returns the number of events processed. */
 int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 {
-    int maxfd = 0, numfd = 0, processed = 0;
-    fd_set rfds, wfds, efds;
-    aeFileEvent *fe = eventLoop->fileEventHead;
+    int processed = 0;
     aeTimeEvent *te;
     long long maxId;
     AE_NOTUSED(flags);
@@ -226,158 +492,117 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
     // 两种类型的事件都不需要处理
     if (!(flags & AE_TIME_EVENTS) && !(flags & AE_FILE_EVENTS)) return 0;
 
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-    FD_ZERO(&efds);
-
-    /* Check file events */
-    // 处理文件事件
-    if (flags & AE_FILE_EVENTS) {
-        while (fe != NULL) {
-            // 根据需要处理的事件，设置对应的变量对应的位
-            if (fe->mask & AE_READABLE) FD_SET(fe->fd, &rfds);
-            if (fe->mask & AE_WRITABLE) FD_SET(fe->fd, &wfds);
-            if (fe->mask & AE_EXCEPTION) FD_SET(fe->fd, &efds);
-            // 记录最大文件描述符select的时候需要用
-            if (maxfd < fe->fd) maxfd = fe->fd;
-            numfd++;
-            fe = fe->next;
-        }
-    }
-    /* Note that we want call select() even if there are no
+    /* Note that we want call the polling backend even if there are no
      * file events to process as long as we want to process time
      * events, in order to sleep until the next time event is ready
      * to fire. */
-    // 有文件事件需要处理，或者有time事件并且没有设置AE_DONT_WAIT（设置的话就不会进入select定时阻塞）标记
-    if (numfd || ((flags & AE_TIME_EVENTS) && !(flags & AE_DONT_WAIT))) {
-        int retval;
+    if ((flags & AE_FILE_EVENTS &&
+         (eventLoop->maxfd != -1 || eventLoop->ioops)) ||
+        ((flags & AE_TIME_EVENTS) && !(flags & AE_DONT_WAIT))) {
+        int j, numevents;
         aeTimeEvent *shortest = NULL;
-        /*
-            struct timeval {
-                long    tv_sec;         // seconds 
-                long    tv_usec;        // and microseconds 
-            };
-        */
         struct timeval tv, *tvp;
-        // 有time事件需要处理，并且没有设置AE_DONT_WAIT标记，则select可能会定时阻塞（如果有time节点的话）
+
+        // 有time事件需要处理，并且没有设置AE_DONT_WAIT标记，则可能会定时阻塞（如果有time节点的话）
         if (flags & AE_TIME_EVENTS && !(flags & AE_DONT_WAIT))
             // 找出最快到期的节点
             shortest = aeSearchNearestTimer(eventLoop);
-        // 有待到期的time节点
         if (shortest) {
-            long now_sec, now_ms;
-
             /* Calculate the time missing for the nearest
              * timer to fire. */
-            aeGetTime(&now_sec, &now_ms);
+            long long ms = shortest->when - aeGetMonotonicMs();
+
+            /* The timer may be already expired */
+            if (ms < 0) ms = 0;
             tvp = &tv;
-            // 算出相对时间，秒数
-            tvp->tv_sec = shortest->when_sec - now_sec;
-            // 不够，需要借位
-            if (shortest->when_ms < now_ms) {
-                // 微秒
-                tvp->tv_usec = ((shortest->when_ms+1000) - now_ms)*1000;
-                // 借一位，减一
-                tvp->tv_sec --;
-            } else {
-                // 乘以1000，即微秒
-                tvp->tv_usec = (shortest->when_ms - now_ms)*1000;
-            }
+            tvp->tv_sec = ms/1000;
+            tvp->tv_usec = (ms%1000)*1000;
         } else {
-            // 没有到期的time节点
             /* If we have to check for events but need to return
              * ASAP because of AE_DONT_WAIT we need to se the timeout
              * to zero */
-            // 设置了AE_DONT_WAIT，则不会阻塞在select
             if (flags & AE_DONT_WAIT) {
                 tv.tv_sec = tv.tv_usec = 0;
                 tvp = &tv;
             } else {
-                // 一直阻塞直到有事件发生
                 /* Otherwise we can block */
                 tvp = NULL; /* wait forever */
             }
         }
-        
-        retval = select(maxfd+1, &rfds, &wfds, &efds, tvp);
-        if (retval > 0) {
-            fe = eventLoop->fileEventHead;
-            while(fe != NULL) {
-                int fd = (int) fe->fd;
-                // 有感兴趣的事件发生
-                if ((fe->mask & AE_READABLE && FD_ISSET(fd, &rfds)) ||
-                    (fe->mask & AE_WRITABLE && FD_ISSET(fd, &wfds)) ||
-                    (fe->mask & AE_EXCEPTION && FD_ISSET(fd, &efds)))
-                {
-                    int mask = 0;
-                    // 记录发生了哪些感兴趣的事件
-                    if (fe->mask & AE_READABLE && FD_ISSET(fd, &rfds))
-                        mask |= AE_READABLE;
-                    if (fe->mask & AE_WRITABLE && FD_ISSET(fd, &wfds))
-                        mask |= AE_WRITABLE;
-                    if (fe->mask & AE_EXCEPTION && FD_ISSET(fd, &efds))
-                        mask |= AE_EXCEPTION;
-                    // 执行回调
-                    fe->fileProc(eventLoop, fe->fd, fe->clientData, mask);
-                    processed++;
-                    /* After an event is processed our file event list
-                     * may no longer be the same, so what we do
-                     * is to clear the bit for this file descriptor and
-                     * restart again from the head. */
-                    /*
-                        执行完回调后，文件事件队列可能发生了变化，
-                        重新开始遍历
-                    */
-                    fe = eventLoop->fileEventHead;
-                    // 清除该文件描述符
-                    FD_CLR(fd, &rfds);
-                    FD_CLR(fd, &wfds);
-                    FD_CLR(fd, &efds);
-                } else {
-                    fe = fe->next;
-                }
+
+        numevents = aeApiPoll(eventLoop, tvp);
+        if (!(flags & AE_FILE_EVENTS)) numevents = 0;
+        for (j = 0; j < numevents; j++) {
+            int fd = eventLoop->fired[j].fd;
+            int mask = eventLoop->fired[j].mask;
+            aeFileEvent *fe = &eventLoop->events[fd];
+            aeFileProc *rproc = NULL;
+
+            /* Note the fe->mask & mask & ... code: maybe an already
+             * processed event removed an element that fired and we still
+             * didn't processed, so we check if the event is still valid.
+             * The events table may also be reallocated by a callback
+             * registering a new fd, so fe is fetched again every time. */
+            if (fe->mask & mask & AE_READABLE) {
+                rproc = fe->rfileProc;
+                /* A proc registered for both reads and writes is called a
+                 * single time with both bits set. */
+                if (fe->mask & mask & AE_WRITABLE && fe->wfileProc == rproc)
+                    rproc(eventLoop,fd,fe->clientData,
+                          AE_READABLE|AE_WRITABLE);
+                else
+                    rproc(eventLoop,fd,fe->clientData,AE_READABLE);
+                processed++;
+                fe = &eventLoop->events[fd];
+            }
+            if (fe->mask & mask & AE_WRITABLE && fe->wfileProc != rproc) {
+                fe->wfileProc(eventLoop,fd,fe->clientData,AE_WRITABLE);
+                processed++;
+                fe = &eventLoop->events[fd];
+            }
+            if (fe->mask & mask & AE_EXCEPTION) {
+                fe->efileProc(eventLoop,fd,fe->clientData,AE_EXCEPTION);
+                processed++;
             }
         }
+#ifdef AE_API_IO
+        /* Call the procs of the I/O requests completed */
+        if (flags & AE_FILE_EVENTS) processed += aeApiProcessIo(eventLoop);
+#endif
     }
     /* Check time events */
     // 处理time事件
     if (flags & AE_TIME_EVENTS) {
-        te = eventLoop->timeEventHead;
+        long long now = aeGetMonotonicMs();
+
         // 先保存这次需要处理的最大id，防止在time回调了不断给队列新增节点，导致死循环
         maxId = eventLoop->timeEventNextId-1;
-        while(te) {
-            long now_sec, now_ms;
-            long long id;
-            // 在本次回调里新增的节点，跳过
-            if (te->id > maxId) {
-                te = te->next;
+        /* Timers are popped in deadline order from the top of the heap,
+         * so we stop at the first one that is not yet expired. */
+        while (eventLoop->timeEventsCount) {
+            int retval;
+
+            te = eventLoop->timeEvents[0];
+            // 在本次回调里新增的节点，下一轮再处理
+            if (te->when > now || te->id > maxId) break;
+            eventLoop->timeEventFiring = te;
+            retval = te->timeProc(eventLoop, te->id, te->clientData);
+            eventLoop->timeEventFiring = NULL;
+            processed++;
+            /* The handler may have deleted its own timer */
+            if (te->id == AE_DELETED_EVENT_ID) {
+                zfree(te);
                 continue;
             }
-            // 获取当前时间
-            aeGetTime(&now_sec, &now_ms);
-            // 到期了
-            if (now_sec > te->when_sec ||
-                (now_sec == te->when_sec && now_ms >= te->when_ms))
-            {
-                int retval;
-
-                id = te->id;
-                // 执行回调
-                retval = te->timeProc(eventLoop, id, te->clientData);
-                /* After an event is processed our time event list may
-                 * no longer be the same, so we restart from head.
-                 * Still we make sure to don't process events registered
-                 * by event handlers itself in order to don't loop forever.
-                 * To do so we saved the max ID we want to handle. */
-                // 继续注册事件，修改超时时间，否则删除该节点
-                if (retval != AE_NOMORE) {
-                    aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-                } else {
-                    aeDeleteTimeEvent(eventLoop, id);
-                }
-                te = eventLoop->timeEventHead;
+            // 继续注册事件，修改超时时间，否则删除该节点
+            if (retval != AE_NOMORE) {
+                /* Never reschedule in the past of this iteration, or a
+                 * timer returning 0 would be served again and again. */
+                te->when = aeGetMonotonicMs()+retval;
+                if (te->when <= now) te->when = now+1;
+                aeTimeHeapFix(eventLoop,te->heapIndex);
             } else {
-                te = te->next;
+                aeRemoveTimeEvent(eventLoop,te);
             }
         }
     }
@@ -386,26 +611,24 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 }
 
 /* Wait for millseconds until the given file descriptor becomes
- * writable/readable/exception */
+ * writable/readable/exception. poll(2) is used instead of select(2) so that
+ * this works with descriptors greater than FD_SETSIZE as well. */
 // 等待一个描述描述符的事件就绪
 int aeWait(int fd, int mask, long long milliseconds) {
-    struct timeval tv;
-    fd_set rfds, wfds, efds;
+    struct pollfd pfd;
     int retmask = 0, retval;
 
-    tv.tv_sec = milliseconds/1000;
-    tv.tv_usec = (milliseconds%1000)*1000;
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-    FD_ZERO(&efds);
-
-    if (mask & AE_READABLE) FD_SET(fd,&rfds);
-    if (mask & AE_WRITABLE) FD_SET(fd,&wfds);
-    if (mask & AE_EXCEPTION) FD_SET(fd,&efds);
-    if ((retval = select(fd+1, &rfds, &wfds, &efds, &tv)) > 0) {
-        if (FD_ISSET(fd,&rfds)) retmask |= AE_READABLE;
-        if (FD_ISSET(fd,&wfds)) retmask |= AE_WRITABLE;
-        if (FD_ISSET(fd,&efds)) retmask |= AE_EXCEPTION;
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = fd;
+    if (mask & AE_READABLE) pfd.events |= POLLIN;
+    if (mask & AE_WRITABLE) pfd.events |= POLLOUT;
+    if (mask & AE_EXCEPTION) pfd.events |= POLLPRI;
+
+    if ((retval = poll(&pfd, 1, milliseconds)) == 1) {
+        if (pfd.revents & POLLIN) retmask |= AE_READABLE;
+        if (pfd.revents & POLLOUT) retmask |= AE_WRITABLE;
+        if (pfd.revents & POLLPRI) retmask |= AE_EXCEPTION;
+        if (pfd.revents & (POLLERR|POLLHUP)) retmask |= mask;
         return retmask;
     } else {
         return retval;
@@ -415,6 +638,17 @@ int aeWait(int fd, int mask, long long milliseconds) {
 void aeMain(aeEventLoop *eventLoop)
 {
     eventLoop->stop = 0;
-    while (!eventLoop->stop)
+    while (!eventLoop->stop) {
+        if (eventLoop->beforesleep != NULL)
+            eventLoop->beforesleep(eventLoop);
         aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+    }
+}
+
+char *aeGetApiName(void) {
+    return aeApiName();
+}
+
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
+    eventLoop->beforesleep = beforesleep;
 }
@@ -33,46 +33,67 @@
 #ifndef __AE_H__
 #define __AE_H__
 
+#include <sys/uio.h>
+
 struct aeEventLoop;
 
 /* Types and data structures */
 typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
+typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
+typedef void aeIoProc(struct aeEventLoop *eventLoop, int fd, void *clientData, char *buf, int res);
 
 /* File event structure */
 typedef struct aeFileEvent {
-    int fd;
-    int mask; /* one of AE_(READABLE|WRITABLE|EXCEPTION) */
-    aeFileProc *fileProc;
+    int mask; /* one or more of AE_(READABLE|WRITABLE|EXCEPTION) */
+    aeFileProc *rfileProc;
+    aeFileProc *wfileProc;
+    aeFileProc *efileProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeFileEvent *next;
 } aeFileEvent;
 
 /* Time event structure */
 typedef struct aeTimeEvent {
     long long id; /* time event identifier. */
-    long when_sec; /* seconds */
-    long when_ms; /* milliseconds */
+    long long when; /* monotonic milliseconds */
+    int heapIndex; /* position in the timers heap */
+    struct aeTimeEvent *idNext; /* next timer in the same id bucket */
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
 } aeTimeEvent;
 
+/* A fired event */
+typedef struct aeFiredEvent {
+    int fd;
+    int mask;
+} aeFiredEvent;
+
 /* State of an event based program */
 typedef struct aeEventLoop {
+    int maxfd;   /* highest file descriptor currently registered */
+    int setsize; /* number of file descriptors the event loop can track */
     long long timeEventNextId;
-    aeFileEvent *fileEventHead;
-    aeTimeEvent *timeEventHead;
+    aeFileEvent *events; /* Registered events, indexed by fd */
+    aeFiredEvent *fired; /* Fired events, filled by the polling backend */
+    aeTimeEvent **timeEvents; /* Min-heap of timers, nearest first */
+    aeTimeEvent **timeEventsById; /* Timers hashed by id, same size */
+    int timeEventsCount;
+    int timeEventsSize;
+    aeTimeEvent *timeEventFiring; /* Timer whose handler is running */
+    int ioops;   /* Completion based I/O requests in flight */
     int stop;
+    void *apidata; /* This is used for polling API specific data */
+    aeBeforeSleepProc *beforesleep; /* Called before every wait for events */
 } aeEventLoop;
 
 /* Defines */
 #define AE_OK 0
 #define AE_ERR -1
 
+#define AE_NONE 0
 #define AE_READABLE 1
 #define AE_WRITABLE 2
 #define AE_EXCEPTION 4
@@ -83,6 +104,11 @@ typedef struct aeEventLoop {
 #define AE_DONT_WAIT 4
 
 #define AE_NOMORE -1
+#define AE_DELETED_EVENT_ID -1
+
+/* Initial number of file descriptors tracked by the event loop, the set
+ * grows automatically as soon as a bigger fd gets registered. */
+#define AE_SETSIZE_INITIAL 1024
 
 /* Macros */
 #define AE_NOTUSED(V) ((void) V)
@@ -99,8 +125,17 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc);
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
+int aeSubmitRecv(aeEventLoop *eventLoop, int fd, size_t len,
+        aeIoProc *proc, void *clientData);
+int aeSubmitSend(aeEventLoop *eventLoop, int fd, struct iovec *iov, int iovcnt,
+        aeIoProc *proc, void *clientData);
+int aeSubmitAccept(aeEventLoop *eventLoop, int fd,
+        aeIoProc *proc, void *clientData);
+void aeCancelIo(aeEventLoop *eventLoop, int fd);
 int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
+char *aeGetApiName(void);
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 
 #endif
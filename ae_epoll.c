@@ -0,0 +1,119 @@
+/* Linux epoll(2) based ae.c module.
+ * Unlike select(2) the cost of every poll is proportional to the number of
+ * descriptors that are actually ready, not to the number of registered
+ * descriptors, and there is no FD_SETSIZE limit.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include <sys/epoll.h>
+
+typedef struct aeApiState {
+    int epfd;
+    struct epoll_event *events;
+    int size;
+} aeApiState;
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+
+    if (!state) return -1;
+    state->events = NULL;
+    state->size = 0;
+    state->epfd = epoll_create(1024); /* 1024 is just an hint for the kernel */
+    if (state->epfd == -1) {
+        zfree(state);
+        return -1;
+    }
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    struct epoll_event *events;
+
+    events = zrealloc(state->events,sizeof(struct epoll_event)*setsize);
+    if (!events) return -1;
+    state->events = events;
+    state->size = setsize;
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    close(state->epfd);
+    zfree(state->events);
+    zfree(state);
+}
+
+static int aeApiUpdate(aeApiState *state, int fd, int oldmask, int mask) {
+    struct epoll_event ee;
+    int op;
+
+    if (mask == oldmask) return 0;
+    if (mask == 0) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        op = (oldmask == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    }
+    ee.events = 0;
+    if (mask & AE_READABLE) ee.events |= EPOLLIN;
+    if (mask & AE_WRITABLE) ee.events |= EPOLLOUT;
+    if (mask & AE_EXCEPTION) ee.events |= EPOLLPRI;
+    ee.data.u64 = 0; /* avoid valgrind warning */
+    ee.data.fd = fd;
+    if (epoll_ctl(state->epfd,op,fd,&ee) == -1) return -1;
+    return 0;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    /* The events table still holds the mask registered so far, ae.c
+     * updates it only after the backend succeeded. */
+    int oldmask = eventLoop->events[fd].mask;
+
+    return aeApiUpdate(state,fd,oldmask,oldmask|mask);
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    int oldmask = eventLoop->events[fd].mask;
+
+    /* Note, the kernel < 2.6.9 requires a non null event pointer even for
+     * EPOLL_CTL_DEL, aeApiUpdate() always passes one. */
+    aeApiUpdate(state,fd,oldmask,oldmask&(~mask));
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    int retval, numevents = 0;
+
+    retval = epoll_wait(state->epfd,state->events,state->size,
+            tvp ? (tvp->tv_sec*1000 + (tvp->tv_usec+999)/1000) : -1);
+    if (retval > 0) {
+        int j;
+
+        numevents = retval;
+        for (j = 0; j < numevents; j++) {
+            int mask = 0;
+            struct epoll_event *e = state->events+j;
+
+            if (e->events & EPOLLIN) mask |= AE_READABLE;
+            if (e->events & EPOLLOUT) mask |= AE_WRITABLE;
+            if (e->events & EPOLLPRI) mask |= AE_EXCEPTION;
+            /* Errors and hangups are reported to whatever handler is
+             * registered, the read()/write() will then fail as usually. */
+            if (e->events & (EPOLLERR|EPOLLHUP))
+                mask |= AE_READABLE|AE_WRITABLE;
+            eventLoop->fired[j].fd = e->data.fd;
+            eventLoop->fired[j].mask = mask;
+        }
+    }
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return "epoll";
+}
@@ -0,0 +1,610 @@
+/* Linux io_uring based ae.c module.
+ *
+ * Besides file events, this backend implements the completion based I/O
+ * of ae.h: recv, send and multishot accept requests are queued in the
+ * submission ring and the kernel performs them, so the handlers get the
+ * data read, or the new connection, without any system call of their own.
+ * Everything queued during an event loop iteration is submitted by the
+ * same io_uring_enter(2) call that waits for the completions: with many
+ * clients a single system call serves all of them.
+ *
+ * The buffers of the requests belong to the event loop. When a request is
+ * cancelled the kernel may still be using its buffer, so the buffer is
+ * only released when the final completion of the request is reaped, and
+ * the caller is free to release its own data right away.
+ *
+ * File events are implemented with one-shot poll requests, armed again
+ * before the next wait if the event is still registered. This gives the
+ * level triggered semantic the rest of ae.c expects, and arming them does
+ * not need a system call either.
+ *
+ * Requires Linux 5.19 or greater (multishot accept).
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+
+#define AE_API_IO 1
+
+#define AE_IOURING_ENTRIES 4096
+/* user_data of the requests whose completion is ignored (cancellations) */
+#define AE_IOURING_IGNORE 0xffffffffffffffffULL
+/* The user_data of I/O requests is the address of the request with the
+ * lowest bit set, poll requests have it cleared. */
+#define AE_IOURING_IOTAG 1ULL
+/* Requests with buffers of this size are recycled, up to a limit */
+#define AE_IOURING_BUFSIZE (1024*16)
+#define AE_IOURING_FREEREQS_MAX 256
+
+#define AE_IO_RECV 0
+#define AE_IO_SEND 1
+#define AE_IO_ACCEPT 2
+
+/* A completion based I/O request */
+typedef struct aeIoReq {
+    int fd;
+    int type;               /* AE_IO_RECV, AE_IO_SEND or AE_IO_ACCEPT */
+    aeIoProc *proc;         /* NULL once the request is cancelled */
+    void *clientData;
+    struct aeIoReq *prev, *next; /* Links of the list holding the request */
+    size_t size;            /* Allocated bytes of buf */
+    size_t len;             /* Bytes to send or to receive */
+    size_t sent;            /* Bytes already sent */
+    char buf[];
+} aeIoReq;
+
+/* A completion reaped from the ring, waiting for aeApiProcessIo() */
+typedef struct aeIoDone {
+    aeIoReq *req;
+    int res;
+    unsigned flags;
+} aeIoDone;
+
+typedef struct aeApiState {
+    int ringfd;
+    /* Submission queue */
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    struct io_uring_sqe *sqes;
+    unsigned sqentries;
+    /* Completion queue */
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_cqe *cqes;
+    /* Mappings, to release them */
+    void *sqring, *cqring;
+    size_t sqringsize, cqringsize, sqessize;
+    /* Per fd state */
+    unsigned *gens;  /* generation of the poll request armed for the fd */
+    char *armed;     /* true if a poll request is armed for the fd */
+    aeIoReq **reqs;  /* I/O requests pending on the fd */
+    int size;
+    int lastfired;   /* Number of events returned by the last poll */
+    /* I/O requests */
+    aeIoReq *cancelled;     /* Cancelled, waiting for their completion */
+    aeIoReq *retired;       /* Cancelled and completed, see aeApiPoll() */
+    aeIoReq *freereqs;      /* Recycled requests */
+    int numfreereqs;
+    aeIoDone *done;         /* Completions reaped by the last poll */
+    int numdone, donesize;
+} aeApiState;
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+    struct io_uring_params p;
+
+    if (!state) return -1;
+    memset(state,0,sizeof(*state));
+    memset(&p,0,sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = AE_IOURING_ENTRIES*4;
+    state->ringfd = syscall(__NR_io_uring_setup,AE_IOURING_ENTRIES,&p);
+    if (state->ringfd == -1) {
+        zfree(state);
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) goto err;
+
+    state->sqringsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cqringsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cqringsize > state->sqringsize)
+            state->sqringsize = state->cqringsize;
+        state->cqringsize = 0;
+    }
+    state->sqring = mmap(NULL,state->sqringsize,PROT_READ|PROT_WRITE,
+                         MAP_SHARED,state->ringfd,IORING_OFF_SQ_RING);
+    if (state->sqring == MAP_FAILED) goto err;
+    if (state->cqringsize) {
+        state->cqring = mmap(NULL,state->cqringsize,PROT_READ|PROT_WRITE,
+                             MAP_SHARED,state->ringfd,IORING_OFF_CQ_RING);
+        if (state->cqring == MAP_FAILED) {
+            munmap(state->sqring,state->sqringsize);
+            goto err;
+        }
+    } else {
+        state->cqring = state->sqring;
+    }
+    state->sqessize = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL,state->sqessize,PROT_READ|PROT_WRITE,
+                       MAP_SHARED,state->ringfd,IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) {
+        munmap(state->sqring,state->sqringsize);
+        if (state->cqringsize) munmap(state->cqring,state->cqringsize);
+        goto err;
+    }
+
+    state->sqhead = (unsigned*)((char*)state->sqring+p.sq_off.head);
+    state->sqtail = (unsigned*)((char*)state->sqring+p.sq_off.tail);
+    state->sqmask = (unsigned*)((char*)state->sqring+p.sq_off.ring_mask);
+    state->sqarray = (unsigned*)((char*)state->sqring+p.sq_off.array);
+    state->sqentries = p.sq_entries;
+    state->cqhead = (unsigned*)((char*)state->cqring+p.cq_off.head);
+    state->cqtail = (unsigned*)((char*)state->cqring+p.cq_off.tail);
+    state->cqmask = (unsigned*)((char*)state->cqring+p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cqring+p.cq_off.cqes);
+    eventLoop->apidata = state;
+    return 0;
+
+err:
+    close(state->ringfd);
+    zfree(state);
+    return -1;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    unsigned *gens;
+    char *armed;
+    aeIoReq **reqs;
+
+    gens = zrealloc(state->gens,sizeof(unsigned)*setsize);
+    if (!gens) return -1;
+    state->gens = gens;
+    armed = zrealloc(state->armed,setsize);
+    if (!armed) return -1;
+    state->armed = armed;
+    reqs = zrealloc(state->reqs,sizeof(aeIoReq*)*setsize);
+    if (!reqs) return -1;
+    state->reqs = reqs;
+    memset(state->gens+state->size,0,sizeof(unsigned)*(setsize-state->size));
+    memset(state->armed+state->size,0,setsize-state->size);
+    memset(state->reqs+state->size,0,sizeof(aeIoReq*)*(setsize-state->size));
+    state->size = setsize;
+    return 0;
+}
+
+static void aeApiFreeReqList(aeIoReq *req) {
+    while (req) {
+        aeIoReq *next = req->next;
+
+        zfree(req);
+        req = next;
+    }
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    /* Closing the ring cancels the requests still pending, so their
+     * buffers can be released after it. */
+    munmap(state->sqes,state->sqessize);
+    munmap(state->sqring,state->sqringsize);
+    if (state->cqringsize) munmap(state->cqring,state->cqringsize);
+    close(state->ringfd);
+    for (j = 0; j < state->size; j++) aeApiFreeReqList(state->reqs[j]);
+    aeApiFreeReqList(state->cancelled);
+    aeApiFreeReqList(state->retired);
+    aeApiFreeReqList(state->freereqs);
+    zfree(state->gens);
+    zfree(state->armed);
+    zfree(state->reqs);
+    zfree(state->done);
+    zfree(state);
+}
+
+/* Submit the queued requests and wait for at least 'wait' completions,
+ * or until the timeout expires if 'ts' is not NULL. */
+static int aeApiEnter(aeApiState *state, unsigned wait,
+                      struct __kernel_timespec *ts)
+{
+    struct io_uring_getevents_arg arg;
+    unsigned tosubmit, flags = IORING_ENTER_EXT_ARG;
+
+    tosubmit = *state->sqtail -
+               __atomic_load_n(state->sqhead,__ATOMIC_ACQUIRE);
+    if (wait) flags |= IORING_ENTER_GETEVENTS;
+    memset(&arg,0,sizeof(arg));
+    arg.ts = (unsigned long)ts;
+    return syscall(__NR_io_uring_enter,state->ringfd,tosubmit,wait,flags,
+                   &arg,sizeof(arg));
+}
+
+/* Return a free submission queue entry, flushing the queue to the kernel
+ * if it is full. */
+static struct io_uring_sqe *aeApiGetSqe(aeApiState *state) {
+    unsigned tail = *state->sqtail, idx;
+    struct io_uring_sqe *sqe;
+
+    while (tail - __atomic_load_n(state->sqhead,__ATOMIC_ACQUIRE) ==
+           state->sqentries)
+    {
+        if (aeApiEnter(state,0,NULL) == -1 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY) return NULL;
+    }
+    idx = tail & *state->sqmask;
+    sqe = state->sqes+idx;
+    memset(sqe,0,sizeof(*sqe));
+    state->sqarray[idx] = idx;
+    __atomic_store_n(state->sqtail,tail+1,__ATOMIC_RELEASE);
+    return sqe;
+}
+
+static unsigned long long aeApiUserData(aeApiState *state, int fd) {
+    return ((unsigned long long)state->gens[fd] << 32) | ((unsigned)fd << 1);
+}
+
+static int aeApiArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeApiGetSqe(state);
+
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (mask & AE_READABLE) sqe->poll32_events |= POLLIN;
+    if (mask & AE_WRITABLE) sqe->poll32_events |= POLLOUT;
+    if (mask & AE_EXCEPTION) sqe->poll32_events |= POLLPRI;
+    sqe->user_data = aeApiUserData(state,fd);
+    state->armed[fd] = 1;
+    return 0;
+}
+
+static int aeApiDisarm(aeApiState *state, int fd) {
+    struct io_uring_sqe *sqe = aeApiGetSqe(state);
+
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = aeApiUserData(state,fd);
+    sqe->user_data = AE_IOURING_IGNORE;
+    /* Completions of the old request, if any, will be ignored */
+    state->gens[fd]++;
+    state->armed[fd] = 0;
+    return 0;
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    /* The events table still holds the mask registered so far, ae.c
+     * updates it only after the backend succeeded. */
+    int oldmask = eventLoop->events[fd].mask;
+
+    if (state->armed[fd]) {
+        if ((oldmask|mask) == oldmask) return 0;
+        if (aeApiDisarm(state,fd) == -1) return -1;
+    }
+    return aeApiArm(state,fd,oldmask|mask);
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    int newmask = eventLoop->events[fd].mask & (~mask);
+
+    /* If no request is armed the fd fired in the last poll, and it will
+     * be armed again with the right mask by aeApiPoll() */
+    if (!state->armed[fd]) return;
+    if (aeApiDisarm(state,fd) == -1) return;
+    if (newmask != AE_NONE) aeApiArm(state,fd,newmask);
+}
+
+/* ------------------------- Completion based I/O --------------------------- */
+
+static aeIoReq *aeApiCreateReq(aeApiState *state, int fd, int type,
+                               size_t len, aeIoProc *proc, void *clientData)
+{
+    size_t size = len <= AE_IOURING_BUFSIZE ? AE_IOURING_BUFSIZE : len;
+    aeIoReq *req;
+
+    if (type == AE_IO_ACCEPT) size = 0;
+    if (size == AE_IOURING_BUFSIZE && state->freereqs) {
+        req = state->freereqs;
+        state->freereqs = req->next;
+        state->numfreereqs--;
+    } else {
+        req = zmalloc(sizeof(*req)+size);
+        if (!req) return NULL;
+        req->size = size;
+    }
+    req->fd = fd;
+    req->type = type;
+    req->proc = proc;
+    req->clientData = clientData;
+    req->len = len;
+    req->sent = 0;
+    return req;
+}
+
+static void aeApiFreeReq(aeApiState *state, aeIoReq *req) {
+    if (req->size == AE_IOURING_BUFSIZE &&
+        state->numfreereqs < AE_IOURING_FREEREQS_MAX)
+    {
+        req->next = state->freereqs;
+        state->freereqs = req;
+        state->numfreereqs++;
+    } else {
+        zfree(req);
+    }
+}
+
+static void aeApiLinkReq(aeIoReq **head, aeIoReq *req) {
+    req->prev = NULL;
+    req->next = *head;
+    if (*head) (*head)->prev = req;
+    *head = req;
+}
+
+static void aeApiUnlinkReq(aeIoReq **head, aeIoReq *req) {
+    if (req->prev)
+        req->prev->next = req->next;
+    else
+        *head = req->next;
+    if (req->next) req->next->prev = req->prev;
+}
+
+/* Queue the request in the submission ring. The part of a send still to
+ * be written is submitted, so this is also used after a short write. */
+static int aeApiQueueReq(aeApiState *state, aeIoReq *req) {
+    struct io_uring_sqe *sqe = aeApiGetSqe(state);
+
+    if (!sqe) return -1;
+    sqe->fd = req->fd;
+    sqe->user_data = (unsigned long long)(uintptr_t)req | AE_IOURING_IOTAG;
+    switch (req->type) {
+    case AE_IO_RECV:
+        sqe->opcode = IORING_OP_RECV;
+        sqe->addr = (unsigned long long)(uintptr_t)req->buf;
+        sqe->len = req->len;
+        break;
+    case AE_IO_SEND:
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (unsigned long long)(uintptr_t)(req->buf+req->sent);
+        sqe->len = req->len-req->sent;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        break;
+    case AE_IO_ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        break;
+    }
+    return 0;
+}
+
+static int aeApiSubmitReq(aeEventLoop *eventLoop, aeIoReq *req) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (aeApiQueueReq(state,req) == -1) {
+        aeApiFreeReq(state,req);
+        return -1;
+    }
+    aeApiLinkReq(&state->reqs[req->fd],req);
+    eventLoop->ioops++;
+    return 0;
+}
+
+static int aeApiSubmitRecv(aeEventLoop *eventLoop, int fd, size_t len,
+                           aeIoProc *proc, void *clientData)
+{
+    aeIoReq *req = aeApiCreateReq(eventLoop->apidata,fd,AE_IO_RECV,len,
+                                  proc,clientData);
+
+    if (!req) return -1;
+    return aeApiSubmitReq(eventLoop,req);
+}
+
+static int aeApiSubmitSend(aeEventLoop *eventLoop, int fd, struct iovec *iov,
+                           int iovcnt, aeIoProc *proc, void *clientData)
+{
+    size_t len = 0;
+    aeIoReq *req;
+    int j;
+
+    for (j = 0; j < iovcnt; j++) len += iov[j].iov_len;
+    req = aeApiCreateReq(eventLoop->apidata,fd,AE_IO_SEND,len,
+                         proc,clientData);
+    if (!req) return -1;
+    for (len = 0, j = 0; j < iovcnt; j++) {
+        memcpy(req->buf+len,iov[j].iov_base,iov[j].iov_len);
+        len += iov[j].iov_len;
+    }
+    return aeApiSubmitReq(eventLoop,req);
+}
+
+static int aeApiSubmitAccept(aeEventLoop *eventLoop, int fd,
+                             aeIoProc *proc, void *clientData)
+{
+    aeIoReq *req = aeApiCreateReq(eventLoop->apidata,fd,AE_IO_ACCEPT,0,
+                                  proc,clientData);
+
+    if (!req) return -1;
+    return aeApiSubmitReq(eventLoop,req);
+}
+
+/* Stop tracking a request that completed for good, or was cancelled */
+static void aeApiRetireReq(aeEventLoop *eventLoop, aeIoReq *req) {
+    aeApiState *state = eventLoop->apidata;
+
+    aeApiUnlinkReq(&state->reqs[req->fd],req);
+    eventLoop->ioops--;
+}
+
+/* A cancelled request completed. It is not released yet, as the
+ * cancellation itself may still be queued in the submission ring: if the
+ * memory was reused by a new request, the new one would be cancelled. */
+static void aeApiRetireCancelledReq(aeApiState *state, aeIoReq *req) {
+    aeApiUnlinkReq(&state->cancelled,req);
+    aeApiLinkReq(&state->retired,req);
+}
+
+static void aeApiCancelIo(aeEventLoop *eventLoop, int fd) {
+    aeApiState *state = eventLoop->apidata;
+
+    while (state->reqs[fd]) {
+        aeIoReq *req = state->reqs[fd];
+        struct io_uring_sqe *sqe;
+
+        aeApiRetireReq(eventLoop,req);
+        req->proc = NULL;
+        aeApiLinkReq(&state->cancelled,req);
+        /* The final completion of the request releases it */
+        if ((sqe = aeApiGetSqe(state)) == NULL) continue;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long long)(uintptr_t)req | AE_IOURING_IOTAG;
+        sqe->user_data = AE_IOURING_IGNORE;
+    }
+}
+
+/* Call the procs of the requests completed in the last poll. Requests
+ * cancelled in the meantime, even by a proc called in this same loop, are
+ * just released once they are done. */
+static int aeApiProcessIo(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    int j, processed = 0;
+
+    for (j = 0; j < state->numdone; j++) {
+        aeIoReq *req = state->done[j].req;
+        int res = state->done[j].res;
+        int more = state->done[j].flags & IORING_CQE_F_MORE;
+
+        if (req->proc == NULL) {
+            if (!more) aeApiRetireCancelledReq(state,req);
+            continue;
+        }
+        /* Not ready after all, try again */
+        if (res == -EAGAIN && !more) {
+            if (aeApiQueueReq(state,req) == -1) res = -ENOMEM;
+            else continue;
+        }
+        switch (req->type) {
+        case AE_IO_SEND:
+            if (res > 0 && req->sent+res < req->len) {
+                /* Short write, send the rest */
+                req->sent += res;
+                if (aeApiQueueReq(state,req) == 0) continue;
+                res = -ENOMEM;
+            }
+            if (res > 0) res = req->len;
+            /* Fall through */
+        case AE_IO_RECV:
+            aeApiRetireReq(eventLoop,req);
+            req->proc(eventLoop,req->fd,req->clientData,
+                      req->type == AE_IO_RECV ? req->buf : NULL,res);
+            aeApiFreeReq(state,req);
+            break;
+        case AE_IO_ACCEPT:
+            req->proc(eventLoop,req->fd,req->clientData,NULL,res);
+            if (more) break;
+            /* The kernel stopped accepting. Unless the proc cancelled the
+             * request it is submitted again. */
+            if (req->proc == NULL) {
+                aeApiRetireCancelledReq(state,req);
+            } else if (aeApiQueueReq(state,req) == -1) {
+                aeApiRetireReq(eventLoop,req);
+                aeApiFreeReq(state,req);
+            }
+            break;
+        }
+        processed++;
+    }
+    state->numdone = 0;
+    return processed;
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    struct __kernel_timespec ts;
+    unsigned head, tail;
+    int j, numevents = 0;
+
+    /* Arm again the descriptors that fired the last time */
+    for (j = 0; j < state->lastfired; j++) {
+        int fd = eventLoop->fired[j].fd;
+        int mask = eventLoop->events[fd].mask;
+
+        if (mask != AE_NONE && !state->armed[fd]) aeApiArm(state,fd,mask);
+    }
+
+    if (tvp) {
+        ts.tv_sec = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec*1000;
+    }
+    if (tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0) {
+        aeApiEnter(state,0,NULL);
+    } else {
+        aeApiEnter(state,1,tvp ? &ts : NULL);
+    }
+    /* Everything queued was submitted, cancellations included */
+    while (state->retired) {
+        aeIoReq *req = state->retired;
+
+        state->retired = req->next;
+        aeApiFreeReq(state,req);
+    }
+
+    head = *state->cqhead;
+    tail = __atomic_load_n(state->cqtail,__ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = state->cqes+(head & *state->cqmask);
+        int fd, mask = 0;
+
+        if (cqe->user_data == AE_IOURING_IGNORE) continue;
+        if (cqe->user_data & AE_IOURING_IOTAG) {
+            /* I/O request: the proc is called by aeApiProcessIo() once
+             * the file events are processed */
+            if (state->numdone == state->donesize) {
+                int size = state->donesize ? state->donesize*2 : 64;
+                aeIoDone *done = zrealloc(state->done,sizeof(aeIoDone)*size);
+
+                /* Leave the rest in the ring for the next poll */
+                if (!done) break;
+                state->done = done;
+                state->donesize = size;
+            }
+            state->done[state->numdone].req = (aeIoReq*)(uintptr_t)
+                (cqe->user_data & ~AE_IOURING_IOTAG);
+            state->done[state->numdone].res = cqe->res;
+            state->done[state->numdone].flags = cqe->flags;
+            state->numdone++;
+            continue;
+        }
+        fd = (cqe->user_data & 0xffffffff) >> 1;
+        /* Skip completions of requests cancelled in the meantime */
+        if (fd >= state->size || (cqe->user_data >> 32) != state->gens[fd])
+            continue;
+        state->armed[fd] = 0;
+        if (cqe->res < 0) {
+            /* Report the error to the handlers, the read()/write() will
+             * then fail as usually. */
+            mask = AE_READABLE|AE_WRITABLE;
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLPRI) mask |= AE_EXCEPTION;
+            if (cqe->res & (POLLERR|POLLHUP)) mask |= AE_READABLE|AE_WRITABLE;
+        }
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cqhead,head,__ATOMIC_RELEASE);
+    state->lastfired = numevents;
+    return numevents;
+}
+
+static char *aeApiName(void) {
+    return "io_uring";
+}
@@ -268,3 +268,20 @@ int anetAccept(char *err, int serversock, char *ip, int *port)
     if (port) *port = ntohs(sa.sin_port);
     return fd;
 }
+
+/* Store the address of the peer connected to 'fd', for sockets not
+ * accepted with anetAccept() */
+int anetPeerToString(int fd, char *ip, int *port)
+{
+    struct sockaddr_in sa;
+    socklen_t saLen = sizeof(sa);
+
+    if (getpeername(fd, (struct sockaddr*)&sa, &saLen) == -1) {
+        if (ip) strcpy(ip,"?");
+        if (port) *port = 0;
+        return ANET_ERR;
+    }
+    if (ip) strcpy(ip,inet_ntoa(sa.sin_addr));
+    if (port) *port = ntohs(sa.sin_port);
+    return ANET_OK;
+}
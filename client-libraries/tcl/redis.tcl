@@ -20,6 +20,8 @@ array set ::redis::bulkarg {}
 # Flag commands requiring last argument as a bulk write operation
 foreach redis_bulk_cmd {
     set setnx rpush lpush lset lrem sadd srem sismember echo getset smove
+    zadd zincrby zrem zscore zrank zrevrank
+    hset hget hdel hexists
 } {
     set ::redis::bulkarg($redis_bulk_cmd) {}
 }
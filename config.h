@@ -0,0 +1,16 @@
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+/* Test for the polling API available on this system: the ae event loop
+ * uses the best one it can find, falling back to select(2). */
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#endif
+
+/* io_uring is opt-in as it requires Linux 5.19 or greater and it is often
+ * disabled in containers: build with 'make USE_IO_URING=yes' to use it. */
+#if defined(__linux__) && defined(USE_IO_URING)
+#define HAVE_IO_URING 1
+#endif
+
+#endif
@@ -41,6 +41,8 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <limits.h>
+#include <ctype.h>
+#include <sys/time.h>
 
 #include "dict.h"
 #include "zmalloc.h"
@@ -72,8 +74,24 @@ static void _dictFree(void *ptr) {
     zfree(ptr);
 }
 
+/* -------------------------- globals --------------------------------------- */
+
+/* Using dictEnableResize() / dictDisableResize() we make possible to
+ * enable/disable resizing of the hash table as needed. This is very important
+ * for Redis, as we use copy-on-write and don't want to move too much memory
+ * around when there is a child performing saving operations.
+ *
+ * Note that even when dict_can_resize is set to 0, not all resizes are
+ * prevented: an hash table is still allowed to grow if the ratio between
+ * the number of elements and the buckets > dict_force_resize_ratio. */
+static int dict_can_resize = 1;
+static unsigned int dict_force_resize_ratio = 5;
+
 /* -------------------------- private prototypes ---------------------------- */
 
+uint64_t siphash(const uint8_t *in, size_t inlen, const uint8_t *k);
+uint64_t siphash_nocase(const uint8_t *in, size_t inlen, const uint8_t *k);
+
 static int _dictExpandIfNeeded(dict *ht);
 static unsigned long _dictNextPower(unsigned long size);
 static int _dictKeyIndex(dict *ht, const void *key);
@@ -100,23 +118,36 @@ unsigned int dictIdentityHashFunction(unsigned int key)
     return key;
 }
 
-/* Generic hash function (a popular one from Bernstein).
- * I tested a few and this was the best. */
+/* The hash function for strings is SipHash (see siphash.c), keyed with a
+ * seed that should be set to a random value at startup using
+ * dictSetHashFunctionSeed(): this way clients can't guess which keys will
+ * end in the same bucket. */
+static uint8_t dict_hash_function_seed[16];
+
+void dictSetHashFunctionSeed(uint8_t *seed) {
+    memcpy(dict_hash_function_seed,seed,sizeof(dict_hash_function_seed));
+}
+
+uint8_t *dictGetHashFunctionSeed(void) {
+    return dict_hash_function_seed;
+}
+
 // 哈希函数
 unsigned int dictGenHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = 5381;
+    return (unsigned int)siphash(buf,len,dict_hash_function_seed);
+}
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
-    return hash;
+/* And a case insensitive version */
+unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len) {
+    return (unsigned int)siphash_nocase(buf,len,dict_hash_function_seed);
 }
 
 /* ----------------------------- API implementation ------------------------- */
 
-/* Reset an hashtable already initialized with ht_init().
+/* Reset an hash table already initialized with ht_init().
  * NOTE: This function should only called by ht_destroy(). */
 // 重置字段元数据
-static void _dictReset(dict *ht)
+static void _dictReset(dictht *ht)
 {
     ht->table = NULL;
     ht->size = 0;
@@ -129,111 +160,183 @@ static void _dictReset(dict *ht)
 dict *dictCreate(dictType *type,
         void *privDataPtr)
 {
-    dict *ht = _dictAlloc(sizeof(*ht));
+    dict *d = _dictAlloc(sizeof(*d));
 
-    _dictInit(ht,type,privDataPtr);
-    return ht;
-}   
+    _dictInit(d,type,privDataPtr);
+    return d;
+}
 
 /* Initialize the hash table */
 // 初始化字典数据结构
-int _dictInit(dict *ht, dictType *type,
+int _dictInit(dict *d, dictType *type,
         void *privDataPtr)
 {
-    _dictReset(ht);
-    ht->type = type;
-    ht->privdata = privDataPtr;
+    _dictReset(&d->ht[0]);
+    _dictReset(&d->ht[1]);
+    d->type = type;
+    d->privdata = privDataPtr;
+    d->rehashidx = -1;
+    d->iterators = 0;
     return DICT_OK;
 }
 
 /* Resize the table to the minimal size that contains all the elements,
  * but with the invariant of a USER/BUCKETS ration near to <= 1 */
 // 扩容
-int dictResize(dict *ht)
+int dictResize(dict *d)
 {
-    int minimal = ht->used;
+    unsigned long minimal;
 
+    if (!dict_can_resize || dictIsRehashing(d)) return DICT_ERR;
+    minimal = d->ht[0].used;
     if (minimal < DICT_HT_INITIAL_SIZE)
         minimal = DICT_HT_INITIAL_SIZE;
-    return dictExpand(ht, minimal);
+    return dictExpand(d, minimal);
 }
 
-/* Expand or create the hashtable */
-int dictExpand(dict *ht, unsigned long size)
+/* Expand or create the hash table. The elements are not moved here: if
+ * the dictionary is not empty the new table is just installed as ht[1]
+ * and the elements are migrated incrementally by dictRehash(). */
+int dictExpand(dict *d, unsigned long size)
 {
-    dict n; /* the new hashtable */
+    dictht n; /* the new hash table */
     // 2的倍数
-    unsigned long realsize = _dictNextPower(size), i;
+    unsigned long realsize = _dictNextPower(size);
 
     /* the size is invalid if it is smaller than the number of
-     * elements already inside the hashtable */
-    // 申请的内存大小小于已使用的，报错，不能shrink
-    if (ht->used > size)
+     * elements already inside the hash table, or if we are already
+     * rehashing */
+    if (dictIsRehashing(d) || d->ht[0].used > size)
         return DICT_ERR;
-    // 
-    _dictInit(&n, ht->type, ht->privdata);
+    if (realsize == d->ht[0].size) return DICT_ERR;
+
     // 哈希表数组的长度
     n.size = realsize;
     // 索引掩码，用于计算索引
     n.sizemask = realsize-1;
     // 用作哈希表的指针数组
     n.table = _dictAlloc(realsize*sizeof(dictEntry*));
+    n.used = 0;
 
     /* Initialize all the pointers to NULL */
     // 初始化内存为0
     memset(n.table, 0, realsize*sizeof(dictEntry*));
 
-    /* Copy all the elements from the old to the new table:
-     * note that if the old hash table is empty ht->size is zero,
-     * so dictExpand just creates an hash table. */
-    // 之前字典已经使用的项数，复制过来，used是字典里节点个数
-    n.used = ht->used;
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
-        // 空项，不需要复制
-        if (ht->table[i] == NULL) continue;
-        
-        /* For each hash entry on this slot... */
-        he = ht->table[i];
-        while(he) {
+    /* Is this the first initialization? If so it's not really a rehashing
+     * we just set the first hash table so that it can accept keys. */
+    if (d->ht[0].table == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
+
+    /* Prepare a second hash table for incremental rehashing */
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Performs N steps of incremental rehashing, every step moves all the
+ * elements of a bucket from the old to the new table. Returns 1 if there
+ * are still keys to move from the old to the new hash table, otherwise 0
+ * is returned.
+ * Empty buckets are visited as well but they count less, so that a step
+ * on a very sparse table can't take too long. */
+int dictRehash(dict *d, int n) {
+    int emptyvisits = n*10;
+
+    if (!dictIsRehashing(d)) return 0;
+
+    while(n--) {
+        dictEntry *de, *nextde;
+
+        /* Check if we already rehashed the whole table... */
+        if (d->ht[0].used == 0) {
+            _dictFree(d->ht[0].table);
+            d->ht[0] = d->ht[1];
+            _dictReset(&d->ht[1]);
+            d->rehashidx = -1;
+            return 0;
+        }
+
+        /* Note that rehashidx can't overflow as we are sure there are more
+         * elements because ht[0].used != 0 */
+        while(d->ht[0].table[d->rehashidx] == NULL) {
+            d->rehashidx++;
+            if (--emptyvisits == 0) return 1;
+        }
+        de = d->ht[0].table[d->rehashidx];
+        /* Move all the keys in this bucket from the old to the new hash HT */
+        while(de) {
             unsigned int h;
+
             // 保存下一个节点的地址，table的每一个项都是一个链表
-            nextHe = he->next;  
-            /* Get the new element index */
-            // 重新计算he的索引
-            h = dictHashKey(ht, he->key) & n.sizemask;
-            // 插入索引为h的字典项中，头插法
-            he->next = n.table[h];
-            n.table[h] = he;
-            // 使用数减一
-            ht->used--;
-            /* Pass to the next element */
-            he = nextHe;
+            nextde = de->next;
+            /* Get the index in the new hash table */
+            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
+            // 头插法插入新表
+            de->next = d->ht[1].table[h];
+            d->ht[1].table[h] = de;
+            d->ht[0].used--;
+            d->ht[1].used++;
+            de = nextde;
         }
+        d->ht[0].table[d->rehashidx] = NULL;
+        d->rehashidx++;
     }
-    assert(ht->used == 0);
-    // 释放旧的内存
-    _dictFree(ht->table);
+    return 1;
+}
 
-    /* Remap the new hashtable in the old */
-    // 覆盖之前的信息
-    *ht = n;
-    return DICT_OK;
+static long long timeInMilliseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
+}
+
+/* Rehash for an amount of time between ms milliseconds and ms+1
+ * milliseconds. Returns the number of rehash steps performed. */
+int dictRehashMilliseconds(dict *d, int ms) {
+    long long start = timeInMilliseconds();
+    int rehashes = 0;
+
+    if (d->iterators) return 0;
+    while(dictRehash(d,100)) {
+        rehashes += 100;
+        if (timeInMilliseconds()-start > ms) break;
+    }
+    return rehashes;
+}
+
+/* This function performs just a step of rehashing, and only if there are
+ * no iterators bound to our hash table. When we have iterators in the
+ * middle of a rehashing we can't mess with the two hash tables otherwise
+ * some element can be missed or duplicated.
+ *
+ * This function is called by common lookup or update operations in the
+ * dictionary so that the hash table automatically migrates from H1 to H2
+ * while it is actively used. */
+static void _dictRehashStep(dict *d) {
+    if (d->iterators == 0) dictRehash(d,1);
 }
 
 /* Add an element to the target hash table */
-int dictAdd(dict *ht, void *key, void *val)
+int dictAdd(dict *d, void *key, void *val)
 {
     int index;
     dictEntry *entry;
+    dictht *ht;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
     // 计算key是否已经存在，不存在则返回key对应的索引
-    if ((index = _dictKeyIndex(ht, key)) == -1)
+    if ((index = _dictKeyIndex(d, key)) == -1)
         return DICT_ERR;
 
-    /* Allocates the memory and stores key */
+    /* Allocates the memory and stores key. While rehashing new elements
+     * always go in the new table. */
+    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
     // 申请一个字典项
     entry = _dictAlloc(sizeof(*entry));
     // 头插法插入第index项对应的链表中
@@ -242,72 +345,76 @@ int dictAdd(dict *ht, void *key, void *val)
 
     /* Set the hash entry fields. */
     // 设置键值
-    dictSetHashKey(ht, entry, key);
-    dictSetHashVal(ht, entry, val);
+    dictSetHashKey(d, entry, key);
+    dictSetHashVal(d, entry, val);
     // 节点数加一
     ht->used++;
     return DICT_OK;
 }
 
 /* Add an element, discarding the old if the key already exists */
-int dictReplace(dict *ht, void *key, void *val)
+int dictReplace(dict *d, void *key, void *val)
 {
     dictEntry *entry;
 
     /* Try to add the element. If the key
      * does not exists dictAdd will suceed. */
     // 尝试新增，成功说明之前还没有这个key，否则说明存在，下面再替换
-    if (dictAdd(ht, key, val) == DICT_OK)
+    if (dictAdd(d, key, val) == DICT_OK)
         return DICT_OK;
     /* It already exists, get the entry */
     // 找到key对应的索引
-    entry = dictFind(ht, key);
+    entry = dictFind(d, key);
     /* Free the old value and set the new one */
     // 释放当前的value
-    dictFreeEntryVal(ht, entry);
+    dictFreeEntryVal(d, entry);
     // 重新设置新值
-    dictSetHashVal(ht, entry, val);
+    dictSetHashVal(d, entry, val);
     return DICT_OK;
 }
 
 /* Search and remove an element */
-static int dictGenericDelete(dict *ht, const void *key, int nofree)
+static int dictGenericDelete(dict *d, const void *key, int nofree)
 {
-    unsigned int h;
+    unsigned int h, idx;
     dictEntry *he, *prevHe;
+    int table;
+
     // 空字典
-    if (ht->size == 0)
+    if (d->ht[0].size == 0)
         return DICT_ERR;
-    // 算出索引
-    h = dictHashKey(ht, key) & ht->sizemask;
-    // 拿到索引对应的链表
-    he = ht->table[h];
-
-    prevHe = NULL;
-    while(he) {
-        // 比较key，找到返回true
-        if (dictCompareHashKeys(ht, key, he->key)) {
-            /* Unlink the element from the list */
-            // 上一个不匹配节点的next指针指向待删除节点的下一个节点
-            if (prevHe)
-                prevHe->next = he->next;
-            else
-                // prevHe为空，说明待删除的节点是链表的第一个节点，则更新头指针指向待删除节点的下一个
-                ht->table[h] = he->next;
-            // 
-            if (!nofree) {
-                dictFreeEntryKey(ht, he);
-                dictFreeEntryVal(ht, he);
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    // 算出哈希值
+    h = dictHashKey(d, key);
+
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        // 拿到索引对应的链表
+        he = d->ht[table].table[idx];
+        prevHe = NULL;
+        while(he) {
+            // 比较key，找到返回true
+            if (dictCompareHashKeys(d, key, he->key)) {
+                /* Unlink the element from the list */
+                if (prevHe)
+                    prevHe->next = he->next;
+                else
+                    d->ht[table].table[idx] = he->next;
+                if (!nofree) {
+                    dictFreeEntryKey(d, he);
+                    dictFreeEntryVal(d, he);
+                }
+                // 删除这个节点
+                _dictFree(he);
+                // 已使用个数减一
+                d->ht[table].used--;
+                return DICT_OK;
             }
-            // 删除这个节点
-            _dictFree(he);
-            // 已使用个数减一
-            ht->used--;
-            return DICT_OK;
+            // 保存上一个不匹配的
+            prevHe = he;
+            he = he->next;
         }
-        // 保存上一个不匹配的
-        prevHe = he;
-        he = he->next;
+        if (!dictIsRehashing(d)) break;
     }
     return DICT_ERR; /* not found */
 }
@@ -321,8 +428,8 @@ int dictDeleteNoFree(dict *ht, const void *key) {
 }
 
 /* Destroy an entire hash table */
-// 销毁整个字典
-int _dictClear(dict *ht)
+// 销毁整个哈希表
+static int _dictClear(dict *d, dictht *ht)
 {
     unsigned long i;
 
@@ -336,9 +443,9 @@ int _dictClear(dict *ht)
             // 先保存下一个节点地址，不然下面内存被释放就找不到了
             nextHe = he->next;
             // 释放键内存
-            dictFreeEntryKey(ht, he);
+            dictFreeEntryKey(d, he);
             // 释放值内存
-            dictFreeEntryVal(ht, he);
+            dictFreeEntryVal(d, he);
             // 释放节点内存
             _dictFree(he);
             // 使用数减一
@@ -347,7 +454,6 @@ int _dictClear(dict *ht)
         }
     }
     /* Free the table and the allocated cache structure */
-    // 释放字典结构体
     _dictFree(ht->table);
     /* Re-initialize the table */
     // 重置字段
@@ -357,33 +463,43 @@ int _dictClear(dict *ht)
 
 /* Clear & Release the hash table */
 // 释放字典里的数据和字典本身
-void dictRelease(dict *ht)
+void dictRelease(dict *d)
 {
-    _dictClear(ht);
-    _dictFree(ht);
+    _dictClear(d,&d->ht[0]);
+    _dictClear(d,&d->ht[1]);
+    _dictFree(d);
 }
 // 根据key从字典（哈希表）找到对应的节点
-dictEntry *dictFind(dict *ht, const void *key)
+dictEntry *dictFind(dict *d, const void *key)
 {
     dictEntry *he;
-    unsigned int h;
-
-    if (ht->size == 0) return NULL;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return he;
-        he = he->next;
+    unsigned int h, idx, table;
+
+    if (d->ht[0].size == 0) return NULL; /* We don't have a table at all */
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    /* While rehashing the key can be in both the tables */
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        he = d->ht[table].table[idx];
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key))
+                return he;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) return NULL;
     }
     return NULL;
 }
 // 字典迭代器
-dictIterator *dictGetIterator(dict *ht)
+dictIterator *dictGetIterator(dict *d)
 {
     dictIterator *iter = _dictAlloc(sizeof(*iter));
 
-    iter->ht = ht;
+    /* Pause the rehashing until the iterator is released */
+    d->iterators++;
+    iter->d = d;
+    iter->table = 0;
     iter->index = -1;
     iter->entry = NULL;
     iter->nextEntry = NULL;
@@ -395,12 +511,20 @@ dictEntry *dictNext(dictIterator *iter)
     while (1) {
         // 初始化时entry为NULL
         if (iter->entry == NULL) {
+            dictht *ht = &iter->d->ht[iter->table];
+
             iter->index++;
-            // 到底了才break，而不是entry为空
-            if (iter->index >=
-                    (signed)iter->ht->size) break;
-            // 返回索引为0对应的链表
-            iter->entry = iter->ht->table[iter->index];
+            if (iter->index >= (signed)ht->size) {
+                /* Go on with the new table if we are rehashing */
+                if (dictIsRehashing(iter->d) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                    ht = &iter->d->ht[1];
+                } else {
+                    break;
+                }
+            }
+            iter->entry = ht->table[iter->index];
         } else {
             iter->entry = iter->nextEntry;
         }
@@ -417,24 +541,36 @@ dictEntry *dictNext(dictIterator *iter)
 // 释放迭代器
 void dictReleaseIterator(dictIterator *iter)
 {
+    iter->d->iterators--;
     _dictFree(iter);
 }
 
 /* Return a random entry from the hash table. Useful to
  * implement randomized algorithms */
 // 返回字典中一个随机节点
-dictEntry *dictGetRandomKey(dict *ht)
+dictEntry *dictGetRandomKey(dict *d)
 {
     dictEntry *he;
     unsigned int h;
     int listlen, listele;
 
-    if (ht->used == 0) return NULL;
+    if (dictSize(d) == 0) return NULL;
+    if (dictIsRehashing(d)) _dictRehashStep(d);
     // 从字典中获得一个值非空的随机索引
-    do {
-        h = random() & ht->sizemask;
-        he = ht->table[h];
-    } while(he == NULL);
+    if (dictIsRehashing(d)) {
+        /* The buckets of ht[0] before rehashidx are empty */
+        do {
+            h = d->rehashidx +
+                (random() % (d->ht[0].size+d->ht[1].size-d->rehashidx));
+            he = (h >= d->ht[0].size) ? d->ht[1].table[h-d->ht[0].size] :
+                                        d->ht[0].table[h];
+        } while(he == NULL);
+    } else {
+        do {
+            h = random() & d->ht[0].sizemask;
+            he = d->ht[0].table[h];
+        } while(he == NULL);
+    }
 
     /* Now we found a non empty bucket, but it is a linked
      * list and we need to get a random element from the list.
@@ -448,22 +584,133 @@ dictEntry *dictGetRandomKey(dict *ht)
     }
     // 从链表中随机选一个节点
     listele = random() % listlen;
-    he = ht->table[h];
+    he = (h >= d->ht[0].size) ? d->ht[1].table[h-d->ht[0].size] :
+                                d->ht[0].table[h];
     while(listele--) he = he->next;
     return he;
 }
 
+/* Reverse the bits of an unsigned long, used by dictScan() */
+static unsigned long rev(unsigned long v) {
+    unsigned long s = 8 * sizeof(v); /* bit size; must be power of 2 */
+    unsigned long mask = ~0UL;
+
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* dictScan() is used to iterate over the elements of a dictionary without
+ * keeping any state on the server side: the caller starts with a cursor of
+ * zero, and calls the function again with the returned cursor until zero
+ * is returned. For every element found the callback 'fn' is called.
+ *
+ * Every element present in the dictionary from the start to the end of
+ * the iteration is returned at least once, even if the table is resized
+ * or rehashed between the calls. Elements may be returned more than once.
+ *
+ * The trick is to increment the cursor starting from its most significant
+ * bit: the cursor is the index of a bucket with its bits reversed. When
+ * the table grows every bucket is split into buckets whose index has the
+ * same low bits, and they are all still ahead of the reversed cursor; when
+ * the table shrinks several buckets are merged into one, whose index is
+ * the common low part of them, so again nothing is left behind (at worst
+ * some bucket is visited twice).
+ *
+ * While rehashing we visit the bucket of the smaller table and then all
+ * the buckets of the bigger table that are expansions of it. */
+// 用游标遍历字典，每次调用遍历一个或多个桶，返回下一次遍历的游标，为 0 说明遍历完成
+unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn,
+                       void *privdata)
+{
+    dictht *t0, *t1;
+    const dictEntry *de;
+    unsigned long m0, m1;
+
+    if (dictSize(d) == 0) return 0;
+
+    if (!dictIsRehashing(d)) {
+        t0 = &(d->ht[0]);
+        m0 = t0->sizemask;
+
+        /* Emit entries at cursor */
+        de = t0->table[v & m0];
+        while (de) {
+            fn(privdata, de);
+            de = de->next;
+        }
+    } else {
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+
+        /* Emit entries at cursor */
+        de = t0->table[v & m0];
+        while (de) {
+            fn(privdata, de);
+            de = de->next;
+        }
+
+        /* Iterate over indices in larger table that are the expansion
+         * of the index pointed to by the cursor in the smaller table */
+        do {
+            /* Emit entries at cursor */
+            de = t1->table[v & m1];
+            while (de) {
+                fn(privdata, de);
+                de = de->next;
+            }
+
+            /* Increment bits not covered by the smaller mask */
+            v = (((v | m0) + 1) & ~m0) | (v & m0);
+
+            /* Continue while bits covered by mask difference is non-zero */
+        } while (v & (m0 ^ m1));
+    }
+
+    /* Set unmasked bits so incrementing the reversed cursor
+     * operates on the masked bits of the smaller table */
+    v |= ~m0;
+
+    /* Increment the reverse cursor */
+    v = rev(v);
+    v++;
+    v = rev(v);
+
+    return v;
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
-static int _dictExpandIfNeeded(dict *ht)
+static int _dictExpandIfNeeded(dict *d)
 {
-    /* If the hash table is empty expand it to the intial size,
-     * if the table is "full" dobule its size. */
-    if (ht->size == 0)
-        return dictExpand(ht, DICT_HT_INITIAL_SIZE);
-    if (ht->used == ht->size)
-        return dictExpand(ht, ht->size*2);
+    /* Incremental rehashing already in progress. Return. */
+    if (dictIsRehashing(d)) return DICT_OK;
+
+    /* If the hash table is empty expand it to the intial size. */
+    if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
+
+    /* If we reached the 1:1 ratio, and we are allowed to resize the hash
+     * table (global setting) or we should avoid it but the ratio between
+     * elements/buckets is over the "safe" threshold, we resize doubling
+     * the number of buckets. */
+    if (d->ht[0].used >= d->ht[0].size &&
+        (dict_can_resize ||
+         d->ht[0].used/d->ht[0].size > dict_force_resize_ratio))
+    {
+        return dictExpand(d, d->ht[0].used*2);
+    }
     return DICT_OK;
 }
 
@@ -483,34 +730,52 @@ static unsigned long _dictNextPower(unsigned long size)
 
 /* Returns the index of a free slot that can be populated with
  * an hash entry for the given 'key'.
- * If the key already exists, -1 is returned. */
+ * If the key already exists, -1 is returned.
+ *
+ * Note that if we are in the process of rehashing the hash table, the
+ * index is always returned in the context of the second (new) hash table. */
 // 判断key是否存在字典中，是返回-1，否则返回key对应的索引
-static int _dictKeyIndex(dict *ht, const void *key)
+static int _dictKeyIndex(dict *d, const void *key)
 {
-    unsigned int h;
+    unsigned int h, idx, table;
     dictEntry *he;
 
     /* Expand the hashtable if needed */
-    if (_dictExpandIfNeeded(ht) == DICT_ERR)
+    if (_dictExpandIfNeeded(d) == DICT_ERR)
         return -1;
     /* Compute the key hash value */
-    h = dictHashKey(ht, key) & ht->sizemask;
-    /* Search if this slot does not already contain the given key */
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return -1;
-        he = he->next;
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        /* Search if this slot does not already contain the given key */
+        he = d->ht[table].table[idx];
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key))
+                return -1;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) break;
     }
-    return h;
+    return idx;
+}
+
+void dictEmpty(dict *d) {
+    _dictClear(d,&d->ht[0]);
+    _dictClear(d,&d->ht[1]);
+    d->rehashidx = -1;
+    d->iterators = 0;
+}
+
+void dictEnableResize(void) {
+    dict_can_resize = 1;
 }
 
-void dictEmpty(dict *ht) {
-    _dictClear(ht);
+void dictDisableResize(void) {
+    dict_can_resize = 0;
 }
 
 #define DICT_STATS_VECTLEN 50
-void dictPrintStats(dict *ht) {
+static void _dictPrintStatsHt(dictht *ht) {
     unsigned long i, slots = 0, chainlen, maxchainlen = 0;
     unsigned long totchainlen = 0;
     unsigned long clvector[DICT_STATS_VECTLEN];
@@ -554,6 +819,14 @@ void dictPrintStats(dict *ht) {
     }
 }
 
+void dictPrintStats(dict *d) {
+    _dictPrintStatsHt(&d->ht[0]);
+    if (dictIsRehashing(d)) {
+        printf("-- Rehashing into ht[1]:\n");
+        _dictPrintStatsHt(&d->ht[1]);
+    }
+}
+
 /* ----------------------- StringCopy Hash Table Type ------------------------*/
 
 static unsigned int _dictStringCopyHTHashFunction(const void *key)
@@ -635,3 +908,127 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringCopyHTKeyDestructor,       /* key destructor */
     _dictStringKeyValCopyHTValDestructor, /* val destructor */
 };
+
+/* ------------------------------- Benchmark ---------------------------------*/
+
+#ifdef DICT_BENCHMARK_MAIN
+
+/* Compare the SipHash based dictGenHashFunction() with the "hash * 33 + c"
+ * function we used before, both in terms of speed and of distribution of
+ * the keys in the buckets. Build with 'make dict-benchmark'. */
+
+static unsigned int djbHashFunction(const unsigned char *buf, int len) {
+    unsigned int hash = 5381;
+
+    while (len--)
+        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
+    return hash;
+}
+
+typedef unsigned int benchHashFunction(const unsigned char *buf, int len);
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static void benchmarkSpeed(const char *name, benchHashFunction *hash) {
+    static unsigned char buf[1024];
+    int lens[] = {8, 16, 32, 64, 256, 1024}, j;
+    unsigned int sum = 0;
+
+    for (j = 0; j < (int)sizeof(buf); j++) buf[j] = j*7;
+    printf("%-8s", name);
+    for (j = 0; j < (int)(sizeof(lens)/sizeof(int)); j++) {
+        long long start, elapsed, bytes = 0;
+        long i, iter = (64*1024*1024)/lens[j];
+
+        start = ustime();
+        for (i = 0; i < iter; i++) {
+            buf[0] = i;
+            sum += hash(buf,lens[j]);
+            bytes += lens[j];
+        }
+        elapsed = ustime()-start;
+        printf(" %4d: %7.1f MB/s", lens[j],
+            (double)bytes/(elapsed ? elapsed : 1));
+    }
+    printf("  (%u)\n", sum & 1);
+}
+
+/* Hash 'count' keys into 'buckets' buckets, and print the longest chain
+ * and the chi-square of the distribution (close to 1 is good). */
+static void benchmarkDistribution(const char *name, benchHashFunction *hash,
+                                  char **keys, int count, unsigned long buckets)
+{
+    unsigned long *chains = zmalloc(sizeof(unsigned long)*buckets), j;
+    unsigned long maxchain = 0, empty = 0;
+    double expected = (double)count/buckets, chi = 0;
+    int i;
+
+    memset(chains,0,sizeof(unsigned long)*buckets);
+    for (i = 0; i < count; i++)
+        chains[hash((unsigned char*)keys[i],strlen(keys[i])) & (buckets-1)]++;
+    for (j = 0; j < buckets; j++) {
+        double diff = chains[j]-expected;
+
+        if (chains[j] > maxchain) maxchain = chains[j];
+        if (chains[j] == 0) empty++;
+        chi += diff*diff/expected;
+    }
+    printf("%-8s max chain: %6lu  empty buckets: %6.2f%%  chi2/buckets: %.3f\n",
+        name, maxchain, (double)empty*100/buckets, chi/buckets);
+    zfree(chains);
+}
+
+static void freeKeys(char **keys, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) zfree(keys[i]);
+    zfree(keys);
+}
+
+int main(void) {
+    int count = 1<<20, i, j;
+    char **keys;
+    uint8_t seed[16];
+
+    srandom(ustime());
+    for (i = 0; i < 16; i++) seed[i] = random() & 0xff;
+    dictSetHashFunctionSeed(seed);
+
+    printf("== Throughput\n");
+    benchmarkSpeed("djb", djbHashFunction);
+    benchmarkSpeed("siphash", dictGenHashFunction);
+
+    printf("\n== %d keys \"key:<n>\" in as many buckets\n", count);
+    keys = zmalloc(sizeof(char*)*count);
+    for (i = 0; i < count; i++) {
+        keys[i] = zmalloc(32);
+        snprintf(keys[i],32,"key:%d",i);
+    }
+    benchmarkDistribution("djb", djbHashFunction, keys, count, count);
+    benchmarkDistribution("siphash", dictGenHashFunction, keys, count, count);
+    freeKeys(keys,count);
+
+    /* "Ez" and "FY" have the same "hash * 33 + c" value, so every string
+     * made of N of these blocks collides: a client can fill a bucket with
+     * 2^N keys. */
+    count = 1<<16;
+    printf("\n== %d colliding keys for djb, %d buckets\n", count, count);
+    keys = zmalloc(sizeof(char*)*count);
+    for (i = 0; i < count; i++) {
+        keys[i] = zmalloc(33);
+        for (j = 0; j < 16; j++)
+            memcpy(keys[i]+j*2, (i & (1<<j)) ? "Ez" : "FY", 2);
+        keys[i][32] = '\0';
+    }
+    benchmarkDistribution("djb", djbHashFunction, keys, count, count);
+    benchmarkDistribution("siphash", dictGenHashFunction, keys, count, count);
+    freeKeys(keys,count);
+    return 0;
+}
+
+#endif
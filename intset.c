@@ -0,0 +1,268 @@
+/* Sorted set of integers stored in a single allocation.
+ *
+ * The layout of an intset is:
+ *
+ * <encoding><length><contents>
+ *
+ * <encoding> is the size in bytes of every element: 2, 4 or 8.
+ * <length> is the number of elements.
+ * <contents> are the elements, sorted from the smallest to the largest
+ * and without duplicates. They are stored in the host byte order, as the
+ * RDB file saves the members of a set and not the intset itself.
+ *
+ * The encoding is only upgraded: removing the only value that needed a
+ * larger width leaves the array as it is.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "intset.h"
+#include "zmalloc.h"
+
+#define INTSET_ENC_INT16 (sizeof(int16_t))
+#define INTSET_ENC_INT32 (sizeof(int32_t))
+#define INTSET_ENC_INT64 (sizeof(int64_t))
+
+/* When a set is this many times larger than the other one, intersecting
+ * them with a binary search for every element of the smaller set is
+ * faster than walking both of them. */
+#define INTSET_GALLOP_RATIO 32
+
+/* ------------------------- Heap Management Wrappers------------------------ */
+
+static intset *intsetResize(intset *is, uint32_t len) {
+    size_t size = sizeof(intset)+(size_t)len*is->encoding;
+
+    is = zrealloc(is,size);
+    if (is == NULL) {
+        fprintf(stderr, "\nINTSET LIBRARY PANIC: Out of memory\n\n");
+        abort();
+    }
+    return is;
+}
+
+/* --------------------------- Elements encoding ---------------------------- */
+
+/* Return the smallest encoding able to hold 'value' */
+static uint32_t intsetValueEncoding(int64_t value) {
+    if (value < INT32_MIN || value > INT32_MAX)
+        return INTSET_ENC_INT64;
+    else if (value < INT16_MIN || value > INT16_MAX)
+        return INTSET_ENC_INT32;
+    else
+        return INTSET_ENC_INT16;
+}
+
+static int64_t intsetGetEncoded(intset *is, uint32_t pos, uint32_t enc) {
+    if (enc == INTSET_ENC_INT64)
+        return ((int64_t*)is->contents)[pos];
+    else if (enc == INTSET_ENC_INT32)
+        return ((int32_t*)is->contents)[pos];
+    else
+        return ((int16_t*)is->contents)[pos];
+}
+
+static int64_t intsetGetValue(intset *is, uint32_t pos) {
+    return intsetGetEncoded(is,pos,is->encoding);
+}
+
+/* Store 'value' at 'pos'. A value that does not fit the encoding is
+ * truncated, see intsetIntersect(). */
+static void intsetSetValue(intset *is, uint32_t pos, int64_t value) {
+    if (is->encoding == INTSET_ENC_INT64)
+        ((int64_t*)is->contents)[pos] = value;
+    else if (is->encoding == INTSET_ENC_INT32)
+        ((int32_t*)is->contents)[pos] = (int32_t)value;
+    else
+        ((int16_t*)is->contents)[pos] = (int16_t)value;
+}
+
+/* Search 'value' with a binary search. Returns 1 and sets *pos to its
+ * position if found, otherwise returns 0 and sets *pos to the position
+ * where it should be inserted. */
+static int intsetSearch(intset *is, int64_t value, uint32_t *pos) {
+    uint32_t lo = 0, hi = is->length, mid;
+    int64_t cur;
+
+    /* Members are often added in order, check the tail first */
+    if (hi == 0 || value > intsetGetValue(is,hi-1)) {
+        *pos = hi;
+        return 0;
+    }
+    while(lo < hi) {
+        mid = lo+(hi-lo)/2;
+        cur = intsetGetValue(is,mid);
+        if (cur < value) {
+            lo = mid+1;
+        } else if (cur > value) {
+            hi = mid;
+        } else {
+            *pos = mid;
+            return 1;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+/* Move the elements from 'from' to the end of the array at 'to' */
+static void intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
+    memmove(is->contents+(size_t)to*is->encoding,
+            is->contents+(size_t)from*is->encoding,
+            (size_t)(is->length-from)*is->encoding);
+}
+
+/* Add a value that does not fit the current encoding. Such a value is
+ * either smaller or greater than every element, so it always goes at
+ * one of the ends of the array. */
+static intset *intsetUpgradeAndAdd(intset *is, int64_t value) {
+    uint32_t curenc = is->encoding, length = is->length;
+    int prepend = value < 0;
+
+    is->encoding = intsetValueEncoding(value);
+    is = intsetResize(is,length+1);
+    /* Widen the elements starting from the last one, so that nothing is
+     * overwritten before being read */
+    while(length--)
+        intsetSetValue(is,length+prepend,intsetGetEncoded(is,length,curenc));
+    intsetSetValue(is,prepend ? 0 : is->length,value);
+    is->length++;
+    return is;
+}
+
+/* ----------------------------- Public API --------------------------------- */
+
+intset *intsetNew(void) {
+    intset *is = zmalloc(sizeof(intset));
+
+    if (is == NULL) {
+        fprintf(stderr, "\nINTSET LIBRARY PANIC: Out of memory\n\n");
+        abort();
+    }
+    is->encoding = INTSET_ENC_INT16;
+    is->length = 0;
+    return is;
+}
+
+/* Add 'value'. *success is set to 0 if it was already a member. */
+intset *intsetAdd(intset *is, int64_t value, int *success) {
+    uint32_t pos;
+
+    if (success) *success = 1;
+    if (intsetValueEncoding(value) > is->encoding)
+        return intsetUpgradeAndAdd(is,value);
+    if (intsetSearch(is,value,&pos)) {
+        if (success) *success = 0;
+        return is;
+    }
+    is = intsetResize(is,is->length+1);
+    if (pos < is->length) intsetMoveTail(is,pos,pos+1);
+    intsetSetValue(is,pos,value);
+    is->length++;
+    return is;
+}
+
+/* Remove 'value'. *success is set to 0 if it was not a member. */
+intset *intsetRemove(intset *is, int64_t value, int *success) {
+    uint32_t pos;
+
+    if (success) *success = 0;
+    if (intsetValueEncoding(value) <= is->encoding &&
+        intsetSearch(is,value,&pos))
+    {
+        if (success) *success = 1;
+        if (pos < is->length-1) intsetMoveTail(is,pos+1,pos);
+        is = intsetResize(is,is->length-1);
+        is->length--;
+    }
+    return is;
+}
+
+int intsetFind(intset *is, int64_t value) {
+    uint32_t pos;
+
+    return intsetValueEncoding(value) <= is->encoding &&
+           intsetSearch(is,value,&pos);
+}
+
+/* Store the element at 'pos' in *value. Returns 0 if 'pos' is out of
+ * range, so that all the elements can be read with:
+ *
+ * for (j = 0; intsetGet(is,j,&value); j++) ... */
+int intsetGet(intset *is, uint32_t pos, int64_t *value) {
+    if (pos >= is->length) return 0;
+    *value = intsetGetValue(is,pos);
+    return 1;
+}
+
+/* Return a new intset with the elements of both 'a' and 'b'.
+ *
+ * Sets of similar sizes are merged walking both arrays at once. The merge
+ * loop has no data dependent branches: the element of 'a' is always
+ * written to the result, but the result only grows when it is also the
+ * element of 'b', and the positions advance by the result of comparisons,
+ * so the compiler turns the loop body into conditional moves. When a set
+ * is much smaller than the other one, every element of the smaller set
+ * is looked up with a binary search instead, in the part of the larger
+ * set following the previous match. */
+intset *intsetIntersect(intset *a, intset *b) {
+    intset *is;
+    uint32_t i = 0, j = 0, n = 0, lo, hi, mid;
+    int64_t va, vb;
+
+    if (a->length > b->length) {
+        is = a;
+        a = b;
+        b = is;
+    }
+    /* The common elements fit the smaller encoding. Elements of the other
+     * set that don't fit are truncated by the speculative writes of the
+     * merge, but they are never counted in the result. */
+    is = intsetNew();
+    is->encoding = a->encoding < b->encoding ? a->encoding : b->encoding;
+    if (a->length == 0) return is;
+    is = intsetResize(is,a->length);
+
+    if ((uint64_t)a->length*INTSET_GALLOP_RATIO < b->length) {
+        for (i = 0; i < a->length && j < b->length; i++) {
+            va = intsetGetValue(a,i);
+            lo = j;
+            hi = b->length;
+            while(lo < hi) {
+                mid = lo+(hi-lo)/2;
+                if (intsetGetValue(b,mid) < va)
+                    lo = mid+1;
+                else
+                    hi = mid;
+            }
+            j = lo;
+            if (j < b->length && intsetGetValue(b,j) == va)
+                intsetSetValue(is,n++,va);
+        }
+    } else {
+        while(i < a->length && j < b->length) {
+            va = intsetGetValue(a,i);
+            vb = intsetGetValue(b,j);
+            intsetSetValue(is,n,va);
+            n += va == vb;
+            i += va <= vb;
+            j += vb <= va;
+        }
+    }
+    is->length = n;
+    return intsetResize(is,n);
+}
+
+uint32_t intsetLen(intset *is) {
+    return is->length;
+}
+
+/* Return the total size in bytes of the intset */
+size_t intsetBlobLen(intset *is) {
+    return sizeof(intset)+(size_t)is->length*is->encoding;
+}
@@ -0,0 +1,34 @@
+/* Sorted set of integers stored in a single allocation.
+ *
+ * An intset is an array of integers kept sorted and without duplicates,
+ * so lookups are a binary search. All the elements use the same width,
+ * 16, 32 or 64 bits, that is the smallest one able to hold every value
+ * in the set: adding a value that does not fit upgrades the whole array
+ * to a larger width. It is used to encode sets made only of integers
+ * with a fraction of the memory needed by a dict of objects.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#ifndef __INTSET_H
+#define __INTSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct intset {
+    uint32_t encoding;          /* size in bytes of every element */
+    uint32_t length;            /* number of elements */
+    int8_t contents[];
+} intset;
+
+intset *intsetNew(void);
+intset *intsetAdd(intset *is, int64_t value, int *success);
+intset *intsetRemove(intset *is, int64_t value, int *success);
+int intsetFind(intset *is, int64_t value);
+int intsetGet(intset *is, uint32_t pos, int64_t *value);
+intset *intsetIntersect(intset *a, intset *b);
+uint32_t intsetLen(intset *is);
+size_t intsetBlobLen(intset *is);
+
+#endif /* __INTSET_H */
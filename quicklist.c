@@ -0,0 +1,391 @@
+/* List made of linked chunks of packed entries, see quicklist.h
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "quicklist.h"
+#include "ziplist.h"
+#include "zmalloc.h"
+
+/* A node is not grown past this size unless it is empty, so that big
+ * elements don't make every insertion move a lot of memory. */
+#define QUICKLIST_NODE_MAX_BYTES 8192
+
+/* ------------------------- Heap Management Wrappers------------------------ */
+
+static void *_quicklistAlloc(size_t size) {
+    void *p = zmalloc(size);
+    if (p == NULL) {
+        fprintf(stderr, "\nQUICKLIST LIBRARY PANIC: Out of memory\n\n");
+        abort();
+    }
+    return p;
+}
+
+/* ------------------------------- Skip index ------------------------------- */
+
+/* Rebuild the index from scratch, leaving free slots at both ends so that
+ * nodes can be added at the head and at the tail without a rebuild. */
+static void __quicklistIndexRebuild(quicklist *ql) {
+    unsigned long size = ql->len*2+16, j;
+    long long start = 0;
+    quicklistNode *node;
+
+    zfree(ql->index);
+    ql->index = _quicklistAlloc(sizeof(quicklistNode*)*size);
+    ql->indexsize = size;
+    ql->indexoff = (size-ql->len)/2;
+    for (node = ql->head, j = ql->indexoff; node; node = node->next, j++) {
+        ql->index[j] = node;
+        node->start = start;
+        start += node->count;
+    }
+    ql->indexvalid = 1;
+}
+
+/* Called when 'delta' elements were added (or removed when negative) at
+ * position 'pos' of 'node'. The positions of the elements of the next
+ * nodes change, unless the update happened at the start of the head node,
+ * where only the start of the head has to move, or in the tail node. */
+static void __quicklistIndexUpdate(quicklist *ql, quicklistNode *node,
+                                   long pos, long delta)
+{
+    if (node == ql->head && pos == 0)
+        node->start -= delta;
+    else if (node != ql->tail)
+        ql->indexvalid = 0;
+}
+
+/* Return the node holding the element at 'index', that must be in range,
+ * and store the position of the element inside the node in *offset. */
+static quicklistNode *__quicklistFindNode(quicklist *ql, unsigned long index,
+                                          long *offset)
+{
+    long long pos;
+    unsigned long lo, hi, mid;
+    quicklistNode *node;
+
+    if (!ql->indexvalid) __quicklistIndexRebuild(ql);
+    pos = ql->head->start+index;
+    /* Binary search of the last node starting at or before pos */
+    lo = ql->indexoff;
+    hi = ql->indexoff+ql->len-1;
+    while (lo < hi) {
+        mid = lo+(hi-lo+1)/2;
+        if (ql->index[mid]->start <= pos)
+            lo = mid;
+        else
+            hi = mid-1;
+    }
+    node = ql->index[lo];
+    *offset = pos-node->start;
+    return node;
+}
+
+/* ------------------------------ Nodes ------------------------------------- */
+
+static quicklistNode *__quicklistCreateNode(void) {
+    quicklistNode *node = _quicklistAlloc(sizeof(*node));
+
+    node->prev = node->next = NULL;
+    node->zl = ziplistNew();
+    node->count = 0;
+    node->start = 0;
+    return node;
+}
+
+/* Add an empty node at the head or at the tail of the list */
+static quicklistNode *__quicklistAddNode(quicklist *ql, int where) {
+    quicklistNode *node = __quicklistCreateNode();
+
+    if (where == QUICKLIST_HEAD) {
+        node->next = ql->head;
+        if (ql->head) {
+            ql->head->prev = node;
+            node->start = ql->head->start;
+        } else {
+            ql->tail = node;
+        }
+        ql->head = node;
+        if (ql->indexvalid && ql->indexoff > 0)
+            ql->index[--ql->indexoff] = node;
+        else
+            ql->indexvalid = 0;
+    } else {
+        node->prev = ql->tail;
+        if (ql->tail) {
+            ql->tail->next = node;
+            node->start = ql->tail->start+ql->tail->count;
+        } else {
+            ql->head = node;
+        }
+        ql->tail = node;
+        if (ql->indexvalid && ql->indexoff+ql->len < ql->indexsize)
+            ql->index[ql->indexoff+ql->len] = node;
+        else
+            ql->indexvalid = 0;
+    }
+    ql->len++;
+    return node;
+}
+
+/* Unlink and free a node together with all its elements */
+static void __quicklistDelNode(quicklist *ql, quicklistNode *node) {
+    if (node == ql->head && node == ql->tail) {
+        ql->head = ql->tail = NULL;
+    } else if (node == ql->head) {
+        ql->head = node->next;
+        ql->head->prev = NULL;
+        ql->indexoff++;
+    } else if (node == ql->tail) {
+        ql->tail = node->prev;
+        ql->tail->next = NULL;
+    } else {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        ql->indexvalid = 0;
+    }
+    ql->len--;
+    ql->count -= node->count;
+    zfree(node->zl);
+    zfree(node);
+}
+
+/* Delete the element at 'p', position 'pos', of 'node'. Returns 1 if the
+ * node was deleted as it was left empty, otherwise 0. */
+static int __quicklistDelIndex(quicklist *ql, quicklistNode *node,
+                               unsigned char *p, long pos)
+{
+    if (node->count == 1) {
+        __quicklistDelNode(ql,node);
+        return 1;
+    }
+    node->zl = ziplistDelete(node->zl,&p);
+    node->count--;
+    ql->count--;
+    __quicklistIndexUpdate(ql,node,pos,-1);
+    return 0;
+}
+
+static int __quicklistNodeAllowInsert(quicklist *ql, quicklistNode *node,
+                                      unsigned int sz)
+{
+    if (node == NULL || node->count >= ql->fill) return 0;
+    return ziplistBlobLen(node->zl)+sz <= QUICKLIST_NODE_MAX_BYTES;
+}
+
+static void __quicklistFillEntry(quicklistEntry *entry, quicklistNode *node,
+                                 unsigned char *zi, long offset)
+{
+    entry->node = node;
+    entry->zi = zi;
+    entry->offset = offset;
+    ziplistGet(zi,&entry->value,&entry->sz,&entry->longval);
+}
+
+/* ----------------------------- API implementation ------------------------- */
+
+/* Create a new list holding at most 'fill' elements per node */
+quicklist *quicklistCreate(int fill) {
+    quicklist *ql = _quicklistAlloc(sizeof(*ql));
+
+    ql->head = ql->tail = NULL;
+    ql->count = 0;
+    ql->len = 0;
+    ql->fill = (fill < 1) ? 1 : fill;
+    ql->index = NULL;
+    ql->indexoff = ql->indexsize = 0;
+    ql->indexvalid = 0;
+    return ql;
+}
+
+void quicklistRelease(quicklist *ql) {
+    quicklistNode *node = ql->head, *next;
+
+    while (node) {
+        next = node->next;
+        zfree(node->zl);
+        zfree(node);
+        node = next;
+    }
+    zfree(ql->index);
+    zfree(ql);
+}
+
+/* Add an element at the head or at the tail of the list */
+void quicklistPush(quicklist *ql, unsigned char *s, unsigned int sz, int where) {
+    quicklistNode *node = (where == QUICKLIST_HEAD) ? ql->head : ql->tail;
+
+    if (!__quicklistNodeAllowInsert(ql,node,sz))
+        node = __quicklistAddNode(ql,where);
+    if (where == QUICKLIST_HEAD) {
+        node->zl = ziplistPush(node->zl,s,sz,ZIPLIST_HEAD);
+        __quicklistIndexUpdate(ql,node,0,1);
+    } else {
+        node->zl = ziplistPush(node->zl,s,sz,ZIPLIST_TAIL);
+        __quicklistIndexUpdate(ql,node,node->count,1);
+    }
+    node->count++;
+    ql->count++;
+}
+
+/* Add all the elements of 'zl' at the tail of the list, using the ziplist
+ * itself as a node. The list takes ownership of the ziplist. */
+void quicklistAppendZiplist(quicklist *ql, unsigned char *zl) {
+    unsigned int count = ziplistLen(zl);
+    quicklistNode *node;
+
+    if (count == 0) {
+        zfree(zl);
+        return;
+    }
+    node = __quicklistAddNode(ql,QUICKLIST_TAIL);
+    zfree(node->zl);
+    node->zl = zl;
+    node->count = count;
+    ql->count += count;
+}
+
+/* Lookup the element at 'index', negative indexes starting from the tail.
+ * Returns 0 if the index is out of range, otherwise 1 and 'entry' is
+ * filled with the element. */
+int quicklistIndex(quicklist *ql, long index, quicklistEntry *entry) {
+    quicklistNode *node;
+    unsigned char *zi;
+    long offset;
+
+    if (index < 0) index += ql->count;
+    if (index < 0 || (unsigned long)index >= ql->count) return 0;
+
+    node = __quicklistFindNode(ql,index,&offset);
+    /* Seek from the nearest end of the node */
+    if (offset < (long)node->count/2)
+        zi = ziplistIndex(node->zl,offset);
+    else
+        zi = ziplistIndex(node->zl,offset-(long)node->count);
+    __quicklistFillEntry(entry,node,zi,offset);
+    return 1;
+}
+
+/* Replace the element of 'entry' with the string 's'. The entry is not
+ * valid anymore after this call. */
+void quicklistReplaceEntry(quicklist *ql, quicklistEntry *entry,
+                           unsigned char *s, unsigned int sz)
+{
+    quicklistNode *node = entry->node;
+    unsigned char *p = entry->zi;
+
+    ((void) ql);
+    node->zl = ziplistDelete(node->zl,&p);
+    node->zl = ziplistInsert(node->zl,p,s,sz);
+}
+
+/* Delete 'count' elements starting at 'start', negative indexes starting
+ * from the tail. Nodes entirely in the range are freed without touching
+ * their elements. */
+void quicklistDelRange(quicklist *ql, long start, long count) {
+    quicklistNode *node, *next;
+    long offset, del;
+
+    if (start < 0) start += ql->count;
+    if (start < 0 || (unsigned long)start >= ql->count || count <= 0) return;
+    if ((unsigned long)count > ql->count-start) count = ql->count-start;
+
+    node = __quicklistFindNode(ql,start,&offset);
+    while (count > 0) {
+        next = node->next;
+        del = node->count-offset;
+        if (del > count) del = count;
+        if (del == (long)node->count) {
+            __quicklistDelNode(ql,node);
+        } else {
+            node->zl = ziplistDeleteRange(node->zl,offset,del);
+            node->count -= del;
+            ql->count -= del;
+            __quicklistIndexUpdate(ql,node,offset,-del);
+        }
+        count -= del;
+        offset = 0;
+        node = next;
+    }
+}
+
+/* Return an iterator starting at the element at 'index', negative indexes
+ * starting from the tail. When the index is out of range the iterator
+ * returns no element. */
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *ql, int direction, long index) {
+    quicklistIter *iter = _quicklistAlloc(sizeof(*iter));
+    long offset;
+
+    iter->ql = ql;
+    iter->current = NULL;
+    iter->zi = NULL;
+    iter->offset = 0;
+    iter->direction = direction;
+
+    if (index < 0) index += ql->count;
+    if (index >= 0 && (unsigned long)index < ql->count) {
+        iter->current = __quicklistFindNode(ql,index,&offset);
+        /* Going backward the offset is relative to the tail of the node,
+         * so that it remains valid when elements before it are deleted */
+        if (direction == QUICKLIST_HEAD)
+            offset -= iter->current->count;
+        iter->offset = offset;
+    }
+    return iter;
+}
+
+/* Store the next element in 'entry'. Returns 0 when there are no more
+ * elements. */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+    int forward = iter->direction == QUICKLIST_TAIL;
+
+    while (iter->current) {
+        unsigned char *zl = iter->current->zl;
+
+        if (iter->zi == NULL) {
+            iter->zi = ziplistIndex(zl,iter->offset);
+        } else if (forward) {
+            iter->zi = ziplistNext(zl,iter->zi);
+            iter->offset++;
+        } else {
+            iter->zi = ziplistPrev(zl,iter->zi);
+            iter->offset--;
+        }
+        if (iter->zi) {
+            __quicklistFillEntry(entry,iter->current,iter->zi,iter->offset);
+            return 1;
+        }
+        /* Continue with the first element of the next node */
+        iter->current = forward ? iter->current->next : iter->current->prev;
+        iter->offset = forward ? 0 : -1;
+    }
+    return 0;
+}
+
+/* Delete the element of 'entry', returned by quicklistNext(). The iterator
+ * can be used to continue the iteration. */
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
+    quicklistNode *node = entry->node;
+    quicklistNode *next = (iter->direction == QUICKLIST_TAIL) ?
+                          node->next : node->prev;
+    long pos = (entry->offset < 0) ? node->count+entry->offset : entry->offset;
+
+    if (__quicklistDelIndex(iter->ql,node,entry->zi,pos)) {
+        iter->current = next;
+        iter->offset = (iter->direction == QUICKLIST_TAIL) ? 0 : -1;
+    } else {
+        /* The element that followed the deleted one in the direction of
+         * the iteration now has the same offset */
+        iter->offset = entry->offset;
+    }
+    iter->zi = NULL;
+}
+
+void quicklistReleaseIterator(quicklistIter *iter) {
+    zfree(iter);
+}
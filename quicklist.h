@@ -0,0 +1,76 @@
+/* List made of linked chunks of packed entries.
+ *
+ * A quicklist is a doubly linked list of nodes, every node holding up to
+ * 'fill' elements in a ziplist together with the number of elements it
+ * holds. It has the memory efficiency of ziplists and the O(1) push and
+ * pop at both ends of linked lists.
+ *
+ * Random access uses a skip index: an array with the nodes in order, each
+ * node knowing the position of its first element, so the node holding an
+ * element is found with a binary search and the element is then reached
+ * walking the ziplist from its nearest end. Pushing and popping at the
+ * ends keep the index up to date, while removing elements in the middle
+ * of the list invalidates it, and it is rebuilt on the next lookup.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#ifndef __QUICKLIST_H
+#define __QUICKLIST_H
+
+#define QUICKLIST_HEAD 0
+#define QUICKLIST_TAIL 1
+
+typedef struct quicklistNode {
+    struct quicklistNode *prev;
+    struct quicklistNode *next;
+    unsigned char *zl;
+    unsigned int count;         /* number of elements in zl */
+    long long start;            /* position of the first element */
+} quicklistNode;
+
+typedef struct quicklist {
+    quicklistNode *head;
+    quicklistNode *tail;
+    unsigned long count;        /* total number of elements */
+    unsigned long len;          /* number of nodes */
+    unsigned int fill;          /* max number of elements per node */
+    quicklistNode **index;      /* skip index, see the top comment */
+    unsigned long indexoff;     /* first used slot of the index */
+    unsigned long indexsize;    /* allocated slots of the index */
+    int indexvalid;
+} quicklist;
+
+typedef struct quicklistIter {
+    quicklist *ql;
+    quicklistNode *current;
+    unsigned char *zi;
+    long offset;                /* from the tail of the node if negative */
+    int direction;              /* QUICKLIST_TAIL moves towards the tail */
+} quicklistIter;
+
+typedef struct quicklistEntry {
+    quicklistNode *node;
+    unsigned char *zi;
+    unsigned char *value;       /* NULL when the element is an integer */
+    unsigned int sz;
+    long long longval;
+    long offset;
+} quicklistEntry;
+
+#define quicklistCount(ql) ((ql)->count)
+
+/* API */
+quicklist *quicklistCreate(int fill);
+void quicklistRelease(quicklist *ql);
+void quicklistPush(quicklist *ql, unsigned char *s, unsigned int sz, int where);
+void quicklistAppendZiplist(quicklist *ql, unsigned char *zl);
+int quicklistIndex(quicklist *ql, long index, quicklistEntry *entry);
+void quicklistReplaceEntry(quicklist *ql, quicklistEntry *entry, unsigned char *s, unsigned int sz);
+void quicklistDelRange(quicklist *ql, long start, long count);
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *ql, int direction, long index);
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry);
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry);
+void quicklistReleaseIterator(quicklistIter *iter);
+
+#endif /* __QUICKLIST_H */
@@ -86,15 +86,41 @@ static struct redisCommand cmdTable[] = {
     {"sdiff",-2,REDIS_CMD_INLINE},
     {"sdiffstore",-3,REDIS_CMD_INLINE},
     {"smembers",2,REDIS_CMD_INLINE},
+    {"zadd",4,REDIS_CMD_BULK},
+    {"zincrby",4,REDIS_CMD_BULK},
+    {"zrem",3,REDIS_CMD_BULK},
+    {"zscore",3,REDIS_CMD_BULK},
+    {"zcard",2,REDIS_CMD_INLINE},
+    {"zrank",3,REDIS_CMD_BULK},
+    {"zrevrank",3,REDIS_CMD_BULK},
+    {"zrange",-4,REDIS_CMD_INLINE},
+    {"zrevrange",-4,REDIS_CMD_INLINE},
+    {"zrangebyscore",-4,REDIS_CMD_INLINE},
+    {"zcount",4,REDIS_CMD_INLINE},
+    {"zremrangebyscore",4,REDIS_CMD_INLINE},
+    {"zremrangebyrank",4,REDIS_CMD_INLINE},
+    {"hset",4,REDIS_CMD_BULK},
+    {"hget",3,REDIS_CMD_BULK},
+    {"hmget",-3,REDIS_CMD_INLINE},
+    {"hgetall",2,REDIS_CMD_INLINE},
+    {"hincrby",4,REDIS_CMD_INLINE},
+    {"hdel",3,REDIS_CMD_BULK},
+    {"hlen",2,REDIS_CMD_INLINE},
+    {"hexists",3,REDIS_CMD_BULK},
     {"incrby",3,REDIS_CMD_INLINE},
     {"decrby",3,REDIS_CMD_INLINE},
     {"getset",3,REDIS_CMD_BULK},
+    {"setbit",4,REDIS_CMD_INLINE},
+    {"getbit",3,REDIS_CMD_INLINE},
+    {"bitcount",-2,REDIS_CMD_INLINE},
+    {"bitop",-4,REDIS_CMD_INLINE},
     {"randomkey",1,REDIS_CMD_INLINE},
     {"select",2,REDIS_CMD_INLINE},
     {"move",3,REDIS_CMD_INLINE},
     {"rename",3,REDIS_CMD_INLINE},
     {"renamenx",3,REDIS_CMD_INLINE},
     {"keys",2,REDIS_CMD_INLINE},
+    {"scan",-2,REDIS_CMD_INLINE},
     {"dbsize",1,REDIS_CMD_INLINE},
     {"ping",1,REDIS_CMD_INLINE},
     {"echo",2,REDIS_CMD_BULK},
@@ -48,13 +48,22 @@
 #include <fcntl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "ae.h"     /* Event driven programming library */
 #include "sds.h"    /* Dynamic safe strings */
 #include "anet.h"   /* Networking the easy way */
 #include "dict.h"   /* Hash tables */
 #include "adlist.h" /* Linked lists */
+#include "ziplist.h" /* Compact lists */
+#include "quicklist.h" /* Lists of ziplists */
+#include "intset.h"  /* Compact integer sets */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "lzf.h"    /* LZF compression library */
 #include "pqsort.h" /* Partial qsort for SORT+LIMIT */
@@ -66,7 +75,7 @@
 /* Static server configuration */
 #define REDIS_SERVERPORT        6379    /* TCP port */
 #define REDIS_MAXIDLETIME       (60*5)  /* default client timeout */
-#define REDIS_IOBUF_LEN         1024
+#define REDIS_IOBUF_LEN         (1024*16)
 #define REDIS_LOADBUF_LEN       1024
 #define REDIS_STATIC_ARGS       4
 #define REDIS_DEFAULT_DBNUM     16
@@ -74,11 +83,36 @@
 #define REDIS_OBJFREELIST_MAX   1000000 /* Max number of objects to cache */
 #define REDIS_MAX_SYNC_TIME     60      /* Slave can't take more to sync */
 #define REDIS_EXPIRELOOKUPS_PER_CRON    100 /* try to expire 100 keys/second */
+#define REDIS_IOTHREADS_MAX     128     /* Max number of I/O threads */
+#define REDIS_INLINE_MAX_SIZE   (1024*32) /* Max size of inline reads */
+#define REDIS_MBULK_BIG_ARG     (1024*32) /* Read in place from this size */
+#define REDIS_MBULK_MAX_ARGS    (1024*1024) /* Max arguments of a request */
+#define REDIS_MBULK_PREALLOC_ARGS 1024  /* argv slots allocated upfront */
+#define REDIS_SCAN_MAX_COUNT    1000    /* Max COUNT of a SCAN call */
+#define REDIS_REPLY_CHUNK_BYTES (1024*16) /* Static reply buffer size */
+#define REDIS_SEND_MAX_BYTES    (1024*64) /* Max bytes submitted at once */
+#define REDIS_SHARED_BULKHDR_LEN 32     /* Shared "$<len>" and "*<len>" */
+#define REDIS_LONGSTR_SIZE      21      /* Bytes to hold a long long */
+#define REDIS_SHARED_INTEGERS   10000   /* Shared integer values 0-9999 */
+#define REDIS_LIST_MAX_ZIPLIST_ENTRIES 128 /* Max elements of a ziplist */
+#define REDIS_LIST_MAX_ZIPLIST_VALUE 64 /* Max element size in a ziplist */
+#define REDIS_HASH_MAX_ZIPLIST_ENTRIES 128 /* Max fields of a ziplist hash */
+#define REDIS_HASH_MAX_ZIPLIST_VALUE 64 /* Max field/value size in a ziplist */
+#define REDIS_SET_MAX_INTSET_ENTRIES 512 /* Max members of an intset set */
+#ifdef IOV_MAX
+#define REDIS_WRITEV_MAX        (IOV_MAX < 1024 ? IOV_MAX : 1024)
+#else
+#define REDIS_WRITEV_MAX        16      /* The minimum POSIX allows */
+#endif
 
 /* Hash table parameters */
 #define REDIS_HT_MINFILL        10      /* Minimal hash table fill 10% */
 #define REDIS_HT_MINSLOTS       16384   /* Never resize the HT under this */
 
+/* Client request types */
+#define REDIS_REQ_INLINE        1
+#define REDIS_REQ_MULTIBULK     2
+
 /* Command flags */
 #define REDIS_CMD_BULK          1
 #define REDIS_CMD_INLINE        2
@@ -87,7 +121,36 @@
 #define REDIS_STRING 0
 #define REDIS_LIST 1
 #define REDIS_SET 2
-#define REDIS_HASH 3
+#define REDIS_ZSET 3
+#define REDIS_HASH 4
+
+/* Object encodings. String values that are the canonical representation
+ * of an integer fitting in a long are stored directly in the 'ptr' field
+ * of the object, using the INT encoding. Short strings are allocated
+ * together with the object, 'ptr' pointing to an sds right after it.
+ * Small lists are packed in a ziplist, and converted to a quicklist, a
+ * linked list of ziplists, when they grow. Small hashes are packed in a
+ * ziplist of field/value pairs, and converted to a dict when they grow.
+ * Sets of integers are stored in an intset, a sorted array of integers,
+ * and converted to a dict when they grow or get a non integer member. */
+#define REDIS_ENCODING_RAW 0    /* Raw representation, ptr is an sds */
+#define REDIS_ENCODING_INT 1    /* Encoded as integer, ptr is a long */
+#define REDIS_ENCODING_EMBSTR 2 /* Embedded sds, read only */
+#define REDIS_ENCODING_ZIPLIST 3 /* List packed in a ziplist */
+#define REDIS_ENCODING_QUICKLIST 4 /* List of ziplists, ptr is a quicklist */
+#define REDIS_ENCODING_HT 5     /* Hash table, ptr is a dict */
+#define REDIS_ENCODING_INTSET 6 /* Sorted integers, ptr is an intset */
+
+static char *strencoding[] = {
+    "raw", "int", "embstr", "ziplist", "quicklist", "hashtable", "intset"
+};
+
+/* Strings up to this length are embedded: the object, the sds header, the
+ * string and the null term fit in 64 bytes. */
+#define REDIS_EMBSTR_SIZE_LIMIT (64-sizeof(robj)-sizeof(struct sdshdr8)-1)
+
+#define sdsEncodedObject(o) ((o)->encoding == REDIS_ENCODING_RAW || \
+                             (o)->encoding == REDIS_ENCODING_EMBSTR)
 
 /* Object types only used for dumping to disk */
 #define REDIS_EXPIRETIME 253
@@ -126,6 +189,21 @@
 #define REDIS_SLAVE 2       /* This client is a slave server */
 #define REDIS_MASTER 4      /* This client is a master server */
 #define REDIS_MONITOR 8      /* This client is a slave monitor, see MONITOR */
+#define REDIS_PENDING_READ 16   /* Queued for reading by the I/O threads */
+#define REDIS_PENDING_WRITE 32  /* Queued for writing by the I/O threads */
+#define REDIS_PENDING_COMMAND 64 /* argv was parsed by an I/O thread */
+#define REDIS_SEND_INFLIGHT 128 /* Replies submitted to the event loop */
+
+/* Result of the last socket operation performed on behalf of a client,
+ * see readClientSocket() and writeClientSocket() */
+#define REDIS_IO_OK 0       /* No error */
+#define REDIS_IO_CLOSED 1   /* The client closed the connection */
+#define REDIS_IO_ERR 2      /* Read or write error, see the ioerrno field */
+#define REDIS_IO_PROTOERR 3 /* Protocol error */
+
+/* Kind of job assigned to the I/O threads */
+#define REDIS_IOJOB_READ 0
+#define REDIS_IOJOB_WRITE 1
 
 /* Slave replication state - slave side */
 #define REDIS_REPL_NONE 0   /* No active replication */
@@ -167,7 +245,8 @@
 /* A redis object, that is a type able to hold a string / list / set */
 typedef struct redisObject {
     void *ptr;
-    int type;
+    unsigned char type;
+    unsigned char encoding;
     int refcount;
 } robj;
 
@@ -184,11 +263,17 @@ typedef struct redisClient {
     redisDb *db;
     int dictid;
     sds querybuf;
+    size_t qb_pos;          /* current parsing position in querybuf */
     robj **argv;
     int argc;
+    int argvlen;            /* allocated slots of argv */
+    struct redisCommand *cmd; /* command looked up, while reading its bulk */
     int bulklen;            /* bulk read len. -1 if not in bulk read mode */
+    int reqtype;            /* REDIS_REQ_* type of the request being read */
+    int multibulklen;       /* number of multi bulk arguments left to read */
+    long mbbulklen;         /* length of the multi bulk argument being read */
     list *reply;
-    int sentlen;
+    int sentlen;            /* bytes sent of c->buf, or of the first reply */
     time_t lastinteraction; /* time of the last interaction, used for timeout */
     int flags;              /* REDIS_CLOSE | REDIS_SLAVE | REDIS_MONITOR */
     int slaveseldb;         /* slave selected db, if this client is a slave */
@@ -197,6 +282,14 @@ typedef struct redisClient {
     int repldbfd;           /* replication DB file descriptor */
     long repldboff;          /* replication DB file offset */
     off_t repldbsize;       /* replication DB file size */
+    int iostatus;           /* REDIS_IO_* status of the last read or write */
+    int ioerrno;            /* errno when iostatus is REDIS_IO_ERR */
+    int iosent;             /* replies fully written by the last write */
+    listNode *pendingreadnode;  /* node in server.clients_pending_read */
+    listNode *pendingwritenode; /* node in server.clients_pending_write */
+    /* Small replies are copied here while the reply list is empty */
+    int bufpos;
+    char buf[REDIS_REPLY_CHUNK_BYTES];
 } redisClient;
 
 struct saveparam {
@@ -210,6 +303,7 @@ struct redisServer {
     int fd;
     redisDb *db;
     dict *sharingpool;
+    dict *commands;             /* Command table, indexed by name */
     unsigned int sharingpoolsize;
     long long dirty;            /* changes to DB from the last save */
     list *clients;
@@ -226,7 +320,7 @@ struct redisServer {
     long long stat_numconnections; /* number of connections received */
     /* Configuration */
     int verbosity;
-    int glueoutputbuf;
+    int glueoutputbuf;          /* No longer used, replies use writev() */
     int maxidletime;
     int dbnum;
     int daemonize;
@@ -239,6 +333,11 @@ struct redisServer {
     char *dbfilename;
     char *requirepass;
     int shareobjects;
+    size_t list_max_ziplist_entries;
+    size_t list_max_ziplist_value;
+    size_t hash_max_ziplist_entries;
+    size_t hash_max_ziplist_value;
+    size_t set_max_intset_entries;
     /* Replication related */
     int isslave;
     char *masterhost;
@@ -251,6 +350,12 @@ struct redisServer {
     int sort_desc;
     int sort_alpha;
     int sort_bypattern;
+    /* Threaded I/O */
+    int iothreads;              /* Number of I/O threads, main one included */
+    int iothreadsbusy;          /* True while the I/O threads are working */
+    list *clients_pending_read; /* Clients with data to read and parse */
+    list *clients_pending_write; /* Clients with replies to write */
+    int iocompletion;           /* Client I/O is performed by the event loop */
 };
 
 typedef void redisCommandProc(redisClient *c);
@@ -274,13 +379,81 @@ typedef struct _redisSortOperation {
     robj *pattern;
 } redisSortOperation;
 
+/* List iterator, hiding the encoding of the list */
+typedef struct listTypeIterator {
+    robj *subject;
+    unsigned char encoding;
+    unsigned char direction;    /* REDIS_HEAD or REDIS_TAIL */
+    unsigned char *zi;          /* Next ziplist entry */
+    quicklistIter *qi;
+} listTypeIterator;
+
+/* Current element of a list iterator */
+typedef struct listTypeEntry {
+    listTypeIterator *li;
+    unsigned char *zi;
+    quicklistEntry qe;
+} listTypeEntry;
+
+/* Sorted sets are a skiplist ordered by score, then by member, and a dict
+ * mapping every member to its score. Every link of the skiplist stores the
+ * number of elements it jumps over (its span), so that the rank of an
+ * element, or the element at a given rank, is found in O(log N). */
+#define ZSKIPLIST_MAXLEVEL 32   /* Should be enough for 2^32 elements */
+#define ZSKIPLIST_P 0.25        /* Skiplist P = 1/4 */
+
+typedef struct zskiplistNode {
+    robj *obj;
+    double score;
+    struct zskiplistNode *backward;
+    struct zskiplistLevel {
+        struct zskiplistNode *forward;
+        unsigned long span;
+    } level[];
+} zskiplistNode;
+
+typedef struct zskiplist {
+    struct zskiplistNode *header, *tail;
+    unsigned long length;
+    int level;
+} zskiplist;
+
+/* The dict values point to the score stored in the skiplist node, the
+ * member objects are owned by the skiplist. */
+typedef struct zset {
+    dict *dict;
+    zskiplist *zsl;
+} zset;
+
+/* Hash iterator, hiding the encoding of the hash */
+typedef struct hashTypeIterator {
+    robj *subject;
+    int encoding;
+    unsigned char *fptr, *vptr; /* Current field and value in the ziplist */
+    dictIterator *di;
+    dictEntry *de;
+} hashTypeIterator;
+
+#define REDIS_HASH_KEY 1
+#define REDIS_HASH_VALUE 2
+
+/* Set iterator, hiding the encoding of the set */
+typedef struct setTypeIterator {
+    robj *subject;
+    int encoding;
+    uint32_t ii;                /* Current position in the intset */
+    dictIterator *di;
+} setTypeIterator;
+
 struct sharedObjectsStruct {
     robj *crlf, *ok, *err, *emptybulk, *czero, *cone, *pong, *space,
     *colon, *nullbulk, *nullmultibulk,
     *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
     *outofrangeerr, *plus,
     *select0, *select1, *select2, *select3, *select4,
-    *select5, *select6, *select7, *select8, *select9;
+    *select5, *select6, *select7, *select8, *select9,
+    *bulkhdr[REDIS_SHARED_BULKHDR_LEN], *mbulkhdr[REDIS_SHARED_BULKHDR_LEN],
+    *integers[REDIS_SHARED_INTEGERS];
 } shared;
 
 /*================================ Prototypes =============================== */
@@ -288,18 +461,44 @@ struct sharedObjectsStruct {
 static void freeStringObject(robj *o);
 static void freeListObject(robj *o);
 static void freeSetObject(robj *o);
+static void freeZsetObject(robj *o);
 static void decrRefCount(void *o);
 static robj *createObject(int type, void *ptr);
 static void freeClient(redisClient *c);
 static int rdbLoad(char *filename);
+static int clientHasPendingReplies(redisClient *c);
 static void addReply(redisClient *c, robj *obj);
 static void addReplySds(redisClient *c, sds s);
+static void addReplyString(redisClient *c, char *s, size_t len);
 static void incrRefCount(robj *o);
 static int rdbSaveBackground(char *filename);
 static robj *createStringObject(char *ptr, size_t len);
 static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int dictid, robj **argv, int argc);
 static int syncWithMaster(void);
 static robj *tryObjectSharing(robj *o);
+static robj *createStringObjectFromLongLong(long long value);
+static robj *tryObjectEncoding(robj *o);
+static robj *getDecodedObject(robj *o);
+static void listTypePush(robj *subject, robj *value, int where);
+static unsigned long listTypeLength(robj *subject);
+static listTypeIterator *listTypeInitIterator(robj *subject, int index, unsigned char direction);
+static int listTypeNext(listTypeIterator *li, listTypeEntry *entry);
+static robj *listTypeGet(listTypeEntry *entry);
+static void listTypeReleaseIterator(listTypeIterator *li);
+static zskiplist *zslCreate(void);
+static void zslFree(zskiplist *zsl);
+static zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj);
+static void hashTypeConvert(robj *o, int enc);
+static unsigned long hashTypeLength(robj *o);
+static hashTypeIterator *hashTypeInitIterator(robj *subject);
+static int hashTypeNext(hashTypeIterator *hi);
+static robj *hashTypeCurrent(hashTypeIterator *hi, int what);
+static void hashTypeReleaseIterator(hashTypeIterator *hi);
+static int setTypeAdd(robj *o, robj *value);
+static unsigned long setTypeSize(robj *o);
+static setTypeIterator *setTypeInitIterator(robj *subject);
+static robj *setTypeNext(setTypeIterator *si);
+static void setTypeReleaseIterator(setTypeIterator *si);
 static int removeExpire(redisDb *db, robj *key);
 static int expireIfNeeded(redisDb *db, robj *key);
 static int deleteIfVolatile(redisDb *db, robj *key);
@@ -307,6 +506,10 @@ static int deleteKey(redisDb *db, robj *key);
 static time_t getExpire(redisDb *db, robj *key);
 static int setExpire(redisDb *db, robj *key, time_t when);
 static void updateSalvesWaitingBgsave(int bgsaveerr);
+static void initIOThreads(void);
+static void beforeSleep(aeEventLoop *eventLoop);
+static void acceptCompletion(aeEventLoop *el, int fd, void *privdata, char *buf, int res);
+static void populateCommandTable(void);
 
 static void authCommand(redisClient *c);
 static void pingCommand(redisClient *c);
@@ -320,9 +523,14 @@ static void incrCommand(redisClient *c);
 static void decrCommand(redisClient *c);
 static void incrbyCommand(redisClient *c);
 static void decrbyCommand(redisClient *c);
+static void setbitCommand(redisClient *c);
+static void getbitCommand(redisClient *c);
+static void bitcountCommand(redisClient *c);
+static void bitopCommand(redisClient *c);
 static void selectCommand(redisClient *c);
 static void randomkeyCommand(redisClient *c);
 static void keysCommand(redisClient *c);
+static void scanCommand(redisClient *c);
 static void dbsizeCommand(redisClient *c);
 static void lastsaveCommand(redisClient *c);
 static void saveCommand(redisClient *c);
@@ -352,6 +560,27 @@ static void sunionCommand(redisClient *c);
 static void sunionstoreCommand(redisClient *c);
 static void sdiffCommand(redisClient *c);
 static void sdiffstoreCommand(redisClient *c);
+static void zaddCommand(redisClient *c);
+static void zincrbyCommand(redisClient *c);
+static void zremCommand(redisClient *c);
+static void zscoreCommand(redisClient *c);
+static void zcardCommand(redisClient *c);
+static void zrankCommand(redisClient *c);
+static void zrevrankCommand(redisClient *c);
+static void zrangeCommand(redisClient *c);
+static void zrevrangeCommand(redisClient *c);
+static void zrangebyscoreCommand(redisClient *c);
+static void zcountCommand(redisClient *c);
+static void zremrangebyscoreCommand(redisClient *c);
+static void zremrangebyrankCommand(redisClient *c);
+static void hsetCommand(redisClient *c);
+static void hgetCommand(redisClient *c);
+static void hmgetCommand(redisClient *c);
+static void hgetallCommand(redisClient *c);
+static void hincrbyCommand(redisClient *c);
+static void hdelCommand(redisClient *c);
+static void hlenCommand(redisClient *c);
+static void hexistsCommand(redisClient *c);
 static void syncCommand(redisClient *c);
 static void flushdbCommand(redisClient *c);
 static void flushallCommand(redisClient *c);
@@ -364,6 +593,7 @@ static void expireCommand(redisClient *c);
 static void getSetCommand(redisClient *c);
 static void ttlCommand(redisClient *c);
 static void slaveofCommand(redisClient *c);
+static void debugCommand(redisClient *c);
 
 /*================================= Globals ================================= */
 
@@ -400,9 +630,34 @@ static struct redisCommand cmdTable[] = {
     {"sdiff",sdiffCommand,-2,REDIS_CMD_INLINE},
     {"sdiffstore",sdiffstoreCommand,-3,REDIS_CMD_INLINE},
     {"smembers",sinterCommand,2,REDIS_CMD_INLINE},
+    {"zadd",zaddCommand,4,REDIS_CMD_BULK},
+    {"zincrby",zincrbyCommand,4,REDIS_CMD_BULK},
+    {"zrem",zremCommand,3,REDIS_CMD_BULK},
+    {"zscore",zscoreCommand,3,REDIS_CMD_BULK},
+    {"zcard",zcardCommand,2,REDIS_CMD_INLINE},
+    {"zrank",zrankCommand,3,REDIS_CMD_BULK},
+    {"zrevrank",zrevrankCommand,3,REDIS_CMD_BULK},
+    {"zrange",zrangeCommand,-4,REDIS_CMD_INLINE},
+    {"zrevrange",zrevrangeCommand,-4,REDIS_CMD_INLINE},
+    {"zrangebyscore",zrangebyscoreCommand,-4,REDIS_CMD_INLINE},
+    {"zcount",zcountCommand,4,REDIS_CMD_INLINE},
+    {"zremrangebyscore",zremrangebyscoreCommand,4,REDIS_CMD_INLINE},
+    {"zremrangebyrank",zremrangebyrankCommand,4,REDIS_CMD_INLINE},
+    {"hset",hsetCommand,4,REDIS_CMD_BULK},
+    {"hget",hgetCommand,3,REDIS_CMD_BULK},
+    {"hmget",hmgetCommand,-3,REDIS_CMD_INLINE},
+    {"hgetall",hgetallCommand,2,REDIS_CMD_INLINE},
+    {"hincrby",hincrbyCommand,4,REDIS_CMD_INLINE},
+    {"hdel",hdelCommand,3,REDIS_CMD_BULK},
+    {"hlen",hlenCommand,2,REDIS_CMD_INLINE},
+    {"hexists",hexistsCommand,3,REDIS_CMD_BULK},
     {"incrby",incrbyCommand,3,REDIS_CMD_INLINE},
     {"decrby",decrbyCommand,3,REDIS_CMD_INLINE},
     {"getset",getSetCommand,3,REDIS_CMD_BULK},
+    {"setbit",setbitCommand,4,REDIS_CMD_INLINE},
+    {"getbit",getbitCommand,3,REDIS_CMD_INLINE},
+    {"bitcount",bitcountCommand,-2,REDIS_CMD_INLINE},
+    {"bitop",bitopCommand,-4,REDIS_CMD_INLINE},
     {"randomkey",randomkeyCommand,1,REDIS_CMD_INLINE},
     {"select",selectCommand,2,REDIS_CMD_INLINE},
     {"move",moveCommand,3,REDIS_CMD_INLINE},
@@ -410,6 +665,7 @@ static struct redisCommand cmdTable[] = {
     {"renamenx",renamenxCommand,3,REDIS_CMD_INLINE},
     {"expire",expireCommand,3,REDIS_CMD_INLINE},
     {"keys",keysCommand,2,REDIS_CMD_INLINE},
+    {"scan",scanCommand,-2,REDIS_CMD_INLINE},
     {"dbsize",dbsizeCommand,1,REDIS_CMD_INLINE},
     {"auth",authCommand,2,REDIS_CMD_INLINE},
     {"ping",pingCommand,1,REDIS_CMD_INLINE},
@@ -427,6 +683,7 @@ static struct redisCommand cmdTable[] = {
     {"monitor",monitorCommand,1,REDIS_CMD_INLINE},
     {"ttl",ttlCommand,2,REDIS_CMD_INLINE},
     {"slaveof",slaveofCommand,3,REDIS_CMD_INLINE},
+    {"debug",debugCommand,-2,REDIS_CMD_INLINE},
     {NULL,NULL,0,0}
 };
 
@@ -555,6 +812,57 @@ int stringmatchlen(const char *pattern, int patternLen,
     return 0;
 }
 
+/* Convert a long long into a string, without the overhead of snprintf().
+ * Two digits are emitted at a time using a lookup table. Returns the
+ * length of the string, or 0 if the buffer is too small. */
+static int ll2string(char *s, size_t len, long long value) {
+    static const char digits[201] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char buf[REDIS_LONGSTR_SIZE], *p = buf+sizeof(buf);
+    unsigned long long v;
+    size_t l;
+
+    v = (value < 0) ? -(unsigned long long)value : (unsigned long long)value;
+    while(v >= 100) {
+        int i = (v % 100)*2;
+
+        v /= 100;
+        *--p = digits[i+1];
+        *--p = digits[i];
+    }
+    if (v < 10) {
+        *--p = '0'+v;
+    } else {
+        *--p = digits[v*2+1];
+        *--p = digits[v*2];
+    }
+    if (value < 0) *--p = '-';
+    l = buf+sizeof(buf)-p;
+    if (l >= len) return 0;
+    memcpy(s,p,l);
+    s[l] = '\0';
+    return l;
+}
+
+/* Fill 'p' with 'len' random bytes from /dev/urandom. If it is not
+ * available we fall back to a weaker source based on the time and pid. */
+static void getRandomBytes(unsigned char *p, size_t len) {
+    FILE *fp = fopen("/dev/urandom","r");
+    size_t j;
+
+    if (fp && fread(p,len,1,fp) == 1) {
+        fclose(fp);
+        return;
+    }
+    if (fp) fclose(fp);
+    srandom(time(NULL)^getpid());
+    for (j = 0; j < len; j++) p[j] = random() & 0xff;
+}
+
 void redisLog(int level, const char *fmt, ...)
 {
     va_list ap;
@@ -627,6 +935,38 @@ static dictType setDictType = {
     NULL                       /* val destructor */
 };
 
+/* Command names are matched case insensitively */
+static int dictSdsKeyCaseCompare(void *privdata, const void *key1,
+        const void *key2)
+{
+    DICT_NOTUSED(privdata);
+
+    return strcasecmp(key1, key2) == 0;
+}
+
+static unsigned int dictSdsCaseHash(const void *key) {
+    return dictGenCaseHashFunction(key, sdslen((sds)key));
+}
+
+static dictType commandTableDictType = {
+    dictSdsCaseHash,           /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCaseCompare,     /* key compare */
+    NULL,                      /* key destructor */
+    NULL                       /* val destructor */
+};
+
+/* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
+static dictType zsetDictType = {
+    dictSdsHash,               /* hash function */
+    NULL,                      /* key dup */
+    NULL,                      /* val dup */
+    dictSdsKeyCompare,         /* key compare */
+    NULL,                      /* key destructor, the skiplist owns it */
+    NULL                       /* val destructor */
+};
+
 static dictType hashDictType = {
     dictSdsHash,                /* hash function */
     NULL,                       /* key dup */
@@ -684,11 +1024,25 @@ void tryResizeHashTables(void) {
             (used*100/size < REDIS_HT_MINFILL)) {
             redisLog(REDIS_NOTICE,"The hash table %d is too sparse, resize it...",j);
             dictResize(server.db[j].dict);
-            redisLog(REDIS_NOTICE,"Hash table %d resized.",j);
         }
     }
 }
 
+/* The tables are rehashed incrementally, a bucket at a time, by every
+ * lookup or update. Here we also spend a millisecond of CPU for every DB
+ * that is being rehashed, so that idle tables don't keep two tables
+ * allocated forever. */
+static void incrementallyRehash(void) {
+    int j;
+
+    for (j = 0; j < server.dbnum; j++) {
+        if (dictIsRehashing(server.db[j].dict))
+            dictRehashMilliseconds(server.db[j].dict,1);
+        if (dictIsRehashing(server.db[j].expires))
+            dictRehashMilliseconds(server.db[j].expires,1);
+    }
+}
+
 int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     int j, loops = server.cronloops++;
     REDIS_NOTUSED(eventLoop);
@@ -717,7 +1071,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
      * if we resize the HT while there is the saving child at work actually
      * a lot of memory movements in the parent will cause a lot of pages
      * copied. */
-    if (!server.bgsaveinprogress) tryResizeHashTables();
+    if (!server.bgsaveinprogress) {
+        tryResizeHashTables();
+        incrementallyRehash();
+    }
 
     /* Show information about connected clients */
     if (!(loops % 5)) {
@@ -748,6 +1105,7 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
                     "Background saving error");
             }
             server.bgsaveinprogress = 0;
+            dictEnableResize();
             updateSalvesWaitingBgsave(exitcode == 0 ? REDIS_OK : REDIS_ERR);
         }
     } else {
@@ -801,6 +1159,8 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 }
 // 创建共享的对象（数据）
 static void createSharedObjects(void) {
+    int j;
+
     shared.crlf = createObject(REDIS_STRING,sdsnew("\r\n"));
     shared.ok = createObject(REDIS_STRING,sdsnew("+OK\r\n"));
     shared.err = createObject(REDIS_STRING,sdsnew("-ERR\r\n"));
@@ -835,6 +1195,17 @@ static void createSharedObjects(void) {
     shared.select7 = createStringObject("select 7\r\n",10);
     shared.select8 = createStringObject("select 8\r\n",10);
     shared.select9 = createStringObject("select 9\r\n",10);
+    for (j = 0; j < REDIS_SHARED_BULKHDR_LEN; j++) {
+        shared.bulkhdr[j] = createObject(REDIS_STRING,
+            sdscatprintf(sdsempty(),"$%d\r\n",j));
+        shared.mbulkhdr[j] = createObject(REDIS_STRING,
+            sdscatprintf(sdsempty(),"*%d\r\n",j));
+    }
+    /* Small integer values are never allocated, see tryObjectEncoding() */
+    for (j = 0; j < REDIS_SHARED_INTEGERS; j++) {
+        shared.integers[j] = createObject(REDIS_STRING,(void*)(long)j);
+        shared.integers[j]->encoding = REDIS_ENCODING_INT;
+    }
 }
 
 static void appendServerSaveParams(time_t seconds, int changes) {
@@ -868,7 +1239,13 @@ static void initServerConfig() {
     server.dbfilename = "dump.rdb";
     server.requirepass = NULL;
     server.shareobjects = 0;
+    server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
+    server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.hash_max_ziplist_entries = REDIS_HASH_MAX_ZIPLIST_ENTRIES;
+    server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
+    server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
     server.maxclients = 0;
+    server.iothreads = 1;
     ResetServerSaveParams();
 
     appendServerSaveParams(60*60,1);  /* save after 1 hour and 1 change */
@@ -892,12 +1269,17 @@ static void initServer() {
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.objfreelist = listCreate();
+    server.clients_pending_read = listCreate();
+    server.clients_pending_write = listCreate();
+    server.iothreadsbusy = 0;
     createSharedObjects();
     server.el = aeCreateEventLoop();
     server.db = zmalloc(sizeof(redisDb)*server.dbnum);
     server.sharingpool = dictCreate(&setDictType,NULL);
     server.sharingpoolsize = 1024;
-    if (!server.db || !server.clients || !server.slaves || !server.monitors || !server.el || !server.objfreelist)
+    populateCommandTable();
+    if (!server.db || !server.clients || !server.slaves || !server.monitors || !server.el || !server.objfreelist ||
+        !server.clients_pending_read || !server.clients_pending_write)
         oom("server initialization"); /* Fatal OOM */
     // 启动服务器，保存返回的文件描述符
     server.fd = anetTcpServer(server.neterr, server.port, server.bindaddr);
@@ -905,6 +1287,16 @@ static void initServer() {
         redisLog(REDIS_WARNING, "Opening TCP port: %s", server.neterr);
         exit(1);
     }
+    /* If the event loop can perform the I/O itself, accept the clients
+     * this way, and their sockets are then read and written this way too.
+     * Otherwise acceptHandler() is registered by main(). */
+    if (aeSubmitAccept(server.el,server.fd,acceptCompletion,NULL) == AE_OK) {
+        server.iocompletion = 1;
+        if (server.iothreads > 1) {
+            redisLog(REDIS_NOTICE,"The I/O is performed by the event loop, io-threads is ignored");
+            server.iothreads = 1;
+        }
+    }
     // 初始化db
     for (j = 0; j < server.dbnum; j++) {
         server.db[j].dict = dictCreate(&hashDictType,NULL);
@@ -920,6 +1312,9 @@ static void initServer() {
     server.stat_numconnections = 0;
     server.stat_starttime = time(NULL);
     aeCreateTimeEvent(server.el, 1000, serverCron, NULL, NULL);
+    if (server.iothreads > 1) initIOThreads();
+    if (server.iothreads > 1 || server.iocompletion)
+        aeSetBeforeSleepProc(server.el,beforeSleep);
 }
 
 /* Empty the whole database */
@@ -1054,6 +1449,21 @@ static void loadServerConfig(char *filename) {
           server.pidfile = zstrdup(argv[1]);
         } else if (!strcasecmp(argv[0],"dbfilename") && argc == 2) {
           server.dbfilename = zstrdup(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-max-ziplist-entries") && argc == 2) {
+            server.list_max_ziplist_entries = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"list-max-ziplist-value") && argc == 2) {
+            server.list_max_ziplist_value = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"hash-max-ziplist-entries") && argc == 2) {
+            server.hash_max_ziplist_entries = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"hash-max-ziplist-value") && argc == 2) {
+            server.hash_max_ziplist_value = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"set-max-intset-entries") && argc == 2) {
+            server.set_max_intset_entries = atoi(argv[1]);
+        } else if (!strcasecmp(argv[0],"io-threads") && argc == 2) {
+            server.iothreads = atoi(argv[1]);
+            if (server.iothreads < 1 || server.iothreads > REDIS_IOTHREADS_MAX) {
+                err = "Invalid number of I/O threads"; goto loaderr;
+            }
         } else {
             err = "Bad directive or wrong number of arguments"; goto loaderr;
         }
@@ -1086,6 +1496,7 @@ static void freeClient(redisClient *c) {
     // 撤销注册的事件
     aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
     aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+    aeCancelIo(server.el,c->fd);
     // 释放保存的客户端数据
     sdsfree(c->querybuf);
     // 释放缓存的回复
@@ -1098,6 +1509,12 @@ static void freeClient(redisClient *c) {
     assert(ln != NULL);
     // 从链表中删除该client
     listDelNode(server.clients,ln);
+    /* The queues of the I/O threads may be long, so the client remembers
+     * its node in them and is unlinked in O(1) */
+    if (c->flags & REDIS_PENDING_READ)
+        listDelNode(server.clients_pending_read,c->pendingreadnode);
+    if (c->flags & REDIS_PENDING_WRITE)
+        listDelNode(server.clients_pending_write,c->pendingwritenode);
     if (c->flags & REDIS_SLAVE) {
         if (c->replstate == REDIS_REPL_SEND_BULK && c->repldbfd != -1)
             close(c->repldbfd);
@@ -1114,108 +1531,233 @@ static void freeClient(redisClient *c) {
     zfree(c->argv);
     zfree(c);
 }
-// 聚合reply的内容，即把多个小的聚合到一个大的redisObj
-static void glueReplyBuffersIfNeeded(redisClient *c) {
-    int totlen = 0;
-    listNode *ln;
-    robj *o;
-    // 重置迭代指针
-    listRewind(c->reply);
-    // 计算聚合后的大小，达到阈值则不聚合，最大1024
-    while((ln = listYield(c->reply))) {
-        o = ln->value;
-        totlen += sdslen(o->ptr);
-        /* This optimization makes more sense if we don't have to copy
-         * too much data */
-        if (totlen > 1024) return;
-    }
-    if (totlen > 0) {
-        // 保存聚合后的数据
-        char buf[1024];
-        int copylen = 0;
-
-        listRewind(c->reply);
-        // 遍历每个reply，开始聚合
-        while((ln = listYield(c->reply))) {
-            o = ln->value;
-            // 逐个reply复制到buf
-            memcpy(buf+copylen,o->ptr,sdslen(o->ptr));
-            // 第一个可用的内存地址
-            copylen += sdslen(o->ptr);
-            // 聚合完则从队列中删除
-            listDelNode(c->reply,ln);
-        }
-        /* Now the output buffer is empty, add the new single element */
-        // 聚合后创建一个redisObj保存聚合的内容
-        o = createObject(REDIS_STRING,sdsnewlen(buf,totlen));
-        // 聚合后重新追加到reply队列
-        if (!listAddNodeTail(c->reply,o)) oom("listAddNodeTail");
+/* Write as much as possible of the static buffer and of the reply list
+ * to the client socket. Up to REDIS_WRITEV_MAX reply objects are sent with
+ * a single writev(2), so that replies made of many small objects (multi
+ * bulk replies have a length, a value and a CRLF for every element) need
+ * just a few system calls.
+ *
+ * The objects sent are not released here since this is also called by
+ * the I/O threads: the number of objects fully sent is stored in
+ * c->iosent, and c->sentlen is updated with the bytes already sent of the
+ * static buffer, or of the next object once the buffer is empty. */
+static void writeClientSocket(redisClient *c) {
+    struct iovec iov[REDIS_WRITEV_MAX];
+    listNode *ln = listFirst(c->reply);
+
+    c->iostatus = REDIS_IO_OK;
+    c->iosent = 0;
+    /* Replies to our master are just discarded */
+    if (c->flags & REDIS_MASTER) {
+        c->iosent = listLength(c->reply);
+        c->bufpos = 0;
+        c->sentlen = 0;
+        return;
+    }
+    while(c->bufpos || ln) {
+        listNode *next = ln;
+        size_t offset = c->sentlen, totlen = 0;
+        ssize_t nwritten;
+        int iovcnt = 0;
+
+        /* The static buffer always comes before the reply list */
+        if (c->bufpos) {
+            iov[0].iov_base = c->buf+c->sentlen;
+            iov[0].iov_len = c->bufpos-c->sentlen;
+            totlen = iov[0].iov_len;
+            iovcnt = 1;
+            offset = 0;
+        }
+        /* Collect the objects to send, skipping the empty ones */
+        while(next && iovcnt < REDIS_WRITEV_MAX) {
+            robj *o = listNodeValue(next);
+            size_t objlen = sdslen(o->ptr);
+
+            if (objlen > offset) {
+                iov[iovcnt].iov_base = ((char*)o->ptr)+offset;
+                iov[iovcnt].iov_len = objlen-offset;
+                totlen += objlen-offset;
+                iovcnt++;
+            }
+            offset = 0;
+            next = listNextNode(next);
+        }
+        if (iovcnt) {
+            nwritten = writev(c->fd,iov,iovcnt);
+            if (nwritten == -1) {
+                if (errno != EAGAIN) {
+                    c->iostatus = REDIS_IO_ERR;
+                    c->ioerrno = errno;
+                }
+                break;
+            }
+        } else {
+            nwritten = 0;
+        }
+        /* Account the data written, the last part may be partial */
+        if (c->bufpos) {
+            if ((size_t)nwritten < (size_t)(c->bufpos-c->sentlen)) {
+                c->sentlen += nwritten;
+                break;
+            }
+            nwritten -= c->bufpos-c->sentlen;
+            c->bufpos = 0;
+            c->sentlen = 0;
+        }
+        while(ln != next) {
+            robj *o = listNodeValue(ln);
+            size_t remaining = sdslen(o->ptr)-c->sentlen;
+
+            if ((size_t)nwritten < remaining) {
+                c->sentlen += nwritten;
+                break;
+            }
+            nwritten -= remaining;
+            c->sentlen = 0;
+            c->iosent++;
+            ln = listNextNode(ln);
+        }
+        /* Stop if the socket buffer is full */
+        if (ln != next) break;
+    }
+}
+
+/* Release the objects written by writeClientSocket() and remove the
+ * write handler if there is nothing more to send. Returns REDIS_ERR if
+ * the client was freed because of a write error. */
+static int clientRepliesWritten(redisClient *c) {
+    if (c->iostatus != REDIS_IO_OK) {
+        redisLog(REDIS_DEBUG,
+            "Error writing to client: %s", strerror(c->ioerrno));
+        freeClient(c);
+        return REDIS_ERR;
+    }
+    if (c->iosent) c->lastinteraction = time(NULL);
+    while(c->iosent--)
+        listDelNode(c->reply,listFirst(c->reply));
+    // 发完了撤销写事件
+    if (!clientHasPendingReplies(c)) {
+        c->sentlen = 0;
+        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
     }
+    return REDIS_OK;
 }
 
 static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     redisClient *c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    robj *o;
     REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
     REDIS_NOTUSED(mask);
 
-    if (server.glueoutputbuf && listLength(c->reply) > 1)
-        glueReplyBuffersIfNeeded(c);
-    while(listLength(c->reply)) {
-        o = listNodeValue(listFirst(c->reply));
-        objlen = sdslen(o->ptr);
-        // 无效值，从队列中删除
-        if (objlen == 0) {
-            listDelNode(c->reply,listFirst(c->reply));
-            continue;
-        }
+    writeClientSocket(c);
+    clientRepliesWritten(c);
+}
 
-        if (c->flags & REDIS_MASTER) {
-            nwritten = objlen - c->sentlen;
-        } else {
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen, objlen - c->sentlen);
-            if (nwritten <= 0) break;
-        }
-        c->sentlen += nwritten;
-        totwritten += nwritten;
-        /* If we fully sent the object on head go to the next one */
-        if (c->sentlen == objlen) {
-            listDelNode(c->reply,listFirst(c->reply));
-            c->sentlen = 0;
+static void sendReplyCompletion(aeEventLoop *el, int fd, void *privdata, char *buf, int res);
+
+/* Submit the pending output of the client to the event loop, when the
+ * client I/O is completion based. The event loop copies the data, so the
+ * objects are released right away, and writes all of it. At most
+ * REDIS_SEND_MAX_BYTES are submitted, the rest is submitted once the send
+ * completes, like the replies added in the meantime. Returns REDIS_ERR if
+ * the client was freed. */
+static int submitClientReplies(redisClient *c) {
+    struct iovec iov[REDIS_WRITEV_MAX];
+    size_t offset = c->sentlen, totlen = 0, partial = 0;
+    int iovcnt = 0, consumed = 0;
+    listNode *ln;
+
+    /* The static buffer always comes before the reply list */
+    if (c->bufpos) {
+        iov[0].iov_base = c->buf+c->sentlen;
+        iov[0].iov_len = c->bufpos-c->sentlen;
+        totlen = iov[0].iov_len;
+        iovcnt = 1;
+        offset = 0;
+    }
+    ln = listFirst(c->reply);
+    while(ln && iovcnt < REDIS_WRITEV_MAX && totlen < REDIS_SEND_MAX_BYTES) {
+        robj *o = listNodeValue(ln);
+        size_t len = sdslen(o->ptr)-offset;
+
+        /* Only the first part of a big object fits */
+        if (len > REDIS_SEND_MAX_BYTES-totlen) {
+            len = REDIS_SEND_MAX_BYTES-totlen;
+            partial = offset+len;
         }
-    }
-    if (nwritten == -1) {
-        if (errno == EAGAIN) {
-            nwritten = 0;
-        } else {
-            redisLog(REDIS_DEBUG,
-                "Error writing to client: %s", strerror(errno));
-            freeClient(c);
-            return;
+        if (len) {
+            iov[iovcnt].iov_base = ((char*)o->ptr)+offset;
+            iov[iovcnt].iov_len = len;
+            totlen += len;
+            iovcnt++;
         }
+        if (partial) break;
+        offset = 0;
+        consumed++;
+        ln = listNextNode(ln);
+    }
+    if (totlen && aeSubmitSend(server.el,c->fd,iov,iovcnt,
+                               sendReplyCompletion,c) == AE_ERR)
+    {
+        redisLog(REDIS_DEBUG,"Error submitting the replies of a client");
+        freeClient(c);
+        return REDIS_ERR;
     }
-    if (totwritten > 0) c->lastinteraction = time(NULL);
-    // 发完了撤销写事件
-    if (listLength(c->reply) == 0) {
-        c->sentlen = 0;
-        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+    if (totlen) c->flags |= REDIS_SEND_INFLIGHT;
+    c->bufpos = 0;
+    c->sentlen = partial;
+    while(consumed--)
+        listDelNode(c->reply,listFirst(c->reply));
+    return REDIS_OK;
+}
+
+/* Called by the event loop when the data submitted by
+ * submitClientReplies() was written */
+static void sendReplyCompletion(aeEventLoop *el, int fd, void *privdata, char *buf, int res) {
+    redisClient *c = privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(buf);
+
+    c->flags &= ~REDIS_SEND_INFLIGHT;
+    if (res < 0) {
+        redisLog(REDIS_DEBUG,"Error writing to client: %s", strerror(-res));
+        freeClient(c);
+        return;
     }
+    c->lastinteraction = time(NULL);
+    /* Slaves are served by the write handler, see sendBulkToSlave() */
+    if (clientHasPendingReplies(c) && !(c->flags & REDIS_SLAVE))
+        submitClientReplies(c);
 }
-// 通过字符串找到对应的命令
-static struct redisCommand *lookupCommand(char *name) {
-    int j = 0;
-    while(cmdTable[j].name != NULL) {
-        if (!strcasecmp(name,cmdTable[j].name)) return &cmdTable[j];
-        j++;
+/* Index the command table by name, so that lookupCommand() does not
+ * depend on the position of the command in the table. */
+static void populateCommandTable(void) {
+    int j;
+
+    server.commands = dictCreate(&commandTableDictType,NULL);
+    if (!server.commands) oom("populateCommandTable");
+    for (j = 0; cmdTable[j].name != NULL; j++) {
+        if (dictAdd(server.commands,sdsnew(cmdTable[j].name),cmdTable+j)
+            != DICT_OK) oom("populateCommandTable");
     }
-    return NULL;
+}
+
+// 通过字符串找到对应的命令
+static struct redisCommand *lookupCommand(sds name) {
+    dictEntry *de = dictFind(server.commands,name);
+
+    return de ? dictGetEntryVal(de) : NULL;
 }
 
 /* resetClient prepare the client to process the next command */
 static void resetClient(redisClient *c) {
     freeClientArgv(c);
     c->bulklen = -1;
+    c->reqtype = 0;
+    c->multibulklen = 0;
+    c->mbbulklen = -1;
+    c->cmd = NULL;
 }
 
 /* If this function gets called we already read a whole
@@ -1230,10 +1772,15 @@ static int processCommand(redisClient *c) {
     struct redisCommand *cmd;
     long long dirty;
 
+    /* The command was already looked up if we were reading its bulk */
+    if (c->cmd) {
+        cmd = c->cmd;
+        goto bulkread;
+    }
     /* The QUIT command is handled as a special case. Normal command
      * procs are unable to close the client connection safely */
     // 退出
-    if (!strcasecmp(c->argv[0]->ptr,"quit")) {
+    if (sdslen(c->argv[0]->ptr) == 4 && !strcasecmp(c->argv[0]->ptr,"quit")) {
         freeClient(c);
         return 0;
     }
@@ -1249,7 +1796,8 @@ static int processCommand(redisClient *c) {
         addReplySds(c,sdsnew("-ERR wrong number of arguments\r\n"));
         resetClient(c);
         return 1;
-    } else if (cmd->flags & REDIS_CMD_BULK && c->bulklen == -1) {
+    } else if (cmd->flags & REDIS_CMD_BULK && c->bulklen == -1 &&
+               c->reqtype == REDIS_REQ_INLINE) {
         int bulklen = atoi(c->argv[c->argc-1]->ptr);
 
         decrRefCount(c->argv[c->argc-1]);
@@ -1263,14 +1811,17 @@ static int processCommand(redisClient *c) {
         c->bulklen = bulklen+2; /* add two bytes for CR+LF */
         /* It is possible that the bulk read is already in the
          * buffer. Check this condition and handle it accordingly */
-        if ((signed)sdslen(c->querybuf) >= c->bulklen) {
-            c->argv[c->argc] = createStringObject(c->querybuf,c->bulklen-2);
+        if (sdslen(c->querybuf)-c->qb_pos >= (size_t)c->bulklen) {
+            c->argv[c->argc] = createStringObject(c->querybuf+c->qb_pos,
+                                                  c->bulklen-2);
             c->argc++;
-            c->querybuf = sdsrange(c->querybuf,c->bulklen,-1);
+            c->qb_pos += c->bulklen;
         } else {
+            c->cmd = cmd;
             return 1;
         }
     }
+bulkread:
     /* Let's try to share objects on the command arguments vector */
     if (server.shareobjects) {
         int j;
@@ -1302,33 +1853,54 @@ static int processCommand(redisClient *c) {
     return 1;
 }
 
+/* Commands are propagated to slaves and monitors as multi bulk requests,
+ * so that arguments containing spaces or newlines are preserved. */
 static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int dictid, robj **argv, int argc) {
     listNode *ln;
     int outc = 0, j;
-    robj **outv;
-    /* (args*2)+1 is enough room for args, spaces, newlines */
-    robj *static_outv[REDIS_STATIC_ARGS*2+1];
+    robj **outv, *lenobj;
+    /* (args*3)+1 is enough room for the count, lengths, args, newlines */
+    robj *static_outv[REDIS_STATIC_ARGS*3+1];
+    REDIS_NOTUSED(cmd);
 
     if (argc <= REDIS_STATIC_ARGS) {
         outv = static_outv;
     } else {
-        outv = zmalloc(sizeof(robj*)*(argc*2+1));
+        outv = zmalloc(sizeof(robj*)*(argc*3+1));
         if (!outv) oom("replicationFeedSlaves");
     }
-    
+
+    if (argc < REDIS_SHARED_BULKHDR_LEN) {
+        lenobj = shared.mbulkhdr[argc];
+    } else {
+        lenobj = createObject(REDIS_STRING,
+            sdscatprintf(sdsempty(),"*%d\r\n",argc));
+        lenobj->refcount = 0;
+    }
+    outv[outc++] = lenobj;
     for (j = 0; j < argc; j++) {
-        if (j != 0) outv[outc++] = shared.space;
-        if ((cmd->flags & REDIS_CMD_BULK) && j == argc-1) {
-            robj *lenobj;
+        robj *o = argv[j];
+        size_t len;
+
+        /* Integer encoded arguments are sent as strings. As the length
+         * objects above, the decoded copy is freed by the final decrement. */
+        if (!sdsEncodedObject(o)) {
+            o = getDecodedObject(o);
+            o->refcount = 0;
+        }
+        len = sdslen(o->ptr);
 
+        if (len < REDIS_SHARED_BULKHDR_LEN) {
+            lenobj = shared.bulkhdr[len];
+        } else {
             lenobj = createObject(REDIS_STRING,
-                sdscatprintf(sdsempty(),"%d\r\n",sdslen(argv[j]->ptr)));
+                sdscatprintf(sdsempty(),"$%lu\r\n",(unsigned long)len));
             lenobj->refcount = 0;
-            outv[outc++] = lenobj;
         }
-        outv[outc++] = argv[j];
+        outv[outc++] = lenobj;
+        outv[outc++] = o;
+        outv[outc++] = shared.crlf;
     }
-    outv[outc++] = shared.crlf;
 
     /* Increment all the refcounts at start and decrement at end in order to
      * be sure to free objects if there is no slave in a replication state
@@ -1359,10 +1931,10 @@ static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int di
             default:
                 selectcmd = createObject(REDIS_STRING,
                     sdscatprintf(sdsempty(),"select %d\r\n",dictid));
-                selectcmd->refcount = 0;
                 break;
             }
             addReply(slave,selectcmd);
+            if (dictid < 0 || dictid > 9) decrRefCount(selectcmd);
             slave->slaveseldb = dictid;
         }
         for (j = 0; j < outc; j++) addReply(slave,outv[j]);
@@ -1370,107 +1942,363 @@ static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int di
     for (j = 0; j < outc; j++) decrRefCount(outv[j]);
     if (outv != static_outv) zfree(outv);
 }
-// 读取客户端发送过来的数据
-static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = (redisClient*) privdata;
-    char buf[REDIS_IOBUF_LEN];
+/* Return how many bytes to read from the client socket. If a big multi
+ * bulk argument is being read, read all of it but nothing more: the query
+ * buffer will then contain just the argument, and will be used as the
+ * argument object itself. */
+static size_t clientQueryReadLen(redisClient *c) {
+    if (c->reqtype == REDIS_REQ_MULTIBULK && c->multibulklen &&
+        c->mbbulklen >= REDIS_MBULK_BIG_ARG)
+    {
+        long remaining = (c->mbbulklen+2)-(sdslen(c->querybuf)-c->qb_pos);
+
+        if (remaining > 0) return remaining;
+    }
+    return REDIS_IOBUF_LEN;
+}
+
+/* Read the data available on the client socket into the query buffer.
+ * Returns the number of bytes read, or -1 if the client must be closed,
+ * in which case c->iostatus tells why. This is also called by the I/O
+ * threads so it must not touch any global state. */
+static int readClientSocket(redisClient *c) {
+    size_t readlen = clientQueryReadLen(c);
     int nread;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
 
-    nread = read(fd, buf, REDIS_IOBUF_LEN);
+    c->iostatus = REDIS_IO_OK;
+    c->querybuf = sdsMakeRoomFor(c->querybuf,readlen);
+    nread = read(c->fd, c->querybuf+sdslen(c->querybuf), readlen);
     if (nread == -1) {
-        if (errno == EAGAIN) {
-            nread = 0;
-        } else {
-            redisLog(REDIS_DEBUG, "Reading from client: %s",strerror(errno));
-            freeClient(c);
-            return;
-        }
+        if (errno == EAGAIN) return 0;
+        c->iostatus = REDIS_IO_ERR;
+        c->ioerrno = errno;
+        return -1;
     } else if (nread == 0) {
-        redisLog(REDIS_DEBUG, "Client closed connection");
-        freeClient(c);
-        return;
+        c->iostatus = REDIS_IO_CLOSED;
+        return -1;
     }
-    if (nread) {
-        // 保存客户端发送的数据
-        c->querybuf = sdscatlen(c->querybuf, buf, nread);
-        // 记录最后一次收到数据的时间
-        c->lastinteraction = time(NULL);
-    } else {
-        return;
+    // 数据直接读到查询缓冲区
+    sdsIncrLen(c->querybuf,nread);
+    // 记录最后一次收到数据的时间
+    c->lastinteraction = time(NULL);
+    return nread;
+}
+
+/* Make room in the client argv for one more argument */
+static void clientArgvMakeRoom(redisClient *c) {
+    if (c->argc < c->argvlen) return;
+    c->argvlen = c->argvlen ? c->argvlen*2 : REDIS_STATIC_ARGS;
+    c->argv = zrealloc(c->argv,sizeof(robj*)*c->argvlen);
+    if (c->argv == NULL) oom("allocating arguments list for client");
+}
+
+/* Parse the next line of the query buffer, starting at c->qb_pos, into
+ * the client argv. The arguments are created directly from the slices of
+ * the query buffer, which is not modified: consumed data is only removed
+ * by processInputBuffer() once all the complete commands were processed.
+ *
+ * Returns 1 if a whole line was parsed (argc is zero for empty lines), 0
+ * if more data is needed, -1 on protocol error (c->iostatus is set
+ * accordingly). Like readClientSocket() this is also called by the I/O
+ * threads. */
+static int parseInlineQuery(redisClient *c) {
+    char *line = c->querybuf+c->qb_pos, *p, *end;
+    size_t avail = sdslen(c->querybuf)-c->qb_pos;
+
+    /* Read the first line of the query */
+    // end指向第一个\n
+    end = memchr(line,'\n',avail);
+    if (!end) {
+        if (avail >= REDIS_INLINE_MAX_SIZE) {
+            c->iostatus = REDIS_IO_PROTOERR;
+            return -1;
+        }
+        return 0;
     }
+    c->qb_pos += (end-line)+1;
+    if (end != line && *(end-1) == '\r') end--; /* strip "\r" if any */
 
-again:
-    if (c->bulklen == -1) {
-        /* Read the first line of the query */
-        // p指向第一个\n
-        char *p = strchr(c->querybuf,'\n');
-        size_t querylen;
-        if (p) {
-            sds query, *argv;
-            int argc, j;
-            
-            query = c->querybuf;
-            c->querybuf = sdsempty();
-            querylen = 1+(p-(query));
-            if (sdslen(query) > querylen) {
-                /* leave data after the first line of the query in the buffer */
-                c->querybuf = sdscatlen(c->querybuf,query+querylen,sdslen(query)-querylen);
-            }
-            *p = '\0'; /* remove "\n" */
-            if (*(p-1) == '\r') *(p-1) = '\0'; /* and "\r" if any */
-            sdsupdatelen(query);
-
-            /* Now we can split the query in arguments */
-            if (sdslen(query) == 0) {
-                /* Ignore empty query */
-                sdsfree(query);
-                return;
-            }
-            argv = sdssplitlen(query,sdslen(query)," ",1,&argc);
-            if (argv == NULL) oom("sdssplitlen");
-            sdsfree(query);
+    /* Now we can split the query in arguments. Empty arguments due to
+     * multiple spaces are ignored. */
+    p = line;
+    while(p < end) {
+        char *arg;
+
+        while(p < end && *p == ' ') p++;
+        if (p == end) break;
+        arg = p;
+        while(p < end && *p != ' ') p++;
+        clientArgvMakeRoom(c);
+        c->argv[c->argc++] = createStringObject(arg,p-arg);
+    }
+    return 1;
+}
+
+/* Parse the "<prefix><number>\r\n" line at c->qb_pos. Returns 1 and
+ * advances qb_pos if the line is complete and valid, 0 if more data is
+ * needed, -1 on protocol error, including a '\r' not followed by '\n'. */
+static int parseMultibulkLine(redisClient *c, char prefix, long long *value) {
+    char *line = c->querybuf+c->qb_pos, *p;
+    size_t avail = sdslen(c->querybuf)-c->qb_pos;
+    char *newline = memchr(line,'\r',avail);
+    long long v = 0;
+    int neg = 0;
+
+    if (!newline || (size_t)(newline-line)+2 > avail) {
+        return (avail >= REDIS_INLINE_MAX_SIZE) ? -1 : 0;
+    }
+    if (line[0] != prefix || newline[1] != '\n') return -1;
+    p = line+1;
+    if (p < newline && *p == '-') {
+        neg = 1;
+        p++;
+    }
+    if (p == newline || newline-p > 18) return -1;
+    while(p < newline) {
+        if (*p < '0' || *p > '9') return -1;
+        v = v*10+(*p-'0');
+        p++;
+    }
+    *value = neg ? -v : v;
+    c->qb_pos += (newline-line)+2;
+    return 1;
+}
+
+/* Parse a multi bulk request: "*<argc>\r\n" followed by argc times
+ * "$<len>\r\n<argument>\r\n". The arguments are binary safe. The parsing
+ * state is kept in the client so that it can continue with the next
+ * read, without parsing the same data again.
+ *
+ * Return values are the same as parseInlineQuery(). */
+static int parseMultibulkQuery(redisClient *c) {
+    long long ll;
+    int retval;
 
-            if (c->argv) zfree(c->argv);
-            c->argv = zmalloc(sizeof(robj*)*argc);
+    if (c->multibulklen == 0) {
+        retval = parseMultibulkLine(c,'*',&ll);
+        if (retval != 1) goto done;
+        if (ll > REDIS_MBULK_MAX_ARGS) {
+            retval = -1;
+            goto done;
+        }
+        /* "*0" and "*-1" are just ignored like empty inline queries */
+        if (ll <= 0) return 1;
+        c->multibulklen = ll;
+        /* Preallocate argv, but not trusting the count sent by the client
+         * too much: above a few slots argv grows as the arguments arrive */
+        if (c->argvlen < ll && c->argvlen < REDIS_MBULK_PREALLOC_ARGS) {
+            zfree(c->argv);
+            c->argvlen = (ll < REDIS_MBULK_PREALLOC_ARGS) ?
+                         ll : REDIS_MBULK_PREALLOC_ARGS;
+            c->argv = zmalloc(sizeof(robj*)*c->argvlen);
             if (c->argv == NULL) oom("allocating arguments list for client");
+        }
+    }
 
-            for (j = 0; j < argc; j++) {
-                if (sdslen(argv[j])) {
-                    c->argv[c->argc] = createObject(REDIS_STRING,argv[j]);
-                    c->argc++;
-                } else {
-                    sdsfree(argv[j]);
+    while(c->multibulklen) {
+        if (c->mbbulklen == -1) {
+            retval = parseMultibulkLine(c,'$',&ll);
+            if (retval != 1) goto done;
+            if (ll < 0 || ll > 1024*1024*1024) {
+                retval = -1;
+                goto done;
+            }
+            if (ll >= REDIS_MBULK_BIG_ARG) {
+                /* Move the argument at the start of the query buffer and
+                 * make room for all of it, see readClientSocket() */
+                if (c->qb_pos) {
+                    c->querybuf = sdsrange(c->querybuf,c->qb_pos,-1);
+                    c->qb_pos = 0;
                 }
+                if (sdslen(c->querybuf) < (size_t)ll+2)
+                    c->querybuf = sdsMakeRoomFor(c->querybuf,
+                                                 ll+2-sdslen(c->querybuf));
             }
-            zfree(argv);
-            /* Execute the command. If the client is still valid
-             * after processCommand() return and there is something
-             * on the query buffer try to process the next command. */
-            if (processCommand(c) && sdslen(c->querybuf)) goto again;
-            return;
-        } else if (sdslen(c->querybuf) >= 1024*32) {
-            redisLog(REDIS_DEBUG, "Client protocol error");
-            freeClient(c);
-            return;
+            c->mbbulklen = ll;
         }
-    } else {
-        /* Bulk read handling. Note that if we are at this point
-           the client already sent a command terminated with a newline,
-           we are reading the bulk data that is actually the last
-           argument of the command. */
-        int qbl = sdslen(c->querybuf);
 
-        if (c->bulklen <= qbl) {
+        /* Read the argument and the final CRLF */
+        if (sdslen(c->querybuf)-c->qb_pos < (size_t)c->mbbulklen+2) return 0;
+        if (c->querybuf[c->qb_pos+c->mbbulklen] != '\r' ||
+            c->querybuf[c->qb_pos+c->mbbulklen+1] != '\n')
+        {
+            retval = -1;
+            goto done;
+        }
+        clientArgvMakeRoom(c);
+        if (c->qb_pos == 0 && c->mbbulklen >= REDIS_MBULK_BIG_ARG &&
+            sdslen(c->querybuf) == (size_t)c->mbbulklen+2)
+        {
+            /* The query buffer is exactly the argument: use it as the
+             * argument object instead of copying it. */
+            c->argv[c->argc++] = createObject(REDIS_STRING,
+                sdsrange(c->querybuf,0,c->mbbulklen-1));
+            c->querybuf = sdsempty();
+        } else {
+            c->argv[c->argc++] = createStringObject(c->querybuf+c->qb_pos,
+                                                    c->mbbulklen);
+            c->qb_pos += c->mbbulklen+2;
+        }
+        c->mbbulklen = -1;
+        c->multibulklen--;
+    }
+    return 1;
+
+done:
+    if (retval == -1) c->iostatus = REDIS_IO_PROTOERR;
+    return retval;
+}
+
+/* Parse the next request in the query buffer, starting at c->qb_pos, in
+ * the client argv. The request type is detected by its first byte.
+ * Return values are the same as parseInlineQuery(), empty requests are
+ * skipped. */
+static int parseQuery(redisClient *c) {
+    while(1) {
+        int retval;
+
+        if (!c->reqtype) {
+            if (c->qb_pos == sdslen(c->querybuf)) return 0;
+            c->reqtype = (c->querybuf[c->qb_pos] == '*') ?
+                REDIS_REQ_MULTIBULK : REDIS_REQ_INLINE;
+        }
+        if (c->reqtype == REDIS_REQ_MULTIBULK)
+            retval = parseMultibulkQuery(c);
+        else
+            retval = parseInlineQuery(c);
+        if (retval != 1 || c->argc) return retval;
+        c->reqtype = 0; /* Empty request, go to the next one */
+    }
+}
+
+/* Reply with a protocol error and close the connection. The client is
+ * freed right away, so the pending replies and the error are written to
+ * the socket as far as it is possible without blocking. */
+static void freeClientAfterProtocolError(redisClient *c) {
+    redisLog(REDIS_DEBUG, "Client protocol error");
+    addReplySds(c,sdsnew("-ERR Protocol error\r\n"));
+    /* The replies submitted to the event loop must be written first */
+    if (!(c->flags & REDIS_SEND_INFLIGHT)) writeClientSocket(c);
+    freeClient(c);
+}
+
+/* Process the commands in the query buffer. Returns REDIS_ERR if the
+ * client was freed. */
+static int processInputBuffer(redisClient *c) {
+    while((c->flags & REDIS_PENDING_COMMAND) ||
+          c->qb_pos < sdslen(c->querybuf))
+    {
+        if (c->flags & REDIS_PENDING_COMMAND) {
+            /* The first command was already parsed by an I/O thread */
+            c->flags &= ~REDIS_PENDING_COMMAND;
+        } else if (c->bulklen == -1) {
+            int retval = parseQuery(c);
+
+            if (retval == -1) {
+                freeClientAfterProtocolError(c);
+                return REDIS_ERR;
+            }
+            if (retval == 0) break;
+        } else {
+            /* Bulk read handling. Note that if we are at this point
+               the client already sent a command terminated with a newline,
+               we are reading the bulk data that is actually the last
+               argument of the command. */
+            if ((size_t)c->bulklen > sdslen(c->querybuf)-c->qb_pos) break;
             /* Copy everything but the final CRLF as final argument */
-            c->argv[c->argc] = createStringObject(c->querybuf,c->bulklen-2);
+            c->argv[c->argc] = createStringObject(c->querybuf+c->qb_pos,
+                                                  c->bulklen-2);
             c->argc++;
-            c->querybuf = sdsrange(c->querybuf,c->bulklen,-1);
-            processCommand(c);
-            return;
+            c->qb_pos += c->bulklen;
+        }
+        /* Execute the command. If the client is still valid after
+         * processCommand() return try to process the next command. */
+        if (!processCommand(c)) return REDIS_ERR;
+    }
+    /* Remove the consumed data from the query buffer, just once for all
+     * the commands processed. */
+    if (c->qb_pos) {
+        c->querybuf = sdsrange(c->querybuf,c->qb_pos,-1);
+        c->qb_pos = 0;
+    }
+    return REDIS_OK;
+}
+
+/* Called when a read performed by readClientSocket() failed */
+static void freeClientAfterReadError(redisClient *c) {
+    if (c->iostatus == REDIS_IO_CLOSED) {
+        redisLog(REDIS_DEBUG, "Client closed connection");
+    } else if (c->iostatus == REDIS_IO_PROTOERR) {
+        freeClientAfterProtocolError(c);
+        return;
+    } else {
+        redisLog(REDIS_DEBUG, "Reading from client: %s",strerror(c->ioerrno));
+    }
+    freeClient(c);
+}
+
+/* Return true if the socket I/O of this client can be performed by the
+ * I/O threads. Masters and slaves are always served by the main thread. */
+static int clientCanUseIOThreads(redisClient *c) {
+    return server.iothreads > 1 && !(c->flags & (REDIS_MASTER|REDIS_SLAVE));
+}
+
+/* Return true if the replies of this client are submitted to the event
+ * loop. Like with the I/O threads, masters and slaves use the write
+ * handler instead, as their replies are not plain replies. */
+static int clientUsesCompletionWrites(redisClient *c) {
+    return server.iocompletion && !(c->flags & (REDIS_MASTER|REDIS_SLAVE));
+}
+
+// 读取客户端发送过来的数据
+static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    /* Defer the read to the I/O threads, see beforeSleep() */
+    if (clientCanUseIOThreads(c)) {
+        if (!(c->flags & REDIS_PENDING_READ)) {
+            c->flags |= REDIS_PENDING_READ;
+            if (!listAddNodeTail(server.clients_pending_read,c))
+                oom("listAddNodeTail");
+            c->pendingreadnode = listLast(server.clients_pending_read);
+        }
+        return;
+    }
+    switch(readClientSocket(c)) {
+    case -1: freeClientAfterReadError(c); return;
+    case 0: return;
+    default: processInputBuffer(c); return;
+    }
+}
+
+/* Called by the event loop with the data read from the client socket,
+ * when the client I/O is completion based. The next read is submitted
+ * once the commands received are processed. */
+static void readQueryCompletion(aeEventLoop *el, int fd, void *privdata, char *buf, int res) {
+    redisClient *c = (redisClient*) privdata;
+    size_t readlen;
+    REDIS_NOTUSED(fd);
+
+    if (res <= 0) {
+        if (res == 0) {
+            c->iostatus = REDIS_IO_CLOSED;
+        } else {
+            c->iostatus = REDIS_IO_ERR;
+            c->ioerrno = -res;
         }
+        freeClientAfterReadError(c);
+        return;
     }
+    c->querybuf = sdscatlen(c->querybuf,buf,res);
+    c->lastinteraction = time(NULL);
+    if (processInputBuffer(c) == REDIS_ERR) return;
+    readlen = clientQueryReadLen(c);
+    if (readlen > REDIS_IOBUF_LEN) readlen = REDIS_IOBUF_LEN;
+    if (aeSubmitRecv(el,c->fd,readlen,readQueryCompletion,c) == AE_ERR)
+        freeClient(c);
 }
 
 static int selectDb(redisClient *c, int id) {
@@ -1494,18 +2322,36 @@ static redisClient *createClient(int fd) {
     selectDb(c,0);
     c->fd = fd;
     c->querybuf = sdsempty();
+    c->qb_pos = 0;
     c->argc = 0;
+    c->argvlen = 0;
     c->argv = NULL;
     c->bulklen = -1;
+    c->reqtype = 0;
+    c->multibulklen = 0;
+    c->mbbulklen = -1;
+    c->cmd = NULL;
     c->sentlen = 0;
     c->flags = 0;
     c->lastinteraction = time(NULL);
     c->authenticated = 0;
     c->replstate = REDIS_REPL_NONE;
+    c->iostatus = REDIS_IO_OK;
+    c->ioerrno = 0;
+    c->iosent = 0;
+    c->pendingreadnode = NULL;
+    c->pendingwritenode = NULL;
+    c->bufpos = 0;
     if ((c->reply = listCreate()) == NULL) oom("listCreate");
     listSetFreeMethod(c->reply,decrRefCount);
     listSetDupMethod(c->reply,dupClientReplyValue);
-    if (aeCreateFileEvent(server.el, c->fd, AE_READABLE,
+    if (server.iocompletion) {
+        if (aeSubmitRecv(server.el,c->fd,REDIS_IOBUF_LEN,
+            readQueryCompletion,c) == AE_ERR) {
+            freeClient(c);
+            return NULL;
+        }
+    } else if (aeCreateFileEvent(server.el, c->fd, AE_READABLE,
         readQueryFromClient, c, NULL) == AE_ERR) {
         freeClient(c);
         return NULL;
@@ -1513,29 +2359,169 @@ static redisClient *createClient(int fd) {
     if (!listAddNodeTail(server.clients,c)) oom("listAddNodeTail");
     return c;
 }
+/* Return true if the client has output not yet written to the socket */
+static int clientHasPendingReplies(redisClient *c) {
+    return c->bufpos || listLength(c->reply);
+}
+
+/* Install the write handler, or queue the client for the I/O threads or
+ * for submitClientReplies(), when the first reply is added to a client
+ * with no pending output. */
+static int prepareClientToWrite(redisClient *c) {
+    if (clientHasPendingReplies(c) ||
+        (c->replstate != REDIS_REPL_NONE &&
+         c->replstate != REDIS_REPL_ONLINE)) return REDIS_OK;
+    if (clientCanUseIOThreads(c) || clientUsesCompletionWrites(c)) {
+        /* The reply will be written by the I/O threads, or submitted to
+         * the event loop, before it goes to sleep again, see beforeSleep() */
+        if (!(c->flags & REDIS_PENDING_WRITE)) {
+            c->flags |= REDIS_PENDING_WRITE;
+            if (!listAddNodeTail(server.clients_pending_write,c))
+                oom("listAddNodeTail");
+            c->pendingwritenode = listLast(server.clients_pending_write);
+        }
+    } else if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+               sendReplyToClient, c, NULL) == AE_ERR) return REDIS_ERR;
+    return REDIS_OK;
+}
+
+/* Copy the reply in the static buffer if it fits. This is only possible
+ * while the reply list is empty, otherwise the order of the replies would
+ * not be preserved. */
+static int addReplyToBuffer(redisClient *c, char *s, size_t len) {
+    if (listLength(c->reply) ||
+        len > (size_t)(REDIS_REPLY_CHUNK_BYTES-c->bufpos)) return REDIS_ERR;
+    memcpy(c->buf+c->bufpos,s,len);
+    c->bufpos += len;
+    return REDIS_OK;
+}
+
 // 追加一个回复给客户端
 static void addReply(redisClient *c, robj *obj) {
-    // reply队列为0，说明之前还没有注册过事件
-    if (listLength(c->reply) == 0 &&
-        (c->replstate == REDIS_REPL_NONE ||
-         c->replstate == REDIS_REPL_ONLINE) &&
-        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-        sendReplyToClient, c, NULL) == AE_ERR) return;
+    if (obj->encoding == REDIS_ENCODING_INT) {
+        char buf[REDIS_LONGSTR_SIZE];
+
+        addReplyString(c,buf,ll2string(buf,sizeof(buf),(long)obj->ptr));
+        return;
+    }
+    if (prepareClientToWrite(c) == REDIS_ERR) return;
+    /* Objects with a NULL ptr are placeholders filled by the caller later,
+     * see keysCommand(), they always go in the reply list. */
+    if (obj->ptr && addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) == REDIS_OK)
+        return;
     // 追加到回复队列
     if (!listAddNodeTail(c->reply,obj)) oom("listAddNodeTail");
     incrRefCount(obj);
 }
 // 追加一个回复
 static void addReplySds(redisClient *c, sds s) {
-    robj *o = createObject(REDIS_STRING,s);
-    addReply(c,o);
-    decrRefCount(o);
+    robj *o;
+
+    if (prepareClientToWrite(c) == REDIS_ERR) {
+        sdsfree(s);
+        return;
+    }
+    if (addReplyToBuffer(c,s,sdslen(s)) == REDIS_OK) {
+        sdsfree(s);
+        return;
+    }
+    o = createObject(REDIS_STRING,s);
+    if (!listAddNodeTail(c->reply,o)) oom("listAddNodeTail");
+}
+
+/* Add raw bytes to the client output, used by the functions below in
+ * order to avoid creating an object for small replies. */
+static void addReplyString(redisClient *c, char *s, size_t len) {
+    robj *o;
+
+    if (prepareClientToWrite(c) == REDIS_ERR) return;
+    if (addReplyToBuffer(c,s,len) == REDIS_OK) return;
+    o = createStringObject(s,len);
+    if (!listAddNodeTail(c->reply,o)) oom("listAddNodeTail");
+}
+
+/* Add a ":<value>\r\n", "$<value>\r\n" or "*<value>\r\n" reply.
+ * Bulk and multi bulk headers of small lengths are shared objects. */
+static void addReplyLongLongWithPrefix(redisClient *c, long long ll,
+                                       char prefix)
+{
+    char buf[REDIS_LONGSTR_SIZE+3];
+    int len;
+
+    if (prefix == '$' && ll >= 0 && ll < REDIS_SHARED_BULKHDR_LEN) {
+        addReply(c,shared.bulkhdr[ll]);
+        return;
+    } else if (prefix == '*' && ll >= 0 && ll < REDIS_SHARED_BULKHDR_LEN) {
+        addReply(c,shared.mbulkhdr[ll]);
+        return;
+    }
+    buf[0] = prefix;
+    len = ll2string(buf+1,sizeof(buf)-1,ll);
+    buf[len+1] = '\r';
+    buf[len+2] = '\n';
+    addReplyString(c,buf,len+3);
+}
+
+static void addReplyLongLong(redisClient *c, long long ll) {
+    if (ll == 0)
+        addReply(c,shared.czero);
+    else if (ll == 1)
+        addReply(c,shared.cone);
+    else
+        addReplyLongLongWithPrefix(c,ll,':');
+}
+
+/* Add the "$<len>\r\n" header of the bulk reply of a string object */
+static void addReplyBulkLen(redisClient *c, robj *obj) {
+    size_t len;
+
+    if (sdsEncodedObject(obj)) {
+        len = sdslen(obj->ptr);
+    } else {
+        char buf[REDIS_LONGSTR_SIZE];
+
+        len = ll2string(buf,sizeof(buf),(long)obj->ptr);
+    }
+    addReplyLongLongWithPrefix(c,len,'$');
 }
 
+static void addReplyMultiBulkLen(redisClient *c, long length) {
+    addReplyLongLongWithPrefix(c,length,'*');
+}
+
+/* Add a string object as a bulk reply */
+static void addReplyBulk(redisClient *c, robj *obj) {
+    addReplyBulkLen(c,obj);
+    addReply(c,obj);
+    addReply(c,shared.crlf);
+}
+
+/* Add a double as a bulk reply, with enough digits to read it back
+ * without losing precision */
+static void addReplyDouble(redisClient *c, double d) {
+    char buf[128];
+    int len = snprintf(buf,sizeof(buf),"%.17g",d);
+
+    addReplyLongLongWithPrefix(c,len,'$');
+    addReplyString(c,buf,len);
+    addReply(c,shared.crlf);
+}
+
+/* Add an integer as a bulk reply, without creating an object for it */
+static void addReplyBulkLongLong(redisClient *c, long long ll) {
+    char buf[REDIS_LONGSTR_SIZE];
+    int len = ll2string(buf,sizeof(buf),ll);
+
+    addReplyLongLongWithPrefix(c,len,'$');
+    addReplyString(c,buf,len);
+    addReply(c,shared.crlf);
+}
+
+static void acceptClient(int cfd);
+
 static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     int cport, cfd;
     char cip[128];
-    redisClient *c;
     REDIS_NOTUSED(el);
     REDIS_NOTUSED(mask);
     REDIS_NOTUSED(privdata);
@@ -1546,6 +2532,31 @@ static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         return;
     }
     redisLog(REDIS_DEBUG,"Accepted %s:%d", cip, cport);
+    acceptClient(cfd);
+}
+
+/* Called by the event loop for every connection accepted on the listening
+ * socket, when the client I/O is completion based */
+static void acceptCompletion(aeEventLoop *el, int fd, void *privdata, char *buf, int res) {
+    int cport;
+    char cip[128];
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(privdata);
+    REDIS_NOTUSED(buf);
+
+    if (res < 0) {
+        redisLog(REDIS_DEBUG,"Accepting client connection: %s", strerror(-res));
+        return;
+    }
+    anetPeerToString(res,cip,&cport);
+    redisLog(REDIS_DEBUG,"Accepted %s:%d", cip, cport);
+    acceptClient(res);
+}
+
+static void acceptClient(int cfd) {
+    redisClient *c;
+
     // 创建一个client，把通信的文件描述符保存到client
     if ((c = createClient(cfd)) == NULL) {
         redisLog(REDIS_WARNING,"Error allocating resoures for the client");
@@ -1568,12 +2579,204 @@ static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     server.stat_numconnections++;
 }
 
+/* ============================== Threaded I/O ============================== */
+
+/* When io-threads is greater than one, reading and parsing queries and
+ * writing replies is performed by a pool of threads, while commands are
+ * still executed by the main thread alone. Sockets ready for reading are
+ * only queued by the event handlers, and the queues are processed in
+ * beforeSleep(): the clients are split among the threads (the main thread
+ * takes its part too), and the main thread waits for all of them to
+ * finish before touching the clients again. So the I/O threads never run
+ * concurrently with the rest of the server. */
+typedef struct ioThread {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* Signaled when a job is assigned or done */
+    int job;                /* REDIS_IOJOB_READ or REDIS_IOJOB_WRITE */
+    int pending;            /* True while the job is in progress */
+    redisClient **clients;  /* Clients assigned to this thread */
+    int numclients;
+    int size;               /* Allocated slots of the clients array */
+} ioThread;
+
+static ioThread iothreads[REDIS_IOTHREADS_MAX];
+
+static void ioThreadProcessClients(ioThread *t) {
+    int j;
+
+    for (j = 0; j < t->numclients; j++) {
+        redisClient *c = t->clients[j];
+
+        if (t->job == REDIS_IOJOB_WRITE) {
+            writeClientSocket(c);
+        } else if (readClientSocket(c) != -1 && c->bulklen == -1 &&
+                   !(c->flags & REDIS_PENDING_COMMAND)) {
+            /* Parse the first command as well, the main thread will
+             * parse the next ones if the client is pipelining. */
+            if (parseQuery(c) == 1) c->flags |= REDIS_PENDING_COMMAND;
+        }
+    }
+}
+
+static void *ioThreadMain(void *arg) {
+    ioThread *t = arg;
+
+    while(1) {
+        pthread_mutex_lock(&t->lock);
+        while(!t->pending) pthread_cond_wait(&t->cond,&t->lock);
+        pthread_mutex_unlock(&t->lock);
+
+        ioThreadProcessClients(t);
+
+        pthread_mutex_lock(&t->lock);
+        t->pending = 0;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
+    return NULL;
+}
+
+static void initIOThreads(void) {
+    int j;
+
+    zmalloc_enable_thread_safeness();
+    for (j = 0; j < server.iothreads; j++) {
+        ioThread *t = iothreads+j;
+
+        t->pending = 0;
+        t->clients = NULL;
+        t->numclients = 0;
+        t->size = 0;
+        /* Thread 0 is the main thread */
+        if (j == 0) continue;
+        pthread_mutex_init(&t->lock,NULL);
+        pthread_cond_init(&t->cond,NULL);
+        if (pthread_create(&t->tid,NULL,ioThreadMain,t) != 0) {
+            redisLog(REDIS_WARNING,"Fatal: can't create the I/O threads");
+            exit(1);
+        }
+    }
+}
+
+/* Perform 'job' for every client in the list using the I/O threads, and
+ * return when all the threads are done. */
+static void ioThreadsRun(list *clients, int job) {
+    int numthreads = server.iothreads, j = 0;
+    listNode *ln;
+
+    /* Waking up the threads is not worth it for just a few clients */
+    if ((int)listLength(clients) < numthreads*2) numthreads = 1;
+    listRewind(clients);
+    while((ln = listYield(clients))) {
+        ioThread *t = iothreads+(j++ % numthreads);
+
+        if (t->numclients == t->size) {
+            t->size = t->size ? t->size*2 : 16;
+            t->clients = zrealloc(t->clients,sizeof(redisClient*)*t->size);
+            if (!t->clients) oom("ioThreadsRun");
+        }
+        t->clients[t->numclients++] = ln->value;
+    }
+
+    server.iothreadsbusy = 1;
+    for (j = 1; j < numthreads; j++) {
+        ioThread *t = iothreads+j;
+
+        pthread_mutex_lock(&t->lock);
+        t->job = job;
+        t->pending = 1;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->lock);
+    }
+    iothreads[0].job = job;
+    ioThreadProcessClients(iothreads);
+    for (j = 1; j < numthreads; j++) {
+        ioThread *t = iothreads+j;
+
+        pthread_mutex_lock(&t->lock);
+        while(t->pending) pthread_cond_wait(&t->cond,&t->lock);
+        pthread_mutex_unlock(&t->lock);
+    }
+    server.iothreadsbusy = 0;
+    for (j = 0; j < numthreads; j++) iothreads[j].numclients = 0;
+}
+
+static void handleClientsWithPendingReads(void) {
+    list *l = server.clients_pending_read;
+
+    if (listLength(l) == 0) return;
+    ioThreadsRun(l,REDIS_IOJOB_READ);
+    /* Now execute the commands in the main thread. Note that a client
+     * may be freed while processing another one, so we always pop the
+     * list head. */
+    while(listLength(l)) {
+        redisClient *c = listNodeValue(listFirst(l));
+
+        listDelNode(l,listFirst(l));
+        c->flags &= ~REDIS_PENDING_READ;
+        c->pendingreadnode = NULL;
+        if (c->iostatus != REDIS_IO_OK) {
+            freeClientAfterReadError(c);
+            continue;
+        }
+        processInputBuffer(c);
+    }
+}
+
+static void handleClientsWithPendingWrites(void) {
+    list *l = server.clients_pending_write;
+
+    if (listLength(l) == 0) return;
+    if (server.iocompletion) {
+        /* All the replies are submitted at once, and the event loop will
+         * write them with a single system call. Clients with a send in
+         * flight submit the new replies once it completes. */
+        while(listLength(l)) {
+            redisClient *c = listNodeValue(listFirst(l));
+
+            listDelNode(l,listFirst(l));
+            c->flags &= ~REDIS_PENDING_WRITE;
+            c->pendingwritenode = NULL;
+            if (!(c->flags & REDIS_SEND_INFLIGHT) &&
+                clientUsesCompletionWrites(c) && clientHasPendingReplies(c))
+                submitClientReplies(c);
+        }
+        return;
+    }
+    ioThreadsRun(l,REDIS_IOJOB_WRITE);
+    while(listLength(l)) {
+        redisClient *c = listNodeValue(listFirst(l));
+
+        listDelNode(l,listFirst(l));
+        c->flags &= ~REDIS_PENDING_WRITE;
+        c->pendingwritenode = NULL;
+        if (clientRepliesWritten(c) == REDIS_ERR) continue;
+        /* Install the write handler if the socket buffer is full */
+        if (clientHasPendingReplies(c) &&
+            aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+            sendReplyToClient, c, NULL) == AE_ERR) freeClient(c);
+    }
+}
+
+/* This is called before every wait for events when the I/O threads are
+ * enabled. Reads are handled first so that the replies of the commands
+ * executed are written in the same iteration. */
+static void beforeSleep(aeEventLoop *eventLoop) {
+    REDIS_NOTUSED(eventLoop);
+
+    handleClientsWithPendingReads();
+    handleClientsWithPendingWrites();
+}
+
 /* ======================= Redis objects implementation ===================== */
 // 创建一个redisObj，优先从空闲列表里取
 static robj *createObject(int type, void *ptr) {
     robj *o;
     // 空闲列表非空，则取出来，从原列表删除，如果列表为空，则申请一个新的节点
-    if (listLength(server.objfreelist)) {
+    /* The free list can't be used while the I/O threads are parsing
+     * queries as they create objects as well. */
+    if (listLength(server.objfreelist) && !server.iothreadsbusy) {
         listNode *head = listFirst(server.objfreelist);
         o = listNodeValue(head);
         listDelNode(server.objfreelist,head);
@@ -1583,49 +2786,145 @@ static robj *createObject(int type, void *ptr) {
     if (!o) oom("createObject");
     // 设置redisObj的值
     o->type = type;
+    o->encoding = REDIS_ENCODING_RAW;
     o->ptr = ptr;
     o->refcount = 1;
     return o;
 }
-// 申请一个redisObj，类型是字符串
+/* Create a string object with the EMBSTR encoding: a single allocation
+ * holding the object, the sds header and the string. These objects don't
+ * go in the free list as their size depends on the string length. */
+static robj *createEmbeddedStringObject(char *ptr, size_t len) {
+    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+    struct sdshdr8 *sh = (void*)(o+1);
+
+    if (!o) oom("createEmbeddedStringObject");
+    o->type = REDIS_STRING;
+    o->encoding = REDIS_ENCODING_EMBSTR;
+    o->ptr = sh->buf;
+    o->refcount = 1;
+    sh->len = len;
+    sh->alloc = len;
+    sh->flags = SDS_TYPE_8;
+    if (ptr)
+        memcpy(sh->buf,ptr,len);
+    else
+        memset(sh->buf,0,len);
+    sh->buf[len] = '\0';
+    return o;
+}
+// 申请一个redisObj，类型是字符串，短字符串和对象在同一块内存里
 static robj *createStringObject(char *ptr, size_t len) {
+    if (len <= REDIS_EMBSTR_SIZE_LIMIT)
+        return createEmbeddedStringObject(ptr,len);
     return createObject(REDIS_STRING,sdsnewlen(ptr,len));
 }
-// 申请一个redisObj，类型是列表
-static robj *createListObject(void) {
-    list *l = listCreate();
+// 用整数创建字符串对象，小整数直接使用共享对象
+static robj *createStringObjectFromLongLong(long long value) {
+    robj *o;
+
+    if (value >= 0 && value < REDIS_SHARED_INTEGERS) {
+        o = shared.integers[value];
+        incrRefCount(o);
+    } else if (value >= LONG_MIN && value <= LONG_MAX) {
+        o = createObject(REDIS_STRING,(void*)((long)value));
+        o->encoding = REDIS_ENCODING_INT;
+    } else {
+        char buf[REDIS_LONGSTR_SIZE];
+
+        o = createStringObject(buf,ll2string(buf,sizeof(buf),value));
+    }
+    return o;
+}
+// 申请一个redisObj，类型是列表，由多个ziplist节点组成
+static robj *createQuicklistObject(void) {
+    robj *o = createObject(REDIS_LIST,
+                           quicklistCreate(server.list_max_ziplist_entries));
 
-    if (!l) oom("listCreate");
-    listSetFreeMethod(l,decrRefCount);
-    return createObject(REDIS_LIST,l);
+    o->encoding = REDIS_ENCODING_QUICKLIST;
+    return o;
+}
+// 小列表使用紧凑的ziplist编码
+static robj *createZiplistObject(void) {
+    robj *o = createObject(REDIS_LIST,ziplistNew());
+
+    o->encoding = REDIS_ENCODING_ZIPLIST;
+    return o;
 }
 // 申请redisObj，类型是字典
 static robj *createSetObject(void) {
     dict *d = dictCreate(&setDictType,NULL);
+    robj *o;
+
     if (!d) oom("dictCreate");
-    return createObject(REDIS_SET,d);
+    o = createObject(REDIS_SET,d);
+    o->encoding = REDIS_ENCODING_HT;
+    return o;
+}
+// 只包含整数的集合使用紧凑的intset编码
+static robj *createIntsetObject(void) {
+    robj *o = createObject(REDIS_SET,intsetNew());
+
+    o->encoding = REDIS_ENCODING_INTSET;
+    return o;
+}
+
+static robj *createHashObject(void) {
+    robj *o = createObject(REDIS_HASH,ziplistNew());
+
+    o->encoding = REDIS_ENCODING_ZIPLIST;
+    return o;
+}
+
+static robj *createZsetObject(void) {
+    zset *zs = zmalloc(sizeof(*zs));
+
+    if (!zs) oom("createZsetObject");
+    zs->dict = dictCreate(&zsetDictType,NULL);
+    zs->zsl = zslCreate();
+    return createObject(REDIS_ZSET,zs);
 }
 // 和上面对应，释放内存
 static void freeStringObject(robj *o) {
-    sdsfree(o->ptr);
+    if (o->encoding == REDIS_ENCODING_RAW) sdsfree(o->ptr);
 }
 
 static void freeListObject(robj *o) {
-    listRelease((list*) o->ptr);
+    switch (o->encoding) {
+    case REDIS_ENCODING_QUICKLIST: quicklistRelease(o->ptr); break;
+    case REDIS_ENCODING_ZIPLIST: zfree(o->ptr); break;
+    default: assert(0 != 0); break;
+    }
 }
 
 static void freeSetObject(robj *o) {
-    dictRelease((dict*) o->ptr);
+    switch (o->encoding) {
+    case REDIS_ENCODING_HT: dictRelease((dict*) o->ptr); break;
+    case REDIS_ENCODING_INTSET: zfree(o->ptr); break;
+    default: assert(0 != 0); break;
+    }
+}
+
+static void freeZsetObject(robj *o) {
+    zset *zs = o->ptr;
+
+    dictRelease(zs->dict);
+    zslFree(zs->zsl);
+    zfree(zs);
 }
 
 static void freeHashObject(robj *o) {
-    dictRelease((dict*) o->ptr);
+    switch (o->encoding) {
+    case REDIS_ENCODING_HT: dictRelease((dict*) o->ptr); break;
+    case REDIS_ENCODING_ZIPLIST: zfree(o->ptr); break;
+    default: assert(0 != 0); break;
+    }
 }
 // 增加引用计数
 static void incrRefCount(robj *o) {
     o->refcount++;
 #ifdef DEBUG_REFCOUNT
-    if (o->type == REDIS_STRING)
+    if (o->type == REDIS_STRING && sdsEncodedObject(o))
         printf("Increment '%s'(%p), now is: %d\n",o->ptr,o,o->refcount);
 #endif
 }
@@ -1634,15 +2933,20 @@ static void decrRefCount(void *obj) {
     robj *o = obj;
 
 #ifdef DEBUG_REFCOUNT
-    if (o->type == REDIS_STRING)
+    if (o->type == REDIS_STRING && sdsEncodedObject(o))
         printf("Decrement '%s'(%p), now is: %d\n",o->ptr,o,o->refcount-1);
 #endif
     // 没有人引用该对象了，释放内存
     if (--(o->refcount) == 0) {
+        if (o->encoding == REDIS_ENCODING_EMBSTR) {
+            zfree(o);
+            return;
+        }
         switch(o->type) {
         case REDIS_STRING: freeStringObject(o); break;
         case REDIS_LIST: freeListObject(o); break;
         case REDIS_SET: freeSetObject(o); break;
+        case REDIS_ZSET: freeZsetObject(o); break;
         case REDIS_HASH: freeHashObject(o); break;
         default: assert(0 != 0); break;
         }
@@ -1662,6 +2966,8 @@ static robj *tryObjectSharing(robj *o) {
     unsigned long c;
 
     if (o == NULL || server.shareobjects == 0) return o;
+    /* Integer encoded objects are already compact, or shared */
+    if (o->encoding == REDIS_ENCODING_INT) return o;
 
     assert(o->type == REDIS_STRING);
     de = dictFind(server.sharingpool,o);
@@ -1700,6 +3006,63 @@ static robj *tryObjectSharing(robj *o) {
         return o;
     }
 }
+/* Check if the sds string 's' is the canonical representation of an integer
+ * fitting in a long, that is, converting it back to a string gives exactly
+ * the same bytes. If so the value is stored in *longval and REDIS_OK is
+ * returned, otherwise REDIS_ERR is returned. */
+static int isStringRepresentableAsLong(sds s, long *longval) {
+    char buf[REDIS_LONGSTR_SIZE], *endptr;
+    size_t slen = sdslen(s);
+    long value;
+
+    if (slen == 0 || slen >= sizeof(buf)) return REDIS_ERR;
+    errno = 0;
+    value = strtol(s,&endptr,10);
+    if (endptr[0] != '\0' || errno == ERANGE) return REDIS_ERR;
+    if ((size_t)ll2string(buf,sizeof(buf),value) != slen ||
+        memcmp(buf,s,slen) != 0) return REDIS_ERR;
+    if (longval) *longval = value;
+    return REDIS_OK;
+}
+
+/* Try to encode a string object in order to save space. The object is
+ * modified in place, and it's only encoded if nobody else is referencing
+ * it, as other references may expect an sds in 'ptr'. Small integers and
+ * embedded strings are replaced by another object, so the caller must
+ * always use the returned object in place of the original one. */
+// 如果字符串是一个整数，则直接存到 ptr 里，不再需要 sds
+static robj *tryObjectEncoding(robj *o) {
+    long value;
+
+    if (o->type != REDIS_STRING || !sdsEncodedObject(o) ||
+        o->refcount > 1) return o;
+    if (isStringRepresentableAsLong(o->ptr,&value) == REDIS_ERR) return o;
+    if ((value >= 0 && value < REDIS_SHARED_INTEGERS) ||
+        o->encoding == REDIS_ENCODING_EMBSTR)
+    {
+        decrRefCount(o);
+        return createStringObjectFromLongLong(value);
+    }
+    sdsfree(o->ptr);
+    o->encoding = REDIS_ENCODING_INT;
+    o->ptr = (void*) value;
+    return o;
+}
+
+/* Get a raw (sds based) version of an object, encoded or not. The returned
+ * object has its reference count incremented, so the caller should call
+ * decrRefCount() against it when done. */
+static robj *getDecodedObject(robj *o) {
+    char buf[REDIS_LONGSTR_SIZE];
+
+    if (sdsEncodedObject(o)) {
+        incrRefCount(o);
+        return o;
+    }
+    assert(o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_INT);
+    return createStringObject(buf,ll2string(buf,sizeof(buf),(long)o->ptr));
+}
+
 // 判断key是否在字典里，是则返回值，否则返回NULL
 static robj *lookupKey(redisDb *db, robj *key) {
     dictEntry *de = dictFind(db->dict,key);
@@ -1770,20 +3133,7 @@ static int rdbSaveLen(FILE *fp, uint32_t len) {
 /* String objects in the form "2391" "-100" without any space and with a
  * range of values that can fit in an 8, 16 or 32 bit signed value can be
  * encoded as integers to save space */
-int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
-    long long value;
-    char *endptr, buf[32];
-
-    /* Check if it's possible to encode this value as a number */
-    value = strtoll(s, &endptr, 10);
-    if (endptr[0] != '\0') return 0;
-    snprintf(buf,32,"%lld",value);
-
-    /* If the number converted back into a string is not identical
-     * then it's not possible to encode the string as integer */
-    if (strlen(buf) != sdslen(s) || memcmp(buf,s,sdslen(s))) return 0;
-
-    /* Finally check if it fits in our ranges */
+static int rdbEncodeInteger(long long value, unsigned char *enc) {
     if (value >= -(1<<7) && value <= (1<<7)-1) {
         enc[0] = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_INT8;
         enc[1] = value&0xFF;
@@ -1805,6 +3155,23 @@ int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
     }
 }
 
+int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
+    long long value;
+    char *endptr, buf[32];
+
+    /* Check if it's possible to encode this value as a number */
+    value = strtoll(s, &endptr, 10);
+    if (endptr[0] != '\0') return 0;
+    snprintf(buf,32,"%lld",value);
+
+    /* If the number converted back into a string is not identical
+     * then it's not possible to encode the string as integer */
+    if (strlen(buf) != sdslen(s) || memcmp(buf,s,sdslen(s))) return 0;
+
+    /* Finally check if it fits in our ranges */
+    return rdbEncodeInteger(value,enc);
+}
+
 static int rdbSaveLzfStringObject(FILE *fp, robj *obj) {
     unsigned int comprlen, outlen;
     unsigned char byte;
@@ -1833,12 +3200,56 @@ writeerr:
     return -1;
 }
 
+/* Save a double value. Doubles are saved as strings prefixed by an unsigned
+ * 8 bit integer specifing the length of the representation.
+ * This 8 bit integer has special values in order to specify the following
+ * conditions:
+ * 253: not a number
+ * 254: + inf
+ * 255: - inf
+ */
+static int rdbSaveDoubleValue(FILE *fp, double val) {
+    unsigned char buf[128];
+    int len;
+
+    if (isnan(val)) {
+        buf[0] = 253;
+        len = 1;
+    } else if (isinf(val)) {
+        buf[0] = (val < 0) ? 255 : 254;
+        len = 1;
+    } else {
+        snprintf((char*)buf+1,sizeof(buf)-1,"%.17g",val);
+        buf[0] = strlen((char*)buf+1);
+        len = buf[0]+1;
+    }
+    if (fwrite(buf,len,1,fp) == 0) return -1;
+    return 0;
+}
+
 /* Save a string objet as [len][data] on disk. If the object is a string
  * representation of an integer value we try to safe it in a special form */
 static int rdbSaveStringObject(FILE *fp, robj *obj) {
-    size_t len = sdslen(obj->ptr);
+    size_t len;
     int enclen;
 
+    /* Integer encoded objects are saved as integers when they fit 32 bits,
+     * otherwise as the string representation. */
+    if (obj->encoding == REDIS_ENCODING_INT) {
+        unsigned char buf[5];
+        int retval;
+
+        if ((enclen = rdbEncodeInteger((long)obj->ptr,buf)) > 0) {
+            if (fwrite(buf,enclen,1,fp) == 0) return -1;
+            return 0;
+        }
+        obj = getDecodedObject(obj);
+        retval = rdbSaveStringObject(fp,obj);
+        decrRefCount(obj);
+        return retval;
+    }
+    len = sdslen(obj->ptr);
+
     /* Try integer encoding */
     if (len <= 11) {
         unsigned char buf[5];
@@ -1915,31 +3326,76 @@ static int rdbSave(char *filename) {
                 /* Save a string value */
                 if (rdbSaveStringObject(fp,o) == -1) goto werr;
             } else if (o->type == REDIS_LIST) {
-                /* Save a list value */
-                list *list = o->ptr;
-                listNode *ln;
-
-                listRewind(list);
-                if (rdbSaveLen(fp,listLength(list)) == -1) goto werr;
-                while((ln = listYield(list))) {
-                    robj *eleobj = listNodeValue(ln);
-
-                    if (rdbSaveStringObject(fp,eleobj) == -1) goto werr;
+                /* Save a list value, the format does not depend on the
+                 * encoding */
+                listTypeIterator *li;
+                listTypeEntry entry;
+
+                if (rdbSaveLen(fp,listTypeLength(o)) == -1) goto werr;
+                li = listTypeInitIterator(o,0,REDIS_TAIL);
+                while(listTypeNext(li,&entry)) {
+                    robj *eleobj = listTypeGet(&entry);
+                    int retval = rdbSaveStringObject(fp,eleobj);
+
+                    decrRefCount(eleobj);
+                    if (retval == -1) {
+                        listTypeReleaseIterator(li);
+                        goto werr;
+                    }
                 }
+                listTypeReleaseIterator(li);
             } else if (o->type == REDIS_SET) {
-                /* Save a set value */
-                dict *set = o->ptr;
-                dictIterator *di = dictGetIterator(set);
-                dictEntry *de;
-
-                if (!set) oom("dictGetIteraotr");
-                if (rdbSaveLen(fp,dictSize(set)) == -1) goto werr;
-                while((de = dictNext(di)) != NULL) {
-                    robj *eleobj = dictGetEntryKey(de);
-
-                    if (rdbSaveStringObject(fp,eleobj) == -1) goto werr;
+                /* Save a set value, the format does not depend on the
+                 * encoding */
+                setTypeIterator *si;
+                robj *eleobj;
+
+                if (rdbSaveLen(fp,setTypeSize(o)) == -1) goto werr;
+                si = setTypeInitIterator(o);
+                while((eleobj = setTypeNext(si)) != NULL) {
+                    int retval = rdbSaveStringObject(fp,eleobj);
+
+                    decrRefCount(eleobj);
+                    if (retval == -1) {
+                        setTypeReleaseIterator(si);
+                        goto werr;
+                    }
                 }
-                dictReleaseIterator(di);
+                setTypeReleaseIterator(si);
+            } else if (o->type == REDIS_ZSET) {
+                /* Save a sorted set value as [len] then [member][score]
+                 * pairs, in score order */
+                zskiplist *zsl = ((zset*)o->ptr)->zsl;
+                zskiplistNode *ln = zsl->header->level[0].forward;
+
+                if (rdbSaveLen(fp,zsl->length) == -1) goto werr;
+                while(ln) {
+                    if (rdbSaveStringObject(fp,ln->obj) == -1) goto werr;
+                    if (rdbSaveDoubleValue(fp,ln->score) == -1) goto werr;
+                    ln = ln->level[0].forward;
+                }
+            } else if (o->type == REDIS_HASH) {
+                /* Save a hash value as [len] then [field][value] pairs,
+                 * the format does not depend on the encoding */
+                hashTypeIterator *hi;
+
+                if (rdbSaveLen(fp,hashTypeLength(o)) == -1) goto werr;
+                hi = hashTypeInitIterator(o);
+                while(hashTypeNext(hi) != REDIS_ERR) {
+                    robj *field = hashTypeCurrent(hi,REDIS_HASH_KEY);
+                    robj *value = hashTypeCurrent(hi,REDIS_HASH_VALUE);
+                    int retval = 0;
+
+                    if (rdbSaveStringObject(fp,field) == -1 ||
+                        rdbSaveStringObject(fp,value) == -1) retval = -1;
+                    decrRefCount(field);
+                    decrRefCount(value);
+                    if (retval == -1) {
+                        hashTypeReleaseIterator(hi);
+                        goto werr;
+                    }
+                }
+                hashTypeReleaseIterator(hi);
             } else {
                 assert(0 != 0);
             }
@@ -1995,6 +3451,8 @@ static int rdbSaveBackground(char *filename) {
         }
         redisLog(REDIS_NOTICE,"Background saving started by pid %d",childpid);
         server.bgsaveinprogress = 1;
+        /* Tables can still grow if they get too crowded, see dict.c */
+        dictDisableResize();
         return REDIS_OK;
     }
     return REDIS_OK; /* unreached */
@@ -2049,8 +3507,11 @@ static uint32_t rdbLoadLen(FILE *fp, int rdbver, int *isencoded) {
     }
 }
 
-static robj *rdbLoadIntegerObject(FILE *fp, int enctype) {
+/* Load an integer encoded string. If 'encode' is true the object is
+ * returned integer encoded (or shared), otherwise as a raw string. */
+static robj *rdbLoadIntegerObject(FILE *fp, int enctype, int encode) {
     unsigned char enc[4];
+    char buf[REDIS_LONGSTR_SIZE];
     long long val;
 
     if (enctype == REDIS_RDB_ENC_INT8) {
@@ -2070,7 +3531,8 @@ static robj *rdbLoadIntegerObject(FILE *fp, int enctype) {
         val = 0; /* anti-warning */
         assert(0!=0);
     }
-    return createObject(REDIS_STRING,sdscatprintf(sdsempty(),"%lld",val));
+    if (encode) return createStringObjectFromLongLong(val);
+    return createStringObject(buf,ll2string(buf,sizeof(buf),val));
 }
 
 static robj *rdbLoadLzfStringObject(FILE*fp, int rdbver) {
@@ -2092,10 +3554,12 @@ err:
     return NULL;
 }
 
-static robj *rdbLoadStringObject(FILE*fp, int rdbver) {
+/* Load a string object. Keys, list elements and set members must be sds
+ * strings, while string values are integer encoded when possible. */
+static robj *rdbGenericLoadStringObject(FILE*fp, int rdbver, int encode) {
     int isencoded;
     uint32_t len;
-    sds val;
+    robj *o;
 
     len = rdbLoadLen(fp,rdbver,&isencoded);
     if (isencoded) {
@@ -2103,7 +3567,7 @@ static robj *rdbLoadStringObject(FILE*fp, int rdbver) {
         case REDIS_RDB_ENC_INT8:
         case REDIS_RDB_ENC_INT16:
         case REDIS_RDB_ENC_INT32:
-            return tryObjectSharing(rdbLoadIntegerObject(fp,len));
+            return tryObjectSharing(rdbLoadIntegerObject(fp,len,encode));
         case REDIS_RDB_ENC_LZF:
             return tryObjectSharing(rdbLoadLzfStringObject(fp,rdbver));
         default:
@@ -2112,12 +3576,39 @@ static robj *rdbLoadStringObject(FILE*fp, int rdbver) {
     }
 
     if (len == REDIS_RDB_LENERR) return NULL;
-    val = sdsnewlen(NULL,len);
-    if (len && fread(val,len,1,fp) == 0) {
-        sdsfree(val);
+    o = createStringObject(NULL,len);
+    if (len && fread(o->ptr,len,1,fp) == 0) {
+        decrRefCount(o);
         return NULL;
     }
-    return tryObjectSharing(createObject(REDIS_STRING,val));
+    if (encode) o = tryObjectEncoding(o);
+    return tryObjectSharing(o);
+}
+
+static robj *rdbLoadStringObject(FILE*fp, int rdbver) {
+    return rdbGenericLoadStringObject(fp,rdbver,0);
+}
+
+static robj *rdbLoadEncodedStringObject(FILE*fp, int rdbver) {
+    return rdbGenericLoadStringObject(fp,rdbver,1);
+}
+
+/* For information about double serialization check rdbSaveDoubleValue() */
+static int rdbLoadDoubleValue(FILE *fp, double *val) {
+    char buf[256];
+    unsigned char len;
+
+    if (fread(&len,1,1,fp) == 0) return -1;
+    switch(len) {
+    case 255: *val = -INFINITY; return 0;
+    case 254: *val = INFINITY; return 0;
+    case 253: *val = NAN; return 0;
+    default:
+        if (fread(buf,len,1,fp) == 0) return -1;
+        buf[len] = '\0';
+        *val = strtod(buf,NULL);
+        return 0;
+    }
 }
 // 加载硬盘的数据
 static int rdbLoad(char *filename) {
@@ -2176,24 +3667,81 @@ static int rdbLoad(char *filename) {
 
         if (type == REDIS_STRING) {
             /* Read string value */
-            if ((o = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+            if ((o = rdbLoadEncodedStringObject(fp,rdbver)) == NULL) goto eoferr;
         } else if (type == REDIS_LIST || type == REDIS_SET) {
             /* Read list/set value */
             uint32_t listlen;
 
             if ((listlen = rdbLoadLen(fp,rdbver,NULL)) == REDIS_RDB_LENERR)
                 goto eoferr;
-            o = (type == REDIS_LIST) ? createListObject() : createSetObject();
+            if (type == REDIS_LIST)
+                o = (listlen <= server.list_max_ziplist_entries) ?
+                    createZiplistObject() : createQuicklistObject();
+            else
+                o = (listlen <= server.set_max_intset_entries) ?
+                    createIntsetObject() : createSetObject();
             /* Load every single element of the list/set */
             while(listlen--) {
                 robj *ele;
 
                 if ((ele = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
                 if (type == REDIS_LIST) {
-                    if (!listAddNodeTail((list*)o->ptr,ele))
-                        oom("listAddNodeTail");
+                    listTypePush(o,ele,REDIS_TAIL);
+                    decrRefCount(ele);
+                } else {
+                    setTypeAdd(o,ele);
+                    decrRefCount(ele);
+                }
+            }
+        } else if (type == REDIS_ZSET) {
+            /* Read sorted set value */
+            uint32_t zsetlen;
+            zset *zs;
+
+            if ((zsetlen = rdbLoadLen(fp,rdbver,NULL)) == REDIS_RDB_LENERR)
+                goto eoferr;
+            o = createZsetObject();
+            zs = o->ptr;
+            /* Load every single element of the sorted set */
+            while(zsetlen--) {
+                robj *ele;
+                double score;
+                zskiplistNode *ln;
+
+                if ((ele = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+                if (rdbLoadDoubleValue(fp,&score) == -1) goto eoferr;
+                ln = zslInsert(zs->zsl,score,ele);
+                if (dictAdd(zs->dict,ele,&ln->score) == DICT_ERR)
+                    oom("dictAdd");
+            }
+        } else if (type == REDIS_HASH) {
+            /* Read hash value */
+            uint32_t hashlen;
+
+            if ((hashlen = rdbLoadLen(fp,rdbver,NULL)) == REDIS_RDB_LENERR)
+                goto eoferr;
+            o = createHashObject();
+            if (hashlen > server.hash_max_ziplist_entries)
+                hashTypeConvert(o,REDIS_ENCODING_HT);
+            /* Load every field/value pair of the hash */
+            while(hashlen--) {
+                robj *field, *value;
+
+                if ((field = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+                if ((value = rdbLoadStringObject(fp,rdbver)) == NULL) goto eoferr;
+                if (o->encoding == REDIS_ENCODING_ZIPLIST &&
+                    (sdslen(field->ptr) > server.hash_max_ziplist_value ||
+                     sdslen(value->ptr) > server.hash_max_ziplist_value))
+                    hashTypeConvert(o,REDIS_ENCODING_HT);
+                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                    o->ptr = ziplistPush(o->ptr,field->ptr,sdslen(field->ptr),
+                                         ZIPLIST_TAIL);
+                    o->ptr = ziplistPush(o->ptr,value->ptr,sdslen(value->ptr),
+                                         ZIPLIST_TAIL);
+                    decrRefCount(field);
+                    decrRefCount(value);
                 } else {
-                    if (dictAdd((dict*)o->ptr,ele,NULL) == DICT_ERR)
+                    if (dictAdd((dict*)o->ptr,field,value) == DICT_ERR)
                         oom("dictAdd");
                 }
             }
@@ -2242,8 +3790,7 @@ static void pingCommand(redisClient *c) {
 }
 
 static void echoCommand(redisClient *c) {
-    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",
-        (int)sdslen(c->argv[1]->ptr)));
+    addReplyBulkLen(c,c->argv[1]);
     addReply(c,c->argv[1]);
     addReply(c,shared.crlf);
 }
@@ -2253,6 +3800,7 @@ static void echoCommand(redisClient *c) {
 static void setGenericCommand(redisClient *c, int nx) {
     int retval;
 
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
     retval = dictAdd(c->db->dict,c->argv[1],c->argv[2]);
     if (retval == DICT_ERR) {
         if (!nx) {
@@ -2288,7 +3836,7 @@ static void getCommand(redisClient *c) {
         if (o->type != REDIS_STRING) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(o->ptr)));
+            addReplyBulkLen(c,o);
             addReply(c,o);
             addReply(c,shared.crlf);
         }
@@ -2297,6 +3845,7 @@ static void getCommand(redisClient *c) {
 
 static void getSetCommand(redisClient *c) {
     getCommand(c);
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
     if (dictAdd(c->db->dict,c->argv[1],c->argv[2]) == DICT_ERR) {
         dictReplace(c->db->dict,c->argv[1],c->argv[2]);
     } else {
@@ -2310,7 +3859,7 @@ static void getSetCommand(redisClient *c) {
 static void mgetCommand(redisClient *c) {
     int j;
   
-    addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",c->argc-1));
+    addReplyMultiBulkLen(c,c->argc-1);
     for (j = 1; j < c->argc; j++) {
         robj *o = lookupKeyRead(c->db,c->argv[j]);
         if (o == NULL) {
@@ -2319,7 +3868,7 @@ static void mgetCommand(redisClient *c) {
             if (o->type != REDIS_STRING) {
                 addReply(c,shared.nullbulk);
             } else {
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(o->ptr)));
+                addReplyBulkLen(c,o);
                 addReply(c,o);
                 addReply(c,shared.crlf);
             }
@@ -2338,6 +3887,8 @@ static void incrDecrCommand(redisClient *c, long long incr) {
     } else {
         if (o->type != REDIS_STRING) {
             value = 0;
+        } else if (o->encoding == REDIS_ENCODING_INT) {
+            value = (long)o->ptr;
         } else {
             char *eptr;
 
@@ -2346,18 +3897,23 @@ static void incrDecrCommand(redisClient *c, long long incr) {
     }
 
     value += incr;
-    o = createObject(REDIS_STRING,sdscatprintf(sdsempty(),"%lld",value));
-    retval = dictAdd(c->db->dict,c->argv[1],o);
-    if (retval == DICT_ERR) {
-        dictReplace(c->db->dict,c->argv[1],o);
-        removeExpire(c->db,c->argv[1]);
+    if (o && o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_INT &&
+        o->refcount == 1 && value >= LONG_MIN && value <= LONG_MAX)
+    {
+        /* Nobody else is referencing the counter, update it in place */
+        o->ptr = (void*)((long)value);
     } else {
-        incrRefCount(c->argv[1]);
+        o = createStringObjectFromLongLong(value);
+        retval = dictAdd(c->db->dict,c->argv[1],o);
+        if (retval == DICT_ERR) {
+            dictReplace(c->db->dict,c->argv[1],o);
+            removeExpire(c->db,c->argv[1]);
+        } else {
+            incrRefCount(c->argv[1]);
+        }
     }
     server.dirty++;
-    addReply(c,shared.colon);
-    addReply(c,o);
-    addReply(c,shared.crlf);
+    addReplyLongLong(c,value);
 }
 
 static void incrCommand(redisClient *c) {
@@ -2378,28 +3934,314 @@ static void decrbyCommand(redisClient *c) {
     incrDecrCommand(c,-incr);
 }                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                                             
 
-/* ========================= Type agnostic commands ========================= */
+/* =============================== Bit operations =========================== */
 
-static void delCommand(redisClient *c) {
-    int deleted = 0, j;
+/* Strings can be used as bitmaps: bit 0 is the most significant bit of the
+ * first byte. Setting a bit past the end of the string grows it with zero
+ * bytes, so a bitmap of N bits only takes N/8 bytes. */
 
-    for (j = 1; j < c->argc; j++) {
+#define REDIS_BITOP_AND 0
+#define REDIS_BITOP_OR 1
+#define REDIS_BITOP_XOR 2
+#define REDIS_BITOP_NOT 3
+
+/* Count the bits set in the 'count' bytes at 's'. The SSE2 kernel counts
+ * the bits of every byte of a 16 bytes block in parallel, then sums the
+ * bytes with psadbw. */
+static size_t redisPopcount(const void *s, size_t count) {
+    const unsigned char *p = s;
+    size_t bits = 0, j = 0;
+
+#ifdef __SSE2__
+    const __m128i m1 = _mm_set1_epi8(0x55);
+    const __m128i m2 = _mm_set1_epi8(0x33);
+    const __m128i m4 = _mm_set1_epi8(0x0f);
+    __m128i acc = _mm_setzero_si128();
+
+    for (; j+16 <= count; j += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(p+j));
+
+        x = _mm_sub_epi8(x,_mm_and_si128(_mm_srli_epi64(x,1),m1));
+        x = _mm_add_epi8(_mm_and_si128(x,m2),
+                         _mm_and_si128(_mm_srli_epi64(x,2),m2));
+        x = _mm_and_si128(_mm_add_epi8(x,_mm_srli_epi64(x,4)),m4);
+        acc = _mm_add_epi64(acc,_mm_sad_epu8(x,_mm_setzero_si128()));
+    }
+    {
+        uint64_t sums[2];
+
+        _mm_storeu_si128((__m128i*)sums,acc);
+        bits = sums[0]+sums[1];
+    }
+#endif
+    for (; j+8 <= count; j += 8) {
+        uint64_t w;
+
+        memcpy(&w,p+j,8);
+        bits += __builtin_popcountll(w);
+    }
+    for (; j < count; j++) bits += __builtin_popcount(p[j]);
+    return bits;
+}
+
+/* dst = dst <op> src for the first 'len' bytes. With REDIS_BITOP_NOT 'src'
+ * is not used and dst is inverted. */
+static void bitopApply(int op, unsigned char *dst, const unsigned char *src,
+                       size_t len)
+{
+    size_t j = 0;
+
+#ifdef __SSE2__
+    const __m128i ones = _mm_set1_epi8(-1);
+
+    for (; j+16 <= len; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst+j));
+        __m128i b = (op == REDIS_BITOP_NOT) ? ones :
+                    _mm_loadu_si128((const __m128i*)(src+j));
+
+        switch(op) {
+        case REDIS_BITOP_AND: a = _mm_and_si128(a,b); break;
+        case REDIS_BITOP_OR: a = _mm_or_si128(a,b); break;
+        default: a = _mm_xor_si128(a,b); break; /* XOR and NOT */
+        }
+        _mm_storeu_si128((__m128i*)(dst+j),a);
+    }
+#endif
+    for (; j < len; j++) {
+        switch(op) {
+        case REDIS_BITOP_AND: dst[j] &= src[j]; break;
+        case REDIS_BITOP_OR: dst[j] |= src[j]; break;
+        case REDIS_BITOP_XOR: dst[j] ^= src[j]; break;
+        case REDIS_BITOP_NOT: dst[j] = ~dst[j]; break;
+        }
+    }
+}
+
+/* Parse a bit offset, replying with an error if it is not a number between
+ * 0 and 2^32-1, that is a string of at most 512 MB. */
+static int getBitOffsetFromObjectOrReply(redisClient *c, robj *o, size_t *offset) {
+    char *eptr;
+    long long loffset;
+
+    errno = 0;
+    loffset = strtoll(o->ptr,&eptr,10);
+    if (sdslen(o->ptr) == 0 || *eptr != '\0' || errno == ERANGE ||
+        loffset < 0 || (unsigned long long)loffset >= (1ULL<<32))
+    {
+        addReplySds(c,sdsnew("-ERR bit offset is not an integer or out of range\r\n"));
+        return REDIS_ERR;
+    }
+    *offset = (size_t)loffset;
+    return REDIS_OK;
+}
+
+static void setbitCommand(redisClient *c) {
+    robj *o;
+    size_t bitoffset, byte;
+    int bit, on, oldbit;
+    char *value = c->argv[3]->ptr;
+
+    if (getBitOffsetFromObjectOrReply(c,c->argv[2],&bitoffset) != REDIS_OK)
+        return;
+    if ((value[0] != '0' && value[0] != '1') || value[1] != '\0') {
+        addReplySds(c,sdsnew("-ERR bit is not an integer or out of range\r\n"));
+        return;
+    }
+    on = value[0] == '1';
+
+    o = lookupKeyWrite(c->db,c->argv[1]);
+    if (o == NULL) {
+        o = createObject(REDIS_STRING,sdsempty());
+        dictAdd(c->db->dict,c->argv[1],o);
+        incrRefCount(c->argv[1]);
+    } else if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    } else if (o->encoding != REDIS_ENCODING_RAW || o->refcount > 1) {
+        /* The value is modified in place, so it must be a plain sds that
+         * nobody else references: not an integer, an embedded or a shared
+         * string. */
+        robj *decoded = getDecodedObject(o);
+
+        o = createObject(REDIS_STRING,
+                         sdsnewlen(decoded->ptr,sdslen(decoded->ptr)));
+        decrRefCount(decoded);
+        dictReplace(c->db->dict,c->argv[1],o);
+    }
+
+    byte = bitoffset >> 3;
+    o->ptr = sdsgrowzero(o->ptr,byte+1);
+    bit = 7 - (bitoffset & 0x7);
+    oldbit = (((unsigned char*)o->ptr)[byte] >> bit) & 1;
+    ((unsigned char*)o->ptr)[byte] &= ~(1 << bit);
+    ((unsigned char*)o->ptr)[byte] |= on << bit;
+    server.dirty++;
+    addReply(c,oldbit ? shared.cone : shared.czero);
+}
+
+static void getbitCommand(redisClient *c) {
+    robj *o;
+    char buf[REDIS_LONGSTR_SIZE];
+    unsigned char *p;
+    size_t bitoffset, byte, len;
+    int bit = 0;
+
+    if (getBitOffsetFromObjectOrReply(c,c->argv[2],&bitoffset) != REDIS_OK)
+        return;
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.czero);
+        return;
+    }
+    if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+
+    if (o->encoding == REDIS_ENCODING_INT) {
+        p = (unsigned char*)buf;
+        len = ll2string(buf,sizeof(buf),(long)o->ptr);
+    } else {
+        p = o->ptr;
+        len = sdslen(o->ptr);
+    }
+    byte = bitoffset >> 3;
+    if (byte < len) bit = (p[byte] >> (7 - (bitoffset & 0x7))) & 1;
+    addReply(c,bit ? shared.cone : shared.czero);
+}
+
+/* BITCOUNT key [start end], start and end are byte indexes, that can be
+ * negative to count from the end of the string like for LRANGE. */
+static void bitcountCommand(redisClient *c) {
+    robj *o;
+    char buf[REDIS_LONGSTR_SIZE];
+    unsigned char *p;
+    long start, end, len;
+
+    if (c->argc != 2 && c->argc != 4) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.czero);
+        return;
+    }
+    if (o->type != REDIS_STRING) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+
+    if (o->encoding == REDIS_ENCODING_INT) {
+        p = (unsigned char*)buf;
+        len = ll2string(buf,sizeof(buf),(long)o->ptr);
+    } else {
+        p = o->ptr;
+        len = sdslen(o->ptr);
+    }
+
+    if (c->argc == 4) {
+        start = strtol(c->argv[2]->ptr,NULL,10);
+        end = strtol(c->argv[3]->ptr,NULL,10);
+        /* convert negative indexes */
+        if (start < 0) start = len+start;
+        if (end < 0) end = len+end;
+        if (start < 0) start = 0;
+        if (end < 0) end = 0;
+        if (end >= len) end = len-1;
+    } else {
+        start = 0;
+        end = len-1;
+    }
+
+    if (start > end) {
+        addReply(c,shared.czero);
+    } else {
+        addReplyLongLong(c,redisPopcount(p+start,end-start+1));
+    }
+}
+
+/* BITOP op destkey srckey1 srckey2 ... srckeyN. Missing keys and strings
+ * shorter than the longest one are considered to be padded with zeros. */
+static void bitopCommand(redisClient *c) {
+    char *opname = c->argv[1]->ptr;
+    robj *dstkey = c->argv[2], **objects, *o;
+    unsigned long numkeys = c->argc-3, j;
+    size_t maxlen = 0;
+    int op;
+    sds res;
+
+    if (!strcasecmp(opname,"and")) op = REDIS_BITOP_AND;
+    else if (!strcasecmp(opname,"or")) op = REDIS_BITOP_OR;
+    else if (!strcasecmp(opname,"xor")) op = REDIS_BITOP_XOR;
+    else if (!strcasecmp(opname,"not")) op = REDIS_BITOP_NOT;
+    else {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    if (op == REDIS_BITOP_NOT && numkeys != 1) {
+        addReplySds(c,sdsnew("-ERR BITOP NOT must be called with a single source key.\r\n"));
+        return;
+    }
+
+    /* Lookup the source keys, keeping a decoded copy of every value */
+    objects = zmalloc(sizeof(robj*)*numkeys);
+    if (!objects) oom("bitopCommand");
+    for (j = 0; j < numkeys; j++) {
+        o = lookupKeyRead(c->db,c->argv[j+3]);
+        if (o != NULL && o->type != REDIS_STRING) {
+            while(j--) if (objects[j]) decrRefCount(objects[j]);
+            zfree(objects);
+            addReply(c,shared.wrongtypeerr);
+            return;
+        }
+        objects[j] = o ? getDecodedObject(o) : NULL;
+        if (objects[j] && sdslen(objects[j]->ptr) > maxlen)
+            maxlen = sdslen(objects[j]->ptr);
+    }
+
+    /* Start from the first key, then apply the others one at a time */
+    res = sdsnewlen(NULL,maxlen);
+    if (objects[0])
+        memcpy(res,objects[0]->ptr,sdslen(objects[0]->ptr));
+    if (op == REDIS_BITOP_NOT)
+        bitopApply(op,(unsigned char*)res,NULL,maxlen);
+    for (j = 1; j < numkeys; j++) {
+        size_t len = objects[j] ? sdslen(objects[j]->ptr) : 0;
+
+        if (len) bitopApply(op,(unsigned char*)res,objects[j]->ptr,len);
+        /* AND with the zero padding of shorter strings */
+        if (op == REDIS_BITOP_AND && len < maxlen)
+            memset(res+len,0,maxlen-len);
+    }
+    for (j = 0; j < numkeys; j++)
+        if (objects[j]) decrRefCount(objects[j]);
+    zfree(objects);
+
+    /* Store the result, an empty result deletes the target key */
+    deleteKey(c->db,dstkey);
+    if (maxlen) {
+        dictAdd(c->db->dict,dstkey,createObject(REDIS_STRING,res));
+        incrRefCount(dstkey);
+    } else {
+        sdsfree(res);
+    }
+    server.dirty++;
+    addReplyLongLong(c,maxlen);
+}
+
+/* ========================= Type agnostic commands ========================= */
+
+static void delCommand(redisClient *c) {
+    int deleted = 0, j;
+
+    for (j = 1; j < c->argc; j++) {
         if (deleteKey(c->db,c->argv[j])) {
             server.dirty++;
             deleted++;
         }
     }
-    switch(deleted) {
-    case 0:
-        addReply(c,shared.czero);
-        break;
-    case 1:
-        addReply(c,shared.cone);
-        break;
-    default:
-        addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",deleted));
-        break;
-    }
+    addReplyLongLong(c,deleted);
 }
 
 static void existsCommand(redisClient *c) {
@@ -2465,14 +4307,134 @@ static void keysCommand(redisClient *c) {
     addReply(c,shared.crlf);
 }
 
+/* Parse a long argument, replying with an error if it is not a number
+ * that fits a long. */
+static int getLongFromObjectOrReply(redisClient *c, robj *o, long *target) {
+    char *eptr;
+    long value;
+
+    errno = 0;
+    value = strtol(o->ptr,&eptr,10);
+    if (sdslen(o->ptr) == 0 || *eptr != '\0' || errno == ERANGE) {
+        addReplySds(c,sdsnew("-ERR value is not an integer or out of range\r\n"));
+        return REDIS_ERR;
+    }
+    *target = value;
+    return REDIS_OK;
+}
+
+static void scanCallback(void *privdata, const dictEntry *de) {
+    list *keys = privdata;
+    robj *key = dictGetEntryKey(de);
+
+    incrRefCount(key);
+    if (!listAddNodeTail(keys,key)) oom("listAddNodeTail");
+}
+
+/* SCAN cursor [MATCH pattern] [COUNT count]
+ *
+ * Unlike KEYS this command returns only a few keys per call, so it can be
+ * used against big data sets without blocking the server for a long time.
+ * The reply is a multi bulk whose first element is the cursor to pass to
+ * the next call, followed by the keys found. The iteration is complete
+ * when the returned cursor is zero. */
+// 基于 dictScan 的增量遍历，每次只遍历少量的桶
+static void scanCommand(redisClient *c) {
+    unsigned long cursor;
+    long count = 10, maxiterations;
+    sds pattern = NULL;
+    int plen = 0, j;
+    char *cstr = c->argv[1]->ptr, *eptr;
+    list *keys;
+    listNode *ln, *next;
+    char buf[REDIS_LONGSTR_SIZE];
+    int len;
+
+    /* strtoul() accepts negative numbers, so check the first char too */
+    errno = 0;
+    cursor = strtoul(cstr,&eptr,10);
+    if (!isdigit((unsigned char)cstr[0]) || *eptr != '\0' || errno == ERANGE) {
+        addReplySds(c,sdsnew("-ERR invalid cursor\r\n"));
+        return;
+    }
+
+    /* Parse the options */
+    j = 2;
+    while(j < c->argc) {
+        int leftargs = c->argc-j-1;
+
+        if (!strcasecmp(c->argv[j]->ptr,"match") && leftargs >= 1) {
+            pattern = c->argv[j+1]->ptr;
+            plen = sdslen(pattern);
+            if (pattern[0] == '*' && pattern[1] == '\0') pattern = NULL;
+            j++;
+        } else if (!strcasecmp(c->argv[j]->ptr,"count") && leftargs >= 1) {
+            if (getLongFromObjectOrReply(c,c->argv[j+1],&count) != REDIS_OK)
+                return;
+            if (count < 1) {
+                addReply(c,shared.syntaxerr);
+                return;
+            }
+            /* A bigger COUNT would block the server like KEYS does */
+            if (count > REDIS_SCAN_MAX_COUNT) count = REDIS_SCAN_MAX_COUNT;
+            j++;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+        j++;
+    }
+
+    /* Visit buckets until 'count' keys are collected. Most buckets may be
+     * empty when the table is sparse, so the number of calls is capped as
+     * well: a client may get fewer keys, or none, with a non zero cursor.
+     * As COUNT is clamped the number of calls is bounded as well. */
+    keys = listCreate();
+    if (!keys) oom("listCreate");
+    listSetFreeMethod(keys,(void (*)(void*)) decrRefCount);
+    maxiterations = count*10;
+    do {
+        cursor = dictScan(c->db->dict,cursor,scanCallback,keys);
+    } while(cursor && maxiterations-- && (long)listLength(keys) < count);
+
+    /* Filter the keys that don't match or are expired */
+    ln = listFirst(keys);
+    while(ln) {
+        robj *keyobj = listNodeValue(ln);
+        sds key = keyobj->ptr;
+
+        next = listNextNode(ln);
+        if ((pattern && !stringmatchlen(pattern,plen,key,sdslen(key),0)) ||
+            expireIfNeeded(c->db,keyobj))
+        {
+            listDelNode(keys,ln);
+        }
+        ln = next;
+    }
+
+    addReplyMultiBulkLen(c,1+listLength(keys));
+    len = ll2string(buf,sizeof(buf),cursor);
+    addReplyLongLongWithPrefix(c,len,'$');
+    addReplyString(c,buf,len);
+    addReply(c,shared.crlf);
+    ln = listFirst(keys);
+    while(ln) {
+        robj *keyobj = listNodeValue(ln);
+
+        addReplyBulkLen(c,keyobj);
+        addReply(c,keyobj);
+        addReply(c,shared.crlf);
+        ln = listNextNode(ln);
+    }
+    listRelease(keys);
+}
+
 static void dbsizeCommand(redisClient *c) {
-    addReplySds(c,
-        sdscatprintf(sdsempty(),":%lu\r\n",dictSize(c->db->dict)));
+    addReplyLongLong(c,dictSize(c->db->dict));
 }
 
 static void lastsaveCommand(redisClient *c) {
-    addReplySds(c,
-        sdscatprintf(sdsempty(),":%lu\r\n",server.lastsave));
+    addReplyLongLong(c,server.lastsave);
 }
 
 static void typeCommand(redisClient *c) {
@@ -2487,6 +4449,8 @@ static void typeCommand(redisClient *c) {
         case REDIS_STRING: type = "+string"; break;
         case REDIS_LIST: type = "+list"; break;
         case REDIS_SET: type = "+set"; break;
+        case REDIS_ZSET: type = "+zset"; break;
+        case REDIS_HASH: type = "+hash"; break;
         default: type = "unknown"; break;
         }
     }
@@ -2618,35 +4582,200 @@ static void moveCommand(redisClient *c) {
 }
 
 /* =================================== Lists ================================ */
+
+/* Lists are created with the ZIPLIST encoding, and converted to a
+ * quicklist once they have more than list-max-ziplist-entries elements or
+ * an element longer than list-max-ziplist-value bytes. The nodes of the
+ * quicklist hold up to list-max-ziplist-entries elements as well. The
+ * listType functions hide the encoding to the commands. */
+
+/* Return a new string object with the value of a ziplist entry. Integers
+ * are turned back into strings as list elements are expected to be sds
+ * encoded, see lookupKeyByPattern(). */
+static robj *listTypeValueObject(unsigned char *vstr, unsigned int vlen, long long vlong) {
+    char buf[REDIS_LONGSTR_SIZE];
+
+    if (vstr) return createStringObject((char*)vstr,vlen);
+    return createStringObject(buf,ll2string(buf,sizeof(buf),vlong));
+}
+
+static robj *listTypeZiplistValue(unsigned char *p) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    ziplistGet(p,&vstr,&vlen,&vlong);
+    return listTypeValueObject(vstr,vlen,vlong);
+}
+
+/* The ziplist becomes the first node of the quicklist as it is */
+static void listTypeConvert(robj *subject, int enc) {
+    quicklist *ql;
+
+    assert(subject->encoding == REDIS_ENCODING_ZIPLIST &&
+           enc == REDIS_ENCODING_QUICKLIST);
+    ql = quicklistCreate(server.list_max_ziplist_entries);
+    quicklistAppendZiplist(ql,subject->ptr);
+    subject->ptr = ql;
+    subject->encoding = REDIS_ENCODING_QUICKLIST;
+}
+
+// 元素太长时转成quicklist
+static void listTypeTryConversion(robj *subject, robj *value) {
+    if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
+    if (sdsEncodedObject(value) &&
+        sdslen(value->ptr) > server.list_max_ziplist_value)
+        listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
+}
+
+static void listTypePush(robj *subject, robj *value, int where) {
+    listTypeTryConversion(subject,value);
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
+        ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
+        listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
+
+    value = getDecodedObject(value);
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+        int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
+
+        subject->ptr = ziplistPush(subject->ptr,value->ptr,
+                                   sdslen(value->ptr),pos);
+    } else {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+
+        quicklistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
+    }
+    decrRefCount(value);
+}
+
+/* Remove an element from the head or the tail of the list and return it,
+ * or NULL if the list is empty. The caller owns the returned object. */
+static robj *listTypePop(robj *subject, int where) {
+    robj *value = NULL;
+    int index = (where == REDIS_HEAD) ? 0 : -1;
+
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *p = ziplistIndex(subject->ptr,index);
+
+        if (p != NULL) {
+            value = listTypeZiplistValue(p);
+            subject->ptr = ziplistDelete(subject->ptr,&p);
+        }
+    } else {
+        quicklistEntry qe;
+
+        if (quicklistIndex(subject->ptr,index,&qe)) {
+            value = listTypeValueObject(qe.value,qe.sz,qe.longval);
+            quicklistDelRange(subject->ptr,index,1);
+        }
+    }
+    return value;
+}
+
+static unsigned long listTypeLength(robj *subject) {
+    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
+        return ziplistLen(subject->ptr);
+    return quicklistCount((quicklist*)subject->ptr);
+}
+
+/* Create an iterator starting at 'index' (negative indexes start from the
+ * tail) and moving towards the tail or the head of the list. */
+static listTypeIterator *listTypeInitIterator(robj *subject, int index, unsigned char direction) {
+    listTypeIterator *li = zmalloc(sizeof(*li));
+
+    if (!li) oom("listTypeInitIterator");
+    li->subject = subject;
+    li->encoding = subject->encoding;
+    li->direction = direction;
+    li->zi = NULL;
+    li->qi = NULL;
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        li->zi = ziplistIndex(subject->ptr,index);
+    } else {
+        int dir = (direction == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+
+        li->qi = quicklistGetIteratorAtIdx(subject->ptr,dir,index);
+    }
+    return li;
+}
+
+static void listTypeReleaseIterator(listTypeIterator *li) {
+    if (li->qi) quicklistReleaseIterator(li->qi);
+    zfree(li);
+}
+
+/* Store the current element in 'entry' and advance the iterator. Returns
+ * 0 when there are no more elements. */
+static int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
+    /* The list must not be converted while iterating */
+    assert(li->subject->encoding == li->encoding);
+
+    entry->li = li;
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        entry->zi = li->zi;
+        if (entry->zi == NULL) return 0;
+        if (li->direction == REDIS_TAIL)
+            li->zi = ziplistNext(li->subject->ptr,li->zi);
+        else
+            li->zi = ziplistPrev(li->subject->ptr,li->zi);
+        return 1;
+    }
+    if (!quicklistNext(li->qi,&entry->qe)) return 0;
+    entry->zi = entry->qe.zi;
+    return 1;
+}
+
+/* Return the element of the entry. The caller owns the returned object. */
+static robj *listTypeGet(listTypeEntry *entry) {
+    quicklistEntry *qe = &entry->qe;
+
+    if (entry->li->encoding == REDIS_ENCODING_ZIPLIST)
+        return listTypeZiplistValue(entry->zi);
+    return listTypeValueObject(qe->value,qe->sz,qe->longval);
+}
+
+// 比较当前元素和字符串对象o，两种编码的元素都保存在ziplist里
+static int listTypeEqual(listTypeEntry *entry, robj *o) {
+    int equal;
+
+    o = getDecodedObject(o);
+    equal = ziplistCompare(entry->zi,o->ptr,sdslen(o->ptr));
+    decrRefCount(o);
+    return equal;
+}
+
+/* Delete the element of the entry, the iterator stays valid */
+static void listTypeDelete(listTypeEntry *entry) {
+    listTypeIterator *li = entry->li;
+
+    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *p = entry->zi;
+
+        li->subject->ptr = ziplistDelete(li->subject->ptr,&p);
+        /* p now points to the element that followed the deleted one, or
+         * to the end of the ziplist */
+        if (li->direction == REDIS_TAIL)
+            li->zi = ziplistGet(p,NULL,NULL,NULL) ? p : NULL;
+        else
+            li->zi = ziplistPrev(li->subject->ptr,p);
+    } else {
+        quicklistDelEntry(li->qi,&entry->qe);
+    }
+}
+
 static void pushGenericCommand(redisClient *c, int where) {
     robj *lobj;
-    list *list;
 
     lobj = lookupKeyWrite(c->db,c->argv[1]);
     if (lobj == NULL) {
-        lobj = createListObject();
-        list = lobj->ptr;
-        if (where == REDIS_HEAD) {
-            if (!listAddNodeHead(list,c->argv[2])) oom("listAddNodeHead");
-        } else {
-            if (!listAddNodeTail(list,c->argv[2])) oom("listAddNodeTail");
-        }
+        lobj = createZiplistObject();
         dictAdd(c->db->dict,c->argv[1],lobj);
         incrRefCount(c->argv[1]);
-        incrRefCount(c->argv[2]);
-    } else {
-        if (lobj->type != REDIS_LIST) {
-            addReply(c,shared.wrongtypeerr);
-            return;
-        }
-        list = lobj->ptr;
-        if (where == REDIS_HEAD) {
-            if (!listAddNodeHead(list,c->argv[2])) oom("listAddNodeHead");
-        } else {
-            if (!listAddNodeTail(list,c->argv[2])) oom("listAddNodeTail");
-        }
-        incrRefCount(c->argv[2]);
+    } else if (lobj->type != REDIS_LIST) {
+        addReply(c,shared.wrongtypeerr);
+        return;
     }
+    listTypePush(lobj,c->argv[2],where);
     server.dirty++;
     addReply(c,shared.ok);
 }
@@ -2661,7 +4790,6 @@ static void rpushCommand(redisClient *c) {
 
 static void llenCommand(redisClient *c) {
     robj *o;
-    list *l;
     
     o = lookupKeyRead(c->db,c->argv[1]);
     if (o == NULL) {
@@ -2671,8 +4799,7 @@ static void llenCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            l = o->ptr;
-            addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",listLength(l)));
+            addReplyLongLong(c,listTypeLength(o));
         }
     }
 }
@@ -2688,18 +4815,19 @@ static void lindexCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            
-            ln = listIndex(list, index);
-            if (ln == NULL) {
+            listTypeIterator *li = listTypeInitIterator(o,index,REDIS_TAIL);
+            listTypeEntry entry;
+
+            if (!listTypeNext(li,&entry)) {
                 addReply(c,shared.nullbulk);
             } else {
-                robj *ele = listNodeValue(ln);
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(ele->ptr)));
+                robj *ele = listTypeGet(&entry);
+                addReplyBulkLen(c,ele);
                 addReply(c,ele);
                 addReply(c,shared.crlf);
+                decrRefCount(ele);
             }
+            listTypeReleaseIterator(li);
         }
     }
 }
@@ -2715,20 +4843,36 @@ static void lsetCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            
-            ln = listIndex(list, index);
-            if (ln == NULL) {
-                addReply(c,shared.outofrangeerr);
+            listTypeTryConversion(o,c->argv[3]);
+            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                unsigned char *p = ziplistIndex(o->ptr,index);
+
+                if (p == NULL) {
+                    addReply(c,shared.outofrangeerr);
+                } else {
+                    robj *value = getDecodedObject(c->argv[3]);
+
+                    o->ptr = ziplistDelete(o->ptr,&p);
+                    o->ptr = ziplistInsert(o->ptr,p,value->ptr,
+                                           sdslen(value->ptr));
+                    decrRefCount(value);
+                    addReply(c,shared.ok);
+                    server.dirty++;
+                }
             } else {
-                robj *ele = listNodeValue(ln);
+                quicklistEntry qe;
 
-                decrRefCount(ele);
-                listNodeValue(ln) = c->argv[3];
-                incrRefCount(c->argv[3]);
-                addReply(c,shared.ok);
-                server.dirty++;
+                if (!quicklistIndex(o->ptr,index,&qe)) {
+                    addReply(c,shared.outofrangeerr);
+                } else {
+                    robj *value = getDecodedObject(c->argv[3]);
+
+                    quicklistReplaceEntry(o->ptr,&qe,value->ptr,
+                                          sdslen(value->ptr));
+                    decrRefCount(value);
+                    addReply(c,shared.ok);
+                    server.dirty++;
+                }
             }
         }
     }
@@ -2744,22 +4888,15 @@ static void popGenericCommand(redisClient *c, int where) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-
-            if (where == REDIS_HEAD)
-                ln = listFirst(list);
-            else
-                ln = listLast(list);
+            robj *ele = listTypePop(o,where);
 
-            if (ln == NULL) {
+            if (ele == NULL) {
                 addReply(c,shared.nullbulk);
             } else {
-                robj *ele = listNodeValue(ln);
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(ele->ptr)));
+                addReplyBulkLen(c,ele);
                 addReply(c,ele);
                 addReply(c,shared.crlf);
-                listDelNode(list,ln);
+                decrRefCount(ele);
                 server.dirty++;
             }
         }
@@ -2786,9 +4923,9 @@ static void lrangeCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            int llen = listLength(list);
+            listTypeIterator *li;
+            listTypeEntry entry;
+            int llen = listTypeLength(o);
             int rangelen, j;
             robj *ele;
 
@@ -2808,15 +4945,17 @@ static void lrangeCommand(redisClient *c) {
             rangelen = (end-start)+1;
 
             /* Return the result in form of a multi-bulk reply */
-            ln = listIndex(list, start);
-            addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",rangelen));
+            li = listTypeInitIterator(o,start,REDIS_TAIL);
+            addReplyMultiBulkLen(c,rangelen);
             for (j = 0; j < rangelen; j++) {
-                ele = listNodeValue(ln);
-                addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",(int)sdslen(ele->ptr)));
+                listTypeNext(li,&entry);
+                ele = listTypeGet(&entry);
+                addReplyBulkLen(c,ele);
                 addReply(c,ele);
                 addReply(c,shared.crlf);
-                ln = ln->next;
+                decrRefCount(ele);
             }
+            listTypeReleaseIterator(li);
         }
     }
 }
@@ -2833,10 +4972,8 @@ static void ltrimCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln;
-            int llen = listLength(list);
-            int j, ltrim, rtrim;
+            int llen = listTypeLength(o);
+            int ltrim, rtrim;
 
             /* convert negative indexes */
             if (start < 0) start = llen+start;
@@ -2856,13 +4993,12 @@ static void ltrimCommand(redisClient *c) {
             }
 
             /* Remove list elements to perform the trim */
-            for (j = 0; j < ltrim; j++) {
-                ln = listFirst(list);
-                listDelNode(list,ln);
-            }
-            for (j = 0; j < rtrim; j++) {
-                ln = listLast(list);
-                listDelNode(list,ln);
+            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                if (ltrim) o->ptr = ziplistDeleteRange(o->ptr,0,ltrim);
+                if (rtrim) o->ptr = ziplistDeleteRange(o->ptr,-rtrim,rtrim);
+            } else {
+                quicklistDelRange(o->ptr,0,ltrim);
+                quicklistDelRange(o->ptr,-rtrim,rtrim);
             }
             addReply(c,shared.ok);
             server.dirty++;
@@ -2880,53 +5016,203 @@ static void lremCommand(redisClient *c) {
         if (o->type != REDIS_LIST) {
             addReply(c,shared.wrongtypeerr);
         } else {
-            list *list = o->ptr;
-            listNode *ln, *next;
+            listTypeIterator *li;
+            listTypeEntry entry;
             int toremove = atoi(c->argv[2]->ptr);
             int removed = 0;
-            int fromtail = 0;
 
             if (toremove < 0) {
                 toremove = -toremove;
-                fromtail = 1;
+                li = listTypeInitIterator(o,-1,REDIS_HEAD);
+            } else {
+                li = listTypeInitIterator(o,0,REDIS_TAIL);
             }
-            ln = fromtail ? list->tail : list->head;
-            while (ln) {
-                robj *ele = listNodeValue(ln);
-
-                next = fromtail ? ln->prev : ln->next;
-                if (sdscmp(ele->ptr,c->argv[3]->ptr) == 0) {
-                    listDelNode(list,ln);
+            while (listTypeNext(li,&entry)) {
+                if (listTypeEqual(&entry,c->argv[3])) {
+                    listTypeDelete(&entry);
                     server.dirty++;
                     removed++;
                     if (toremove && removed == toremove) break;
                 }
-                ln = next;
             }
-            addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",removed));
+            listTypeReleaseIterator(li);
+            addReplyLongLong(c,removed);
         }
     }
 }
 
 /* ==================================== Sets ================================ */
 
-static void saddCommand(redisClient *c) {
-    robj *set;
-
-    set = lookupKeyWrite(c->db,c->argv[1]);
-    if (set == NULL) {
-        set = createSetObject();
-        dictAdd(c->db->dict,c->argv[1],set);
-        incrRefCount(c->argv[1]);
-    } else {
-        if (set->type != REDIS_SET) {
-            addReply(c,shared.wrongtypeerr);
-            return;
-        }
+/* Sets made only of integers are stored in an intset, a sorted array of
+ * integers that is a lot more compact than a dict with an object for every
+ * member. A set is converted to a dict once it gets a member that is not
+ * an integer, or more than set-max-intset-entries members. Lookups in the
+ * intset are a binary search, so this limit can be larger than the ones
+ * of the ziplist encodings. */
+
+/* Check if 'o' is an integer, integer encoded or as the canonical string
+ * representation of one. If so the value is stored in *llval and REDIS_OK
+ * is returned, otherwise REDIS_ERR is returned. */
+static int isObjectRepresentableAsLongLong(robj *o, long long *llval) {
+    long value;
+
+    if (o->encoding == REDIS_ENCODING_INT) {
+        value = (long)o->ptr;
+    } else if (isStringRepresentableAsLong(o->ptr,&value) == REDIS_ERR) {
+        return REDIS_ERR;
     }
-    if (dictAdd(set->ptr,c->argv[2],NULL) == DICT_OK) {
-        incrRefCount(c->argv[2]);
-        server.dirty++;
+    if (llval) *llval = value;
+    return REDIS_OK;
+}
+
+/* Create an empty set, with the encoding needed to store 'value' */
+static robj *setTypeCreate(robj *value) {
+    if (isObjectRepresentableAsLongLong(value,NULL) == REDIS_OK)
+        return createIntsetObject();
+    return createSetObject();
+}
+
+static void setTypeConvert(robj *o, int enc) {
+    intset *is = o->ptr;
+    dict *d;
+    int64_t value;
+    uint32_t j;
+
+    assert(o->encoding == REDIS_ENCODING_INTSET && enc == REDIS_ENCODING_HT);
+    d = dictCreate(&setDictType,NULL);
+    if (!d) oom("dictCreate");
+    dictExpand(d,intsetLen(is));
+    for (j = 0; intsetGet(is,j,&value); j++) {
+        char buf[REDIS_LONGSTR_SIZE];
+        robj *ele = createStringObject(buf,ll2string(buf,sizeof(buf),value));
+
+        if (dictAdd(d,ele,NULL) == DICT_ERR) oom("dictAdd");
+    }
+    zfree(is);
+    o->ptr = d;
+    o->encoding = REDIS_ENCODING_HT;
+}
+
+/* Add 'value' to the set. Returns 1 if it was added, 0 if it was already
+ * a member. */
+static int setTypeAdd(robj *o, robj *value) {
+    long long llval;
+
+    if (o->encoding == REDIS_ENCODING_INTSET) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == REDIS_OK) {
+            int added;
+
+            o->ptr = intsetAdd(o->ptr,llval,&added);
+            if (added && intsetLen(o->ptr) > server.set_max_intset_entries)
+                setTypeConvert(o,REDIS_ENCODING_HT);
+            return added;
+        }
+        setTypeConvert(o,REDIS_ENCODING_HT);
+    }
+    /* The members of a dict set are sds strings */
+    value = getDecodedObject(value);
+    if (dictAdd(o->ptr,value,NULL) == DICT_OK) return 1;
+    decrRefCount(value);
+    return 0;
+}
+
+/* Remove 'value' from the set. Returns 1 if it was a member. */
+static int setTypeRemove(robj *o, robj *value) {
+    long long llval;
+    int removed;
+
+    if (o->encoding == REDIS_ENCODING_INTSET) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == REDIS_ERR)
+            return 0;
+        o->ptr = intsetRemove(o->ptr,llval,&removed);
+    } else {
+        value = getDecodedObject(value);
+        removed = dictDelete(o->ptr,value) == DICT_OK;
+        decrRefCount(value);
+    }
+    return removed;
+}
+
+static int setTypeIsMember(robj *o, robj *value) {
+    long long llval;
+    int found;
+
+    if (o->encoding == REDIS_ENCODING_INTSET) {
+        if (isObjectRepresentableAsLongLong(value,&llval) == REDIS_ERR)
+            return 0;
+        found = intsetFind(o->ptr,llval);
+    } else {
+        value = getDecodedObject(value);
+        found = dictFind(o->ptr,value) != NULL;
+        decrRefCount(value);
+    }
+    return found;
+}
+
+static unsigned long setTypeSize(robj *o) {
+    if (o->encoding == REDIS_ENCODING_INTSET)
+        return intsetLen(o->ptr);
+    else
+        return dictSize((dict*)o->ptr);
+}
+
+static setTypeIterator *setTypeInitIterator(robj *subject) {
+    setTypeIterator *si = zmalloc(sizeof(*si));
+
+    if (!si) oom("setTypeInitIterator");
+    si->subject = subject;
+    si->encoding = subject->encoding;
+    si->ii = 0;
+    si->di = NULL;
+    if (si->encoding == REDIS_ENCODING_HT) {
+        si->di = dictGetIterator(subject->ptr);
+        if (!si->di) oom("dictGetIterator");
+    }
+    return si;
+}
+
+/* Return the next member as a string object, or NULL when done. The
+ * caller owns a reference to the returned object. */
+static robj *setTypeNext(setTypeIterator *si) {
+    robj *ele;
+
+    if (si->encoding == REDIS_ENCODING_INTSET) {
+        char buf[REDIS_LONGSTR_SIZE];
+        int64_t value;
+
+        if (!intsetGet(si->subject->ptr,si->ii++,&value)) return NULL;
+        ele = createStringObject(buf,ll2string(buf,sizeof(buf),value));
+    } else {
+        dictEntry *de = dictNext(si->di);
+
+        if (de == NULL) return NULL;
+        ele = dictGetEntryKey(de);
+        incrRefCount(ele);
+    }
+    return ele;
+}
+
+static void setTypeReleaseIterator(setTypeIterator *si) {
+    if (si->di) dictReleaseIterator(si->di);
+    zfree(si);
+}
+
+static void saddCommand(redisClient *c) {
+    robj *set;
+
+    set = lookupKeyWrite(c->db,c->argv[1]);
+    if (set == NULL) {
+        set = setTypeCreate(c->argv[2]);
+        dictAdd(c->db->dict,c->argv[1],set);
+        incrRefCount(c->argv[1]);
+    } else {
+        if (set->type != REDIS_SET) {
+            addReply(c,shared.wrongtypeerr);
+            return;
+        }
+    }
+    if (setTypeAdd(set,c->argv[2])) {
+        server.dirty++;
         addReply(c,shared.cone);
     } else {
         addReply(c,shared.czero);
@@ -2944,7 +5230,7 @@ static void sremCommand(redisClient *c) {
             addReply(c,shared.wrongtypeerr);
             return;
         }
-        if (dictDelete(set->ptr,c->argv[2]) == DICT_OK) {
+        if (setTypeRemove(set,c->argv[2])) {
             server.dirty++;
             addReply(c,shared.cone);
         } else {
@@ -2959,291 +5245,1264 @@ static void smoveCommand(redisClient *c) {
     srcset = lookupKeyWrite(c->db,c->argv[1]);
     dstset = lookupKeyWrite(c->db,c->argv[2]);
 
-    /* If the source key does not exist return 0, if it's of the wrong type
-     * raise an error */
-    if (srcset == NULL || srcset->type != REDIS_SET) {
-        addReply(c, srcset ? shared.wrongtypeerr : shared.czero);
+    /* If the source key does not exist return 0, if it's of the wrong type
+     * raise an error */
+    if (srcset == NULL || srcset->type != REDIS_SET) {
+        addReply(c, srcset ? shared.wrongtypeerr : shared.czero);
+        return;
+    }
+    /* Error if the destination key is not a set as well */
+    if (dstset && dstset->type != REDIS_SET) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    /* Remove the element from the source set */
+    if (!setTypeRemove(srcset,c->argv[3])) {
+        /* Key not found in the src set! return zero */
+        addReply(c,shared.czero);
+        return;
+    }
+    server.dirty++;
+    /* Add the element to the destination set */
+    if (!dstset) {
+        dstset = setTypeCreate(c->argv[3]);
+        dictAdd(c->db->dict,c->argv[2],dstset);
+        incrRefCount(c->argv[2]);
+    }
+    setTypeAdd(dstset,c->argv[3]);
+    addReply(c,shared.cone);
+}
+
+static void sismemberCommand(redisClient *c) {
+    robj *set;
+
+    set = lookupKeyRead(c->db,c->argv[1]);
+    if (set == NULL) {
+        addReply(c,shared.czero);
+    } else {
+        if (set->type != REDIS_SET) {
+            addReply(c,shared.wrongtypeerr);
+            return;
+        }
+        if (setTypeIsMember(set,c->argv[2]))
+            addReply(c,shared.cone);
+        else
+            addReply(c,shared.czero);
+    }
+}
+
+static void scardCommand(redisClient *c) {
+    robj *o;
+    
+    o = lookupKeyRead(c->db,c->argv[1]);
+    if (o == NULL) {
+        addReply(c,shared.czero);
+        return;
+    } else {
+        if (o->type != REDIS_SET) {
+            addReply(c,shared.wrongtypeerr);
+        } else {
+            addReplyLongLong(c,setTypeSize(o));
+        }
+    }
+}
+
+static int qsortCompareSetsByCardinality(const void *s1, const void *s2) {
+    robj **o1 = (void*) s1, **o2 = (void*) s2;
+    unsigned long l1 = setTypeSize(*o1), l2 = setTypeSize(*o2);
+
+    return (l1 > l2)-(l1 < l2);
+}
+
+/* Intersect sets that are all intsets, merging the sorted arrays from the
+ * smallest set to the largest, so that the partial result only shrinks.
+ * Returns a new intset. */
+static intset *sinterIntsets(robj **sets, int setsnum) {
+    intset *is = sets[0]->ptr, *tmp;
+    int j;
+
+    if (setsnum == 1) {
+        tmp = zmalloc(intsetBlobLen(is));
+        if (!tmp) oom("sinterIntsets");
+        memcpy(tmp,is,intsetBlobLen(is));
+        return tmp;
+    }
+    for (j = 1; j < setsnum; j++) {
+        tmp = intsetIntersect(is,sets[j]->ptr);
+        if (j > 1) zfree(is);
+        is = tmp;
+        if (intsetLen(is) == 0) break;
+    }
+    return is;
+}
+
+static void sinterGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey) {
+    robj **sets = zmalloc(sizeof(robj*)*setsnum);
+    setTypeIterator *si;
+    robj *ele, *lenobj = NULL, *dstset = NULL;
+    int j, cardinality = 0;
+
+    if (!sets) oom("sinterGenericCommand");
+    for (j = 0; j < setsnum; j++) {
+        robj *setobj;
+
+        setobj = dstkey ?
+                    lookupKeyWrite(c->db,setskeys[j]) :
+                    lookupKeyRead(c->db,setskeys[j]);
+        if (!setobj) {
+            zfree(sets);
+            if (dstkey) {
+                deleteKey(c->db,dstkey);
+                addReply(c,shared.ok);
+            } else {
+                addReply(c,shared.nullmultibulk);
+            }
+            return;
+        }
+        if (setobj->type != REDIS_SET) {
+            zfree(sets);
+            addReply(c,shared.wrongtypeerr);
+            return;
+        }
+        sets[j] = setobj;
+    }
+    /* Sort sets from the smallest to largest, this will improve our
+     * algorithm's performace */
+    qsort(sets,setsnum,sizeof(robj*),qsortCompareSetsByCardinality);
+
+    for (j = 0; j < setsnum; j++)
+        if (sets[j]->encoding != REDIS_ENCODING_INTSET) break;
+    if (j == setsnum) {
+        intset *is = sinterIntsets(sets,setsnum);
+
+        if (!dstkey) {
+            int64_t value;
+            uint32_t k;
+
+            addReplyMultiBulkLen(c,intsetLen(is));
+            for (k = 0; intsetGet(is,k,&value); k++)
+                addReplyBulkLongLong(c,value);
+            zfree(is);
+        } else {
+            dstset = createIntsetObject();
+            zfree(dstset->ptr);
+            dstset->ptr = is;
+        }
+    } else {
+        /* The first thing we should output is the total number of
+         * elements... since this is a multi-bulk write, but at this stage
+         * we don't know the intersection set size, so we use a trick,
+         * append an empty object to the output list and save the pointer
+         * to later modify it with the right length */
+        if (!dstkey) {
+            lenobj = createObject(REDIS_STRING,NULL);
+            addReply(c,lenobj);
+            decrRefCount(lenobj);
+        } else {
+            /* If we have a target key where to store the resulting set
+             * create this key with an empty set inside */
+            dstset = createIntsetObject();
+        }
+
+        /* Iterate all the elements of the first (smallest) set, and test
+         * the element against all the other sets, if at least one set does
+         * not include the element it is discarded */
+        si = setTypeInitIterator(sets[0]);
+        while((ele = setTypeNext(si)) != NULL) {
+            for (j = 1; j < setsnum; j++)
+                if (!setTypeIsMember(sets[j],ele)) break;
+            /* Skip the member if at least one set does not contain it */
+            if (j == setsnum) {
+                if (!dstkey) {
+                    addReplyBulk(c,ele);
+                    cardinality++;
+                } else {
+                    setTypeAdd(dstset,ele);
+                }
+            }
+            decrRefCount(ele);
+        }
+        setTypeReleaseIterator(si);
+        if (!dstkey)
+            lenobj->ptr = sdscatprintf(sdsempty(),"*%d\r\n",cardinality);
+    }
+
+    if (dstkey) {
+        /* Store the resulting set into the target */
+        deleteKey(c->db,dstkey);
+        dictAdd(c->db->dict,dstkey,dstset);
+        incrRefCount(dstkey);
+        addReplyLongLong(c,setTypeSize(dstset));
+        server.dirty++;
+    }
+    zfree(sets);
+}
+
+static void sinterCommand(redisClient *c) {
+    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+}
+
+static void sinterstoreCommand(redisClient *c) {
+    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+}
+
+#define REDIS_OP_UNION 0
+#define REDIS_OP_DIFF 1
+
+static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey, int op) {
+    robj **sets = zmalloc(sizeof(robj*)*setsnum);
+    setTypeIterator *si;
+    robj *ele, *dstset = NULL;
+    int j, cardinality = 0;
+
+    if (!sets) oom("sunionDiffGenericCommand");
+    for (j = 0; j < setsnum; j++) {
+        robj *setobj;
+
+        setobj = dstkey ?
+                    lookupKeyWrite(c->db,setskeys[j]) :
+                    lookupKeyRead(c->db,setskeys[j]);
+        if (!setobj) {
+            sets[j] = NULL;
+            continue;
+        }
+        if (setobj->type != REDIS_SET) {
+            zfree(sets);
+            addReply(c,shared.wrongtypeerr);
+            return;
+        }
+        sets[j] = setobj;
+    }
+
+    /* We need a temp set object to store our union. If the dstkey
+     * is not NULL (that is, we are inside an SUNIONSTORE operation) then
+     * this set object will be the resulting object to set into the target key*/
+    dstset = createIntsetObject();
+
+    /* Iterate all the elements of all the sets, add every element a single
+     * time to the result set */
+    for (j = 0; j < setsnum; j++) {
+        if (op == REDIS_OP_DIFF && j == 0 && !sets[j]) break; /* result set is empty */
+        if (!sets[j]) continue; /* non existing keys are like empty sets */
+
+        si = setTypeInitIterator(sets[j]);
+        while((ele = setTypeNext(si)) != NULL) {
+            /* setTypeAdd will not add the same element multiple times */
+            if (op == REDIS_OP_UNION || j == 0) {
+                if (setTypeAdd(dstset,ele)) cardinality++;
+            } else if (op == REDIS_OP_DIFF) {
+                if (setTypeRemove(dstset,ele)) cardinality--;
+            }
+            decrRefCount(ele);
+        }
+        setTypeReleaseIterator(si);
+
+        if (op == REDIS_OP_DIFF && cardinality == 0) break; /* result set is empty */
+    }
+
+    /* Output the content of the resulting set, if not in STORE mode */
+    if (!dstkey) {
+        addReplyMultiBulkLen(c,cardinality);
+        si = setTypeInitIterator(dstset);
+        while((ele = setTypeNext(si)) != NULL) {
+            addReplyBulk(c,ele);
+            decrRefCount(ele);
+        }
+        setTypeReleaseIterator(si);
+    } else {
+        /* If we have a target key where to store the resulting set
+         * create this key with the result set inside */
+        deleteKey(c->db,dstkey);
+        dictAdd(c->db->dict,dstkey,dstset);
+        incrRefCount(dstkey);
+    }
+
+    /* Cleanup */
+    if (!dstkey) {
+        decrRefCount(dstset);
+    } else {
+        addReplyLongLong(c,setTypeSize(dstset));
+        server.dirty++;
+    }
+    zfree(sets);
+}
+
+static void sunionCommand(redisClient *c) {
+    sunionDiffGenericCommand(c,c->argv+1,c->argc-1,NULL,REDIS_OP_UNION);
+}
+
+static void sunionstoreCommand(redisClient *c) {
+    sunionDiffGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],REDIS_OP_UNION);
+}
+
+static void sdiffCommand(redisClient *c) {
+    sunionDiffGenericCommand(c,c->argv+1,c->argc-1,NULL,REDIS_OP_DIFF);
+}
+
+static void sdiffstoreCommand(redisClient *c) {
+    sunionDiffGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],REDIS_OP_DIFF);
+}
+
+/* ================================ Sorted sets ============================= */
+
+/* This skiplist implementation is almost a C translation of the original
+ * algorithm described by William Pugh in "Skip Lists: A Probabilistic
+ * Alternative to Balanced Trees", modified in three ways:
+ * a) this implementation allows for repeated scores.
+ * b) the comparison is not just by key (our 'score') but by satellite data.
+ * c) there is a back pointer, so it's a doubly linked list with the back
+ * pointers being only at "level 1". This allows to traverse the list
+ * from tail to head, useful for ZREVRANGE. */
+
+static zskiplistNode *zslCreateNode(int level, double score, robj *obj) {
+    zskiplistNode *zn = zmalloc(sizeof(*zn)+level*sizeof(struct zskiplistLevel));
+
+    if (!zn) oom("zslCreateNode");
+    zn->score = score;
+    zn->obj = obj;
+    return zn;
+}
+
+static zskiplist *zslCreate(void) {
+    int j;
+    zskiplist *zsl;
+
+    zsl = zmalloc(sizeof(*zsl));
+    if (!zsl) oom("zslCreate");
+    zsl->level = 1;
+    zsl->length = 0;
+    zsl->header = zslCreateNode(ZSKIPLIST_MAXLEVEL,0,NULL);
+    for (j = 0; j < ZSKIPLIST_MAXLEVEL; j++) {
+        zsl->header->level[j].forward = NULL;
+        zsl->header->level[j].span = 0;
+    }
+    zsl->header->backward = NULL;
+    zsl->tail = NULL;
+    return zsl;
+}
+
+static void zslFreeNode(zskiplistNode *node) {
+    decrRefCount(node->obj);
+    zfree(node);
+}
+
+static void zslFree(zskiplist *zsl) {
+    zskiplistNode *node = zsl->header->level[0].forward, *next;
+
+    zfree(zsl->header);
+    while(node) {
+        next = node->level[0].forward;
+        zslFreeNode(node);
+        node = next;
+    }
+    zfree(zsl);
+}
+
+/* Returns a random level for the new skiplist node we are going to create.
+ * The return value of this function is between 1 and ZSKIPLIST_MAXLEVEL
+ * (both inclusive), with a powerlaw-alike distribution where higher
+ * levels are less likely to be returned. */
+static int zslRandomLevel(void) {
+    int level = 1;
+
+    while ((random()&0xFFFF) < (ZSKIPLIST_P * 0xFFFF))
+        level += 1;
+    return (level < ZSKIPLIST_MAXLEVEL) ? level : ZSKIPLIST_MAXLEVEL;
+}
+
+/* Elements are ordered by score, and elements with the same score by
+ * member. Returns true if the node 'x' comes before score/obj. */
+static int zslLessThan(zskiplistNode *x, double score, robj *obj) {
+    return x->score < score ||
+        (x->score == score && sdscmp(x->obj->ptr,obj->ptr) < 0);
+}
+
+/* Insert a new node in the skiplist. The caller must make sure the
+ * element is not already inside, and transfers its reference to 'obj'. */
+static zskiplistNode *zslInsert(zskiplist *zsl, double score, robj *obj) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[ZSKIPLIST_MAXLEVEL];
+    int i, level;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        /* store rank that is crossed to reach the insert position */
+        rank[i] = i == (zsl->level-1) ? 0 : rank[i+1];
+        while (x->level[i].forward && zslLessThan(x->level[i].forward,score,obj)) {
+            rank[i] += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+    level = zslRandomLevel();
+    if (level > zsl->level) {
+        for (i = zsl->level; i < level; i++) {
+            rank[i] = 0;
+            update[i] = zsl->header;
+            update[i]->level[i].span = zsl->length;
+        }
+        zsl->level = level;
+    }
+    x = zslCreateNode(level,score,obj);
+    for (i = 0; i < level; i++) {
+        x->level[i].forward = update[i]->level[i].forward;
+        update[i]->level[i].forward = x;
+
+        /* update span covered by update[i] as x is inserted here */
+        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+    }
+
+    /* increment span for untouched levels */
+    for (i = level; i < zsl->level; i++)
+        update[i]->level[i].span++;
+
+    x->backward = (update[0] == zsl->header) ? NULL : update[0];
+    if (x->level[0].forward)
+        x->level[0].forward->backward = x;
+    else
+        zsl->tail = x;
+    zsl->length++;
+    return x;
+}
+
+/* Unlink 'x' from the skiplist, 'update' holding the nodes before it at
+ * every level. The node is not freed. */
+static void zslDeleteNode(zskiplist *zsl, zskiplistNode *x, zskiplistNode **update) {
+    int i;
+
+    for (i = 0; i < zsl->level; i++) {
+        if (update[i]->level[i].forward == x) {
+            update[i]->level[i].span += x->level[i].span - 1;
+            update[i]->level[i].forward = x->level[i].forward;
+        } else {
+            update[i]->level[i].span -= 1;
+        }
+    }
+    if (x->level[0].forward)
+        x->level[0].forward->backward = x->backward;
+    else
+        zsl->tail = x->backward;
+    while(zsl->level > 1 && zsl->header->level[zsl->level-1].forward == NULL)
+        zsl->level--;
+    zsl->length--;
+}
+
+/* Delete the element with matching score/object, releasing the reference
+ * held by the skiplist. Returns 1 if found, 0 otherwise. */
+static int zslDelete(zskiplist *zsl, double score, robj *obj) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    int i;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward && zslLessThan(x->level[i].forward,score,obj))
+            x = x->level[i].forward;
+        update[i] = x;
+    }
+    /* We may have multiple elements with the same score, what we need
+     * is to find the element with both the right score and object. */
+    x = x->level[0].forward;
+    if (x && score == x->score && sdscmp(x->obj->ptr,obj->ptr) == 0) {
+        zslDeleteNode(zsl,x,update);
+        zslFreeNode(x);
+        return 1;
+    }
+    return 0; /* not found */
+}
+
+/* Delete all the elements with rank between start and end from the
+ * skiplist and the dict. Start and end are inclusive and 1-based. */
+static unsigned long zslDeleteRangeByRank(zskiplist *zsl, unsigned long start, unsigned long end, dict *dict) {
+    zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+    unsigned long traversed = 0, removed = 0;
+    int i;
+
+    x = zsl->header;
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward && (traversed + x->level[i].span) < start) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        update[i] = x;
+    }
+
+    traversed++;
+    x = x->level[0].forward;
+    while (x && traversed <= end) {
+        zskiplistNode *next = x->level[0].forward;
+
+        zslDeleteNode(zsl,x,update);
+        dictDelete(dict,x->obj);
+        zslFreeNode(x);
+        removed++;
+        traversed++;
+        x = next;
+    }
+    return removed;
+}
+
+/* Number of elements with a score lower than 'score', or lower or equal
+ * if 'inclusive' is true. This is also the rank of the last of them. */
+static unsigned long zslCountBelow(zskiplist *zsl, double score, int inclusive) {
+    zskiplistNode *x = zsl->header;
+    unsigned long rank = 0;
+    int i;
+
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+            (x->level[i].forward->score < score ||
+             (inclusive && x->level[i].forward->score == score))) {
+            rank += x->level[i].span;
+            x = x->level[i].forward;
+        }
+    }
+    return rank;
+}
+
+/* Find the rank for an element by both score and key.
+ * Returns 0 when the element cannot be found, rank otherwise.
+ * Note that the rank is 1-based due to the span of zsl->header to the
+ * first element. */
+static unsigned long zslGetRank(zskiplist *zsl, double score, robj *obj) {
+    zskiplistNode *x = zsl->header;
+    unsigned long rank = 0;
+    int i;
+
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward &&
+            (x->level[i].forward->score < score ||
+                (x->level[i].forward->score == score &&
+                sdscmp(x->level[i].forward->obj->ptr,obj->ptr) <= 0))) {
+            rank += x->level[i].span;
+            x = x->level[i].forward;
+        }
+
+        /* x might be equal to zsl->header, so test if obj is non-NULL */
+        if (x->obj && sdscmp(x->obj->ptr,obj->ptr) == 0) return rank;
+    }
+    return 0;
+}
+
+/* Finds an element by its rank. The rank argument needs to be 1-based. */
+static zskiplistNode *zslGetElementByRank(zskiplist *zsl, unsigned long rank) {
+    zskiplistNode *x = zsl->header;
+    unsigned long traversed = 0;
+    int i;
+
+    for (i = zsl->level-1; i >= 0; i--) {
+        while (x->level[i].forward && (traversed + x->level[i].span) <= rank) {
+            traversed += x->level[i].span;
+            x = x->level[i].forward;
+        }
+        if (traversed == rank) return x;
+    }
+    return NULL;
+}
+
+/* Parse a score argument, replying with an error if it is not a valid
+ * double. NaN is refused as it can't be ordered. */
+static int getDoubleFromObjectOrReply(redisClient *c, robj *o, double *target) {
+    char *eptr;
+    double value;
+
+    value = strtod(o->ptr,&eptr);
+    if (sdslen(o->ptr) == 0 || *eptr != '\0' || isnan(value)) {
+        addReplySds(c,sdsnew("-ERR value is not a double\r\n"));
+        return REDIS_ERR;
+    }
+    *target = value;
+    return REDIS_OK;
+}
+
+/* Lookup the sorted set at 'key' for a write, creating it if missing.
+ * Replies with an error and returns NULL if the key holds another type. */
+static zset *lookupZsetForWrite(redisClient *c, robj *key) {
+    robj *zsetobj = lookupKeyWrite(c->db,key);
+
+    if (zsetobj == NULL) {
+        zsetobj = createZsetObject();
+        dictAdd(c->db->dict,key,zsetobj);
+        incrRefCount(key);
+    } else if (zsetobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    return zsetobj->ptr;
+}
+
+/* Implements ZADD and ZINCRBY. With 'incr' the score is added to the
+ * current one, and the new score is returned. */
+static void zaddGenericCommand(redisClient *c, robj *key, robj *ele, double score, int incr) {
+    zset *zs;
+    dictEntry *de;
+    zskiplistNode *ln;
+
+    if ((zs = lookupZsetForWrite(c,key)) == NULL) return;
+    de = dictFind(zs->dict,ele);
+    if (de == NULL) {
+        /* New element: the skiplist takes the reference, the dict shares
+         * the same object as key */
+        incrRefCount(ele);
+        ln = zslInsert(zs->zsl,score,ele);
+        dictAdd(zs->dict,ele,&ln->score);
+        server.dirty++;
+        if (incr)
+            addReplyDouble(c,score);
+        else
+            addReply(c,shared.cone);
+    } else {
+        double curscore = *(double*)dictGetEntryVal(de);
+
+        if (incr) {
+            score += curscore;
+            if (isnan(score)) {
+                addReplySds(c,sdsnew("-ERR resulting score is not a number (NaN)\r\n"));
+                return;
+            }
+        }
+        /* Move the element to its new position if the score changed */
+        if (score != curscore) {
+            robj *member = dictGetEntryKey(de);
+
+            incrRefCount(member); /* zslDelete() releases one reference */
+            zslDelete(zs->zsl,curscore,member);
+            ln = zslInsert(zs->zsl,score,member);
+            dictGetEntryVal(de) = &ln->score;
+            server.dirty++;
+        }
+        if (incr)
+            addReplyDouble(c,score);
+        else
+            addReply(c,shared.czero);
+    }
+}
+
+static void zaddCommand(redisClient *c) {
+    double score;
+
+    if (getDoubleFromObjectOrReply(c,c->argv[2],&score) != REDIS_OK) return;
+    zaddGenericCommand(c,c->argv[1],c->argv[3],score,0);
+}
+
+static void zincrbyCommand(redisClient *c) {
+    double incr;
+
+    if (getDoubleFromObjectOrReply(c,c->argv[2],&incr) != REDIS_OK) return;
+    zaddGenericCommand(c,c->argv[1],c->argv[3],incr,1);
+}
+
+/* Check that 'zsetobj', the result of a key lookup, is a sorted set.
+ * Replies with 'empty' if the key does not exist and with an error if it
+ * is of another type, returning NULL in both cases. */
+static zset *zsetFromObjectOrReply(redisClient *c, robj *zsetobj, robj *empty) {
+    if (zsetobj == NULL) {
+        addReply(c,empty);
+        return NULL;
+    }
+    if (zsetobj->type != REDIS_ZSET) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    return zsetobj->ptr;
+}
+
+static void zremCommand(redisClient *c) {
+    zset *zs;
+    dictEntry *de;
+    double score;
+
+    zs = zsetFromObjectOrReply(c,lookupKeyWrite(c->db,c->argv[1]),
+        shared.czero);
+    if (zs == NULL) return;
+    de = dictFind(zs->dict,c->argv[2]);
+    if (de == NULL) {
+        addReply(c,shared.czero);
+        return;
+    }
+    /* The member object is owned by the skiplist, so remove it from the
+     * dict first */
+    score = *(double*)dictGetEntryVal(de);
+    dictDelete(zs->dict,c->argv[2]);
+    zslDelete(zs->zsl,score,c->argv[2]);
+    server.dirty++;
+    addReply(c,shared.cone);
+}
+
+static void zscoreCommand(redisClient *c) {
+    zset *zs;
+    dictEntry *de;
+
+    zs = zsetFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.nullbulk);
+    if (zs == NULL) return;
+    de = dictFind(zs->dict,c->argv[2]);
+    if (de == NULL) {
+        addReply(c,shared.nullbulk);
+    } else {
+        addReplyDouble(c,*(double*)dictGetEntryVal(de));
+    }
+}
+
+static void zcardCommand(redisClient *c) {
+    zset *zs;
+
+    zs = zsetFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.czero);
+    if (zs == NULL) return;
+    addReplyLongLong(c,zs->zsl->length);
+}
+
+static void zrankGenericCommand(redisClient *c, int reverse) {
+    zset *zs;
+    dictEntry *de;
+    unsigned long rank;
+
+    zs = zsetFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.nullbulk);
+    if (zs == NULL) return;
+    de = dictFind(zs->dict,c->argv[2]);
+    if (de == NULL) {
+        addReply(c,shared.nullbulk);
+        return;
+    }
+    rank = zslGetRank(zs->zsl,*(double*)dictGetEntryVal(de),c->argv[2]);
+    assert(rank != 0);
+    if (reverse)
+        addReplyLongLong(c,zs->zsl->length-rank);
+    else
+        addReplyLongLong(c,rank-1);
+}
+
+static void zrankCommand(redisClient *c) {
+    zrankGenericCommand(c,0);
+}
+
+static void zrevrankCommand(redisClient *c) {
+    zrankGenericCommand(c,1);
+}
+
+/* Reply with 'count' elements starting at the 1-based 'rank', walking
+ * backward if 'reverse' is true. */
+static void zsetReplyRange(redisClient *c, zskiplist *zsl, unsigned long rank,
+                           unsigned long count, int reverse, int withscores)
+{
+    zskiplistNode *ln;
+
+    /* Check if the starting point is trivial, before searching the
+     * element in log(N) time */
+    if (rank == 1)
+        ln = zsl->header->level[0].forward;
+    else if (rank == zsl->length)
+        ln = zsl->tail;
+    else
+        ln = zslGetElementByRank(zsl,rank);
+
+    addReplyMultiBulkLen(c,withscores ? count*2 : count);
+    while(count--) {
+        addReplyBulk(c,ln->obj);
+        if (withscores) addReplyDouble(c,ln->score);
+        ln = reverse ? ln->backward : ln->level[0].forward;
+    }
+}
+
+static void zrangeGenericCommand(redisClient *c, int reverse) {
+    zset *zs;
+    int start = atoi(c->argv[2]->ptr);
+    int end = atoi(c->argv[3]->ptr);
+    int withscores = 0;
+    int llen, rangelen;
+
+    if (c->argc == 5 && !strcasecmp(c->argv[4]->ptr,"withscores")) {
+        withscores = 1;
+    } else if (c->argc >= 5) {
+        addReply(c,shared.syntaxerr);
+        return;
+    }
+    zs = zsetFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.nullmultibulk);
+    if (zs == NULL) return;
+    llen = zs->zsl->length;
+
+    /* convert negative indexes */
+    if (start < 0) start = llen+start;
+    if (end < 0) end = llen+end;
+    if (start < 0) start = 0;
+    if (end < 0) end = 0;
+
+    /* indexes sanity checks */
+    if (start > end || start >= llen) {
+        /* Out of range start or start > end result in empty list */
+        addReply(c,shared.emptymultibulk);
+        return;
+    }
+    if (end >= llen) end = llen-1;
+    rangelen = (end-start)+1;
+
+    zsetReplyRange(c,zs->zsl,reverse ? llen-start : start+1,rangelen,
+        reverse,withscores);
+}
+
+static void zrangeCommand(redisClient *c) {
+    zrangeGenericCommand(c,0);
+}
+
+static void zrevrangeCommand(redisClient *c) {
+    zrangeGenericCommand(c,1);
+}
+
+/* Implements ZRANGEBYSCORE and ZCOUNT. Both the min and max scores are
+ * inclusive. The elements in range are found counting the elements
+ * below min and up to max, so the count is O(log N) as well. */
+static void zrangebyscoreGenericCommand(redisClient *c, int justcount) {
+    zset *zs;
+    double min, max;
+    unsigned long first, count;
+    long offset = 0, limit = -1;
+    int withscores = 0, j;
+
+    if (getDoubleFromObjectOrReply(c,c->argv[2],&min) != REDIS_OK ||
+        getDoubleFromObjectOrReply(c,c->argv[3],&max) != REDIS_OK) return;
+    for (j = 4; j < c->argc; j++) {
+        int leftargs = c->argc-j-1;
+
+        if (!justcount && !strcasecmp(c->argv[j]->ptr,"withscores")) {
+            withscores = 1;
+        } else if (!justcount && !strcasecmp(c->argv[j]->ptr,"limit") &&
+                   leftargs >= 2) {
+            offset = atol(c->argv[j+1]->ptr);
+            limit = atol(c->argv[j+2]->ptr);
+            j += 2;
+        } else {
+            addReply(c,shared.syntaxerr);
+            return;
+        }
+    }
+    zs = zsetFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        justcount ? shared.czero : shared.nullmultibulk);
+    if (zs == NULL) return;
+
+    first = zslCountBelow(zs->zsl,min,0);
+    count = (min > max) ? 0 : zslCountBelow(zs->zsl,max,1)-first;
+    if (justcount) {
+        addReplyLongLong(c,count);
         return;
     }
-    /* Error if the destination key is not a set as well */
-    if (dstset && dstset->type != REDIS_SET) {
-        addReply(c,shared.wrongtypeerr);
+    if (offset < 0 || (unsigned long)offset >= count) {
+        addReply(c,shared.emptymultibulk);
         return;
     }
-    /* Remove the element from the source set */
-    if (dictDelete(srcset->ptr,c->argv[3]) == DICT_ERR) {
-        /* Key not found in the src set! return zero */
-        addReply(c,shared.czero);
+    count -= offset;
+    if (limit >= 0 && (unsigned long)limit < count) count = limit;
+    if (count == 0) {
+        addReply(c,shared.emptymultibulk);
         return;
     }
-    server.dirty++;
-    /* Add the element to the destination set */
-    if (!dstset) {
-        dstset = createSetObject();
-        dictAdd(c->db->dict,c->argv[2],dstset);
-        incrRefCount(c->argv[2]);
-    }
-    if (dictAdd(dstset->ptr,c->argv[3],NULL) == DICT_OK)
-        incrRefCount(c->argv[3]);
-    addReply(c,shared.cone);
+    zsetReplyRange(c,zs->zsl,first+offset+1,count,0,withscores);
 }
 
-static void sismemberCommand(redisClient *c) {
-    robj *set;
+static void zrangebyscoreCommand(redisClient *c) {
+    zrangebyscoreGenericCommand(c,0);
+}
 
-    set = lookupKeyRead(c->db,c->argv[1]);
-    if (set == NULL) {
-        addReply(c,shared.czero);
-    } else {
-        if (set->type != REDIS_SET) {
-            addReply(c,shared.wrongtypeerr);
-            return;
-        }
-        if (dictFind(set->ptr,c->argv[2]))
-            addReply(c,shared.cone);
-        else
-            addReply(c,shared.czero);
-    }
+static void zcountCommand(redisClient *c) {
+    zrangebyscoreGenericCommand(c,1);
 }
 
-static void scardCommand(redisClient *c) {
-    robj *o;
-    dict *s;
-    
-    o = lookupKeyRead(c->db,c->argv[1]);
-    if (o == NULL) {
+static void zremrangebyscoreCommand(redisClient *c) {
+    zset *zs;
+    double min, max;
+    unsigned long first, last, removed = 0;
+
+    if (getDoubleFromObjectOrReply(c,c->argv[2],&min) != REDIS_OK ||
+        getDoubleFromObjectOrReply(c,c->argv[3],&max) != REDIS_OK) return;
+    zs = zsetFromObjectOrReply(c,lookupKeyWrite(c->db,c->argv[1]),
+        shared.czero);
+    if (zs == NULL) return;
+
+    first = zslCountBelow(zs->zsl,min,0);
+    last = zslCountBelow(zs->zsl,max,1);
+    if (min <= max && last > first)
+        removed = zslDeleteRangeByRank(zs->zsl,first+1,last,zs->dict);
+    server.dirty += removed;
+    addReplyLongLong(c,removed);
+}
+
+static void zremrangebyrankCommand(redisClient *c) {
+    zset *zs;
+    int start = atoi(c->argv[2]->ptr);
+    int end = atoi(c->argv[3]->ptr);
+    int llen;
+    unsigned long removed;
+
+    zs = zsetFromObjectOrReply(c,lookupKeyWrite(c->db,c->argv[1]),
+        shared.czero);
+    if (zs == NULL) return;
+    llen = zs->zsl->length;
+
+    /* convert negative indexes */
+    if (start < 0) start = llen+start;
+    if (end < 0) end = llen+end;
+    if (start < 0) start = 0;
+    if (end < 0) end = 0;
+
+    /* indexes sanity checks */
+    if (start > end || start >= llen) {
         addReply(c,shared.czero);
         return;
-    } else {
-        if (o->type != REDIS_SET) {
-            addReply(c,shared.wrongtypeerr);
-        } else {
-            s = o->ptr;
-            addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",
-                dictSize(s)));
+    }
+    if (end >= llen) end = llen-1;
+
+    /* ranks are 1-based in the skiplist */
+    removed = zslDeleteRangeByRank(zs->zsl,start+1,end+1,zs->dict);
+    server.dirty += removed;
+    addReplyLongLong(c,removed);
+}
+
+/* ================================== Hashes ================================ */
+
+/* Small hashes are stored in a ziplist of field/value pairs, that is a lot
+ * more compact than a dict with an entry and two objects per field. A hash
+ * is converted to a dict once it has more than hash-max-ziplist-entries
+ * fields, or a field or a value longer than hash-max-ziplist-value bytes.
+ * Lookups in the ziplist are O(N), so these limits should be kept small. */
+
+/* Convert the ziplist hash to a dict. Values that look like integers are
+ * stored integer encoded. */
+static void hashTypeConvert(robj *o, int enc) {
+    unsigned char *zl = o->ptr, *fptr, *vptr;
+    dict *d;
+
+    assert(o->encoding == REDIS_ENCODING_ZIPLIST && enc == REDIS_ENCODING_HT);
+    d = dictCreate(&hashDictType,NULL);
+    if (!d) oom("dictCreate");
+    fptr = ziplistIndex(zl,0);
+    while(fptr) {
+        robj *field, *value;
+
+        vptr = ziplistNext(zl,fptr);
+        field = listTypeZiplistValue(fptr);
+        value = tryObjectEncoding(listTypeZiplistValue(vptr));
+        if (dictAdd(d,field,value) == DICT_ERR) oom("dictAdd");
+        fptr = ziplistNext(zl,vptr);
+    }
+    zfree(zl);
+    o->ptr = d;
+    o->encoding = REDIS_ENCODING_HT;
+}
+
+/* Convert a ziplist hash to a dict if any of the objects argv[start..end]
+ * is too long to be stored in the ziplist. */
+static void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
+    int i;
+
+    if (o->encoding != REDIS_ENCODING_ZIPLIST) return;
+    for (i = start; i <= end; i++) {
+        if (sdsEncodedObject(argv[i]) &&
+            sdslen(argv[i]->ptr) > server.hash_max_ziplist_value)
+        {
+            hashTypeConvert(o,REDIS_ENCODING_HT);
+            break;
         }
     }
 }
 
-static int qsortCompareSetsByCardinality(const void *s1, const void *s2) {
-    dict **d1 = (void*) s1, **d2 = (void*) s2;
+/* Returns the ziplist entry of 'field', or NULL if it is not in the hash */
+static unsigned char *hashTypeZiplistFind(unsigned char *zl, robj *field) {
+    unsigned char *fptr = ziplistIndex(zl,ZIPLIST_HEAD);
 
-    return dictSize(*d1)-dictSize(*d2);
+    if (fptr == NULL) return NULL;
+    return ziplistFind(fptr,field->ptr,sdslen(field->ptr),1);
 }
 
-static void sinterGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey) {
-    dict **dv = zmalloc(sizeof(dict*)*setsnum);
-    dictIterator *di;
-    dictEntry *de;
-    robj *lenobj = NULL, *dstset = NULL;
-    int j, cardinality = 0;
+/* Get the value of 'field', or NULL if the field does not exist. The
+ * caller owns a reference to the returned object. */
+static robj *hashTypeGet(robj *o, robj *field) {
+    robj *value = NULL;
 
-    if (!dv) oom("sinterGenericCommand");
-    for (j = 0; j < setsnum; j++) {
-        robj *setobj;
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *fptr = hashTypeZiplistFind(o->ptr,field);
 
-        setobj = dstkey ?
-                    lookupKeyWrite(c->db,setskeys[j]) :
-                    lookupKeyRead(c->db,setskeys[j]);
-        if (!setobj) {
-            zfree(dv);
-            if (dstkey) {
-                deleteKey(c->db,dstkey);
-                addReply(c,shared.ok);
-            } else {
-                addReply(c,shared.nullmultibulk);
-            }
-            return;
-        }
-        if (setobj->type != REDIS_SET) {
-            zfree(dv);
-            addReply(c,shared.wrongtypeerr);
-            return;
+        if (fptr) value = listTypeZiplistValue(ziplistNext(o->ptr,fptr));
+    } else {
+        dictEntry *de = dictFind(o->ptr,field);
+
+        if (de) {
+            value = dictGetEntryVal(de);
+            incrRefCount(value);
         }
-        dv[j] = setobj->ptr;
     }
-    /* Sort sets from the smallest to largest, this will improve our
-     * algorithm's performace */
-    qsort(dv,setsnum,sizeof(dict*),qsortCompareSetsByCardinality);
+    return value;
+}
 
-    /* The first thing we should output is the total number of elements...
-     * since this is a multi-bulk write, but at this stage we don't know
-     * the intersection set size, so we use a trick, append an empty object
-     * to the output list and save the pointer to later modify it with the
-     * right length */
-    if (!dstkey) {
-        lenobj = createObject(REDIS_STRING,NULL);
-        addReply(c,lenobj);
-        decrRefCount(lenobj);
-    } else {
-        /* If we have a target key where to store the resulting set
-         * create this key with an empty set inside */
-        dstset = createSetObject();
-    }
+static int hashTypeExists(robj *o, robj *field) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST)
+        return hashTypeZiplistFind(o->ptr,field) != NULL;
+    else
+        return dictFind(o->ptr,field) != NULL;
+}
 
-    /* Iterate all the elements of the first (smallest) set, and test
-     * the element against all the other sets, if at least one set does
-     * not include the element it is discarded */
-    di = dictGetIterator(dv[0]);
-    if (!di) oom("dictGetIterator");
+/* Set 'field' to 'value'. Returns 1 if the field already existed and its
+ * value was updated, 0 if it was added. */
+static int hashTypeSet(robj *o, robj *field, robj *value) {
+    int update = 0;
 
-    while((de = dictNext(di)) != NULL) {
-        robj *ele;
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = o->ptr, *fptr, *vptr;
 
-        for (j = 1; j < setsnum; j++)
-            if (dictFind(dv[j],dictGetEntryKey(de)) == NULL) break;
-        if (j != setsnum)
-            continue; /* at least one set does not contain the member */
-        ele = dictGetEntryKey(de);
-        if (!dstkey) {
-            addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",sdslen(ele->ptr)));
-            addReply(c,ele);
-            addReply(c,shared.crlf);
-            cardinality++;
+        value = getDecodedObject(value);
+        if ((fptr = hashTypeZiplistFind(zl,field)) != NULL) {
+            /* Replace the value, that is right after the field */
+            vptr = ziplistNext(zl,fptr);
+            zl = ziplistDelete(zl,&vptr);
+            zl = ziplistInsert(zl,vptr,value->ptr,sdslen(value->ptr));
+            update = 1;
         } else {
-            dictAdd(dstset->ptr,ele,NULL);
-            incrRefCount(ele);
+            zl = ziplistPush(zl,field->ptr,sdslen(field->ptr),ZIPLIST_TAIL);
+            zl = ziplistPush(zl,value->ptr,sdslen(value->ptr),ZIPLIST_TAIL);
         }
+        o->ptr = zl;
+        decrRefCount(value);
+        if (hashTypeLength(o) > server.hash_max_ziplist_entries)
+            hashTypeConvert(o,REDIS_ENCODING_HT);
+    } else {
+        if (dictAdd(o->ptr,field,value) == DICT_OK) {
+            incrRefCount(field);
+        } else {
+            dictReplace(o->ptr,field,value);
+            update = 1;
+        }
+        incrRefCount(value);
     }
-    dictReleaseIterator(di);
+    return update;
+}
 
-    if (dstkey) {
-        /* Store the resulting set into the target */
-        deleteKey(c->db,dstkey);
-        dictAdd(c->db->dict,dstkey,dstset);
-        incrRefCount(dstkey);
-    }
+/* Delete 'field'. Returns 1 if the field was found and removed. */
+static int hashTypeDelete(robj *o, robj *field) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = o->ptr, *fptr;
 
-    if (!dstkey) {
-        lenobj->ptr = sdscatprintf(sdsempty(),"*%d\r\n",cardinality);
+        if ((fptr = hashTypeZiplistFind(zl,field)) == NULL) return 0;
+        zl = ziplistDelete(zl,&fptr); /* the field */
+        zl = ziplistDelete(zl,&fptr); /* and its value */
+        o->ptr = zl;
+        return 1;
     } else {
-        addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",
-            dictSize((dict*)dstset->ptr)));
-        server.dirty++;
+        return dictDelete(o->ptr,field) == DICT_OK;
     }
-    zfree(dv);
 }
 
-static void sinterCommand(redisClient *c) {
-    sinterGenericCommand(c,c->argv+1,c->argc-1,NULL);
+static unsigned long hashTypeLength(robj *o) {
+    if (o->encoding == REDIS_ENCODING_ZIPLIST)
+        return ziplistLen(o->ptr)/2;
+    else
+        return dictSize((dict*)o->ptr);
 }
 
-static void sinterstoreCommand(redisClient *c) {
-    sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
+static hashTypeIterator *hashTypeInitIterator(robj *subject) {
+    hashTypeIterator *hi = zmalloc(sizeof(*hi));
+
+    if (!hi) oom("hashTypeInitIterator");
+    hi->subject = subject;
+    hi->encoding = subject->encoding;
+    hi->fptr = hi->vptr = NULL;
+    hi->di = NULL;
+    hi->de = NULL;
+    if (hi->encoding == REDIS_ENCODING_HT) {
+        hi->di = dictGetIterator(subject->ptr);
+        if (!hi->di) oom("dictGetIterator");
+    }
+    return hi;
 }
 
-#define REDIS_OP_UNION 0
-#define REDIS_OP_DIFF 1
+/* Move to the next field/value pair. Returns REDIS_ERR when done. */
+static int hashTypeNext(hashTypeIterator *hi) {
+    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = hi->subject->ptr;
 
-static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey, int op) {
-    dict **dv = zmalloc(sizeof(dict*)*setsnum);
-    dictIterator *di;
-    dictEntry *de;
-    robj *dstset = NULL;
-    int j, cardinality = 0;
+        if (hi->fptr == NULL)
+            hi->fptr = ziplistIndex(zl,0);
+        else
+            hi->fptr = ziplistNext(zl,hi->vptr);
+        if (hi->fptr == NULL) return REDIS_ERR;
+        hi->vptr = ziplistNext(zl,hi->fptr);
+    } else {
+        if ((hi->de = dictNext(hi->di)) == NULL) return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
 
-    if (!dv) oom("sunionDiffGenericCommand");
-    for (j = 0; j < setsnum; j++) {
-        robj *setobj;
+/* Get the field (REDIS_HASH_KEY) or the value (REDIS_HASH_VALUE) at the
+ * iterator position. The caller owns a reference to the returned object. */
+static robj *hashTypeCurrent(hashTypeIterator *hi, int what) {
+    robj *o;
 
-        setobj = dstkey ?
-                    lookupKeyWrite(c->db,setskeys[j]) :
-                    lookupKeyRead(c->db,setskeys[j]);
-        if (!setobj) {
-            dv[j] = NULL;
-            continue;
-        }
-        if (setobj->type != REDIS_SET) {
-            zfree(dv);
-            addReply(c,shared.wrongtypeerr);
-            return;
-        }
-        dv[j] = setobj->ptr;
+    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+        o = listTypeZiplistValue(what == REDIS_HASH_KEY ? hi->fptr : hi->vptr);
+    } else {
+        o = (what == REDIS_HASH_KEY) ? dictGetEntryKey(hi->de) :
+                                       dictGetEntryVal(hi->de);
+        incrRefCount(o);
     }
+    return o;
+}
 
-    /* We need a temp set object to store our union. If the dstkey
-     * is not NULL (that is, we are inside an SUNIONSTORE operation) then
-     * this set object will be the resulting object to set into the target key*/
-    dstset = createSetObject();
+static void hashTypeReleaseIterator(hashTypeIterator *hi) {
+    if (hi->di) dictReleaseIterator(hi->di);
+    zfree(hi);
+}
 
-    /* Iterate all the elements of all the sets, add every element a single
-     * time to the result set */
-    for (j = 0; j < setsnum; j++) {
-        if (op == REDIS_OP_DIFF && j == 0 && !dv[j]) break; /* result set is empty */
-        if (!dv[j]) continue; /* non existing keys are like empty sets */
+/* Lookup the hash at 'key' for a write, creating it if missing. Replies
+ * with an error and returns NULL if the key holds another type. */
+static robj *lookupHashForWrite(redisClient *c, robj *key) {
+    robj *o = lookupKeyWrite(c->db,key);
 
-        di = dictGetIterator(dv[j]);
-        if (!di) oom("dictGetIterator");
+    if (o == NULL) {
+        o = createHashObject();
+        dictAdd(c->db->dict,key,o);
+        incrRefCount(key);
+    } else if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    return o;
+}
 
-        while((de = dictNext(di)) != NULL) {
-            robj *ele;
+/* Check that 'o', the result of a key lookup, is a hash. Replies with
+ * 'empty' if the key does not exist and with an error if it is of another
+ * type, returning NULL in both cases. */
+static robj *hashFromObjectOrReply(redisClient *c, robj *o, robj *empty) {
+    if (o == NULL) {
+        addReply(c,empty);
+        return NULL;
+    }
+    if (o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+        return NULL;
+    }
+    return o;
+}
 
-            /* dictAdd will not add the same element multiple times */
-            ele = dictGetEntryKey(de);
-            if (op == REDIS_OP_UNION || j == 0) {
-                if (dictAdd(dstset->ptr,ele,NULL) == DICT_OK) {
-                    incrRefCount(ele);
-                    cardinality++;
-                }
-            } else if (op == REDIS_OP_DIFF) {
-                if (dictDelete(dstset->ptr,ele) == DICT_OK) {
-                    cardinality--;
-                }
-            }
-        }
-        dictReleaseIterator(di);
+static void hsetCommand(redisClient *c) {
+    robj *o;
+    int update;
 
-        if (op == REDIS_OP_DIFF && cardinality == 0) break; /* result set is empty */
-    }
+    if ((o = lookupHashForWrite(c,c->argv[1])) == NULL) return;
+    hashTypeTryConversion(o,c->argv,2,3);
+    update = hashTypeSet(o,c->argv[2],c->argv[3]);
+    server.dirty++;
+    addReply(c,update ? shared.czero : shared.cone);
+}
 
-    /* Output the content of the resulting set, if not in STORE mode */
-    if (!dstkey) {
-        addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",cardinality));
-        di = dictGetIterator(dstset->ptr);
-        if (!di) oom("dictGetIterator");
-        while((de = dictNext(di)) != NULL) {
-            robj *ele;
+static void hgetCommand(redisClient *c) {
+    robj *o, *value;
 
-            ele = dictGetEntryKey(de);
-            addReplySds(c,sdscatprintf(sdsempty(),
-                    "$%d\r\n",sdslen(ele->ptr)));
-            addReply(c,ele);
-            addReply(c,shared.crlf);
-        }
-        dictReleaseIterator(di);
+    o = hashFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.nullbulk);
+    if (o == NULL) return;
+    if ((value = hashTypeGet(o,c->argv[2])) == NULL) {
+        addReply(c,shared.nullbulk);
     } else {
-        /* If we have a target key where to store the resulting set
-         * create this key with the result set inside */
-        deleteKey(c->db,dstkey);
-        dictAdd(c->db->dict,dstkey,dstset);
-        incrRefCount(dstkey);
+        addReplyBulk(c,value);
+        decrRefCount(value);
     }
+}
 
-    /* Cleanup */
-    if (!dstkey) {
-        decrRefCount(dstset);
-    } else {
-        addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",
-            dictSize((dict*)dstset->ptr)));
-        server.dirty++;
+static void hmgetCommand(redisClient *c) {
+    robj *o = lookupKeyRead(c->db,c->argv[1]);
+    int j;
+
+    /* A missing key is like an empty hash, a nil for every field */
+    if (o != NULL && o->type != REDIS_HASH) {
+        addReply(c,shared.wrongtypeerr);
+        return;
+    }
+    addReplyMultiBulkLen(c,c->argc-2);
+    for (j = 2; j < c->argc; j++) {
+        robj *value = o ? hashTypeGet(o,c->argv[j]) : NULL;
+
+        if (value == NULL) {
+            addReply(c,shared.nullbulk);
+        } else {
+            addReplyBulk(c,value);
+            decrRefCount(value);
+        }
     }
-    zfree(dv);
 }
 
-static void sunionCommand(redisClient *c) {
-    sunionDiffGenericCommand(c,c->argv+1,c->argc-1,NULL,REDIS_OP_UNION);
+static void hgetallCommand(redisClient *c) {
+    robj *o;
+    hashTypeIterator *hi;
+
+    o = hashFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.emptymultibulk);
+    if (o == NULL) return;
+    addReplyMultiBulkLen(c,hashTypeLength(o)*2);
+    hi = hashTypeInitIterator(o);
+    while(hashTypeNext(hi) != REDIS_ERR) {
+        robj *field = hashTypeCurrent(hi,REDIS_HASH_KEY);
+        robj *value = hashTypeCurrent(hi,REDIS_HASH_VALUE);
+
+        addReplyBulk(c,field);
+        addReplyBulk(c,value);
+        decrRefCount(field);
+        decrRefCount(value);
+    }
+    hashTypeReleaseIterator(hi);
+}
+
+/* Like INCRBY, a value that is not a number counts as 0 */
+static void hincrbyCommand(redisClient *c) {
+    long long value = 0, incr = strtoll(c->argv[3]->ptr,NULL,10);
+    robj *o, *current, *new;
+
+    if ((o = lookupHashForWrite(c,c->argv[1])) == NULL) return;
+    if ((current = hashTypeGet(o,c->argv[2])) != NULL) {
+        if (current->encoding == REDIS_ENCODING_INT)
+            value = (long)current->ptr;
+        else
+            value = strtoll(current->ptr,NULL,10);
+        decrRefCount(current);
+    }
+    value += incr;
+    new = createStringObjectFromLongLong(value);
+    hashTypeTryConversion(o,c->argv,2,2);
+    hashTypeSet(o,c->argv[2],new);
+    decrRefCount(new);
+    server.dirty++;
+    addReplyLongLong(c,value);
 }
 
-static void sunionstoreCommand(redisClient *c) {
-    sunionDiffGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],REDIS_OP_UNION);
+static void hdelCommand(redisClient *c) {
+    robj *o;
+
+    o = hashFromObjectOrReply(c,lookupKeyWrite(c->db,c->argv[1]),
+        shared.czero);
+    if (o == NULL) return;
+    if (hashTypeDelete(o,c->argv[2])) {
+        server.dirty++;
+        addReply(c,shared.cone);
+    } else {
+        addReply(c,shared.czero);
+    }
 }
 
-static void sdiffCommand(redisClient *c) {
-    sunionDiffGenericCommand(c,c->argv+1,c->argc-1,NULL,REDIS_OP_DIFF);
+static void hlenCommand(redisClient *c) {
+    robj *o;
+
+    o = hashFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.czero);
+    if (o == NULL) return;
+    addReplyLongLong(c,hashTypeLength(o));
 }
 
-static void sdiffstoreCommand(redisClient *c) {
-    sunionDiffGenericCommand(c,c->argv+2,c->argc-2,c->argv[1],REDIS_OP_DIFF);
+static void hexistsCommand(redisClient *c) {
+    robj *o;
+
+    o = hashFromObjectOrReply(c,lookupKeyRead(c->db,c->argv[1]),
+        shared.czero);
+    if (o == NULL) return;
+    addReply(c,hashTypeExists(o,c->argv[2]) ? shared.cone : shared.czero);
 }
 
 static void flushdbCommand(redisClient *c) {
@@ -3276,11 +6535,8 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
     robj keyobj;
     int prefixlen, sublen, postfixlen;
     /* Expoit the internal sds representation to create a sds string allocated on the stack in order to make this function faster */
-    struct {
-        long len;
-        long free;
-        char buf[REDIS_SORTKEY_MAX+1];
-    } keyname;
+    char keyname[sizeof(struct sdshdr16)+REDIS_SORTKEY_MAX+1];
+    struct sdshdr16 *sh = (void*)keyname;
 
     spat = pattern->ptr;
     ssub = subst->ptr;
@@ -3291,17 +6547,20 @@ robj *lookupKeyByPattern(redisDb *db, robj *pattern, robj *subst) {
     prefixlen = p-spat;
     sublen = sdslen(ssub);
     postfixlen = sdslen(spat)-(prefixlen+1);
-    memcpy(keyname.buf,spat,prefixlen);
-    memcpy(keyname.buf+prefixlen,ssub,sublen);
-    memcpy(keyname.buf+prefixlen+sublen,p+1,postfixlen);
-    keyname.buf[prefixlen+sublen+postfixlen] = '\0';
-    keyname.len = prefixlen+sublen+postfixlen;
+    memcpy(sh->buf,spat,prefixlen);
+    memcpy(sh->buf+prefixlen,ssub,sublen);
+    memcpy(sh->buf+prefixlen+sublen,p+1,postfixlen);
+    sh->buf[prefixlen+sublen+postfixlen] = '\0';
+    sh->len = prefixlen+sublen+postfixlen;
+    sh->alloc = sh->len;
+    sh->flags = SDS_TYPE_16;
 
     keyobj.refcount = 1;
     keyobj.type = REDIS_STRING;
-    keyobj.ptr = ((char*)&keyname)+(sizeof(long)*2);
+    keyobj.encoding = REDIS_ENCODING_RAW;
+    keyobj.ptr = sh->buf;
 
-    /* printf("lookup '%s' => %p\n", keyname.buf,de); */
+    /* printf("lookup '%s' => %p\n", sh->buf,de); */
     return lookupKeyRead(db,&keyobj);
 }
 
@@ -3425,37 +6684,36 @@ static void sortCommand(redisClient *c) {
 
     /* Load the sorting vector with all the objects to sort */
     vectorlen = (sortval->type == REDIS_LIST) ?
-        listLength((list*)sortval->ptr) :
-        dictSize((dict*)sortval->ptr);
+        listTypeLength(sortval) :
+        setTypeSize(sortval);
     vector = zmalloc(sizeof(redisSortObject)*vectorlen);
     if (!vector) oom("allocating objects vector for SORT");
     j = 0;
+    /* Every object in the vector holds a reference, as the elements of a
+     * ziplist encoded list and the members of an intset are created on
+     * the fly. */
     if (sortval->type == REDIS_LIST) {
-        list *list = sortval->ptr;
-        listNode *ln;
+        listTypeIterator *li = listTypeInitIterator(sortval,0,REDIS_TAIL);
+        listTypeEntry entry;
 
-        listRewind(list);
-        while((ln = listYield(list))) {
-            robj *ele = ln->value;
-            vector[j].obj = ele;
+        while(listTypeNext(li,&entry)) {
+            vector[j].obj = listTypeGet(&entry);
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
         }
+        listTypeReleaseIterator(li);
     } else {
-        dict *set = sortval->ptr;
-        dictIterator *di;
-        dictEntry *setele;
-
-        di = dictGetIterator(set);
-        if (!di) oom("dictGetIterator");
-        while((setele = dictNext(di)) != NULL) {
-            vector[j].obj = dictGetEntryKey(setele);
+        setTypeIterator *si = setTypeInitIterator(sortval);
+        robj *ele;
+
+        while((ele = setTypeNext(si)) != NULL) {
+            vector[j].obj = ele;
             vector[j].u.score = 0;
             vector[j].u.cmpobj = NULL;
             j++;
         }
-        dictReleaseIterator(di);
+        setTypeReleaseIterator(si);
     }
     assert(j == vectorlen);
 
@@ -3468,8 +6726,9 @@ static void sortCommand(redisClient *c) {
                 byval = lookupKeyByPattern(c->db,sortby,vector[j].obj);
                 if (!byval || byval->type != REDIS_STRING) continue;
                 if (alpha) {
-                    vector[j].u.cmpobj = byval;
-                    incrRefCount(byval);
+                    vector[j].u.cmpobj = getDecodedObject(byval);
+                } else if (byval->encoding == REDIS_ENCODING_INT) {
+                    vector[j].u.score = (long)byval->ptr;
                 } else {
                     vector[j].u.score = strtod(byval->ptr,NULL);
                 }
@@ -3502,12 +6761,11 @@ static void sortCommand(redisClient *c) {
     /* Send command output to the output buffer, performing the specified
      * GET/DEL/INCR/DECR operations if any. */
     outputlen = getop ? getop*(end-start+1) : end-start+1;
-    addReplySds(c,sdscatprintf(sdsempty(),"*%d\r\n",outputlen));
+    addReplyMultiBulkLen(c,outputlen);
     for (j = start; j <= end; j++) {
         listNode *ln;
         if (!getop) {
-            addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",
-                sdslen(vector[j].obj->ptr)));
+            addReplyBulkLen(c,vector[j].obj);
             addReply(c,vector[j].obj);
             addReply(c,shared.crlf);
         }
@@ -3521,8 +6779,7 @@ static void sortCommand(redisClient *c) {
                 if (!val || val->type != REDIS_STRING) {
                     addReply(c,shared.nullbulk);
                 } else {
-                    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",
-                        sdslen(val->ptr)));
+                    addReplyBulkLen(c,val);
                     addReply(c,val);
                     addReply(c,shared.crlf);
                 }
@@ -3536,6 +6793,7 @@ static void sortCommand(redisClient *c) {
     decrRefCount(sortval);
     listRelease(operations);
     for (j = 0; j < vectorlen; j++) {
+        decrRefCount(vector[j].obj);
         if (sortby && alpha && vector[j].u.cmpobj)
             decrRefCount(vector[j].u.cmpobj);
     }
@@ -3559,6 +6817,7 @@ static void infoCommand(redisClient *c) {
         "total_connections_received:%lld\r\n"
         "total_commands_processed:%lld\r\n"
         "role:%s\r\n"
+        "multiplexing_api:%s\r\n"
         ,REDIS_VERSION,
         uptime,
         uptime/(3600*24),
@@ -3570,7 +6829,8 @@ static void infoCommand(redisClient *c) {
         server.lastsave,
         server.stat_numconnections,
         server.stat_numcommands,
-        server.masterhost == NULL ? "master" : "slave"
+        server.masterhost == NULL ? "master" : "slave",
+        aeGetApiName()
     );
     if (server.masterhost) {
         info = sdscatprintf(info,
@@ -3585,7 +6845,7 @@ static void infoCommand(redisClient *c) {
             (int)(time(NULL)-server.master->lastinteraction)
         );
     }
-    addReplySds(c,sdscatprintf(sdsempty(),"$%d\r\n",sdslen(info)));
+    addReplyLongLongWithPrefix(c,sdslen(info),'$');
     addReplySds(c,info);
     addReply(c,shared.crlf);
 }
@@ -3600,6 +6860,42 @@ static void monitorCommand(redisClient *c) {
     addReply(c,shared.ok);
 }
 
+/* DEBUG RELOAD saves the DB and loads it back, so that the tests can check
+ * that every type and encoding survives the RDB format. DEBUG OBJECT shows
+ * the encoding of a value. */
+static void debugCommand(redisClient *c) {
+    if (!strcasecmp(c->argv[1]->ptr,"reload") && c->argc == 2) {
+        if (rdbSave(server.dbfilename) != REDIS_OK) {
+            addReply(c,shared.err);
+            return;
+        }
+        emptyDb();
+        if (rdbLoad(server.dbfilename) != REDIS_OK) {
+            addReply(c,shared.err);
+            return;
+        }
+        redisLog(REDIS_NOTICE,"DB reloaded by DEBUG RELOAD");
+        addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"object") && c->argc == 3) {
+        dictEntry *de = dictFind(c->db->dict,c->argv[2]);
+        robj *key, *val;
+
+        if (!de) {
+            addReply(c,shared.nokeyerr);
+            return;
+        }
+        key = dictGetEntryKey(de);
+        val = dictGetEntryVal(de);
+        addReplySds(c,sdscatprintf(sdsempty(),
+            "+Key at:%p refcount:%d, value at:%p refcount:%d encoding:%s\r\n",
+            (void*)key, key->refcount, (void*)val, val->refcount,
+            strencoding[val->encoding]));
+    } else {
+        addReplySds(c,sdsnew(
+            "-ERR Syntax error, try DEBUG [OBJECT <key>|RELOAD]\r\n"));
+    }
+}
+
 /* ================================= Expire ================================= */
 static int removeExpire(redisDb *db, robj *key) {
     if (dictDelete(db->expires,key) == DICT_OK) {
@@ -3694,7 +6990,7 @@ static void ttlCommand(redisClient *c) {
         ttl = (int) (expire-time(NULL));
         if (ttl < 0) ttl = -1;
     }
-    addReplySds(c,sdscatprintf(sdsempty(),":%d\r\n",ttl));
+    addReplyLongLong(c,ttl);
 }
 
 /* =============================== Replication  ============================= */
@@ -3769,7 +7065,7 @@ static void syncCommand(redisClient *c) {
      * the client about already issued commands. We need a fresh reply
      * buffer registering the differences between the BGSAVE and the current
      * dataset, so that we can copy to other slaves if needed. */
-    if (listLength(c->reply) != 0) {
+    if (clientHasPendingReplies(c)) {
         addReplySds(c,sdsnew("-ERR SYNC is invalid with pending input\r\n"));
         return;
     }
@@ -3795,6 +7091,8 @@ static void syncCommand(redisClient *c) {
             listRelease(c->reply);
             c->reply = listDup(slave->reply);
             if (!c->reply) oom("listDup copying slave reply list");
+            memcpy(c->buf,slave->buf,slave->bufpos);
+            c->bufpos = slave->bufpos;
             c->replstate = REDIS_REPL_WAIT_BGSAVE_END;
             redisLog(REDIS_NOTICE,"Waiting for end of BGSAVE for SYNC");
         } else {
@@ -3827,6 +7125,8 @@ static void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
     char buf[REDIS_IOBUF_LEN];
     ssize_t nwritten, buflen;
 
+    /* Wait for the replies submitted to the event loop before SYNC */
+    if (slave->flags & REDIS_SEND_INFLIGHT) return;
     if (slave->repldboff == 0) {
         /* Write the bulk write count before to transfer the DB. In theory here
          * we don't know how much room there is in the output buffer of the
@@ -4068,9 +7368,13 @@ static void daemonize(void) {
 }
 
 int main(int argc, char **argv) {
+    uint8_t hashseed[16];
+
 #ifdef __linux__
     linuxOvercommitMemoryWarning();
 #endif
+    getRandomBytes(hashseed,sizeof(hashseed));
+    dictSetHashFunctionSeed(hashseed);
 
     initServerConfig();
     if (argc == 2) {
@@ -4087,8 +7391,9 @@ int main(int argc, char **argv) {
     redisLog(REDIS_NOTICE,"Server started, Redis version " REDIS_VERSION);
     if (rdbLoad(server.dbfilename) == REDIS_OK)
         redisLog(REDIS_NOTICE,"DB loaded from disk");
-    if (aeCreateFileEvent(server.el, server.fd, AE_READABLE,
-        acceptHandler, NULL, NULL) == AE_ERR) oom("creating file event");
+    if (!server.iocompletion && aeCreateFileEvent(server.el, server.fd,
+        AE_READABLE, acceptHandler, NULL, NULL) == AE_ERR)
+        oom("creating file event");
     redisLog(REDIS_NOTICE,"The server is now ready to accept connections on port %d", server.port);
     aeMain(server.el);
     aeDeleteEventLoop(server.el);
@@ -36,32 +36,57 @@
 #include <ctype.h>
 #include "zmalloc.h"
 
+#define SDS_MAX_PREALLOC (1024*1024) /* Max free space sdsMakeRoomFor() adds */
+
 static void sdsOomAbort(void) {
     fprintf(stderr,"SDS: Out Of Memory (SDS_ABORT_ON_OOM defined)\n");
     abort();
 }
+
+static int sdsHdrSize(char type) {
+    switch(type & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return sizeof(struct sdshdr8);
+    case SDS_TYPE_16: return sizeof(struct sdshdr16);
+    case SDS_TYPE_32: return sizeof(struct sdshdr32);
+    case SDS_TYPE_64: return sizeof(struct sdshdr64);
+    }
+    return 0;
+}
+
+/* Return the smallest header type able to hold the given size */
+static char sdsReqType(size_t size) {
+    if (size < 1<<8) return SDS_TYPE_8;
+    if (size < 1<<16) return SDS_TYPE_16;
+    if ((unsigned long long)size < 1ULL<<32) return SDS_TYPE_32;
+    return SDS_TYPE_64;
+}
 // 分配一个字符串，init是字符串的内存，initlen是长度，不包括\0
 sds sdsnewlen(const void *init, size_t initlen) {
-    struct sdshdr *sh;
+    void *sh;
+    sds s;
+    char type = sdsReqType(initlen);
+    int hdrlen = sdsHdrSize(type);
     // 分配一块存储字符串的内存，元数据结构体大小+字符串内容长度+\0
-    sh = zmalloc(sizeof(struct sdshdr)+initlen+1);
+    sh = zmalloc(hdrlen+initlen+1);
 #ifdef SDS_ABORT_ON_OOM
     if (sh == NULL) sdsOomAbort();
 #else
     if (sh == NULL) return NULL;
 #endif
-    // 字符串长度
-    sh->len = initlen;
-    sh->free = 0;
+    s = (char*)sh+hdrlen;
+    // 头部的类型，字符串长度
+    s[-1] = type;
+    sdssetlen(s,initlen);
+    sdssetalloc(s,initlen);
     // 设置了长度
     if (initlen) {
         // 有数据则复制，否则初始化为0
-        if (init) memcpy(sh->buf, init, initlen);
-        else memset(sh->buf,0,initlen);
+        if (init) memcpy(s, init, initlen);
+        else memset(s,0,initlen);
     }
     // 结束符
-    sh->buf[initlen] = '\0';
-    return (char*)sh->buf;
+    s[initlen] = '\0';
+    return s;
 }
 
 sds sdsempty(void) {
@@ -72,63 +97,101 @@ sds sdsnew(const char *init) {
     size_t initlen = (init == NULL) ? 0 : strlen(init);
     return sdsnewlen(init, initlen);
 }
-// s为字符串内容的首地址，减去sdshdr为元数据结构体的地址
-size_t sdslen(const sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    return sh->len;
-}
 
 sds sdsdup(const sds s) {
     return sdsnewlen(s, sdslen(s));
 }
-
+// s为字符串内容的首地址，减去头部的大小为元数据结构体的地址
 void sdsfree(sds s) {
     if (s == NULL) return;
-    zfree(s-sizeof(struct sdshdr));
-}
-// 还有多少个空闲字节可用
-size_t sdsavail(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    return sh->free;
+    zfree(s-sdsHdrSize(s[-1]));
 }
 
 void sdsupdatelen(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    int reallen = strlen(s);
-    sh->free += (sh->len-reallen);
-    sh->len = reallen;
+    sdssetlen(s,strlen(s));
 }
 
-static sds sdsMakeRoomFor(sds s, size_t addlen) {
-    struct sdshdr *sh, *newsh;
-    size_t free = sdsavail(s);
+/* Enlarge the free space at the end of the sds string so that the caller
+ * is sure that after calling this function can overwrite up to addlen
+ * bytes after the end of the string, plus one more byte for nul term.
+ * If the new size doesn't fit the current header type the string is
+ * moved to a new allocation with a bigger header. */
+sds sdsMakeRoomFor(sds s, size_t addlen) {
+    void *sh, *newsh;
+    size_t avail = sdsavail(s);
     size_t len, newlen;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen;
 
-    if (free >= addlen) return s;
+    if (avail >= addlen) return s;
     len = sdslen(s);
-    sh = (void*) (s-(sizeof(struct sdshdr)));
-    newlen = (len+addlen)*2;
-    newsh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1);
+    sh = s-sdsHdrSize(oldtype);
+    newlen = len+addlen;
+    /* Double the size to make appends amortized O(1), but not over
+     * SDS_MAX_PREALLOC bytes of free space to avoid wasting memory. */
+    if (newlen < SDS_MAX_PREALLOC)
+        newlen *= 2;
+    else
+        newlen += SDS_MAX_PREALLOC;
+
+    type = sdsReqType(newlen);
+    hdrlen = sdsHdrSize(type);
+    if (type == oldtype) {
+        newsh = zrealloc(sh, hdrlen+newlen+1);
+#ifdef SDS_ABORT_ON_OOM
+        if (newsh == NULL) sdsOomAbort();
+#else
+        if (newsh == NULL) return NULL;
+#endif
+        s = (char*)newsh+hdrlen;
+    } else {
+        newsh = zmalloc(hdrlen+newlen+1);
 #ifdef SDS_ABORT_ON_OOM
-    if (newsh == NULL) sdsOomAbort();
+        if (newsh == NULL) sdsOomAbort();
 #else
-    if (newsh == NULL) return NULL;
+        if (newsh == NULL) return NULL;
 #endif
+        memcpy((char*)newsh+hdrlen, s, len+1);
+        zfree(sh);
+        s = (char*)newsh+hdrlen;
+        s[-1] = type;
+        sdssetlen(s,len);
+    }
+    sdssetalloc(s,newlen);
+    return s;
+}
+
+/* Increment the length of the string by incr after bytes were written
+ * past its end, in the space made available by sdsMakeRoomFor(), and set
+ * the nul term. */
+void sdsIncrLen(sds s, size_t incr) {
+    size_t len = sdslen(s)+incr;
+
+    sdssetlen(s,len);
+    s[len] = '\0';
+}
+
+/* Grow the string to 'len' bytes, the new bytes being set to zero. If
+ * the string is already that long nothing is done. */
+sds sdsgrowzero(sds s, size_t len) {
+    size_t curlen = sdslen(s);
 
-    newsh->free = newlen - len;
-    return newsh->buf;
+    if (len <= curlen) return s;
+    s = sdsMakeRoomFor(s,len-curlen);
+    if (s == NULL) return NULL;
+    /* Also set the nul term */
+    memset(s+curlen,0,(len-curlen+1));
+    sdssetlen(s,len);
+    return s;
 }
 
 sds sdscatlen(sds s, void *t, size_t len) {
-    struct sdshdr *sh;
     size_t curlen = sdslen(s);
 
     s = sdsMakeRoomFor(s,len);
     if (s == NULL) return NULL;
-    sh = (void*) (s-(sizeof(struct sdshdr)));
     memcpy(s+curlen, t, len);
-    sh->len = curlen+len;
-    sh->free = sh->free-len;
+    sdssetlen(s,curlen+len);
     s[curlen+len] = '\0';
     return s;
 }
@@ -138,19 +201,13 @@ sds sdscat(sds s, char *t) {
 }
 
 sds sdscpylen(sds s, char *t, size_t len) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    size_t totlen = sh->free+sh->len;
-
-    if (totlen < len) {
-        s = sdsMakeRoomFor(s,len-totlen);
+    if (sdsalloc(s) < len) {
+        s = sdsMakeRoomFor(s,len-sdslen(s));
         if (s == NULL) return NULL;
-        sh = (void*) (s-(sizeof(struct sdshdr)));
-        totlen = sh->free+sh->len;
     }
     memcpy(s, t, len);
     s[len] = '\0';
-    sh->len = len;
-    sh->free = totlen-len;
+    sdssetlen(s,len);
     return s;
 }
 
@@ -187,7 +244,6 @@ sds sdscatprintf(sds s, const char *fmt, ...) {
 }
 
 sds sdstrim(sds s, const char *cset) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     char *start, *end, *sp, *ep;
     size_t len;
 
@@ -196,15 +252,13 @@ sds sdstrim(sds s, const char *cset) {
     while(sp <= end && strchr(cset, *sp)) sp++;
     while(ep > start && strchr(cset, *ep)) ep--;
     len = (sp > ep) ? 0 : ((ep-sp)+1);
-    if (sh->buf != sp) memmove(sh->buf, sp, len);
-    sh->buf[len] = '\0';
-    sh->free = sh->free+(sh->len-len);
-    sh->len = len;
+    if (s != sp) memmove(s, sp, len);
+    s[len] = '\0';
+    sdssetlen(s,len);
     return s;
 }
 
 sds sdsrange(sds s, long start, long end) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     size_t newlen, len = sdslen(s);
 
     if (len == 0) return s;
@@ -224,10 +278,9 @@ sds sdsrange(sds s, long start, long end) {
     } else {
         start = 0;
     }
-    if (start != 0) memmove(sh->buf, sh->buf+start, newlen);
-    sh->buf[newlen] = 0;
-    sh->free = sh->free+(sh->len-newlen);
-    sh->len = newlen;
+    if (start != 0) memmove(s, s+start, newlen);
+    s[newlen] = 0;
+    sdssetlen(s,newlen);
     return s;
 }
 
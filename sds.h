@@ -32,22 +32,96 @@
 #define __SDS_H
 
 #include <sys/types.h>
+#include <stdint.h>
 
 typedef char *sds;
 
-struct sdshdr {
-    long len;
-    long free;
+/* The header of an sds string is stored just before the string itself, and
+ * its size depends on the length of the string: most strings, like keys,
+ * are short and only need 8 bit fields. 'alloc' is the size of the buffer
+ * excluding the header and the null term. The byte just before the string
+ * is always 'flags', whose 3 lower bits tell the type of the header, so
+ * sdslen() and friends can find the header of any string in O(1). */
+struct __attribute__ ((__packed__)) sdshdr8 {
+    uint8_t len;
+    uint8_t alloc;
+    unsigned char flags;
     char buf[];
 };
+struct __attribute__ ((__packed__)) sdshdr16 {
+    uint16_t len;
+    uint16_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr32 {
+    uint32_t len;
+    uint32_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr64 {
+    uint64_t len;
+    uint64_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+
+#define SDS_TYPE_8  1
+#define SDS_TYPE_16 2
+#define SDS_TYPE_32 3
+#define SDS_TYPE_64 4
+#define SDS_TYPE_MASK 7
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
+
+static inline size_t sdslen(const sds s) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->len;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->len;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->len;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->len;
+    }
+    return 0;
+}
+
+/* Size of the buffer, excluding the header and the null term */
+static inline size_t sdsalloc(const sds s) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->alloc;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->alloc;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->alloc;
+    case SDS_TYPE_64: return SDS_HDR(64,s)->alloc;
+    }
+    return 0;
+}
+
+static inline size_t sdsavail(const sds s) {
+    return sdsalloc(s)-sdslen(s);
+}
+
+static inline void sdssetlen(sds s, size_t newlen) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->len = newlen; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->len = newlen; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->len = newlen; break;
+    case SDS_TYPE_64: SDS_HDR(64,s)->len = newlen; break;
+    }
+}
+
+static inline void sdssetalloc(sds s, size_t newalloc) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->alloc = newalloc; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->alloc = newalloc; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->alloc = newalloc; break;
+    case SDS_TYPE_64: SDS_HDR(64,s)->alloc = newalloc; break;
+    }
+}
 
 sds sdsnewlen(const void *init, size_t initlen);
 sds sdsnew(const char *init);
 sds sdsempty();
-size_t sdslen(const sds s);
 sds sdsdup(const sds s);
 void sdsfree(sds s);
-size_t sdsavail(sds s);
 sds sdscatlen(sds s, void *t, size_t len);
 sds sdscat(sds s, char *t);
 sds sdscpylen(sds s, char *t, size_t len);
@@ -59,5 +133,8 @@ void sdsupdatelen(sds s);
 int sdscmp(sds s1, sds s2);
 sds *sdssplitlen(char *s, int len, char *sep, int seplen, int *count);
 void sdstolower(sds s);
+sds sdsMakeRoomFor(sds s, size_t addlen);
+void sdsIncrLen(sds s, size_t incr);
+sds sdsgrowzero(sds s, size_t len);
 
 #endif
@@ -0,0 +1,118 @@
+/* SipHash-1-3, used by dict.c as the hash function for string keys.
+ *
+ * SipHash is a keyed hash function designed by Jean-Philippe Aumasson and
+ * Daniel J. Bernstein: unlike the simple multiplicative hashes it is not
+ * possible for a client that does not know the key to produce many strings
+ * colliding into the same hash table bucket. The input is consumed eight
+ * bytes at a time, so it is also faster than a byte at a time loop on long
+ * strings.
+ *
+ * We use one compression round and three finalization rounds instead of
+ * the 2-4 of the original design: the resulting function is still believed
+ * to be fine as a hash table hash function, and it is considerably faster.
+ *
+ * This implementation is based on the SipHash reference implementation,
+ * released into the public domain (CC0) by its authors.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#ifndef SIPHASH_CROUNDS
+#define SIPHASH_CROUNDS 1
+#endif
+#ifndef SIPHASH_DROUNDS
+#define SIPHASH_DROUNDS 3
+#endif
+
+#define ROTL(x,b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define U8TO64_LE(p)                                                         \
+    (((uint64_t)((p)[0])) | ((uint64_t)((p)[1]) << 8) |                      \
+     ((uint64_t)((p)[2]) << 16) | ((uint64_t)((p)[3]) << 24) |               \
+     ((uint64_t)((p)[4]) << 32) | ((uint64_t)((p)[5]) << 40) |               \
+     ((uint64_t)((p)[6]) << 48) | ((uint64_t)((p)[7]) << 56))
+
+#define U8TO64_LE_NOCASE(p)                                                  \
+    (((uint64_t)(tolower((p)[0]))) | ((uint64_t)(tolower((p)[1])) << 8) |    \
+     ((uint64_t)(tolower((p)[2])) << 16) |                                   \
+     ((uint64_t)(tolower((p)[3])) << 24) |                                   \
+     ((uint64_t)(tolower((p)[4])) << 32) |                                   \
+     ((uint64_t)(tolower((p)[5])) << 40) |                                   \
+     ((uint64_t)(tolower((p)[6])) << 48) |                                   \
+     ((uint64_t)(tolower((p)[7])) << 56))
+
+#define SIPROUND                                                             \
+    do {                                                                     \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);           \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                               \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                               \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);           \
+    } while (0)
+
+/* Hash 'inlen' bytes at 'in' with the 16 bytes key 'k'. If 'nocase' is
+ * true the ASCII letters are hashed as they were lower case. */
+static uint64_t siphashGeneric(const uint8_t *in, size_t inlen,
+                               const uint8_t *k, int nocase)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL;
+    uint64_t v1 = 0x646f72616e646f6dULL;
+    uint64_t v2 = 0x6c7967656e657261ULL;
+    uint64_t v3 = 0x7465646279746573ULL;
+    uint64_t k0 = U8TO64_LE(k);
+    uint64_t k1 = U8TO64_LE(k + 8);
+    uint64_t m, b = ((uint64_t)inlen) << 56;
+    const uint8_t *end = in + inlen - (inlen % 8);
+    int i;
+
+    v3 ^= k1;
+    v2 ^= k0;
+    v1 ^= k1;
+    v0 ^= k0;
+
+    for (; in != end; in += 8) {
+        m = nocase ? U8TO64_LE_NOCASE(in) : U8TO64_LE(in);
+        v3 ^= m;
+        for (i = 0; i < SIPHASH_CROUNDS; i++) SIPROUND;
+        v0 ^= m;
+    }
+
+    /* The last 0-7 bytes, and the length in the most significant byte */
+    switch (inlen & 7) {
+    case 7: b |= ((uint64_t)(nocase ? tolower(in[6]) : in[6])) << 48;
+            /* fall through */
+    case 6: b |= ((uint64_t)(nocase ? tolower(in[5]) : in[5])) << 40;
+            /* fall through */
+    case 5: b |= ((uint64_t)(nocase ? tolower(in[4]) : in[4])) << 32;
+            /* fall through */
+    case 4: b |= ((uint64_t)(nocase ? tolower(in[3]) : in[3])) << 24;
+            /* fall through */
+    case 3: b |= ((uint64_t)(nocase ? tolower(in[2]) : in[2])) << 16;
+            /* fall through */
+    case 2: b |= ((uint64_t)(nocase ? tolower(in[1]) : in[1])) << 8;
+            /* fall through */
+    case 1: b |= ((uint64_t)(nocase ? tolower(in[0]) : in[0]));
+            break;
+    case 0: break;
+    }
+
+    v3 ^= b;
+    for (i = 0; i < SIPHASH_CROUNDS; i++) SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    for (i = 0; i < SIPHASH_DROUNDS; i++) SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+uint64_t siphash(const uint8_t *in, size_t inlen, const uint8_t *k) {
+    return siphashGeneric(in,inlen,k,0);
+}
+
+uint64_t siphash_nocase(const uint8_t *in, size_t inlen, const uint8_t *k) {
+    return siphashGeneric(in,inlen,k,1);
+}
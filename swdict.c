@@ -0,0 +1,435 @@
+/* Open addressing hash table, Swiss table style. See swdict.h.
+ *
+ * The slots are split in groups of SWDICT_GROUP_SIZE. A key is looked up
+ * starting from the group selected by the low bits of its hash, probing
+ * the next groups in triangular order (1, 2, 3 ... groups after the
+ * previous one, that visits all the groups as their number is a power of
+ * two). The control byte of every slot is either EMPTY, DELETED, or the 7
+ * high bits of the hash of the key stored there, so the whole group can be
+ * checked for candidates with a couple of SSE2 instructions. The probing
+ * stops at the first group with an EMPTY slot.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "swdict.h"
+#include "zmalloc.h"
+
+#define SWDICT_EMPTY ((signed char)-128)
+#define SWDICT_DELETED ((signed char)-2)
+
+/* Grow when more than 7/8 of the slots are used or deleted */
+#define SWDICT_MAX_LOAD(size) ((size)-(size)/8)
+
+#define swdictH2(hash) ((signed char)((hash) >> 25))
+
+/* ------------------------- Heap Management Wrappers------------------------ */
+
+static void *_swdictAlloc(size_t size)
+{
+    void *p = zmalloc(size);
+    if (p == NULL) {
+        fprintf(stderr, "\nSWDICT LIBRARY PANIC: Out of memory\n\n");
+        abort();
+    }
+    return p;
+}
+
+/* ---------------------------- Group matching ------------------------------ */
+
+/* Every function returns a bitmask with a bit set for every slot of the
+ * group at 'ctrl' matching the condition. */
+
+#ifdef __SSE2__
+static unsigned int groupMatch(const signed char *ctrl, signed char h2) {
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g,_mm_set1_epi8(h2)));
+}
+
+static unsigned int groupMatchEmpty(const signed char *ctrl) {
+    return groupMatch(ctrl,SWDICT_EMPTY);
+}
+
+/* EMPTY and DELETED are the only negative control bytes */
+static unsigned int groupMatchEmptyOrDeleted(const signed char *ctrl) {
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#else
+static unsigned int groupMatch(const signed char *ctrl, signed char h2) {
+    unsigned int mask = 0;
+    int j;
+
+    for (j = 0; j < SWDICT_GROUP_SIZE; j++)
+        if (ctrl[j] == h2) mask |= 1<<j;
+    return mask;
+}
+
+static unsigned int groupMatchEmpty(const signed char *ctrl) {
+    return groupMatch(ctrl,SWDICT_EMPTY);
+}
+
+static unsigned int groupMatchEmptyOrDeleted(const signed char *ctrl) {
+    unsigned int mask = 0;
+    int j;
+
+    for (j = 0; j < SWDICT_GROUP_SIZE; j++)
+        if (ctrl[j] < 0) mask |= 1<<j;
+    return mask;
+}
+#endif
+
+/* ----------------------------- API implementation ------------------------- */
+
+static void _swdictReset(swdict *d) {
+    d->ctrl = NULL;
+    d->slots = NULL;
+    d->size = 0;
+    d->used = 0;
+    d->deleted = 0;
+}
+
+swdict *swdictCreate(dictType *type, void *privDataPtr) {
+    swdict *d = _swdictAlloc(sizeof(*d));
+
+    _swdictReset(d);
+    d->type = type;
+    d->privdata = privDataPtr;
+    return d;
+}
+
+/* Return the index of the slot holding 'key', or -1 if not found */
+static long _swdictFindSlot(swdict *d, const void *key) {
+    unsigned int hash, mask;
+    unsigned long group, groupmask, step = 0;
+    signed char h2;
+
+    if (d->used == 0) return -1;
+    hash = dictHashKey(d,key);
+    h2 = swdictH2(hash);
+    groupmask = d->size/SWDICT_GROUP_SIZE-1;
+    group = hash & groupmask;
+    while(1) {
+        signed char *ctrl = d->ctrl+group*SWDICT_GROUP_SIZE;
+
+        mask = groupMatch(ctrl,h2);
+        while(mask) {
+            long idx = group*SWDICT_GROUP_SIZE+__builtin_ctz(mask);
+
+            if (dictCompareHashKeys(d,key,d->slots[idx].key)) return idx;
+            mask &= mask-1;
+        }
+        if (groupMatchEmpty(ctrl)) return -1;
+        group = (group+(++step)) & groupmask;
+    }
+}
+
+/* Return the index of the first EMPTY or DELETED slot in the probe
+ * sequence of 'hash'. There is always one as the load is bounded. */
+static long _swdictFreeSlot(swdict *d, unsigned int hash) {
+    unsigned long group, groupmask, step = 0;
+
+    groupmask = d->size/SWDICT_GROUP_SIZE-1;
+    group = hash & groupmask;
+    while(1) {
+        unsigned int mask;
+
+        mask = groupMatchEmptyOrDeleted(d->ctrl+group*SWDICT_GROUP_SIZE);
+        if (mask) return group*SWDICT_GROUP_SIZE+__builtin_ctz(mask);
+        group = (group+(++step)) & groupmask;
+    }
+}
+
+/* Resize the table to 'size' slots (rounded to the next power of two),
+ * rehashing all the elements. Also called with the current size in order
+ * to purge the DELETED slots. */
+int swdictExpand(swdict *d, unsigned long size) {
+    swdict n = *d;
+    unsigned long realsize = SWDICT_GROUP_SIZE, j;
+
+    while(realsize < size) realsize *= 2;
+    if (d->used > SWDICT_MAX_LOAD(realsize)) return DICT_ERR;
+
+    n.size = realsize;
+    n.used = 0;
+    n.deleted = 0;
+    n.ctrl = _swdictAlloc(realsize);
+    n.slots = _swdictAlloc(realsize*sizeof(swdictEntry));
+    memset(n.ctrl,SWDICT_EMPTY,realsize);
+    for (j = 0; j < d->size; j++) {
+        unsigned int hash;
+        long idx;
+
+        if (d->ctrl[j] < 0) continue;
+        hash = dictHashKey(d,d->slots[j].key);
+        idx = _swdictFreeSlot(&n,hash);
+        n.ctrl[idx] = swdictH2(hash);
+        n.slots[idx] = d->slots[j];
+        n.used++;
+    }
+    zfree(d->ctrl);
+    zfree(d->slots);
+    *d = n;
+    return DICT_OK;
+}
+
+/* Make room for a new element if needed */
+static int _swdictExpandIfNeeded(swdict *d) {
+    if (d->size == 0) return swdictExpand(d,SWDICT_GROUP_SIZE);
+    if (d->used+d->deleted+1 <= SWDICT_MAX_LOAD(d->size)) return DICT_OK;
+    /* If many slots are just deleted a rehash at the same size is enough */
+    if (d->used+1 <= SWDICT_MAX_LOAD(d->size)/2)
+        return swdictExpand(d,d->size);
+    return swdictExpand(d,d->size*2);
+}
+
+/* Shrink the table to the minimal size that holds all the elements */
+int swdictResize(swdict *d) {
+    unsigned long minimal = d->used+d->used/7+1;
+
+    if (minimal < SWDICT_GROUP_SIZE) minimal = SWDICT_GROUP_SIZE;
+    return swdictExpand(d,minimal);
+}
+
+int swdictAdd(swdict *d, void *key, void *val) {
+    swdictEntry *he;
+    unsigned int hash;
+    long idx;
+
+    if (_swdictFindSlot(d,key) != -1) return DICT_ERR;
+    if (_swdictExpandIfNeeded(d) == DICT_ERR) return DICT_ERR;
+    hash = dictHashKey(d,key);
+    idx = _swdictFreeSlot(d,hash);
+    if (d->ctrl[idx] == SWDICT_DELETED) d->deleted--;
+    d->ctrl[idx] = swdictH2(hash);
+    he = d->slots+idx;
+    dictSetHashKey(d,he,key);
+    dictSetHashVal(d,he,val);
+    d->used++;
+    return DICT_OK;
+}
+
+/* Add an element, discarding the old value if the key already exists */
+int swdictReplace(swdict *d, void *key, void *val) {
+    long idx = _swdictFindSlot(d,key);
+    swdictEntry *he;
+
+    if (idx == -1) return swdictAdd(d,key,val);
+    he = d->slots+idx;
+    dictFreeEntryVal(d,he);
+    dictSetHashVal(d,he,val);
+    return DICT_OK;
+}
+
+static int _swdictGenericDelete(swdict *d, const void *key, int nofree) {
+    long idx = _swdictFindSlot(d,key);
+    signed char *group;
+
+    if (idx == -1) return DICT_ERR;
+    if (!nofree) {
+        dictFreeEntryKey(d,&d->slots[idx]);
+        dictFreeEntryVal(d,&d->slots[idx]);
+    }
+    /* If the group has an EMPTY slot no probe sequence ever continued
+     * past it, so this slot can be EMPTY as well. Otherwise we need a
+     * DELETED marker in order to don't break the sequences. */
+    group = d->ctrl+(idx & ~(long)(SWDICT_GROUP_SIZE-1));
+    if (groupMatchEmpty(group)) {
+        d->ctrl[idx] = SWDICT_EMPTY;
+    } else {
+        d->ctrl[idx] = SWDICT_DELETED;
+        d->deleted++;
+    }
+    d->used--;
+    return DICT_OK;
+}
+
+int swdictDelete(swdict *d, const void *key) {
+    return _swdictGenericDelete(d,key,0);
+}
+
+int swdictDeleteNoFree(swdict *d, const void *key) {
+    return _swdictGenericDelete(d,key,1);
+}
+
+swdictEntry *swdictFind(swdict *d, const void *key) {
+    long idx = _swdictFindSlot(d,key);
+
+    return (idx == -1) ? NULL : &d->slots[idx];
+}
+
+void swdictEmpty(swdict *d) {
+    unsigned long j;
+
+    for (j = 0; j < d->size && d->used; j++) {
+        if (d->ctrl[j] < 0) continue;
+        dictFreeEntryKey(d,&d->slots[j]);
+        dictFreeEntryVal(d,&d->slots[j]);
+        d->used--;
+    }
+    zfree(d->ctrl);
+    zfree(d->slots);
+    _swdictReset(d);
+}
+
+void swdictRelease(swdict *d) {
+    swdictEmpty(d);
+    zfree(d);
+}
+
+swdictIterator *swdictGetIterator(swdict *d) {
+    swdictIterator *iter = _swdictAlloc(sizeof(*iter));
+
+    iter->d = d;
+    iter->index = -1;
+    return iter;
+}
+
+swdictEntry *swdictNext(swdictIterator *iter) {
+    swdict *d = iter->d;
+
+    while(++iter->index < (long)d->size) {
+        if (d->ctrl[iter->index] >= 0) return &d->slots[iter->index];
+    }
+    return NULL;
+}
+
+void swdictReleaseIterator(swdictIterator *iter) {
+    zfree(iter);
+}
+
+/* Return a random entry from the hash table */
+swdictEntry *swdictGetRandomKey(swdict *d) {
+    unsigned long idx;
+
+    if (d->used == 0) return NULL;
+    do {
+        idx = random() & (d->size-1);
+    } while(d->ctrl[idx] < 0);
+    return &d->slots[idx];
+}
+
+/* ------------------------------- Benchmark ---------------------------------*/
+
+#ifdef SWDICT_BENCHMARK_MAIN
+
+/* Compare dict.c and swdict.c with the kind of keys and access pattern of
+ * the Redis keyspace: sds keys, mostly lookups. Build with
+ * 'make swdict-benchmark'. */
+
+#include <sys/time.h>
+#include "sds.h"
+
+static unsigned int benchSdsHash(const void *key) {
+    return dictGenHashFunction(key,sdslen((sds)key));
+}
+
+static int benchSdsCompare(void *privdata, const void *key1,
+        const void *key2)
+{
+    DICT_NOTUSED(privdata);
+
+    return sdslen((sds)key1) == sdslen((sds)key2) &&
+           memcmp(key1,key2,sdslen((sds)key1)) == 0;
+}
+
+static dictType benchDictType = {
+    benchSdsHash,       /* hash function */
+    NULL,               /* key dup */
+    NULL,               /* val dup */
+    benchSdsCompare,    /* key compare */
+    NULL,               /* key destructor */
+    NULL                /* val destructor */
+};
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+#define BENCH(name, count, code) do { \
+    long long _start = ustime(), _i; \
+    for (_i = 0; _i < (count); _i++) { code; } \
+    printf("  %-24s %7.1f ns/op\n", name, \
+        (double)(ustime()-_start)*1000/(count)); \
+} while(0)
+
+int main(int argc, char **argv) {
+    long count = (argc > 1) ? atol(argv[1]) : 1000000, lookups = count*5;
+    sds *keys = _swdictAlloc(sizeof(sds)*count);
+    sds *misses = _swdictAlloc(sizeof(sds)*count);
+    long *order = _swdictAlloc(sizeof(long)*lookups);
+    uint8_t seed[16];
+    size_t mem;
+    long j, found = 0;
+    dict *d;
+    swdict *sw;
+
+    srandom(ustime());
+    for (j = 0; j < 16; j++) seed[j] = random() & 0xff;
+    dictSetHashFunctionSeed(seed);
+    for (j = 0; j < count; j++) {
+        keys[j] = sdscatprintf(sdsempty(),"key:%ld",j);
+        misses[j] = sdscatprintf(sdsempty(),"miss:%ld",j);
+    }
+    for (j = 0; j < lookups; j++) order[j] = random() % count;
+
+    printf("%ld keys, %ld random lookups\n", count, lookups);
+    printf("dict (chaining, incremental rehashing):\n");
+    mem = zmalloc_used_memory();
+    d = dictCreate(&benchDictType,NULL);
+    BENCH("add", count, dictAdd(d,keys[_i],keys[_i]));
+    printf("  %-24s %7.1f bytes/key\n", "memory",
+        (double)(zmalloc_used_memory()-mem)/count);
+    while(dictIsRehashing(d)) dictRehashMilliseconds(d,100);
+    BENCH("find (hit)", lookups, found += dictFind(d,keys[order[_i]]) != NULL);
+    BENCH("find (miss)", lookups, found += dictFind(d,misses[order[_i]]) != NULL);
+    BENCH("random key", count, found += dictGetRandomKey(d) != NULL);
+    {
+        dictIterator *di = dictGetIterator(d);
+        BENCH("iterate", count, found += dictNext(di) != NULL);
+        dictReleaseIterator(di);
+    }
+    BENCH("delete", count, dictDelete(d,keys[_i]));
+    dictRelease(d);
+
+    printf("swdict (open addressing, %s):\n",
+#ifdef __SSE2__
+        "SSE2"
+#else
+        "scalar"
+#endif
+        );
+    mem = zmalloc_used_memory();
+    sw = swdictCreate(&benchDictType,NULL);
+    BENCH("add", count, swdictAdd(sw,keys[_i],keys[_i]));
+    printf("  %-24s %7.1f bytes/key\n", "memory",
+        (double)(zmalloc_used_memory()-mem)/count);
+    BENCH("find (hit)", lookups, found += swdictFind(sw,keys[order[_i]]) != NULL);
+    BENCH("find (miss)", lookups, found += swdictFind(sw,misses[order[_i]]) != NULL);
+    BENCH("random key", count, found += swdictGetRandomKey(sw) != NULL);
+    {
+        swdictIterator *di = swdictGetIterator(sw);
+        BENCH("iterate", count, found += swdictNext(di) != NULL);
+        swdictReleaseIterator(di);
+    }
+    BENCH("delete", count, swdictDelete(sw,keys[_i]));
+    swdictRelease(sw);
+
+    printf("(%ld)\n", found);
+    return 0;
+}
+
+#endif
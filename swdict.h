@@ -0,0 +1,70 @@
+/* Open addressing hash table, Swiss table style.
+ *
+ * This is an alternative to dict.c with the same dictType and mostly the
+ * same API, meant for tables where lookups dominate. Key and value
+ * pointers are stored inline in a flat array of slots, and for every slot
+ * there is a control byte holding 7 bits of the hash of the key: a lookup
+ * compares the control bytes of 16 slots at once (with SSE2 when
+ * available) and dereferences only the keys with a matching fragment.
+ *
+ * Differences with dict.c:
+ * - Entries are not allocated one by one, so the pointers returned by
+ *   swdictFind() and swdictNext() are only valid until the next insertion.
+ * - The table is resized in a single step, not incrementally.
+ * - No element can be added while iterating, deleting is fine.
+ *
+ * It is intentionally not wired into the keyspace or the other dict.c
+ * users: only swdict-benchmark uses it, and it is not built by 'make all'.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#ifndef __SWDICT_H
+#define __SWDICT_H
+
+#include "dict.h"
+
+#define SWDICT_GROUP_SIZE 16
+
+typedef struct swdictEntry {
+    void *key;
+    void *val;
+} swdictEntry;
+
+typedef struct swdict {
+    dictType *type;
+    void *privdata;
+    signed char *ctrl;          /* one control byte per slot */
+    swdictEntry *slots;
+    unsigned long size;         /* number of slots, a power of two */
+    unsigned long used;         /* number of elements */
+    unsigned long deleted;      /* slots marked as deleted */
+} swdict;
+
+typedef struct swdictIterator {
+    swdict *d;
+    long index;
+} swdictIterator;
+
+#define swdictGetEntryKey(he) ((he)->key)
+#define swdictGetEntryVal(he) ((he)->val)
+#define swdictSlots(d) ((d)->size)
+#define swdictSize(d) ((d)->used)
+
+/* API */
+swdict *swdictCreate(dictType *type, void *privDataPtr);
+int swdictExpand(swdict *d, unsigned long size);
+int swdictAdd(swdict *d, void *key, void *val);
+int swdictReplace(swdict *d, void *key, void *val);
+int swdictDelete(swdict *d, const void *key);
+int swdictDeleteNoFree(swdict *d, const void *key);
+void swdictRelease(swdict *d);
+void swdictEmpty(swdict *d);
+swdictEntry *swdictFind(swdict *d, const void *key);
+int swdictResize(swdict *d);
+swdictIterator *swdictGetIterator(swdict *d);
+swdictEntry *swdictNext(swdictIterator *iter);
+void swdictReleaseIterator(swdictIterator *iter);
+swdictEntry *swdictGetRandomKey(swdict *d);
+
+#endif /* __SWDICT_H */
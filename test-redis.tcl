@@ -113,6 +113,48 @@ proc main {server port} {
         $r dbsize
     } {10001}
 
+    test {SCAN to get all keys} {
+        set cur 0
+        while 1 {
+            set res [$r scan $cur count 100]
+            set cur [lindex $res 0]
+            foreach key [lrange $res 1 end] {set seen($key) 1}
+            if {$cur == 0} break
+        }
+        array size seen
+    } {10001}
+
+    test {SCAN with MATCH} {
+        set cur 0
+        set keys {}
+        while 1 {
+            set res [$r scan $cur match 99* count 1000]
+            set cur [lindex $res 0]
+            foreach key [lrange $res 1 end] {lappend keys $key}
+            if {$cur == 0} break
+        }
+        llength [lsort -unique $keys]
+    } {111}
+
+    test {SCAN with invalid cursor} {
+        catch {$r scan foobar} err
+        format $err
+    } {ERR*}
+
+    test {SCAN with invalid COUNT} {
+        set res {}
+        foreach count {abc 10x 0 -1 99999999999999999999} {
+            catch {$r scan 0 count $count} err
+            lappend res [string match ERR* $err]
+        }
+        format $res
+    } {1 1 1 1 1}
+
+    test {SCAN with a huge COUNT is clamped} {
+        set res [$r scan 0 count 1000000000]
+        list [expr {[lindex $res 0] != 0}] [expr {[llength $res] < 2000}]
+    } {1 1}
+
     test {INCR against non existing key} {
         set res {}
         append res [$r incr novar]
@@ -143,6 +185,22 @@ proc main {server port} {
         $r decrby novar 17179869185
     } {-1}
 
+    test {Integer-like values are returned verbatim} {
+        set res {}
+        foreach v {12 007 -0 +5 { 5} 9223372036854775807 99999999999999999999} {
+            $r set novar $v
+            lappend res [$r get novar]
+        }
+        set res
+    } {12 007 -0 +5 { 5} 9223372036854775807 99999999999999999999}
+
+    test {INCR against key holding an integer set with SET} {
+        $r set novar 4294967296
+        $r incr novar
+        $r incrby novar 10
+        list [$r get novar] [$r mget novar]
+    } {4294967307 4294967307}
+
     test {SETNX target key missing} {
         $r setnx novar2 foobared
         $r get novar2
@@ -180,6 +238,58 @@ proc main {server port} {
         format $res
     } {1xyzk1}
 
+    test {Multi bulk request with binary safe arguments} {
+        set fd [$r channel]
+        puts -nonewline $fd "*3\r\n\$3\r\nSET\r\n\$5\r\nk 1\r\n\r\n\$6\r\nx\r\ny z\r\n"
+        puts -nonewline $fd "*2\r\n\$3\r\nGET\r\n\$5\r\nk 1\r\n\r\n"
+        puts -nonewline $fd "*2\r\n\$3\r\nDEL\r\n\$5\r\nk 1\r\n\r\n"
+        flush $fd
+        set res {}
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [::redis::redis_read_reply $fd]
+        append res [::redis::redis_read_reply $fd]
+    } "1x\r\ny z1"
+
+    test {Multi bulk request with a big argument, mixed with inline ones} {
+        set fd [$r channel]
+        set big [string repeat x 100000]
+        puts -nonewline $fd "*3\r\n\$3\r\nSET\r\n\$3\r\nbig\r\n\$100000\r\n$big\r\n"
+        puts -nonewline $fd "PING\r\n*2\r\n\$6\r\nEXISTS\r\n\$3\r\nbig\r\n"
+        flush $fd
+        set res {}
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [string match PONG* [::redis::redis_read_reply $fd]]
+        append res [::redis::redis_read_reply $fd]
+        append res [expr {[$r get big] eq $big}]
+        $r del big
+        format $res
+    } {1111}
+
+    test {Multi bulk request with bad framing or argument count} {
+        set res {}
+        foreach req [list "*1\r\n\$4\r\nPING\rX" "*1\rX\$4\r\nPING\r\n" \
+                          "*2147483647\r\n" "*1\r\n\$4\r\nPINGxx"] {
+            set rr [redis $server $port]
+            set fd [$rr channel]
+            puts -nonewline $fd $req
+            flush $fd
+            catch {::redis::redis_read_reply $fd} err
+            lappend res [string match {*Protocol error*} $err]
+            close $fd
+        }
+        lappend res [$r ping]
+    } {1 1 1 1 PONG}
+
+    test {Multi bulk request with many arguments} {
+        set fd [$r channel]
+        puts -nonewline $fd "*1501\r\n\$4\r\nMGET\r\n"
+        for {set i 0} {$i < 1500} {incr i} {
+            puts -nonewline $fd "\$[string length k$i]\r\nk$i\r\n"
+        }
+        flush $fd
+        llength [::redis::redis_read_reply $fd]
+    } {1500}
+
     test {Non existing command} {
         catch {$r foobaredcommand} err
         string match ERR* $err
@@ -433,6 +543,63 @@ proc main {server port} {
         format $err
     } {ERR*value*}
 
+    test {LPUSH, LINDEX, LRANGE growing past the compact list limits} {
+        $r del mylist
+        set res {}
+        for {set i 0} {$i < 300} {incr i} {
+            $r rpush mylist $i
+            $r lpush mylist x$i
+        }
+        lappend res [$r llen mylist] [$r lindex mylist -1] [$r lindex mylist 0]
+        $r del mylist
+        $r rpush mylist 1
+        $r rpush mylist [string repeat a 100]
+        $r rpush mylist 3
+        lappend res [$r lrange mylist 0 -1]
+    } [list 600 299 x299 [list 1 [string repeat a 100] 3]]
+
+    test {Compact and big lists survive a reload in order} {
+        $r del smalllist biglist
+        foreach e {a 1 -20 4294967296 b} {$r rpush smalllist $e}
+        for {set i 0} {$i < 300} {incr i} {$r rpush biglist $i}
+        $r rpush biglist [string repeat x 100]
+        set small [$r lrange smalllist 0 -1]
+        set big [$r lrange biglist 0 -1]
+        $r debug reload
+        list [expr {[$r lrange smalllist 0 -1] eq $small}] \
+             [expr {[$r lrange biglist 0 -1] eq $big}] \
+             [string match *encoding:ziplist* [$r debug object smalllist]] \
+             [string match *encoding:quicklist* [$r debug object biglist]]
+    } {1 1 1 1}
+
+    test {LSET, LREM, LPOP with integer and string elements} {
+        $r del mylist
+        foreach e {10 foo -200 100000 007 bar 10} {$r rpush mylist $e}
+        $r lset mylist 1 4294967296
+        $r lset mylist -2 [string repeat b 100]
+        set res [$r lrem mylist 0 10]
+        list $res [$r lpop mylist] [$r rpop mylist] [$r lrange mylist 0 -1]
+    } [list 2 4294967296 [string repeat b 100] {-200 100000 007}]
+
+    test {LINDEX, LSET, LRANGE, LTRIM on a big list} {
+        $r del mylist
+        for {set i 0} {$i < 1000} {incr i} {$r rpush mylist $i}
+        set res {}
+        lappend res [$r lindex mylist 500] [$r lindex mylist -300]
+        $r lset mylist 700 foo
+        $r lset mylist -1 bar
+        lappend res [$r lrange mylist 698 701] [$r lrange mylist -2 -1]
+        $r ltrim mylist 100 -101
+        lappend res [$r llen mylist] [$r lindex mylist 0] [$r lindex mylist -1]
+    } {500 700 {698 699 foo 701} {998 bar} 800 100 899}
+
+    test {LREM from the tail on a big list} {
+        $r del mylist
+        for {set i 0} {$i < 1000} {incr i} {$r rpush mylist [expr {$i%10}]}
+        set res [$r lrem mylist -50 7]
+        list $res [$r llen mylist] [$r lindex mylist 500] [$r lrange mylist -8 -1]
+    } {50 950 0 {1 2 3 4 5 6 8 9}}
+
     test {SADD, SCARD, SISMEMBER, SMEMBERS basics} {
         $r sadd myset foo
         $r sadd myset bar
@@ -515,9 +682,233 @@ proc main {server port} {
         lsort [$r smembers sres]
     } {1 2 3 4}
 
+    test {SADD, SREM, SISMEMBER against a set of integers} {
+        $r del iset
+        foreach i {3 1 -5 2 100000 5000000000 -32769 3} {$r sadd iset $i}
+        set res [$r scard iset]
+        lappend res [$r sismember iset 2] [$r sismember iset 4] \
+            [$r sismember iset 02] [$r sismember iset 5000000000]
+        lappend res [$r srem iset 1] [$r srem iset 1] [$r srem iset foo]
+        lappend res [$r sort iset]
+    } {7 1 0 0 1 1 0 0 {-32769 -5 2 3 100000 5000000000}}
+
+    test {SADD of a non integer member converts a set of integers} {
+        set res [$r sadd iset 007]
+        lappend res [$r sadd iset foo] [$r sismember iset 3] \
+            [$r sismember iset 007] [$r scard iset]
+        lappend res [lsort [$r smembers iset]]
+    } {1 1 1 1 8 {-32769 -5 007 100000 2 3 5000000000 foo}}
+
+    test {SINTER, SUNION, SDIFF against sets of integers} {
+        $r del iset1 iset2 iset3 iset4
+        for {set i 0} {$i < 400} {incr i} {
+            $r sadd iset1 [expr {$i*3}]
+            $r sadd iset2 [expr {$i*5}]
+        }
+        foreach i {-15 0 15 30 45 1000000} {$r sadd iset3 $i}
+        foreach i {0 15 30 foo} {$r sadd iset4 $i}
+        list [lsort -integer [$r sinter iset1 iset2 iset3]] \
+            [lsort -integer [$r sinter iset3 iset2]] \
+            [lsort [$r sinter iset1 iset4]] [$r sinterstore iset5 iset1 iset2] \
+            [$r scard iset5] [$r sismember iset5 1185] \
+            [lsort -integer [$r sunion iset3 iset3]] \
+            [lsort -integer [$r sdiff iset3 iset1]] [lsort [$r sdiff iset4 iset3]]
+    } {{0 15 30 45} {0 15 30 45} {0 15 30} 80 80 1 {-15 0 15 30 45 1000000} {-15 1000000} foo}
+
+    test {Big set of integers converted to a hash table} {
+        $r del iset
+        for {set i 0} {$i < 600} {incr i} {$r sadd iset $i}
+        list [$r scard iset] [$r sismember iset 599] [$r srem iset 0] \
+            [$r sismember iset 0] [$r sadd iset 0] [$r scard iset]
+    } {600 1 1 0 1 600}
+
+    test {Sets of integers of every width survive a reload} {
+        $r del iset16 iset32 iset64 istrset
+        foreach e {1 -2 300} {$r sadd iset16 $e}
+        foreach e {1 300 40000 -70000} {$r sadd iset32 $e}
+        foreach e {1 40000 5000000000 -9000000000} {$r sadd iset64 $e}
+        foreach e {1 300 foo bar} {$r sadd istrset $e}
+        $r debug reload
+        set res {}
+        foreach key {iset16 iset32 iset64} {
+            lappend res [lsort -integer [$r smembers $key]] \
+                [string match *encoding:intset* [$r debug object $key]]
+        }
+        lappend res [lsort [$r smembers istrset]] \
+            [string match *encoding:hashtable* [$r debug object istrset]]
+        lappend res [lsort -integer [$r sinter iset16 iset32 iset64]] \
+            [lsort -integer [$r sinter iset32 iset64]] \
+            [lsort [$r sinter istrset iset16 iset32]]
+    } {{-2 1 300} 1 {-70000 1 300 40000} 1 {-9000000000 1 40000 5000000000} 1 {1 300 bar foo} 1 1 {1 40000} {1 300}}
+
+    test {SMOVE between a set of integers and a set of strings} {
+        $r del iset istrset
+        $r sadd iset 1
+        $r sadd iset 2
+        $r sadd istrset a
+        list [$r smove iset istrset 1] [$r smove istrset iset a] \
+            [lsort [$r smembers iset]] [lsort [$r smembers istrset]]
+    } {1 1 {2 a} 1}
+
+    test {ZADD, ZCARD, ZSCORE basics} {
+        $r del ztmp
+        set res {}
+        lappend res [$r zadd ztmp 10 x]
+        lappend res [$r zadd ztmp 20 y]
+        lappend res [$r zadd ztmp 30 x]
+        lappend res [$r zcard ztmp] [$r zscore ztmp x] [$r zscore ztmp z]
+        lappend res [$r type ztmp]
+    } {1 1 0 2 30 {} zset}
+
+    test {ZADD against non zset and with an invalid score} {
+        $r set x 10
+        catch {$r zadd x 1 foo} err1
+        catch {$r zadd ztmp abc foo} err2
+        catch {$r zadd ztmp nan foo} err3
+        list [string range $err1 0 2] [string range $err2 0 2] \
+             [string range $err3 0 2]
+    } {ERR ERR ERR}
+
+    test {ZRANGE, ZREVRANGE, ZRANK, ZREVRANK} {
+        $r del ztmp
+        $r zadd ztmp 3 c
+        $r zadd ztmp 1 a
+        $r zadd ztmp 2.5 b
+        $r zadd ztmp 2.5 bb
+        $r zadd ztmp -inf first
+        list [$r zrange ztmp 0 -1] [$r zrevrange ztmp 1 2 withscores] \
+             [$r zrange ztmp -2 100] [$r zrange ztmp 3 1] \
+             [$r zrank ztmp b] [$r zrevrank ztmp b] [$r zrank ztmp x]
+    } {{first a b bb c} {bb 2.5 b 2.5} {bb c} {} 2 2 {}}
+
+    test {ZINCRBY moves the element to its new position} {
+        $r del ztmp
+        $r zadd ztmp 1 a
+        $r zadd ztmp 2 b
+        set res {}
+        lappend res [$r zincrby ztmp 5 a]
+        lappend res [$r zincrby ztmp 0.5 c]
+        lappend res [$r zrange ztmp 0 -1]
+    } {6 0.5 {c b a}}
+
+    test {ZRANGEBYSCORE with LIMIT, ZCOUNT} {
+        $r del ztmp
+        foreach {s m} {1 a 2 b 2 c 3 d 5 e 8 f} {$r zadd ztmp $s $m}
+        list [$r zrangebyscore ztmp 2 5] [$r zrangebyscore ztmp -inf 2 withscores] \
+             [$r zrangebyscore ztmp 2 +inf limit 1 2] \
+             [$r zrangebyscore ztmp 2 +inf limit 3 -1] \
+             [$r zcount ztmp 2 3] [$r zcount ztmp 6 4]
+    } {{b c d e} {a 1 b 2 c 2} {c d} {e f} 3 0}
+
+    test {ZREM, ZREMRANGEBYSCORE, ZREMRANGEBYRANK} {
+        set res {}
+        lappend res [$r zrem ztmp c] [$r zrem ztmp c]
+        lappend res [$r zremrangebyscore ztmp 2 3]
+        lappend res [$r zremrangebyrank ztmp -1 -1]
+        lappend res [$r zrange ztmp 0 -1] [$r zscore ztmp d]
+    } {1 0 2 1 {a e} {}}
+
+    test {ZSET scores survive SAVE and a reload} {
+        $r del ztmp
+        foreach {s m} {1.5 a -3 b 0 c 1e10 d 2.25 e} {$r zadd ztmp $s $m}
+        $r save
+        $r debug reload
+        list [$r zrange ztmp 0 -1 withscores] [$r zscore ztmp e] \
+             [$r zscore ztmp d] [$r zcard ztmp]
+    } {{b -3 c 0 a 1.5 e 2.25 d 10000000000} 2.25 10000000000 5}
+
+    test {ZSETs ordering against lsort with many elements} {
+        $r del ztmp
+        set err {}
+        for {set i 0} {$i < 1000} {incr i} {
+            set score [expr {rand()*1000-500}]
+            $r zadd ztmp $score ele$i
+            lappend pairs [list ele$i [$r zscore ztmp ele$i]]
+        }
+        set sorted {}
+        foreach p [lsort -real -index 1 $pairs] {lappend sorted [lindex $p 0]}
+        if {[$r zrange ztmp 0 -1] ne $sorted} {set err "ZRANGE mismatch"}
+        for {set i 0} {$i < 100} {incr i} {
+            set rank [expr {int(rand()*1000)}]
+            set ele [lindex $sorted $rank]
+            if {[$r zrank ztmp $ele] != $rank} {set err "ZRANK mismatch"}
+            if {[$r zrange ztmp $rank $rank] ne $ele} {set err "ZRANGE at rank mismatch"}
+        }
+        format $err
+    } {}
+
+    test {HSET, HGET, HLEN, HEXISTS basics} {
+        $r del htmp
+        set res {}
+        lappend res [$r hset htmp name antirez]
+        lappend res [$r hset htmp age 30]
+        lappend res [$r hset htmp name {salvatore sanfilippo}]
+        lappend res [$r hget htmp name] [$r hget htmp age] [$r hget htmp x]
+        lappend res [$r hlen htmp] [$r hexists htmp age] [$r hexists htmp x]
+        lappend res [$r type htmp]
+    } {1 1 0 {salvatore sanfilippo} 30 {} 2 1 0 hash}
+
+    test {HMGET, HGETALL, HDEL} {
+        set res {}
+        lappend res [$r hmget htmp age x name]
+        lappend res [lsort [$r hgetall htmp]]
+        lappend res [$r hdel htmp age] [$r hdel htmp age]
+        lappend res [$r hgetall htmp] [$r hmget nokey a b]
+    } {{30 {} {salvatore sanfilippo}} {30 age name {salvatore sanfilippo}} 1 0 {name {salvatore sanfilippo}} {{} {}}}
+
+    test {HINCRBY} {
+        $r del htmp
+        set res {}
+        lappend res [$r hincrby htmp counter 5]
+        lappend res [$r hincrby htmp counter -15]
+        $r hset htmp str foo
+        lappend res [$r hincrby htmp str 3]
+        lappend res [$r hget htmp counter]
+    } {5 -10 3 -10}
+
+    test {HSET against non hash} {
+        $r set x 10
+        catch {$r hset x a b} err
+        format $err
+    } {ERR*}
+
+    test {HSET, HGET, HDEL growing past the compact hash limits} {
+        $r del htmp
+        set err {}
+        for {set i 0} {$i < 300} {incr i} {
+            $r hset htmp field$i value$i
+        }
+        $r hset htmp big [string repeat x 100]
+        for {set i 0} {$i < 300} {incr i 2} {
+            $r hdel htmp field$i
+        }
+        for {set i 0} {$i < 300} {incr i} {
+            set expected [expr {$i % 2 ? "value$i" : ""}]
+            if {[$r hget htmp field$i] ne $expected} {set err "mismatch at $i"}
+        }
+        list $err [$r hlen htmp] [string length [$r hget htmp big]]
+    } {{} 151 100}
+
+    test {Compact and big hashes survive a reload} {
+        $r del smallhash bighash
+        foreach {f v} {a 1 b -20 c 4294967296 d foo} {$r hset smallhash $f $v}
+        for {set i 0} {$i < 300} {incr i} {$r hset bighash field$i value$i}
+        set small [lsort [$r hgetall smallhash]]
+        set big [lsort [$r hgetall bighash]]
+        $r debug reload
+        list [expr {[lsort [$r hgetall smallhash]] eq $small}] \
+             [expr {[lsort [$r hgetall bighash]] eq $big}] \
+             [$r hget bighash field299] \
+             [string match *encoding:ziplist* [$r debug object smallhash]] \
+             [string match *encoding:hashtable* [$r debug object bighash]]
+    } {1 1 value299 1 1}
+
     test {SAVE - make sure there are all the types as values} {
         $r lpush mysavelist hello
         $r lpush mysavelist world
+        $r zadd mysavezset 1 hello
+        $r hset mysavehash field hello
+        $r sadd mysaveintset 10
         $r set myemptykey {}
         $r set mynormalkey {blablablba}
         $r save
@@ -690,6 +1081,61 @@ proc main {server port} {
         $r randomkey
     } {}
 
+    test {SETBIT, GETBIT basics} {
+        $r del bits
+        set res {}
+        lappend res [$r setbit bits 1 1] [$r setbit bits 7 1] [$r setbit bits 7 0]
+        lappend res [$r get bits] [$r getbit bits 1] [$r getbit bits 100]
+        lappend res [$r setbit bits 23 1] [string length [$r get bits]]
+        lappend res [$r getbit nokey 5]
+    } {0 0 1 @ 1 0 0 3 0}
+
+    test {SETBIT against integer encoded and shared values} {
+        $r set bits 10
+        $r set other 10
+        $r setbit bits 14 1
+        list [$r get bits] [$r get other]
+    } {12 10}
+
+    test {SETBIT with invalid offset or bit} {
+        catch {$r setbit bits -1 1} err1
+        catch {$r setbit bits 4294967296 1} err2
+        catch {$r setbit bits 1 2} err3
+        $r del bitlist
+        $r lpush bitlist a
+        catch {$r setbit bitlist 1 1} err4
+        list [string range $err1 0 2] [string range $err2 0 2] \
+             [string range $err3 0 2] [string range $err4 0 2]
+    } {ERR ERR ERR ERR}
+
+    test {BITCOUNT with and without a range} {
+        $r set bits foobar
+        list [$r bitcount bits] [$r bitcount bits 0 0] [$r bitcount bits 1 1] \
+             [$r bitcount bits -2 -1] [$r bitcount bits 5 1] [$r bitcount nokey]
+    } {26 4 6 7 0 0}
+
+    test {BITCOUNT against a big random string} {
+        set str [randstring 1000 2000 binary]
+        binary scan $str B* binstr
+        $r set bits $str
+        expr {[$r bitcount bits] == [string length [string map {0 {}} $binstr]]}
+    } {1}
+
+    test {BITOP AND, OR, XOR, NOT} {
+        $r set bits1 "\xff\xf0\x0f\x55"
+        $r set bits2 "\x0f\xff"
+        set res {}
+        foreach op {and or xor} {
+            lappend res [$r bitop $op dest bits1 bits2 nokey]
+            binary scan [$r get dest] H* hex
+            lappend res $hex
+        }
+        lappend res [$r bitop not dest bits2]
+        binary scan [$r get dest] H* hex
+        lappend res $hex
+        lappend res [$r bitop and dest nokey] [$r exists dest]
+    } {4 00000000 4 ffff0f55 4 f00f0f55 2 f000 0 0}
+
     test {GETSET (set new value)} {
         list [$r getset foo xyz] [$r get foo]
     } {{} xyz}
@@ -0,0 +1,695 @@
+/* Compact list of strings and integers stored in a single allocation.
+ *
+ * The layout of a ziplist is:
+ *
+ * <zlbytes><zltail><zllen><entry><entry>...<zlend>
+ *
+ * <zlbytes> is an unsigned 32 bit integer with the total size of the
+ * ziplist, so it can be resized without walking it first.
+ * <zltail> is the offset of the last entry, so it's possible to pop from
+ * the tail without a full traversal.
+ * <zllen> is the number of entries. When it does not fit 16 bits it is
+ * set to UINT16_MAX and the list must be traversed to get the length.
+ * <zlend> is a single byte set to 255 marking the end of the list.
+ *
+ * Every entry starts with the length of the previous entry, stored in a
+ * single byte when smaller than 254 bytes, otherwise as the byte 254
+ * followed by an unsigned 32 bit integer. Then comes the encoding, which
+ * is a length for strings or the size of the integer:
+ *
+ * |00pppppp| string of up to 63 bytes
+ * |01pppppp|qqqqqqqq| string of up to 16383 bytes (big endian)
+ * |10______|qqqqqqqq|rrrrrrrr|ssssssss|tttttttt| longer string (big endian)
+ * |11000000| int16_t
+ * |11010000| int32_t
+ * |11100000| int64_t
+ * |11110000| 24 bit signed integer
+ * |11111110| 8 bit signed integer
+ * |1111xxxx| xxxx between 0001 and 1101 is a value between 0 and 12
+ *
+ * Integers are stored in little endian order.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "ziplist.h"
+#include "zmalloc.h"
+
+#define ZIP_END 255
+#define ZIP_BIGLEN 254
+
+/* Entry encodings */
+#define ZIP_STR_MASK 0xc0
+#define ZIP_STR_06B (0 << 6)
+#define ZIP_STR_14B (1 << 6)
+#define ZIP_STR_32B (2 << 6)
+#define ZIP_INT_16B (0xc0 | 0<<4)
+#define ZIP_INT_32B (0xc0 | 1<<4)
+#define ZIP_INT_64B (0xc0 | 2<<4)
+#define ZIP_INT_24B (0xc0 | 3<<4)
+#define ZIP_INT_8B 0xfe
+#define ZIP_INT_IMM_MASK 0x0f
+#define ZIP_INT_IMM_MIN 0xf1    /* 11110001 */
+#define ZIP_INT_IMM_MAX 0xfd    /* 11111101 */
+
+#define ZIP_IS_STR(enc) (((enc) & ZIP_STR_MASK) < ZIP_STR_MASK)
+
+/* Utility macros to access the header fields */
+#define ZIPLIST_BYTES(zl) (*((uint32_t*)(zl)))
+#define ZIPLIST_TAIL_OFFSET(zl) (*((uint32_t*)((zl)+sizeof(uint32_t))))
+#define ZIPLIST_LENGTH(zl) (*((uint16_t*)((zl)+sizeof(uint32_t)*2)))
+#define ZIPLIST_HEADER_SIZE (sizeof(uint32_t)*2+sizeof(uint16_t))
+#define ZIPLIST_ENTRY_HEAD(zl) ((zl)+ZIPLIST_HEADER_SIZE)
+#define ZIPLIST_ENTRY_TAIL(zl) ((zl)+ZIPLIST_TAIL_OFFSET(zl))
+#define ZIPLIST_ENTRY_END(zl) ((zl)+ZIPLIST_BYTES(zl)-1)
+
+/* The length is only updated while it fits the 16 bits field */
+#define ZIPLIST_INCR_LENGTH(zl,incr) do { \
+    if (ZIPLIST_LENGTH(zl) < UINT16_MAX) \
+        ZIPLIST_LENGTH(zl) = ZIPLIST_LENGTH(zl)+(incr); \
+} while(0)
+
+typedef struct zlentry {
+    unsigned int prevrawlensize, prevrawlen;
+    unsigned int lensize, len;
+    unsigned int headersize;
+    unsigned char encoding;
+    unsigned char *p;
+} zlentry;
+
+/* ------------------------- Heap Management Wrappers------------------------ */
+
+static unsigned char *ziplistResize(unsigned char *zl, unsigned int len) {
+    zl = zrealloc(zl,len);
+    if (zl == NULL) {
+        fprintf(stderr, "\nZIPLIST LIBRARY PANIC: Out of memory\n\n");
+        abort();
+    }
+    ZIPLIST_BYTES(zl) = len;
+    zl[len-1] = ZIP_END;
+    return zl;
+}
+
+/* --------------------------- Entries encoding ----------------------------- */
+
+/* Return bytes needed to store an integer encoded with 'encoding' */
+static unsigned int zipIntSize(unsigned char encoding) {
+    switch(encoding) {
+    case ZIP_INT_8B:  return 1;
+    case ZIP_INT_16B: return 2;
+    case ZIP_INT_24B: return 3;
+    case ZIP_INT_32B: return 4;
+    case ZIP_INT_64B: return 8;
+    default: return 0; /* 4 bit immediate */
+    }
+}
+
+/* Write the encoding header of an entry at 'p' and return its size. When
+ * 'p' is NULL only the number of bytes needed is returned. */
+static unsigned int zipEncodeLength(unsigned char *p, unsigned char encoding,
+                                    unsigned int rawlen)
+{
+    unsigned char len = 1, buf[5];
+
+    if (ZIP_IS_STR(encoding)) {
+        if (rawlen <= 0x3f) {
+            if (!p) return len;
+            buf[0] = ZIP_STR_06B | rawlen;
+        } else if (rawlen <= 0x3fff) {
+            len += 1;
+            if (!p) return len;
+            buf[0] = ZIP_STR_14B | ((rawlen >> 8) & 0x3f);
+            buf[1] = rawlen & 0xff;
+        } else {
+            len += 4;
+            if (!p) return len;
+            buf[0] = ZIP_STR_32B;
+            buf[1] = (rawlen >> 24) & 0xff;
+            buf[2] = (rawlen >> 16) & 0xff;
+            buf[3] = (rawlen >> 8) & 0xff;
+            buf[4] = rawlen & 0xff;
+        }
+    } else {
+        if (!p) return len;
+        buf[0] = encoding;
+    }
+    memcpy(p,buf,len);
+    return len;
+}
+
+/* Decode the encoding header at 'p': the encoding and the header size are
+ * stored by reference, the length of the entry data is returned. */
+static unsigned int zipDecodeLength(unsigned char *p, unsigned char *encoding,
+                                    unsigned int *lensize)
+{
+    unsigned char enc = p[0];
+
+    if (enc < ZIP_STR_MASK) enc &= ZIP_STR_MASK;
+    *encoding = enc;
+    if (enc == ZIP_STR_06B) {
+        *lensize = 1;
+        return p[0] & 0x3f;
+    } else if (enc == ZIP_STR_14B) {
+        *lensize = 2;
+        return ((p[0] & 0x3f) << 8) | p[1];
+    } else if (enc == ZIP_STR_32B) {
+        *lensize = 5;
+        return ((unsigned int)p[1] << 24) | (p[2] << 16) | (p[3] << 8) | p[4];
+    }
+    *lensize = 1;
+    return zipIntSize(enc);
+}
+
+/* Write the length of the previous entry at 'p' and return the number of
+ * bytes used. When 'p' is NULL only the number of bytes needed is returned. */
+static unsigned int zipEncodePrevLength(unsigned char *p, unsigned int len) {
+    if (p == NULL) return (len < ZIP_BIGLEN) ? 1 : sizeof(len)+1;
+    if (len < ZIP_BIGLEN) {
+        p[0] = len;
+        return 1;
+    }
+    p[0] = ZIP_BIGLEN;
+    memcpy(p+1,&len,sizeof(len));
+    return 1+sizeof(len);
+}
+
+/* Write a length that would fit one byte using five bytes. Used when the
+ * field is already five bytes long and shrinking it is not worth it. */
+static void zipEncodePrevLengthForceLarge(unsigned char *p, unsigned int len) {
+    p[0] = ZIP_BIGLEN;
+    memcpy(p+1,&len,sizeof(len));
+}
+
+static unsigned int zipDecodePrevLength(unsigned char *p, unsigned int *lensize) {
+    unsigned int len;
+
+    if (p[0] < ZIP_BIGLEN) {
+        *lensize = 1;
+        return p[0];
+    }
+    *lensize = 1+sizeof(len);
+    memcpy(&len,p+1,sizeof(len));
+    return len;
+}
+
+/* Difference in bytes between the space needed to store 'len' as previous
+ * entry length and the space currently used by the entry at 'p'. */
+static int zipPrevLenByteDiff(unsigned char *p, unsigned int len) {
+    unsigned int prevlensize;
+
+    zipDecodePrevLength(p,&prevlensize);
+    return zipEncodePrevLength(NULL,len)-prevlensize;
+}
+
+static zlentry zipEntry(unsigned char *p) {
+    zlentry e;
+
+    e.prevrawlen = zipDecodePrevLength(p,&e.prevrawlensize);
+    e.len = zipDecodeLength(p+e.prevrawlensize,&e.encoding,&e.lensize);
+    e.headersize = e.prevrawlensize+e.lensize;
+    e.p = p;
+    return e;
+}
+
+static unsigned int zipRawEntryLength(unsigned char *p) {
+    zlentry e = zipEntry(p);
+
+    return e.headersize+e.len;
+}
+
+/* Strict string to long long conversion: only the canonical representation
+ * of a number is accepted, so that the string can be rebuilt exactly. */
+static int zipString2ll(const unsigned char *s, unsigned int slen,
+                        long long *value)
+{
+    unsigned long long v = 0;
+    unsigned int j = 0;
+    int negative = 0;
+
+    if (slen == 0) return 0;
+    if (slen == 1 && s[0] == '0') {
+        *value = 0;
+        return 1;
+    }
+    if (s[0] == '-') {
+        negative = 1;
+        j++;
+        if (j == slen) return 0;
+    }
+    /* No leading zeros, the first digit must be 1-9 */
+    if (s[j] < '1' || s[j] > '9') return 0;
+    for (; j < slen; j++) {
+        if (s[j] < '0' || s[j] > '9') return 0;
+        if (v > (ULLONG_MAX / 10)) return 0;
+        v *= 10;
+        if (v > (ULLONG_MAX - (s[j]-'0'))) return 0;
+        v += s[j]-'0';
+    }
+    if (negative) {
+        if (v > ((unsigned long long)(-(LLONG_MIN+1))+1)) return 0;
+        *value = (v == 0) ? 0 : -(long long)(v-1)-1;
+    } else {
+        if (v > LLONG_MAX) return 0;
+        *value = v;
+    }
+    return 1;
+}
+
+/* Check if the string can be stored as an integer, and if so store the
+ * value and the smallest encoding able to hold it by reference. */
+static int zipTryEncoding(unsigned char *entry, unsigned int entrylen,
+                          long long *v, unsigned char *encoding)
+{
+    long long value;
+
+    if (entrylen >= 32 || !zipString2ll(entry,entrylen,&value)) return 0;
+    if (value >= 0 && value <= 12)
+        *encoding = ZIP_INT_IMM_MIN+value;
+    else if (value >= INT8_MIN && value <= INT8_MAX)
+        *encoding = ZIP_INT_8B;
+    else if (value >= INT16_MIN && value <= INT16_MAX)
+        *encoding = ZIP_INT_16B;
+    else if (value >= -(1<<23) && value <= (1<<23)-1)
+        *encoding = ZIP_INT_24B;
+    else if (value >= INT32_MIN && value <= INT32_MAX)
+        *encoding = ZIP_INT_32B;
+    else
+        *encoding = ZIP_INT_64B;
+    *v = value;
+    return 1;
+}
+
+static void zipSaveInteger(unsigned char *p, long long value,
+                           unsigned char encoding)
+{
+    unsigned int j, size = zipIntSize(encoding);
+    unsigned long long v = (unsigned long long)value;
+
+    for (j = 0; j < size; j++) {
+        p[j] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+static long long zipLoadInteger(unsigned char *p, unsigned char encoding) {
+    unsigned int j, size = zipIntSize(encoding);
+    unsigned long long v = 0;
+
+    if (encoding >= ZIP_INT_IMM_MIN && encoding <= ZIP_INT_IMM_MAX)
+        return (encoding & ZIP_INT_IMM_MASK)-1;
+    for (j = size; j > 0; j--) v = (v << 8) | p[j-1];
+    /* Sign extension */
+    if (size < 8 && (v & (1ULL << (size*8-1)))) v |= ~0ULL << (size*8);
+    return (long long)v;
+}
+
+/* ----------------------------- Private API -------------------------------- */
+
+/* When an entry is inserted or its size changes, the previous length field
+ * of the next entry may need to grow from one to five bytes, which may in
+ * turn make the next entry grow as well, and so forth. This function walks
+ * the list from 'p' fixing the previous length fields until no more
+ * changes are needed. The fields are never shrunk, to avoid flapping. */
+static unsigned char *__ziplistCascadeUpdate(unsigned char *zl, unsigned char *p) {
+    size_t curlen = ZIPLIST_BYTES(zl), rawlen, rawlensize;
+    size_t offset, noffset, extra;
+    unsigned char *np;
+    zlentry cur, next;
+
+    while (p[0] != ZIP_END) {
+        cur = zipEntry(p);
+        rawlen = cur.headersize + cur.len;
+        rawlensize = zipEncodePrevLength(NULL,rawlen);
+
+        /* Abort if there is no next entry */
+        if (p[rawlen] == ZIP_END) break;
+        next = zipEntry(p+rawlen);
+
+        /* Abort when the stored length didn't change */
+        if (next.prevrawlen == rawlen) break;
+
+        if (next.prevrawlensize < rawlensize) {
+            /* The field must grow, make room for it */
+            offset = p-zl;
+            extra = rawlensize-next.prevrawlensize;
+            zl = ziplistResize(zl,curlen+extra);
+            p = zl+offset;
+            np = p+rawlen;
+            noffset = np-zl;
+
+            /* The tail moves, unless the next entry is the tail itself */
+            if ((zl+ZIPLIST_TAIL_OFFSET(zl)) != np)
+                ZIPLIST_TAIL_OFFSET(zl) += extra;
+
+            memmove(np+rawlensize,np+next.prevrawlensize,
+                    curlen-noffset-next.prevrawlensize-1);
+            zipEncodePrevLength(np,rawlen);
+
+            /* Advance the cursor */
+            p += rawlen;
+            curlen += extra;
+        } else {
+            if (next.prevrawlensize > rawlensize)
+                zipEncodePrevLengthForceLarge(p+rawlen,rawlen);
+            else
+                zipEncodePrevLength(p+rawlen,rawlen);
+            /* The size of the next entry didn't change, stop here */
+            break;
+        }
+    }
+    return zl;
+}
+
+/* Delete 'num' entries starting at 'p'. Returns the new ziplist. */
+static unsigned char *__ziplistDelete(unsigned char *zl, unsigned char *p,
+                                      unsigned int num)
+{
+    unsigned int i, totlen, deleted = 0;
+    size_t offset;
+    int nextdiff = 0;
+    zlentry first, tail;
+
+    first = zipEntry(p);
+    for (i = 0; p[0] != ZIP_END && i < num; i++) {
+        p += zipRawEntryLength(p);
+        deleted++;
+    }
+
+    totlen = p-first.p;
+    if (totlen > 0) {
+        if (p[0] != ZIP_END) {
+            /* The entry after the deleted ones now follows the entry before
+             * them: update its previous length field, that may need a
+             * different number of bytes. There is always room for it as
+             * the deleted entries used at least as many bytes. */
+            nextdiff = zipPrevLenByteDiff(p,first.prevrawlen);
+            p -= nextdiff;
+            zipEncodePrevLength(p,first.prevrawlen);
+
+            ZIPLIST_TAIL_OFFSET(zl) -= totlen;
+            /* When the entry is not the tail, the size change of its header
+             * moves the tail as well */
+            tail = zipEntry(p);
+            if (p[tail.headersize+tail.len] != ZIP_END)
+                ZIPLIST_TAIL_OFFSET(zl) += nextdiff;
+
+            memmove(first.p,p,ZIPLIST_BYTES(zl)-(p-zl)-1);
+        } else {
+            /* The entire tail was deleted */
+            ZIPLIST_TAIL_OFFSET(zl) = (first.p-zl)-first.prevrawlen;
+        }
+
+        offset = first.p-zl;
+        zl = ziplistResize(zl,ZIPLIST_BYTES(zl)-totlen+nextdiff);
+        ZIPLIST_INCR_LENGTH(zl,-(int)deleted);
+        p = zl+offset;
+
+        /* The size of the next entry changed, so the entries after it may
+         * need to be updated as well */
+        if (nextdiff != 0) zl = __ziplistCascadeUpdate(zl,p);
+    }
+    return zl;
+}
+
+/* Insert the string 's' before the entry at 'p' (or at the end when 'p'
+ * points to the end marker). Returns the new ziplist. */
+static unsigned char *__ziplistInsert(unsigned char *zl, unsigned char *p,
+                                      unsigned char *s, unsigned int slen)
+{
+    size_t curlen = ZIPLIST_BYTES(zl), reqlen, offset;
+    unsigned int prevlen = 0;
+    int nextdiff = 0, forcelarge = 0;
+    unsigned char encoding = 0;
+    long long value = 0;
+    zlentry entry, tail;
+
+    /* Find the length of the entry before the insertion point */
+    if (p[0] != ZIP_END) {
+        entry = zipEntry(p);
+        prevlen = entry.prevrawlen;
+    } else {
+        unsigned char *ptail = ZIPLIST_ENTRY_TAIL(zl);
+        if (ptail[0] != ZIP_END) prevlen = zipRawEntryLength(ptail);
+    }
+
+    /* Size of the new entry */
+    if (zipTryEncoding(s,slen,&value,&encoding))
+        reqlen = zipIntSize(encoding);
+    else
+        reqlen = slen;
+    reqlen += zipEncodePrevLength(NULL,prevlen);
+    reqlen += zipEncodeLength(NULL,encoding,slen);
+
+    /* When not inserting at the tail, the next entry must be able to
+     * store the length of the new entry. A five bytes field is not shrunk
+     * when the new entry is smaller than four bytes, as the memmove below
+     * would need the array to shrink before the data is moved. */
+    nextdiff = (p[0] != ZIP_END) ? zipPrevLenByteDiff(p,reqlen) : 0;
+    if (nextdiff == -4 && reqlen < 4) {
+        nextdiff = 0;
+        forcelarge = 1;
+    }
+
+    offset = p-zl;
+    zl = ziplistResize(zl,curlen+reqlen+nextdiff);
+    p = zl+offset;
+
+    if (p[0] != ZIP_END) {
+        /* Make room for the new entry */
+        memmove(p+reqlen,p-nextdiff,curlen-offset-1+nextdiff);
+
+        /* Store the length of the new entry in the next one */
+        if (forcelarge)
+            zipEncodePrevLengthForceLarge(p+reqlen,reqlen);
+        else
+            zipEncodePrevLength(p+reqlen,reqlen);
+
+        ZIPLIST_TAIL_OFFSET(zl) += reqlen;
+        /* When the next entry is not the tail, the size change of its
+         * header moves the tail as well */
+        tail = zipEntry(p+reqlen);
+        if (p[reqlen+tail.headersize+tail.len] != ZIP_END)
+            ZIPLIST_TAIL_OFFSET(zl) += nextdiff;
+    } else {
+        /* The new entry is the tail */
+        ZIPLIST_TAIL_OFFSET(zl) = p-zl;
+    }
+
+    if (nextdiff != 0) {
+        offset = p-zl;
+        zl = __ziplistCascadeUpdate(zl,p+reqlen);
+        p = zl+offset;
+    }
+
+    /* Write the entry */
+    p += zipEncodePrevLength(p,prevlen);
+    p += zipEncodeLength(p,encoding,slen);
+    if (ZIP_IS_STR(encoding))
+        memcpy(p,s,slen);
+    else
+        zipSaveInteger(p,value,encoding);
+    ZIPLIST_INCR_LENGTH(zl,1);
+    return zl;
+}
+
+/* ----------------------------- API implementation ------------------------- */
+
+/* Create a new empty ziplist */
+unsigned char *ziplistNew(void) {
+    unsigned int bytes = ZIPLIST_HEADER_SIZE+1;
+    unsigned char *zl = zmalloc(bytes);
+
+    if (zl == NULL) {
+        fprintf(stderr, "\nZIPLIST LIBRARY PANIC: Out of memory\n\n");
+        abort();
+    }
+    ZIPLIST_BYTES(zl) = bytes;
+    ZIPLIST_TAIL_OFFSET(zl) = ZIPLIST_HEADER_SIZE;
+    ZIPLIST_LENGTH(zl) = 0;
+    zl[bytes-1] = ZIP_END;
+    return zl;
+}
+
+/* Add an entry at the head or at the tail of the list */
+unsigned char *ziplistPush(unsigned char *zl, unsigned char *s, unsigned int slen, int where) {
+    unsigned char *p;
+
+    p = (where == ZIPLIST_HEAD) ? ZIPLIST_ENTRY_HEAD(zl) : ZIPLIST_ENTRY_END(zl);
+    return __ziplistInsert(zl,p,s,slen);
+}
+
+/* Return a pointer to the entry at 'index', negative indexes starting from
+ * the tail, or NULL if the index is out of range. */
+unsigned char *ziplistIndex(unsigned char *zl, int index) {
+    unsigned char *p;
+    zlentry entry;
+
+    if (index < 0) {
+        index = (-index)-1;
+        p = ZIPLIST_ENTRY_TAIL(zl);
+        if (p[0] != ZIP_END) {
+            entry = zipEntry(p);
+            while (entry.prevrawlen > 0 && index--) {
+                p -= entry.prevrawlen;
+                entry = zipEntry(p);
+            }
+        }
+    } else {
+        p = ZIPLIST_ENTRY_HEAD(zl);
+        while (p[0] != ZIP_END && index--) {
+            p += zipRawEntryLength(p);
+        }
+    }
+    return (p[0] == ZIP_END || index > 0) ? NULL : p;
+}
+
+/* Return the entry after 'p', or NULL at the end of the list */
+unsigned char *ziplistNext(unsigned char *zl, unsigned char *p) {
+    ((void) zl);
+
+    if (p[0] == ZIP_END) return NULL;
+    p += zipRawEntryLength(p);
+    if (p[0] == ZIP_END) return NULL;
+    return p;
+}
+
+/* Return the entry before 'p', or NULL at the start of the list. When 'p'
+ * is the end marker the tail entry is returned. */
+unsigned char *ziplistPrev(unsigned char *zl, unsigned char *p) {
+    zlentry entry;
+
+    if (p[0] == ZIP_END) {
+        p = ZIPLIST_ENTRY_TAIL(zl);
+        return (p[0] == ZIP_END) ? NULL : p;
+    } else if (p == ZIPLIST_ENTRY_HEAD(zl)) {
+        return NULL;
+    } else {
+        entry = zipEntry(p);
+        return p-entry.prevrawlen;
+    }
+}
+
+/* Get the value of the entry at 'p'. For strings *sval and *slen are set,
+ * for integers *sval is set to NULL and the value is stored in *lval.
+ * Returns 0 if 'p' is NULL or the end of the list, otherwise 1. */
+unsigned int ziplistGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval) {
+    zlentry entry;
+
+    if (p == NULL || p[0] == ZIP_END) return 0;
+    if (sval) *sval = NULL;
+
+    entry = zipEntry(p);
+    if (ZIP_IS_STR(entry.encoding)) {
+        if (sval) {
+            *slen = entry.len;
+            *sval = p+entry.headersize;
+        }
+    } else {
+        if (lval) *lval = zipLoadInteger(p+entry.headersize,entry.encoding);
+    }
+    return 1;
+}
+
+/* Insert an entry before the entry at 'p' */
+unsigned char *ziplistInsert(unsigned char *zl, unsigned char *p, unsigned char *s, unsigned int slen) {
+    return __ziplistInsert(zl,p,s,slen);
+}
+
+/* Delete the entry at *p. On return *p points to the entry that followed
+ * it (or to the end marker), so it is possible to delete while iterating. */
+unsigned char *ziplistDelete(unsigned char *zl, unsigned char **p) {
+    size_t offset = *p-zl;
+
+    zl = __ziplistDelete(zl,*p,1);
+    *p = zl+offset;
+    return zl;
+}
+
+/* Delete 'num' entries starting at 'index' */
+unsigned char *ziplistDeleteRange(unsigned char *zl, int index, unsigned int num) {
+    unsigned char *p = ziplistIndex(zl,index);
+
+    return (p == NULL) ? zl : __ziplistDelete(zl,p,num);
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's', otherwise 0 */
+unsigned int ziplistCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    zlentry entry;
+    unsigned char sencoding;
+    long long zval, sval;
+
+    if (p[0] == ZIP_END) return 0;
+
+    entry = zipEntry(p);
+    if (ZIP_IS_STR(entry.encoding)) {
+        return entry.len == slen &&
+               memcmp(p+entry.headersize,s,slen) == 0;
+    } else {
+        /* Only strings that would be encoded as integers can match */
+        if (zipTryEncoding(s,slen,&sval,&sencoding)) {
+            zval = zipLoadInteger(p+entry.headersize,entry.encoding);
+            return zval == sval;
+        }
+    }
+    return 0;
+}
+
+/* Find the entry equal to 's' starting at 'p'. Only one entry every
+ * 'skip'+1 is compared, so a skip of 1 only looks at the fields of a ziplist
+ * of field/value pairs. Returns NULL when no entry matches. */
+unsigned char *ziplistFind(unsigned char *p, unsigned char *s, unsigned int slen, unsigned int skip) {
+    unsigned int skipcnt = 0;
+    unsigned char sencoding;
+    long long sval = 0;
+    int sint = -1; /* Is 's' an integer? Computed on first need */
+
+    while (p[0] != ZIP_END) {
+        zlentry entry = zipEntry(p);
+
+        if (skipcnt == 0) {
+            if (ZIP_IS_STR(entry.encoding)) {
+                if (entry.len == slen &&
+                    memcmp(p+entry.headersize,s,slen) == 0) return p;
+            } else {
+                if (sint == -1) sint = zipTryEncoding(s,slen,&sval,&sencoding);
+                if (sint &&
+                    zipLoadInteger(p+entry.headersize,entry.encoding) == sval)
+                    return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p += entry.headersize+entry.len;
+    }
+    return NULL;
+}
+
+/* Return the number of entries */
+unsigned int ziplistLen(unsigned char *zl) {
+    unsigned int len = 0;
+
+    if (ZIPLIST_LENGTH(zl) < UINT16_MAX) {
+        len = ZIPLIST_LENGTH(zl);
+    } else {
+        unsigned char *p = ZIPLIST_ENTRY_HEAD(zl);
+        while (*p != ZIP_END) {
+            p += zipRawEntryLength(p);
+            len++;
+        }
+        /* Update the cached length if it fits again */
+        if (len < UINT16_MAX) ZIPLIST_LENGTH(zl) = len;
+    }
+    return len;
+}
+
+/* Return the size in bytes of the ziplist */
+size_t ziplistBlobLen(unsigned char *zl) {
+    return ZIPLIST_BYTES(zl);
+}
@@ -0,0 +1,39 @@
+/* Compact list of strings and integers stored in a single allocation.
+ *
+ * A ziplist is a byte array holding a sequence of entries, each with the
+ * length of the previous entry (so the list can be walked in both
+ * directions) and the length of the entry itself. Strings that are the
+ * canonical representation of an integer are stored as integers. It is
+ * used to encode small lists with a fraction of the memory needed by a
+ * linked list of objects.
+ *
+ * Every insertion or deletion reallocates the array, so the pointers to
+ * entries are only valid until the next modification, and ziplists are
+ * only suited for a small number of elements.
+ *
+ * Copyright (C) 2009 Salvatore Sanfilippo - antirez@gmail.com
+ * Released under the BSD license. See the COPYING file for more info. */
+
+#ifndef __ZIPLIST_H
+#define __ZIPLIST_H
+
+#include <stddef.h>
+
+#define ZIPLIST_HEAD 0
+#define ZIPLIST_TAIL 1
+
+unsigned char *ziplistNew(void);
+unsigned char *ziplistPush(unsigned char *zl, unsigned char *s, unsigned int slen, int where);
+unsigned char *ziplistIndex(unsigned char *zl, int index);
+unsigned char *ziplistNext(unsigned char *zl, unsigned char *p);
+unsigned char *ziplistPrev(unsigned char *zl, unsigned char *p);
+unsigned int ziplistGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval);
+unsigned char *ziplistInsert(unsigned char *zl, unsigned char *p, unsigned char *s, unsigned int slen);
+unsigned char *ziplistDelete(unsigned char *zl, unsigned char **p);
+unsigned char *ziplistDeleteRange(unsigned char *zl, int index, unsigned int num);
+unsigned int ziplistCompare(unsigned char *p, unsigned char *s, unsigned int slen);
+unsigned char *ziplistFind(unsigned char *p, unsigned char *s, unsigned int slen, unsigned int skip);
+unsigned int ziplistLen(unsigned char *zl);
+size_t ziplistBlobLen(unsigned char *zl);
+
+#endif /* __ZIPLIST_H */
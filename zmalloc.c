@@ -32,6 +32,25 @@
 #include <string.h>
 
 static size_t used_memory = 0;
+static int zmalloc_thread_safe = 0;
+
+/* Once threads allocating memory are started the counter is updated with
+ * atomic operations. They are not used otherwise as they are slower. */
+#define increment_used_memory(__n) do { \
+    if (zmalloc_thread_safe) { \
+        __sync_add_and_fetch(&used_memory, (__n)); \
+    } else { \
+        used_memory += (__n); \
+    } \
+} while(0)
+
+#define decrement_used_memory(__n) do { \
+    if (zmalloc_thread_safe) { \
+        __sync_sub_and_fetch(&used_memory, (__n)); \
+    } else { \
+        used_memory -= (__n); \
+    } \
+} while(0)
 /*
     分配sizeof(size_t)+size大小的内存，前面sizeof(size_t)个字节记录本次分配的大小，
     记录分配的总内存大小，返回用于存储数据的内存首地址，即跨过sizeof(size_t)大小个字节
@@ -41,7 +60,7 @@ void *zmalloc(size_t size) {
 
     if (!ptr) return NULL;
     *((size_t*)ptr) = size;
-    used_memory += size+sizeof(size_t);
+    increment_used_memory(size+sizeof(size_t));
     return (char*)ptr+sizeof(size_t);
 }
 // 重新分配内存，ptr是旧数据的内存首地址，size是本次需要分片的内存大小
@@ -61,8 +80,8 @@ void *zrealloc(void *ptr, size_t size) {
     // 记录数据部分的内存大小
     *((size_t*)newptr) = size;
     // 重新计算已分配内存的总大小，sizeof(size_t)这块内存仍然在使用，不需要计算
-    used_memory -= oldsize;
-    used_memory += size;
+    decrement_used_memory(oldsize);
+    increment_used_memory(size);
     // 返回存储数据的内存首地址
     return (char*)newptr+sizeof(size_t);
 }
@@ -76,7 +95,7 @@ void zfree(void *ptr) {
     realptr = (char*)ptr-sizeof(size_t);
     oldsize = *((size_t*)realptr);
     // 减去释放的内存大小
-    used_memory -= oldsize+sizeof(size_t);
+    decrement_used_memory(oldsize+sizeof(size_t));
     free(realptr);
 }
 // 复制字符串
@@ -89,5 +108,11 @@ char *zstrdup(const char *s) {
 }
 
 size_t zmalloc_used_memory(void) {
+    if (zmalloc_thread_safe)
+        return __sync_add_and_fetch(&used_memory, 0);
     return used_memory;
 }
+
+void zmalloc_enable_thread_safeness(void) {
+    zmalloc_thread_safe = 1;
+}